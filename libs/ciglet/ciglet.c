@@ -485,10 +485,22 @@ void cig_fft(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
   }
 }
 
+int cig_czt_buffersize(int n) {
+  int m = pow(2, ceil(log2(n)) + 1);
+  return m * 6;
+}
+
 void cig_czt(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
   FP_TYPE omega0, int n) {
+  FP_TYPE* buffer = malloc(cig_czt_buffersize(n) * sizeof(FP_TYPE));
+  cig_czt_buffered(xr, xi, yr, yi, omega0, n, buffer);
+  free(buffer);
+}
+
+void cig_czt_buffered(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
+  FP_TYPE omega0, int n, FP_TYPE* buffer) {
   int m = pow(2, ceil(log2(n)) + 1);
-  FP_TYPE* buffer = calloc(m * 6, sizeof(FP_TYPE));
+  memset(buffer, 0, m * 6 * sizeof(FP_TYPE));
   FP_TYPE* xq = buffer + 0;
   FP_TYPE* wq = buffer + 2 * m;
   FP_TYPE* Wq = buffer + 4 * m;
@@ -537,7 +549,6 @@ void cig_czt(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
     for(int i = 0; i < n; i ++)
       yi[i] = (- xq[i * 2 + 0] * wq[i * 2 + 1] + xq[i * 2 + 1] * wq[i * 2 + 0]) / m;
   }
-  free(buffer);
 }
 
 void cig_idft(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi, int n) {
@@ -478,6 +478,10 @@ FP_TYPE* wavread(char* filename, int* fs, int* nbit, int* nx);
 void wavwrite(FP_TYPE* y, int ny, int fs, int nbit, char* filename);
 FP_TYPE* wavread_fp(FILE* fin, int* fs, int* nbit, int* nx);
 void wavwrite_fp(FP_TYPE* y, int ny, int fs, int nbit, FILE* fout);
+// The two halves of wavwrite_fp, for writing the samples in pieces after a
+// header that announces ny samples in total.
+void wavwrite_header_fp(int ny, int fs, int nbit, FILE* fout);
+void wavwrite_samples_fp(FP_TYPE* y, int ny, int nbit, FILE* fout);
 
 // === General DSP routines ===
 
@@ -617,6 +621,13 @@ static inline void ifft(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
 
 void cig_czt(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi, FP_TYPE omega0, int n);
 
+// size (in number of FP_TYPE) of the buffer needed by cig_czt_buffered
+int cig_czt_buffersize(int n);
+
+// same as cig_czt, using the given buffer instead of allocating one
+void cig_czt_buffered(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi, FP_TYPE omega0, int n,
+  FP_TYPE* buffer);
+
 static inline void czt(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
   FP_TYPE omega0, int n) {
   cig_czt(xr, xi, yr, yi, omega0, n);
@@ -633,6 +644,17 @@ static inline void iczt(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
       yi[i] /= n;
 }
 
+static inline void iczt_buffered(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi,
+  FP_TYPE omega0, int n, FP_TYPE* buffer) {
+  cig_czt_buffered(xr, xi, yr, yi, -omega0, n, buffer);
+  if(yr != NULL)
+    for(int i = 0; i < n; i ++)
+      yr[i] /= n;
+  if(yi != NULL)
+    for(int i = 0; i < n; i ++)
+      yi[i] /= n;
+}
+
 void cig_idft(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi, int n);
 
 static inline void idft(FP_TYPE* xr, FP_TYPE* xi, FP_TYPE* yr, FP_TYPE* yi, int n) {
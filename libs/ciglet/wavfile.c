@@ -163,12 +163,7 @@ static bool GetParameters(FILE *fp, int *fs, int *nbit, int *wav_length, int *fo
   return true;
 }
 
-void wavwrite_fp(FP_TYPE* x, int x_length, int fs, int nbit, FILE* fp) {
-  if (nbit % 8 != 0 || nbit > 32) {
-    printf("Unsupported bit per sample.\n");
-    return;
-  }
-  
+void wavwrite_header_fp(int x_length, int fs, int nbit, FILE* fp) {
   int nbyte = nbit / 8;
 
   char text[4] = {'R', 'I', 'F', 'F'};
@@ -209,7 +204,10 @@ void wavwrite_fp(FP_TYPE* x, int x_length, int fs, int nbit, FILE* fp) {
   fwrite(text, 1, 4, fp);
   long_number = x_length * nbyte;
   fwrite(&long_number, 4, 1, fp);
+}
 
+void wavwrite_samples_fp(FP_TYPE* x, int x_length, int nbit, FILE* fp) {
+  int nbyte = nbit / 8;
   if (nbyte == 1)
   for (int i = 0; i < x_length; ++i) {
     uint8_t tmp_signal;
@@ -236,6 +234,16 @@ void wavwrite_fp(FP_TYPE* x, int x_length, int fs, int nbit, FILE* fp) {
   }
 }
 
+void wavwrite_fp(FP_TYPE* x, int x_length, int fs, int nbit, FILE* fp) {
+  if (nbit % 8 != 0 || nbit > 32) {
+    printf("Unsupported bit per sample.\n");
+    return;
+  }
+  
+  wavwrite_header_fp(x_length, fs, nbit, fp);
+  wavwrite_samples_fp(x, x_length, nbit, fp);
+}
+
 void wavwrite(FP_TYPE* x, int x_length, int fs, int nbit, char* filename) {
   FILE* fp = fopen(filename, "wb");
   if (fp == NULL) {
@@ -25,6 +25,38 @@
 #include <assert.h>
 #include <stdlib.h>
 
+/** @brief Copy size (<= capacity) samples out of a circular array starting
+ *    from index begin (0 <= begin < capacity) in at most two contiguous runs;
+ *    the samples are added onto dst instead if add is non-zero. */
+static inline void llsm_circular_read(const FP_TYPE* data, int capacity,
+  int begin, int size, FP_TYPE* dst, int add) {
+  int size1 = size < capacity - begin ? size : capacity - begin;
+  const FP_TYPE* data1 = data + begin;
+  if(add) {
+    for(int i = 0; i < size1; i ++) dst[i] += data1[i];
+    for(int i = size1; i < size; i ++) dst[i] += data[i - size1];
+  } else {
+    for(int i = 0; i < size1; i ++) dst[i] = data1[i];
+    for(int i = size1; i < size; i ++) dst[i] = data[i - size1];
+  }
+}
+
+/** @brief Copy size (<= capacity) samples into a circular array starting
+ *    from index begin (0 <= begin < capacity) in at most two contiguous runs;
+ *    the samples are added onto the array instead if add is non-zero. */
+static inline void llsm_circular_write(FP_TYPE* data, int capacity,
+  int begin, int size, const FP_TYPE* src, int add) {
+  int size1 = size < capacity - begin ? size : capacity - begin;
+  FP_TYPE* data1 = data + begin;
+  if(add) {
+    for(int i = 0; i < size1; i ++) data1[i] += src[i];
+    for(int i = size1; i < size; i ++) data[i - size1] += src[i];
+  } else {
+    for(int i = 0; i < size1; i ++) data1[i] = src[i];
+    for(int i = size1; i < size; i ++) data[i - size1] = src[i];
+  }
+}
+
 /** @defgroup group_ringbuffer llsm_ringbuffer
  *  @{ */
 /** @brief A circular array structure for storing audio samples streaming in
@@ -86,9 +118,8 @@ static inline void llsm_ringbuffer_readchunk(llsm_ringbuffer* src,
   assert(size > 0);
   assert(lag + size <= 0);
   assert(lag > -src -> capacity);
-  int base = src -> curr + src -> capacity;
-  for(int i = 0; i < size; i ++)
-    dst[i] = src -> data[(base + lag + i) % src -> capacity];
+  llsm_circular_read(src -> data, src -> capacity,
+    (src -> curr + lag + src -> capacity) % src -> capacity, size, dst, 0);
 }
 
 /** @brief Write an array of samples from a source pointer;
@@ -98,9 +129,8 @@ static inline void llsm_ringbuffer_writechunk(llsm_ringbuffer* dst,
   assert(size > 0);
   assert(lag + size <= 0);
   assert(lag >= -dst -> capacity);
-  int base = dst -> curr + dst -> capacity;
-  for(int i = 0; i < size; i ++)
-    dst -> data[(base + lag + i) % dst -> capacity] = src[i];
+  llsm_circular_write(dst -> data, dst -> capacity,
+    (dst -> curr + lag + dst -> capacity) % dst -> capacity, size, src, 0);
 }
 
 /** @brief Add an array of samples from a source pointer to an subset of
@@ -110,9 +140,8 @@ static inline void llsm_ringbuffer_addchunk(llsm_ringbuffer* dst,
   assert(size > 0);
   assert(lag + size <= 0);
   assert(lag >= -dst -> capacity);
-  int base = dst -> curr + dst -> capacity;
-  for(int i = 0; i < size; i ++)
-    dst -> data[(base + lag + i) % dst -> capacity] += src[i];
+  llsm_circular_write(dst -> data, dst -> capacity,
+    (dst -> curr + lag + dst -> capacity) % dst -> capacity, size, src, 1);
 }
 
 /** @brief Append an array of samples from a source pointer. This will move
@@ -272,4 +301,172 @@ static inline void llsm_vringbuffer_append(llsm_vringbuffer* dst, void* x) {
 }
 /** @} */
 
+/** @defgroup group_spscbuffer llsm_spscbuffer
+ *  @{ */
+// Atomic operations on long variables. llsm_atomic_fence orders a preceding
+//   atomic store before a following atomic load; the MSVC intrinsics are
+//   full barriers already. llsm_atomic_cas(x, e, v) sets x to v if it equals
+//   e and returns non-zero if it did.
+#if defined(__GNUC__)
+#  define llsm_atomic_load(x) __atomic_load_n(& (x), __ATOMIC_ACQUIRE)
+#  define llsm_atomic_store(x, v) __atomic_store_n(& (x), v, __ATOMIC_RELEASE)
+#  define llsm_atomic_increment(x) \
+     __atomic_add_fetch(& (x), 1, __ATOMIC_ACQ_REL)
+#  define llsm_atomic_decrement(x) \
+     __atomic_sub_fetch(& (x), 1, __ATOMIC_ACQ_REL)
+#  define llsm_atomic_cas(x, e, v) __sync_bool_compare_and_swap(& (x), e, v)
+#  define llsm_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+#  include <intrin.h>
+#  define llsm_atomic_load(x) _InterlockedOr(& (x), 0)
+#  define llsm_atomic_store(x, v) _InterlockedExchange(& (x), v)
+#  define llsm_atomic_increment(x) _InterlockedIncrement(& (x))
+#  define llsm_atomic_decrement(x) _InterlockedDecrement(& (x))
+#  define llsm_atomic_cas(x, e, v) \
+     (_InterlockedCompareExchange(& (x), v, e) == (e))
+#  define llsm_atomic_fence() ((void)0)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+  ! defined(__STDC_NO_ATOMICS__)
+#  include <stdatomic.h>
+#  define llsm_atomic_(x) ((_Atomic long*)& (x))
+#  define llsm_atomic_load(x) \
+     atomic_load_explicit(llsm_atomic_(x), memory_order_acquire)
+#  define llsm_atomic_store(x, v) \
+     atomic_store_explicit(llsm_atomic_(x), v, memory_order_release)
+#  define llsm_atomic_increment(x) (atomic_fetch_add(llsm_atomic_(x), 1) + 1)
+#  define llsm_atomic_decrement(x) (atomic_fetch_sub(llsm_atomic_(x), 1) - 1)
+#  define llsm_atomic_cas(x, e, v) llsm_atomic_cas_(llsm_atomic_(x), e, v)
+#  define llsm_atomic_fence() atomic_thread_fence(memory_order_seq_cst)
+static inline int llsm_atomic_cas_(_Atomic long* x, long e, long v) {
+  return atomic_compare_exchange_strong(x, & e, v);
+}
+#else
+// No atomics known for this compiler: plain accesses, which are only
+//   correct as long as no two threads touch the same variable.
+#  define llsm_atomic_load(x) (x)
+#  define llsm_atomic_store(x, v) ((x) = (v))
+#  define llsm_atomic_increment(x) (++ (x))
+#  define llsm_atomic_decrement(x) (-- (x))
+#  define llsm_atomic_cas(x, e, v) ((x) == (e) ? ((x) = (v), 1) : 0)
+#  define llsm_atomic_fence() ((void)0)
+#endif
+
+// Run init once per process for a flag that starts as LLSM_ONCE_INIT, no
+//   matter how many threads call llsm_once on it; the callers arriving while
+//   init runs wait for it to finish.
+#ifdef USE_PTHREAD
+#  include <pthread.h>
+typedef pthread_once_t llsm_once_flag;
+#  define LLSM_ONCE_INIT PTHREAD_ONCE_INIT
+#  define llsm_once(flag, init) pthread_once(& (flag), init)
+#else
+typedef long llsm_once_flag;
+#  define LLSM_ONCE_INIT 0
+#  define llsm_once(flag, init) llsm_once_(& (flag), init)
+static inline void llsm_once_(long* flag, void (*init)(void)) {
+  // 0: not started, 1: running, 2: done
+  if(llsm_atomic_load(*flag) == 2) return;
+  if(llsm_atomic_cas(*flag, 0, 1)) {
+    init();
+    llsm_atomic_store(*flag, 2);
+  } else
+    while(llsm_atomic_load(*flag) != 2) ;
+}
+#endif
+
+#define LLSM_CACHE_LINE 64
+
+/** @brief A lock-free single-producer single-consumer ring buffer for
+ *    passing audio samples (one or more channels in lockstep) from one
+ *    thread to another. The read and write positions run over
+ *    [0, 2 * capacity) so that a full buffer can be told from an empty one;
+ *    each position is only written by its own side and sits on a separate
+ *    cache line. */
+typedef struct {
+  FP_TYPE* data;  /**< channel c starts at data + c * capacity */
+  int capacity;
+  int nchannel;
+  char pad0[LLSM_CACHE_LINE];
+  long head;      /**< write position (owned by the producer) */
+  char pad1[LLSM_CACHE_LINE];
+  long tail;      /**< read position (owned by the consumer) */
+  char pad2[LLSM_CACHE_LINE];
+} llsm_spscbuffer;
+
+/** @brief Create an empty SPSC ring buffer with a given size. */
+static inline llsm_spscbuffer* llsm_create_spscbuffer(int capacity,
+  int nchannel) {
+  assert(capacity > 0 && nchannel > 0);
+  llsm_spscbuffer* ret = (llsm_spscbuffer*)malloc(sizeof(llsm_spscbuffer));
+  ret -> capacity = capacity;
+  ret -> nchannel = nchannel;
+  ret -> data = (FP_TYPE*)calloc(capacity * nchannel, sizeof(FP_TYPE));
+  ret -> head = 0;
+  ret -> tail = 0;
+  return ret;
+}
+
+/** @brief Delete and free a SPSC ring buffer. */
+static inline void llsm_delete_spscbuffer(llsm_spscbuffer* dst) {
+  if(dst == NULL) return;
+  free(dst -> data);
+  free(dst);
+}
+
+/** @brief Get the number of samples ready to be read; can be called from
+ *    either side. */
+static inline int llsm_spscbuffer_size(llsm_spscbuffer* src) {
+  long head = llsm_atomic_load(src -> head);
+  long tail = llsm_atomic_load(src -> tail);
+  return (head - tail + src -> capacity * 2) % (src -> capacity * 2);
+}
+
+/** @brief Get the number of samples that can be written without overwriting
+ *    unread ones; can be called from either side. */
+static inline int llsm_spscbuffer_space(llsm_spscbuffer* dst) {
+  return dst -> capacity - llsm_spscbuffer_size(dst);
+}
+
+/** @brief (Producer) Append size samples to every channel; src[c] points to
+ *    the samples of channel c. The caller has to make sure that there is
+ *    enough space. */
+static inline void llsm_spscbuffer_write(llsm_spscbuffer* dst, int size,
+  FP_TYPE** src) {
+  assert(size <= llsm_spscbuffer_space(dst));
+  long head = dst -> head;
+  for(int c = 0; c < dst -> nchannel; c ++)
+    llsm_circular_write(dst -> data + c * dst -> capacity, dst -> capacity,
+      head % dst -> capacity, size, src[c], 0);
+  llsm_atomic_store(dst -> head, (head + size) % (dst -> capacity * 2));
+}
+
+/** @brief (Consumer) Read up to size samples from channel c into dst[c],
+ *    or add them onto dst[0] for the channels where dst[c] is NULL (c > 0).
+ *    Returns the number of samples read. */
+static inline int llsm_spscbuffer_read(llsm_spscbuffer* src, int size,
+  FP_TYPE** dst) {
+  int available = llsm_spscbuffer_size(src);
+  if(size > available) size = available;
+  if(size <= 0) return 0;
+  long tail = src -> tail;
+  for(int c = 0; c < src -> nchannel; c ++)
+    llsm_circular_read(src -> data + c * src -> capacity, src -> capacity,
+      tail % src -> capacity, size, dst[c] != NULL ? dst[c] : dst[0],
+      dst[c] == NULL);
+  llsm_atomic_store(src -> tail, (tail + size) % (src -> capacity * 2));
+  return size;
+}
+
+/** @brief (Consumer) Drop up to size unread samples; returns the number of
+ *    samples dropped. */
+static inline int llsm_spscbuffer_discard(llsm_spscbuffer* src, int size) {
+  int available = llsm_spscbuffer_size(src);
+  if(size > available) size = available;
+  if(size <= 0) return 0;
+  llsm_atomic_store(src -> tail,
+    (src -> tail + size) % (src -> capacity * 2));
+  return size;
+}
+/** @} */
+
 #endif
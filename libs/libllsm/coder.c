@@ -44,12 +44,12 @@ typedef struct {
 llsm_coder* llsm_create_coder(llsm_container* conf, int order_spec,
   int order_bap) {
   llsm_coder_* ret = malloc(sizeof(llsm_coder_));
-  FP_TYPE* fnyq = llsm_container_get(conf, LLSM_CONF_FNYQ);
-  int* nchannel = llsm_container_get(conf, LLSM_CONF_NCHANNEL);
-  int* nhar_e = llsm_container_get(conf, LLSM_CONF_MAXNHAR_E);
-  int* npsd = llsm_container_get(conf, LLSM_CONF_NPSD);
-  int* nspec = llsm_container_get(conf, LLSM_CONF_NSPEC);
-  FP_TYPE* liprad = llsm_container_get(conf, LLSM_CONF_LIPRADIUS);
+  FP_TYPE* fnyq = llsm_container_peek(conf, LLSM_CONF_FNYQ);
+  int* nchannel = llsm_container_peek(conf, LLSM_CONF_NCHANNEL);
+  int* nhar_e = llsm_container_peek(conf, LLSM_CONF_MAXNHAR_E);
+  int* npsd = llsm_container_peek(conf, LLSM_CONF_NPSD);
+  int* nspec = llsm_container_peek(conf, LLSM_CONF_NSPEC);
+  FP_TYPE* liprad = llsm_container_peek(conf, LLSM_CONF_LIPRADIUS);
   ret -> order_spec = order_spec;
   ret -> order_bap = order_bap;
   ret -> nfullspec = (nspec[0] - 1) * 2;
@@ -87,8 +87,8 @@ FP_TYPE* llsm_coder_encode(llsm_coder* c_, llsm_container* src) {
   int ns = c -> nfullspec / 2 + 1;
   FP_TYPE* enc = calloc(c -> order_spec + c -> order_bap + 3, sizeof(FP_TYPE));
 
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
-  llsm_nmframe* nm = llsm_container_get(src, LLSM_FRAME_NM);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  llsm_nmframe* nm = llsm_container_peek(src, LLSM_FRAME_NM);
   enc[0] = f0[0] > 0; // voicing
   enc[1] = f0[0];     // f0
 
@@ -100,17 +100,18 @@ FP_TYPE* llsm_coder_encode(llsm_coder* c_, llsm_container* src) {
     spec_psd[j] = exp_2(IN2LOG(spec_psd[j]));
 
   if(f0[0] > 0) {
-    FP_TYPE* rd = llsm_container_get(src, LLSM_FRAME_RD);
-    FP_TYPE* vtmagn = llsm_container_get(src, LLSM_FRAME_VTMAGN);
+    FP_TYPE* rd = llsm_container_peek(src, LLSM_FRAME_RD);
+    FP_TYPE* vtmagn = llsm_container_peek(src, LLSM_FRAME_VTMAGN);
     enc[2] = rd[0];
     // spectral synthesis
     lfmodel gfm = lfmodel_from_rd(rd[0], 1.0 / f0[0], 1.0);
     FP_TYPE* lfmagnresp = lfmodel_spectrum(gfm, c -> faxis, ns, NULL);
-    FP_TYPE* lfmagnf0 = lfmodel_spectrum(gfm, f0, 1, NULL);
+    FP_TYPE lfmagnf0 = 0;
+    llsm_lfmodel_harmonics(rd[0], f0[0], 1, & lfmagnf0, NULL);
     FP_TYPE* spec_env = calloc(ns, sizeof(FP_TYPE));
     for(int j = 1; j < ns; j ++) {
       spec_env[j] = exp_2(DB2LOG(vtmagn[j]))
-        * lfmagnresp[j] / lfmagnf0[0] * f0[0] / c -> faxis[j];
+        * lfmagnresp[j] / lfmagnf0 * f0[0] / c -> faxis[j];
     }
     spec_env[0] = spec_env[1];
     llsm_lipfilter(c -> liprad, c -> fnyq / ns, ns, spec_env, NULL, 0);
@@ -129,7 +130,6 @@ FP_TYPE* llsm_coder_encode(llsm_coder* c_, llsm_container* src) {
         apsum += 1 - spec_env[k] / spec_psd[k];
       enc[3 + c -> order_spec + j] = apsum / (n1 - n0);
     }
-    free(lfmagnf0);
     free(lfmagnresp);
     free(spec_env);
   } else {
@@ -219,21 +219,22 @@ static llsm_container* llsm_coder_decode(llsm_coder* c_, FP_TYPE* src,
   FP_TYPE* full_noise = full_ap;  full_ap = NULL;
 
   // power to log intensity
-  free(nm -> psd);
-  nm -> psd = interp1(c -> faxis, full_noise, ns, c -> psdaxis, nm -> npsd);
+  FP_TYPE* psd = interp1(c -> faxis, full_noise, ns, c -> psdaxis, nm -> npsd);
   for(int j = 0; j < nm -> npsd; j ++)
-    nm -> psd[j] = LOG2IN(log_2(nm -> psd[j]));
+    nm -> psd[j] = LOG2IN(log_2(psd[j]));
+  free(psd);
 
   if(nhar > 0 && use_layer1) {
     llsm_container_remove(ret, LLSM_FRAME_HM);
     lfmodel gfm = lfmodel_from_rd(rd, 1.0 / f0, 1.0);
     FP_TYPE* lfmagnresp = lfmodel_spectrum(gfm, c -> faxis, ns, NULL);
-    FP_TYPE* lfmagnf0 = lfmodel_spectrum(gfm, & f0, 1, NULL);
+    FP_TYPE lfmagnf0 = 0;
+    llsm_lfmodel_harmonics(rd, f0, 1, & lfmagnf0, NULL);
     llsm_lipfilter(c -> liprad, c -> fnyq / ns, ns, full_spec, NULL, 1);
     // magnitude to log
     for(int j = 1; j < ns; j ++)
       full_spec[j] = LOG2DB(log_2(full_spec[j]
-        * c -> faxis[j] / f0 * lfmagnf0[0] / lfmagnresp[j]));
+        * c -> faxis[j] / f0 * lfmagnf0 / lfmagnresp[j]));
     full_spec[0] = full_spec[1];
     FP_TYPE* vtmagn = llsm_create_fparray(ns);
     FP_TYPE* vsphse = llsm_create_fparray(nhar);
@@ -242,11 +243,8 @@ static llsm_container* llsm_coder_decode(llsm_coder* c_, FP_TYPE* src,
     llsm_container_attach(ret, LLSM_FRAME_VSPHSE, vsphse,
       llsm_delete_fparray, llsm_copy_fparray);
     for(int j = 0; j < ns; j ++) vtmagn[j] = full_spec[j];
-    FP_TYPE* harfreq = linspace(0, nhar * f0, nhar + 1);
-    free(lfmodel_spectrum(gfm, harfreq + 1, nhar, vsphse));
-    free(harfreq);
+    llsm_lfmodel_harmonics(rd, f0, nhar, NULL, vsphse);
     free(lfmagnresp);
-    free(lfmagnf0);
   }
   if(nhar > 0 && ! use_layer1) {
     llsm_hmframe* hm = llsm_create_hmframe(nhar);
@@ -257,10 +255,10 @@ static llsm_container* llsm_coder_decode(llsm_coder* c_, FP_TYPE* src,
     for(int i = 0; i < nhar; i ++)
       hm -> ampl[i] = ampl[i];
     llsm_lipfilter(c -> liprad, f0, nhar, ampl, NULL, 1);
-    lfmodel gfm = lfmodel_from_rd(rd, 1.0 / f0, 1.0);
     FP_TYPE* vsphse = calloc(nhar, sizeof(FP_TYPE));
     // recover vocal tract magnitude response
-    FP_TYPE* lfmagnresp = lfmodel_spectrum(gfm, harfreq + 1, nhar, vsphse);
+    FP_TYPE* lfmagnresp = calloc(nhar, sizeof(FP_TYPE));
+    llsm_lfmodel_harmonics(rd, f0, nhar, lfmagnresp, vsphse);
     for(int i = 0; i < nhar; i ++) {
       FP_TYPE vs_ampl = lfmagnresp[i] / (i + 1.0) / lfmagnresp[0];
       ampl[i] /= vs_ampl;
@@ -273,6 +271,7 @@ static llsm_container* llsm_coder_decode(llsm_coder* c_, FP_TYPE* src,
     free(harfreq);
     free(ampl);
     free(lfmagnresp);
+    free(vsphse);
     free(vtphse);
   }
 
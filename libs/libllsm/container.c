@@ -18,6 +18,7 @@
 */
 
 #include "llsm.h"
+#include "buffer.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -34,7 +35,7 @@ int*     llsm_create_int(int x) {
 }
 
 FP_TYPE* llsm_create_fparray(int size) {
-  void* ret = calloc(sizeof(FP_TYPE) * size + sizeof(int), 1);
+  void* ret = llsm_calloc(sizeof(FP_TYPE) * size + sizeof(int), 1);
   ((int*)ret)[0] = size;
   return (FP_TYPE*)((int*)ret + 1);
 }
@@ -63,7 +64,7 @@ void     llsm_delete_int(int* dst) {
 }
 
 void     llsm_delete_fparray(FP_TYPE* dst) {
-  free((int*)dst - 1);
+  llsm_free((int*)dst - 1);
 }
 
 int      llsm_fparray_length(FP_TYPE* src) {
@@ -71,100 +72,144 @@ int      llsm_fparray_length(FP_TYPE* src) {
 }
 
 llsm_container* llsm_create_container(int nmember) {
-  llsm_container* ret = malloc(sizeof(llsm_container));
-  ret -> members = calloc(nmember, sizeof(void*));
-  ret -> destructors = calloc(nmember, sizeof(llsm_fdestructor));
-  ret -> copyctors = calloc(nmember, sizeof(llsm_fcopy));
+  llsm_container* ret = llsm_malloc(sizeof(llsm_container));
+  ret -> members = llsm_calloc(nmember, sizeof(void*));
+  ret -> destructors = llsm_calloc(nmember, sizeof(llsm_fdestructor));
+  ret -> copyctors = llsm_calloc(nmember, sizeof(llsm_fcopy));
+  ret -> refcounts = llsm_calloc(nmember, sizeof(long*));
   ret -> nmember = nmember;
   return ret;
 }
 
+// A member with both a destructor and a copy constructor is owned by the
+//   container and gets a reference count, so that copies of the container
+//   can share it until one of them asks for write access.
+static long* llsm_create_refcount() {
+  long* ret = llsm_malloc(sizeof(long));
+  *ret = 1;
+  return ret;
+}
+
+// Drop the reference to a member; whoever drops the last one destroys it.
+static void llsm_container_release(llsm_container* dst, int index) {
+  long* refcount = dst -> refcounts[index];
+  if(refcount != NULL) {
+    if(llsm_atomic_decrement(*refcount) > 0) return;
+    llsm_free(refcount);
+  }
+  if(dst -> destructors[index] != NULL)
+    dst -> destructors[index](dst -> members[index]);
+}
+
+static void llsm_container_expand(llsm_container* dst, int nmember) {
+  if(nmember <= dst -> nmember) return;
+  dst -> members = llsm_realloc(dst -> members, sizeof(void*) * nmember);
+  dst -> destructors = llsm_realloc(dst -> destructors,
+    sizeof(llsm_fdestructor*) * nmember);
+  dst -> copyctors = llsm_realloc(dst -> copyctors,
+    sizeof(llsm_fcopy*) * nmember);
+  dst -> refcounts = llsm_realloc(dst -> refcounts, sizeof(long*) * nmember);
+  for(int i = dst -> nmember; i < nmember; i ++) {
+    dst -> members[i] = NULL;
+    dst -> destructors[i] = NULL;
+    dst -> copyctors[i] = NULL;
+    dst -> refcounts[i] = NULL;
+  }
+  dst -> nmember = nmember;
+}
+
+// Copy member index of src into an empty slot of dst.
+static void llsm_container_share(llsm_container* dst, llsm_container* src,
+  int index) {
+  dst -> copyctors[index] = src -> copyctors[index];
+  if(src -> refcounts[index] != NULL) {
+    llsm_atomic_increment(*src -> refcounts[index]);
+    dst -> members[index] = src -> members[index];
+    dst -> destructors[index] = src -> destructors[index];
+    dst -> refcounts[index] = src -> refcounts[index];
+  } else if(src -> copyctors[index] != NULL) {
+    dst -> members[index] = src -> copyctors[index](src -> members[index]);
+    dst -> destructors[index] = src -> destructors[index];
+  } else
+    dst -> members[index] = src -> members[index];
+}
+
 llsm_container* llsm_copy_container(llsm_container* src) {
   llsm_container* ret = llsm_create_container(src -> nmember);
-  for(int i = 0; i < src -> nmember; i ++) {
-    if(src -> copyctors[i] != NULL) {
-      ret -> members[i] = src -> copyctors[i](src -> members[i]);
-      ret -> destructors[i] = src -> destructors[i];
-    } else
-      ret -> members[i] = src -> members[i];
-    ret -> copyctors[i] = src -> copyctors[i];
-  }
+  for(int i = 0; i < src -> nmember; i ++)
+    llsm_container_share(ret, src, i);
   return ret;
 }
 
 void llsm_copy_container_inplace(llsm_container* dst, llsm_container* src) {
   for(int i = 0; i < dst -> nmember; i ++)
     llsm_container_remove(dst, i);
+  llsm_container_expand(dst, src -> nmember);
   for(int i = 0; i < src -> nmember; i ++)
-    if(src -> members[i] != NULL) {
-      if(src -> copyctors[i] == NULL)
-        llsm_container_attach(dst, i, src -> members[i],
-          src -> destructors[i], src -> copyctors[i]);
-      else
-        llsm_container_attach(dst, i, src -> copyctors[i](src -> members[i]),
-          src -> destructors[i], src -> copyctors[i]);
-    }
+    if(src -> members[i] != NULL)
+      llsm_container_share(dst, src, i);
 }
 
 void llsm_delete_container(llsm_container* dst) {
   if(dst == NULL) return;
-  for(int i = 0; i < dst -> nmember; i ++) {
-    if(dst -> destructors[i] != NULL)
-      dst -> destructors[i](dst -> members[i]);
-  }
-  free(dst -> members);
-  free(dst -> destructors);
-  free(dst -> copyctors);
-  free(dst);
+  for(int i = 0; i < dst -> nmember; i ++)
+    llsm_container_release(dst, i);
+  llsm_free(dst -> members);
+  llsm_free(dst -> destructors);
+  llsm_free(dst -> copyctors);
+  llsm_free(dst -> refcounts);
+  llsm_free(dst);
 }
 
 void* llsm_container_get(llsm_container* src, int index) {
+  if(index >= src -> nmember) return NULL;
+  long* refcount = src -> refcounts[index];
+  if(refcount != NULL && llsm_atomic_load(*refcount) > 1) {
+    // copy on write
+    void* member = src -> copyctors[index](src -> members[index]);
+    llsm_container_release(src, index);
+    src -> members[index] = member;
+    src -> refcounts[index] = llsm_create_refcount();
+  }
+  return src -> members[index];
+}
+
+void* llsm_container_peek(llsm_container* src, int index) {
   if(index >= src -> nmember) return NULL;
   return src -> members[index];
 }
 
 void llsm_container_attach_(llsm_container* dst, int index, void* ptr,
   llsm_fdestructor dtor, llsm_fcopy copyctor) {
-  if(index >= dst -> nmember) { // expand container
-    int new_size = index + 1;
-    dst -> members = realloc(dst -> members, sizeof(void*) * new_size);
-    dst -> destructors = realloc(dst -> destructors,
-      sizeof(llsm_fdestructor*) * new_size);
-    dst -> copyctors = realloc(dst -> copyctors,
-      sizeof(llsm_fcopy*) * new_size);
-    for(int i = dst -> nmember; i < new_size; i ++) {
-      dst -> members[i] = NULL;
-      dst -> destructors[i] = NULL;
-      dst -> copyctors[i] = NULL;
-    }
-    dst -> nmember = new_size;
-  }
+  llsm_container_expand(dst, index + 1); // expand container
   llsm_container_remove(dst, index);
   dst -> members[index] = ptr;
   dst -> destructors[index] = dtor;
   dst -> copyctors[index] = copyctor;
+  if(ptr != NULL && dtor != NULL && copyctor != NULL)
+    dst -> refcounts[index] = llsm_create_refcount();
 }
 
 void llsm_container_remove(llsm_container* dst, int index) {
   if(index >= dst -> nmember || dst -> members[index] == NULL) return;
 
-  if(dst -> destructors[index] != NULL)
-    dst -> destructors[index](dst -> members[index]);
+  llsm_container_release(dst, index);
   dst -> members[index] = NULL;
   dst -> destructors[index] = NULL;
   dst -> copyctors[index] = NULL;
+  dst -> refcounts[index] = NULL;
 }
 
 llsm_chunk* llsm_create_chunk(llsm_container* conf, int init_frames) {
-  llsm_chunk* ret = malloc(sizeof(llsm_chunk));
-  int* nfrm = llsm_container_get(conf, LLSM_CONF_NFRM);
-  int* nchannel = llsm_container_get(conf, LLSM_CONF_NCHANNEL);
-  int* npsd = llsm_container_get(conf, LLSM_CONF_NPSD);
+  llsm_chunk* ret = llsm_malloc(sizeof(llsm_chunk));
+  int* nfrm = llsm_container_peek(conf, LLSM_CONF_NFRM);
+  int* nchannel = llsm_container_peek(conf, LLSM_CONF_NCHANNEL);
+  int* npsd = llsm_container_peek(conf, LLSM_CONF_NPSD);
   if(nchannel == NULL || npsd == NULL) return NULL;
 
   ret -> conf = llsm_copy_container(conf);
   if(nfrm != NULL) {
-    ret -> frames = calloc(*nfrm, sizeof(llsm_container*));
+    ret -> frames = llsm_calloc(*nfrm, sizeof(llsm_container*));
     if(init_frames)
       for(int i = 0; i < *nfrm; i ++)
         ret -> frames[i] = llsm_create_frame(0, *nchannel, 0, *npsd);
@@ -175,7 +220,7 @@ llsm_chunk* llsm_create_chunk(llsm_container* conf, int init_frames) {
 
 llsm_chunk* llsm_copy_chunk(llsm_chunk* src) {
   llsm_chunk* ret = llsm_create_chunk(src -> conf, 0);
-  int* nfrm = llsm_container_get(src -> conf, LLSM_CONF_NFRM);
+  int* nfrm = llsm_container_peek(src -> conf, LLSM_CONF_NFRM);
   if(nfrm != NULL)
     for(int i = 0; i < *nfrm; i ++)
       ret -> frames[i] = llsm_copy_container(src -> frames[i]);
@@ -184,12 +229,12 @@ llsm_chunk* llsm_copy_chunk(llsm_chunk* src) {
 
 void llsm_delete_chunk(llsm_chunk* dst) {
   if(dst == NULL) return;
-  int* nfrm = llsm_container_get(dst -> conf, LLSM_CONF_NFRM);
+  int* nfrm = llsm_container_peek(dst -> conf, LLSM_CONF_NFRM);
   if(nfrm != NULL) {
     for(int i = 0; i < *nfrm; i ++)
       llsm_delete_container(dst -> frames[i]);
   }
   llsm_delete_container(dst -> conf);
-  free(dst -> frames);
-  free(dst);
+  llsm_free(dst -> frames);
+  llsm_free(dst);
 }
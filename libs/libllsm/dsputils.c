@@ -22,9 +22,14 @@
 #include "llsm.h"
 #include "dsputils.h"
 #include "constants.h"
+#include "buffer.h"
 
 #include "filter-coef.h"
 
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
 static int get_chebyshev_filter(FP_TYPE cutoff, char* type,
   FP_TYPE** dst_a, FP_TYPE** dst_b) {
 
@@ -307,14 +312,27 @@ FP_TYPE* llsm_spectral_mean(FP_TYPE* spectrum, int nspec, FP_TYPE fnyq,
 
 FP_TYPE* llsm_spectrum_from_envelope(FP_TYPE* freq, FP_TYPE* ampl, int nfreq,
   int nspec, FP_TYPE fnyq) {
-  FP_TYPE* faxis = calloc(nspec, sizeof(FP_TYPE));
-  for(int i = 0; i < nspec; i ++)
-    faxis[i] = (FP_TYPE)i * fnyq / nspec;
-  FP_TYPE* spectrum = interp1(freq, ampl, nfreq, faxis, nspec);
-  free(faxis);
+  FP_TYPE* spectrum = malloc(nspec * sizeof(FP_TYPE));
+  llsm_spectrum_from_envelope_into(freq, ampl, nfreq, nspec, fnyq, spectrum);
   return spectrum;
 }
 
+// Same as cig_interp on the axis i * fnyq / nspec.
+void llsm_spectrum_from_envelope_into(FP_TYPE* freq, FP_TYPE* ampl,
+  int nfreq, int nspec, FP_TYPE fnyq, FP_TYPE* dst) {
+  int srcidx = 0;
+  for(int i = 0; i < nspec; i ++) {
+    FP_TYPE dstx = (FP_TYPE)i * fnyq / nspec;
+    while(srcidx + 1 < nfreq && freq[srcidx + 1] < dstx) srcidx ++;
+    int i1 = srcidx == nfreq - 1 ? srcidx : srcidx + 1;
+    if(srcidx != i1 && dstx > freq[0])
+      dst[i] = (ampl[i1] - ampl[srcidx]) * (dstx - freq[srcidx]) /
+        (freq[i1] - freq[srcidx]) + ampl[srcidx];
+    else
+      dst[i] = ampl[srcidx];
+  }
+}
+
 int llsm_get_fftsize(FP_TYPE* f0, int nfrm, FP_TYPE fs, FP_TYPE rel_winsize) {
   FP_TYPE minf0 = 1000;
   for(int i = 0; i < nfrm; i ++)
@@ -325,29 +343,138 @@ int llsm_get_fftsize(FP_TYPE* f0, int nfrm, FP_TYPE fs, FP_TYPE rel_winsize) {
   return pow(2, ceil(log2(max_winsize)));
 }
 
+// Number of harmonics advanced together by the oscillator bank. The lane
+//   loops below have a fixed trip count so that the compiler can map them
+//   onto SIMD registers.
+#define OSCBANK_LANES 8
+
+// Each harmonic runs the same second-order recursion as cig_gensins,
+//   s[t] = 2cos(w) s[t - 1] - s[t - 2], with the state of OSCBANK_LANES
+//   harmonics kept in separate arrays. The lanes are summed pairwise.
+void llsm_synthesize_harmonic_frame_ola(FP_TYPE* ampl, FP_TYPE* phse,
+  int nhar, FP_TYPE f0, int nx, FP_TYPE* w, FP_TYPE* y, int offset, int ny) {
+  int t0 = max(0, -offset);
+  int t1 = min(nx, ny - offset);
+  if(t1 <= t0) return;
+  FP_TYPE* dst = y + offset;
+  for(int k0 = 0; k0 < nhar; k0 += OSCBANK_LANES) {
+    FP_TYPE c[OSCBANK_LANES], s0[OSCBANK_LANES];
+    FP_TYPE s1[OSCBANK_LANES], s2[OSCBANK_LANES];
+    for(int l = 0; l < OSCBANK_LANES; l ++) {
+      c[l] = 0; s1[l] = 0; s2[l] = 0;
+      if(k0 + l >= nhar) continue;
+      FP_TYPE omega = 2.0 * M_PI * f0 * (k0 + l + 1.0);
+      FP_TYPE a = ampl[k0 + l];
+      FP_TYPE p = phse[k0 + l];
+      c[l] = 2.0 * cos_3(omega);
+      s2[l] = cos_3(omega * (t0 - nx / 2) + p) * a;
+      s1[l] = cos_3(omega * (t0 - nx / 2 + 1) + p) * a;
+    }
+    for(int t = t0; t < min(t0 + 2, t1); t ++) {
+      FP_TYPE* s = t == t0 ? s2 : s1;
+      FP_TYPE sum = 0;
+      for(int l = 0; l < OSCBANK_LANES; l ++) sum += s[l];
+      dst[t] += w == NULL ? sum : sum * w[t];
+    }
+    for(int t = t0 + 2; t < t1; t ++) {
+      for(int l = 0; l < OSCBANK_LANES; l ++) {
+        s0[l] = c[l] * s1[l] - s2[l];
+        s2[l] = s1[l];
+        s1[l] = s0[l];
+      }
+      for(int l = 0; l < OSCBANK_LANES / 2; l ++)
+        s0[l] += s0[l + OSCBANK_LANES / 2];
+      for(int l = 0; l < OSCBANK_LANES / 4; l ++)
+        s0[l] += s0[l + OSCBANK_LANES / 4];
+      FP_TYPE sum = s0[0] + s0[1];
+      dst[t] += w == NULL ? sum : sum * w[t];
+    }
+  }
+}
+
 FP_TYPE* llsm_synthesize_harmonic_frame(FP_TYPE* ampl, FP_TYPE* phse, int nhar,
   FP_TYPE f0, int nx) {
-  FP_TYPE* freq = malloc(nhar * sizeof(FP_TYPE));
-  for(int i = 0; i < nhar; i ++)
-    freq[i] = f0 * (i + 1.0);
-  FP_TYPE* y = gensins(freq, ampl, phse, nhar, 1.0, nx);
-  free(freq);
+  FP_TYPE* y = calloc(nx, sizeof(FP_TYPE));
+  llsm_synthesize_harmonic_frame_ola(ampl, phse, nhar, f0, nx, NULL, y, 0, nx);
   return y;
 }
 
 FP_TYPE* llsm_synthesize_harmonic_frame_iczt(FP_TYPE* ampl, FP_TYPE* phse,
   int nhar, FP_TYPE f0, int nx) {
   FP_TYPE* yr = malloc(nx * sizeof(FP_TYPE));
-  FP_TYPE* re = calloc(max(nhar + 1, nx) * 2, sizeof(FP_TYPE));
-  FP_TYPE* im = re + max(nhar + 1, nx);
+  FP_TYPE* buffer = malloc(
+    llsm_synthesize_harmonic_frame_iczt_buffersize(nhar, nx) *
+    sizeof(FP_TYPE));
+  llsm_synthesize_harmonic_frame_iczt_buffered(ampl, phse, nhar, f0, nx, yr,
+    buffer);
+  free(buffer);
+  return yr;
+}
+
+int llsm_synthesize_harmonic_frame_iczt_buffersize(int nhar, int nx) {
+  return max(nhar + 1, nx) * 2 + cig_czt_buffersize(nx);
+}
+
+void llsm_synthesize_harmonic_frame_iczt_buffered(FP_TYPE* ampl,
+  FP_TYPE* phse, int nhar, FP_TYPE f0, int nx, FP_TYPE* dst,
+  FP_TYPE* buffer) {
+  int nre = max(nhar + 1, nx);
+  FP_TYPE* re = buffer;
+  FP_TYPE* im = re + nre;
+  memset(re, 0, nre * 2 * sizeof(FP_TYPE));
   FP_TYPE omega0 = 2.0 * M_PI * f0;
   for(int i = 0; i < nhar; i ++) {
     re[i + 1] = ampl[i] * cos_2(phse[i] - nx / 2 * (1.0 + i) * omega0) * nx;
     im[i + 1] = ampl[i] * sin_2(phse[i] - nx / 2 * (1.0 + i) * omega0) * nx;
   }
-  iczt(re, im, yr, NULL, omega0, nx);
-  free(re);
-  return yr;
+  iczt_buffered(re, im, dst, NULL, omega0, nx, im + nre);
+}
+
+// Pairs of Gaussian samples generated per block by llsm_fill_white_noise.
+#define RANDN_BLOCK 64
+
+// The SplitMix64 finalizer.
+static uint64_t mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+void llsm_fill_white_noise(FP_TYPE* x, int nx, uint64_t seed,
+  uint64_t counter) {
+  if(nx <= 0) return;
+  // Sample counter + i is the cosine (even) or sine (odd) half of a
+  //   Box-Muller pair, and each pair is a hash of its index.
+  uint64_t key = mix64(seed);
+  uint64_t pair_begin = counter >> 1;
+  uint64_t pair_end = ((counter + (uint64_t)nx - 1) >> 1) + 1;
+  FP_TYPE u1[RANDN_BLOCK], u2[RANDN_BLOCK], z[RANDN_BLOCK * 2];
+  for(uint64_t p0 = pair_begin; p0 < pair_end; p0 += RANDN_BLOCK) {
+    // pair_end - p0 can exceed the range of int, so clamp it before casting
+    int npair = (int)min((uint64_t)RANDN_BLOCK, pair_end - p0);
+    for(int j = 0; j < npair; j ++) {
+      uint64_t h = mix64(((p0 + j + 1) * 0x9E3779B97F4A7C15ull) ^ key);
+      u1[j] = ((h >> 40) + 1) * (1.0 / 16777216.0);
+      u2[j] = ((h >> 16) & 0xFFFFFF) * (2.0 * M_PI / 16777216.0);
+    }
+    for(int j = 0; j < npair; j ++) {
+      FP_TYPE r = sqrt(-2.0 * log(u1[j]));
+      z[j * 2] = r * cos(u2[j]);
+      z[j * 2 + 1] = r * sin(u2[j]);
+    }
+    // copy the part inside [counter, counter + nx)
+    uint64_t idx0 = p0 * 2;
+    int k0 = idx0 < counter ? (int)(counter - idx0) : 0;
+    int k1 = min(npair * 2, (int)(counter + (uint64_t)nx - idx0));
+    for(int k = k0; k < k1; k ++)
+      x[idx0 + k - counter] = z[k];
+  }
+}
+
+FP_TYPE* llsm_generate_white_noise_seeded(int nx, uint64_t seed) {
+  FP_TYPE* ret = calloc(nx, sizeof(FP_TYPE));
+  llsm_fill_white_noise(ret, nx, seed, 0);
+  return ret;
 }
 
 FP_TYPE* llsm_generate_white_noise(int nx) {
@@ -393,6 +520,175 @@ FP_TYPE* llsm_generate_bandlimited_noise(int nx, FP_TYPE fmin, FP_TYPE fmax) {
   return y;
 }
 
+// Band-limited noise templates are cached for the lifetime of the process,
+//   keyed by the normalized band edges.
+#define NOISE_TEMPLATE_SIZE 20000
+#define NOISE_TEMPLATE_OVERLAP 128
+#define NOISE_TEMPLATE_LENGTH (NOISE_TEMPLATE_SIZE - NOISE_TEMPLATE_OVERLAP)
+
+typedef struct {
+  FP_TYPE fmin;
+  FP_TYPE fmax;
+  FP_TYPE* x;          // NOISE_TEMPLATE_LENGTH samples, loopable
+} noise_template;
+
+static noise_template* noise_templates = NULL;
+static int num_noise_templates = 0;
+#ifdef USE_PTHREAD
+static pthread_mutex_t noise_templates_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// A white noise filtered into the band, made loopable by cross-fading its
+//   tail into the head. The noise is seeded by the band, so that a template
+//   does not depend on when (or by which thread) it is generated.
+static FP_TYPE* make_noise_template(FP_TYPE fmin, FP_TYPE fmax) {
+  int ntemplate = NOISE_TEMPLATE_SIZE;
+  int extension = 128;
+  uint64_t seed = ((uint64_t)round(fmin * 1e6) << 32) |
+    (uint64_t)round(fmax * 1e6);
+  FP_TYPE* template_white = llsm_generate_white_noise_seeded(
+    ntemplate + extension, seed);
+  FP_TYPE* template_colored = chebyfilt(template_white, ntemplate + extension,
+    fmin, fmax);
+  FP_TYPE* y = malloc(NOISE_TEMPLATE_LENGTH * sizeof(FP_TYPE));
+  for(int i = 0; i < NOISE_TEMPLATE_LENGTH; i ++)
+    y[i] = template_colored[i];
+  for(int i = 0; i < NOISE_TEMPLATE_OVERLAP; i ++) {
+    FP_TYPE r = (FP_TYPE)i / NOISE_TEMPLATE_OVERLAP;
+    y[i] = template_colored[NOISE_TEMPLATE_LENGTH + i] * (1.0 - r) +
+      template_colored[i] * r;
+    y[i] /= sqrt(2 * r * (r - 1) + 1);
+  }
+  free(template_white); free(template_colored);
+  return y;
+}
+
+// Must be called with the cache locked.
+static FP_TYPE* find_noise_template(FP_TYPE fmin, FP_TYPE fmax) {
+  for(int i = 0; i < num_noise_templates; i ++)
+    if(fabs(noise_templates[i].fmin - fmin) < 1e-6 &&
+       fabs(noise_templates[i].fmax - fmax) < 1e-6)
+      return noise_templates[i].x;
+  return NULL;
+}
+
+// Must be called with the cache locked.
+static void add_noise_template(FP_TYPE fmin, FP_TYPE fmax, FP_TYPE* x) {
+  noise_templates = realloc(noise_templates,
+    (num_noise_templates + 1) * sizeof(noise_template));
+  noise_templates[num_noise_templates].fmin = fmin;
+  noise_templates[num_noise_templates].fmax = fmax;
+  noise_templates[num_noise_templates].x = x;
+  num_noise_templates ++;
+}
+
+FP_TYPE* llsm_get_noise_template(FP_TYPE fmin, FP_TYPE fmax, int* dst_size) {
+  FP_TYPE* ret = NULL;
+#ifdef USE_PTHREAD
+  pthread_mutex_lock(& noise_templates_mtx);
+#elif defined(_OPENMP)
+# pragma omp critical(llsm_noise_templates)
+#endif
+  {
+    ret = find_noise_template(fmin, fmax);
+    if(ret == NULL) {
+      ret = make_noise_template(fmin, fmax);
+      add_noise_template(fmin, fmax, ret);
+    }
+  }
+#ifdef USE_PTHREAD
+  pthread_mutex_unlock(& noise_templates_mtx);
+#endif
+  if(dst_size != NULL) *dst_size = NOISE_TEMPLATE_LENGTH;
+  return ret;
+}
+
+int llsm_num_noise_templates() {
+  int ret = 0;
+#ifdef USE_PTHREAD
+  pthread_mutex_lock(& noise_templates_mtx);
+#elif defined(_OPENMP)
+# pragma omp critical(llsm_noise_templates)
+#endif
+  ret = num_noise_templates;
+#ifdef USE_PTHREAD
+  pthread_mutex_unlock(& noise_templates_mtx);
+#endif
+  return ret;
+}
+
+// File layout: "LLNT", version, sizeof(FP_TYPE), template length, number of
+//   templates, then (fmin, fmax, samples) for each template.
+int llsm_save_noise_templates(const char* path) {
+  FILE* fp = fopen(path, "wb");
+  if(fp == NULL) return 0;
+  int header[4] = {1, sizeof(FP_TYPE), NOISE_TEMPLATE_LENGTH, 0};
+#ifdef USE_PTHREAD
+  pthread_mutex_lock(& noise_templates_mtx);
+#elif defined(_OPENMP)
+# pragma omp critical(llsm_noise_templates)
+#endif
+  {
+    header[3] = num_noise_templates;
+    fwrite("LLNT", 1, 4, fp);
+    fwrite(header, sizeof(int), 4, fp);
+    for(int i = 0; i < num_noise_templates; i ++) {
+      fwrite(& noise_templates[i].fmin, sizeof(FP_TYPE), 1, fp);
+      fwrite(& noise_templates[i].fmax, sizeof(FP_TYPE), 1, fp);
+      fwrite(noise_templates[i].x, sizeof(FP_TYPE), NOISE_TEMPLATE_LENGTH,
+        fp);
+    }
+  }
+#ifdef USE_PTHREAD
+  pthread_mutex_unlock(& noise_templates_mtx);
+#endif
+  int ret = ! ferror(fp);
+  fclose(fp);
+  return ret;
+}
+
+int llsm_load_noise_templates(const char* path) {
+  FILE* fp = fopen(path, "rb");
+  if(fp == NULL) return 0;
+  char magic[4];
+  int header[4];
+  if(fread(magic, 1, 4, fp) != 4 || memcmp(magic, "LLNT", 4) ||
+     fread(header, sizeof(int), 4, fp) != 4 || header[0] != 1 ||
+     header[1] != sizeof(FP_TYPE) || header[2] != NOISE_TEMPLATE_LENGTH ||
+     header[3] < 0) {
+    fclose(fp);
+    return 0;
+  }
+  int ret = 1;
+  for(int i = 0; i < header[3]; i ++) {
+    FP_TYPE band[2];
+    FP_TYPE* x = malloc(NOISE_TEMPLATE_LENGTH * sizeof(FP_TYPE));
+    if(fread(band, sizeof(FP_TYPE), 2, fp) != 2 ||
+       fread(x, sizeof(FP_TYPE), NOISE_TEMPLATE_LENGTH, fp) !=
+         NOISE_TEMPLATE_LENGTH) {
+      free(x);
+      ret = 0;
+      break;
+    }
+#ifdef USE_PTHREAD
+    pthread_mutex_lock(& noise_templates_mtx);
+#elif defined(_OPENMP)
+# pragma omp critical(llsm_noise_templates)
+#endif
+    {
+      if(find_noise_template(band[0], band[1]) == NULL)
+        add_noise_template(band[0], band[1], x);
+      else
+        free(x);
+    }
+#ifdef USE_PTHREAD
+    pthread_mutex_unlock(& noise_templates_mtx);
+#endif
+  }
+  fclose(fp);
+  return ret;
+}
+
 void llsm_lipfilter(FP_TYPE radius, FP_TYPE f0, int nhar,
   FP_TYPE* dst_ampl, FP_TYPE* dst_phse, int inverse) {
   FP_TYPE Rr = 128.0 / 9.0 / M_PI / M_PI;
@@ -429,12 +725,12 @@ void llsm_lipfilter_reim(FP_TYPE radius, FP_TYPE f0, int nhar,
   }
 }
 
-FP_TYPE* llsm_harmonic_spectrum(FP_TYPE* ampl, int nhar, FP_TYPE f0,
-  int nfft) {
-  FP_TYPE* X = calloc(nfft / 2 + 1, sizeof(FP_TYPE));
+static void harmonic_spectrum_into(FP_TYPE* ampl, int nhar, FP_TYPE f0,
+  int nfft, FP_TYPE* X) {
   int nX = nfft / 2 + 1;
   int T = 3.0 / f0;
   int width = ceil(f0 * nfft * 1.5);
+  for(int i = 0; i < nX; i ++) X[i] = 0;
   for(int i = 0; i < nhar; i ++) {
     FP_TYPE ifreq = f0 * (1.0 + i);
     int center = round(ifreq * nfft);
@@ -449,6 +745,12 @@ FP_TYPE* llsm_harmonic_spectrum(FP_TYPE* ampl, int nhar, FP_TYPE f0,
   }
   // normalization
   for(int i = 0; i < nfft / 2 + 1; i ++) X[i] *= f0;
+}
+
+FP_TYPE* llsm_harmonic_spectrum(FP_TYPE* ampl, int nhar, FP_TYPE f0,
+  int nfft) {
+  FP_TYPE* X = calloc(nfft / 2 + 1, sizeof(FP_TYPE));
+  harmonic_spectrum_into(ampl, nhar, f0, nfft, X);
   return X;
 }
 
@@ -462,50 +764,215 @@ static FP_TYPE decompress_logspectrum(FP_TYPE x) {
   return (x + 10.0) * 2 - 10.0;
 }
 
-FP_TYPE* llsm_harmonic_envelope(FP_TYPE* ampl, int nhar, FP_TYPE f0,
-  int nfft) {
-  FP_TYPE* compressed_ampl = calloc(nhar, sizeof(FP_TYPE));
+// Same as cig_interpu, but writes into y.
+static void interpu_into(FP_TYPE xi0, FP_TYPE xi1, FP_TYPE* yi, int ni,
+  FP_TYPE* x, int nx, FP_TYPE* y) {
+  int begin = 0, end = nx - 1;
+  while(begin < nx && x[begin] < xi0) {
+    y[begin] = yi[0];
+    begin ++;
+  }
+  for(end = nx - 1; end > begin; end --) {
+    FP_TYPE srcidx = (x[end] - xi0) / (xi1 - xi0) * ni;
+    if(srcidx + 1.01 < ni) break;
+    y[end] = yi[ni - 1];
+  }
+  for(int i = begin; i <= end; i ++) {
+    FP_TYPE srcidx = (x[i] - xi0) / (xi1 - xi0) * ni;
+    int base = srcidx;
+    FP_TYPE r = srcidx - base;
+    y[i] = yi[base] + (yi[base + 1] - yi[base]) * r;
+  }
+}
+
+// Same as cig_moving_avg, but works in buffer (size nx * 3 + halford * 2)
+//   and writes into y.
+static void moving_avg_into(FP_TYPE* x, int nx, FP_TYPE halford, FP_TYPE* y,
+  FP_TYPE* buffer) {
+  int ihalford = halford;
+  FP_TYPE* acc = buffer;
+  FP_TYPE* interp_idx = acc + nx + ihalford * 2;
+  FP_TYPE* interp_lower = interp_idx + nx;
+
+  acc[0] = x[0];
+  for(int i = 1; i <= ihalford; i ++)
+    acc[i] = acc[i - 1] + x[0];
+  for(int i = 1; i < nx; i ++)
+    acc[i + ihalford] = acc[i + ihalford - 1] + x[i];
+  for(int i = 0; i < ihalford; i ++)
+    acc[nx + ihalford + i] = acc[nx + ihalford + i - 1] + x[nx - 1];
+
+  for(int i = 0; i < nx; i ++) interp_idx[i] = i + halford;
+  interpu_into(-halford, nx + ihalford, acc, nx + ihalford * 2,
+    interp_idx, nx, y);
+  for(int i = 0; i < nx; i ++) interp_idx[i] = i - halford;
+  interpu_into(-halford, nx + ihalford, acc, nx + ihalford * 2,
+    interp_idx, nx, interp_lower);
+
+  for(int i = 0; i < nx; i ++)
+    y[i] = (y[i] - interp_lower[i]) / halford * 0.5;
+}
+
+int llsm_filter_noise_frame_buffersize(int nfft) {
+  int nspec = nfft / 2 + 1;
+  return nfft * 3 + nspec * 6 + 6;
+}
+
+void llsm_filter_noise_frame(FP_TYPE* x, int nfft, FP_TYPE wsqr,
+  FP_TYPE* freq, FP_TYPE* psd, int npsd, FP_TYPE fs, FP_TYPE* buffer) {
+  const int nfade = 16;
+  int nspec = nfft / 2 + 1;
+  FP_TYPE* x_im = buffer;
+  FP_TYPE* fftbuff = x_im + nfft;
+  FP_TYPE* xpsd = fftbuff + nfft * 2;
+  FP_TYPE* env = xpsd + nspec;
+  FP_TYPE* H = env + nspec;
+  FP_TYPE* avgbuff = H + nspec;
+
+  // STFT -> PSD -> diff
+  fft(x, NULL, x, x_im, nfft, fftbuff);
+  llsm_fft_to_psd(x, x_im, nfft, wsqr, xpsd);
+  moving_avg_into(xpsd, nspec, 3, env, avgbuff);
+  llsm_spectrum_from_envelope_into(freq, psd, npsd, nspec - 1, fs / 2.0, H);
+  for(int j = 0; j < nspec - 1; j ++)
+    H[j] = exp(DB2LOG(H[j])) / sqrt(env[j] * 44100 / fs + 1e-8);
+
+  // filter
+  for(int j = 0; j < nspec - 1; j ++) {
+    x[j] *= H[j]; x_im[j] *= H[j];
+  }
+  x[nspec - 1] = x[nspec - 2]; complete_symm(x, nfft);
+  x_im[nspec - 1] = x_im[nspec - 2]; complete_asymm(x_im, nfft);
+
+  // ISTFT
+  ifft(x, x_im, x, NULL, nfft, fftbuff);
+  for(int j = 0; j < nfade; j ++) {
+    x[j] *= (FP_TYPE)j / nfade;
+    x[nfft - j - 1] *= 1.0 - (FP_TYPE)j / nfade;
+  }
+}
+
+int llsm_harmonic_envelope_buffersize(int nhar, int nfft) {
+  int nspec = nfft / 2 + 1;
+  // f0 is below Nyquist, so the smoothing order never exceeds nfft / 6.
+  return nhar + nspec * 2 + nfft * 4 + nspec * 4 + (nfft / 6 + 1) * 2;
+}
+
+// The envelope estimation follows cig_spec2env.
+void llsm_harmonic_envelope_buffered(FP_TYPE* ampl, int nhar, FP_TYPE f0,
+  int nfft, FP_TYPE* dst, FP_TYPE* buffer) {
+  int nspec = nfft / 2 + 1;
+  FP_TYPE* compressed_ampl = buffer;
+  FP_TYPE* X = compressed_ampl + nhar;
+  FP_TYPE* smoothed = X + nspec;
+  FP_TYPE* V = smoothed + nspec;
+  FP_TYPE* C = V + nfft;
+  FP_TYPE* fftbuff = C + nfft;
+  FP_TYPE* avgbuff = fftbuff + nfft * 2;
+
   FP_TYPE peak = log(maxfp(ampl, nhar));
   for(int i = 0; i < nhar; i ++)
     compressed_ampl[i] = exp(compress_logspectrum(log(ampl[i]) - peak));
-  FP_TYPE* X = llsm_harmonic_spectrum(compressed_ampl, nhar, f0, nfft);
-  FP_TYPE* full_spectrum = cig_spec2env(X, nfft, f0, nhar, NULL);
-  free(X);
-  for(int i = 0; i < nfft / 2 + 1; i ++) {
-    full_spectrum[i] = LOG2DB(decompress_logspectrum(full_spectrum[i]) + peak);
-  }
-  free(compressed_ampl);
+  harmonic_spectrum_into(compressed_ampl, nhar, f0, nfft, X);
+
+  FP_TYPE smoothord = (FP_TYPE)nfft / (3.0 / f0);
+  for(int i = 0; i < nspec; i ++) V[i] = X[i];
+  int kf0 = ceil(f0 * nfft);
+  for(int i = 0; i < kf0 / 2; i ++) V[i] = V[kf0 - i];
+  moving_avg_into(V, nspec, smoothord, smoothed, avgbuff);
+  int top = floor(f0 * (nhar - 2) * nfft);
+  for(int i = top; i < nspec; i ++)
+    smoothed[i] = smoothed[i - 1];
+
+  for(int i = 0; i < nspec; i ++)
+    V[i] = log_2(smoothed[i] + M_EPS);
+  complete_symm(V, nfft);
+  ifft(V, NULL, C, NULL, nfft, fftbuff);
+  for(int i = 1; i < nspec; i ++)
+    C[i] *= sin_2(i * f0 * M_PI) / (i * f0 * M_PI) *
+      (1.18 - 2.0 * 0.09 * cos_2(2.0 * M_PI * i * f0));
+  complete_symm(C, nfft);
+  fft(C, NULL, V, NULL, nfft, fftbuff);
+
+  for(int i = 0; i < nspec; i ++)
+    dst[i] = LOG2DB(decompress_logspectrum(V[i]) + peak);
+}
+
+FP_TYPE* llsm_harmonic_envelope(FP_TYPE* ampl, int nhar, FP_TYPE f0,
+  int nfft) {
+  FP_TYPE* buffer = malloc(llsm_harmonic_envelope_buffersize(nhar, nfft) *
+    sizeof(FP_TYPE));
+  FP_TYPE* full_spectrum = calloc(nfft / 2 + 1, sizeof(FP_TYPE));
+  llsm_harmonic_envelope_buffered(ampl, nhar, f0, nfft, full_spectrum, buffer);
+  free(buffer);
   return full_spectrum;
 }
 
-FP_TYPE* llsm_harmonic_minphase(FP_TYPE* ampl, int nhar) {
+static int harmonic_minphase_nfft(int nhar) {
+  return max(64, pow(2, ceil(log2(nhar) + 2)));
+}
+
+int llsm_harmonic_minphase_buffersize(int nhar) {
+  int nfft = harmonic_minphase_nfft(nhar);
+  return (nhar + 1) * 3 + (nfft / 2 + 1) * 2 + nfft * 4;
+}
+
+void llsm_harmonic_minphase_buffered(FP_TYPE* ampl, int nhar, FP_TYPE* dst,
+  FP_TYPE* buffer) {
   // Interpolate the harmonics to form a spectral envelope; compute the
   //   minimum-phase response; subsample the phase response at harmonic
   //   frequencies.
-  int nfft = max(64, pow(2, ceil(log2(nhar) + 2)));
-  FP_TYPE* har_idx  = calloc(nhar + 1, sizeof(FP_TYPE));
-  FP_TYPE* har_ampl = calloc(nhar + 1, sizeof(FP_TYPE));
-  FP_TYPE* fft_idx  = calloc(nfft / 2 + 1, sizeof(FP_TYPE));
+  int nfft = harmonic_minphase_nfft(nhar);
+  FP_TYPE* har_idx  = buffer;
+  FP_TYPE* har_ampl = har_idx + nhar + 1;
+  FP_TYPE* har_phse = har_ampl + nhar + 1;
+  FP_TYPE* fft_idx  = har_phse + nhar + 1;
+  FP_TYPE* spectrum = fft_idx + nfft / 2 + 1;
+  FP_TYPE* S_symm   = spectrum + nfft / 2 + 1;
+  FP_TYPE* C        = S_symm + nfft;
+  FP_TYPE* fftbuff  = C + nfft;
+  har_idx[0] = 0;
   for(int i = 0; i < nhar; i ++) {
     har_idx [i + 1] = (i + 1.0) / (nhar + 1.0) * nfft / 2.0;
     har_ampl[i + 1] = log(ampl[i] + 1e-10);
   }
   har_ampl[0] = har_ampl[1];
   for(int i = 0; i < nfft / 2 + 1; i ++) fft_idx[i] = i;
-  FP_TYPE* spectrum = interp1u(0, har_idx[nhar] * 2 - har_idx[nhar - 1],
-    har_ampl, nhar + 1, fft_idx, nfft / 2 + 1);
-  FP_TYPE* spectrum_phase = minphase(spectrum, nfft);
-  FP_TYPE* har_phse = interp1u(0, nfft / 2 + 1,
-    spectrum_phase, nfft / 2 + 1, har_idx, nhar + 1);
+  interpu_into(0, har_idx[nhar] * 2 - har_idx[nhar - 1],
+    har_ampl, nhar + 1, fft_idx, nfft / 2 + 1, spectrum);
+
+  // minimum phase from the real cepstrum, as in ciglet's minphase
+  for(int i = 0; i < nfft / 2 + 1; i ++)
+    S_symm[i] = spectrum[i];
+  complete_symm(S_symm, nfft);
+  ifft(S_symm, NULL, C, NULL, nfft, fftbuff);
+  for(int i = 1; i < nfft / 2 + 1; i ++)
+    C[i] *= 2.0;
+  for(int i = nfft / 2 + 2; i < nfft; i ++)
+    C[i] = 0.0;
+  fft(C, NULL, NULL, S_symm, nfft, fftbuff);
+
+  interpu_into(0, nfft / 2 + 1,
+    S_symm, nfft / 2 + 1, har_idx, nhar + 1, har_phse);
   for(int i = 1; i < nhar; i ++)
-    har_phse[i - 1] = har_phse[i];
-  free(har_idx); free(har_ampl); free(fft_idx);
-  free(spectrum); free(spectrum_phase);
+    dst[i - 1] = har_phse[i];
+  dst[nhar - 1] = har_phse[nhar - 1];
+}
+
+FP_TYPE* llsm_harmonic_minphase(FP_TYPE* ampl, int nhar) {
+  FP_TYPE* buffer = malloc(llsm_harmonic_minphase_buffersize(nhar) *
+    sizeof(FP_TYPE));
+  FP_TYPE* har_phse = calloc(nhar + 1, sizeof(FP_TYPE));
+  llsm_harmonic_minphase_buffered(ampl, nhar, har_phse, buffer);
+  free(buffer);
   return har_phse;
 }
 
+// The responses are stored harmonic-major (nhar x nresp) so that the fitting
+//   kernel runs over contiguous candidates for each harmonic.
 typedef struct {
-  FP_TYPE** power;     // squared amplitude responses
+  FP_TYPE* invpower;   // reciprocal of the squared amplitude responses
+  FP_TYPE* logpower;   // cumulative sum of log power along the harmonics
   FP_TYPE* param;      // the parameter for each response
   int nhar;            // number of harmonics
   int nresp;           // number of cached responses
@@ -516,7 +983,8 @@ llsm_cached_glottal_model* llsm_create_cached_glottal_model(FP_TYPE* param,
   cached_glottal_model* ret = malloc(sizeof(cached_glottal_model));
   ret -> nresp = nparam;
   ret -> nhar = nhar;
-  ret -> power = calloc(nparam, sizeof(FP_TYPE*));
+  ret -> invpower = calloc(nparam * nhar, sizeof(FP_TYPE));
+  ret -> logpower = calloc(nparam * nhar, sizeof(FP_TYPE));
   ret -> param = calloc(nparam, sizeof(FP_TYPE));
   FP_TYPE f0 = 200.0; // the shape of LF model is f0-independent
   FP_TYPE* freq = calloc(nhar, sizeof(FP_TYPE));
@@ -524,11 +992,16 @@ llsm_cached_glottal_model* llsm_create_cached_glottal_model(FP_TYPE* param,
   for(int i = 0; i < nparam; i ++) {
     ret -> param[i] = param[i];
     lfmodel lf = lfmodel_from_rd(param[i], 1.0 / f0, 1.0);
-    ret -> power[i] = lfmodel_spectrum(lf, freq, nhar, NULL);
+    FP_TYPE* ampl = lfmodel_spectrum(lf, freq, nhar, NULL);
+    FP_TYPE lgsum = 0;
     for(int j = 0; j < nhar; j ++) {
-      ret -> power[i][j] /= j + 1.0;
-      ret -> power[i][j] *= ret -> power[i][j];
+      FP_TYPE power = ampl[j] / (j + 1.0);
+      power = max(power * power, 1e-30);
+      lgsum += log(power);
+      ret -> invpower[j * nparam + i] = 1.0 / power;
+      ret -> logpower[j * nparam + i] = lgsum;
     }
+    free(ampl);
   }
   free(freq);
   return (llsm_cached_glottal_model*)ret;
@@ -537,35 +1010,74 @@ llsm_cached_glottal_model* llsm_create_cached_glottal_model(FP_TYPE* param,
 void llsm_delete_cached_glottal_model(llsm_cached_glottal_model* dst_) {
   if(dst_ == NULL) return;
   cached_glottal_model* dst = (cached_glottal_model*)dst_;
-  free2d(dst -> power, dst -> nresp);
+  free(dst -> invpower);
+  free(dst -> logpower);
   free(dst -> param);
   free(dst);
 }
 
+// Itakura-Saito distance between power and the gain-matched responses of
+//   every stride-th candidate in [lo, hi]. With S the input power, P the
+//   response and g = S_0 / P_0, the distance expands into
+//     (sum(S / P) / g - sum(log(S)) + sum(log(P)) + nhar log(g)) / nhar - 1,
+//   so each harmonic contributes one multiply-add per candidate.
+static void glottal_fitting_kernel(cached_glottal_model* model,
+  FP_TYPE* power, FP_TYPE lgsum, int nhar, int lo, int hi, int stride,
+  FP_TYPE* distance) {
+  int nresp = model -> nresp;
+  for(int i = lo; i <= hi; i += stride) distance[i] = 0;
+  for(int j = 0; j < nhar; j ++) {
+    FP_TYPE* invpower = model -> invpower + j * nresp;
+    FP_TYPE s = power[j];
+    for(int i = lo; i <= hi; i += stride)
+      distance[i] += s * invpower[i];
+  }
+  FP_TYPE* invpower0 = model -> invpower;
+  FP_TYPE* logpower = model -> logpower + (nhar - 1) * nresp;
+  for(int i = lo; i <= hi; i += stride) {
+    FP_TYPE gain = power[0] * invpower0[i];
+    distance[i] = (distance[i] / gain - lgsum + logpower[i] +
+      nhar * log(gain)) / nhar - 1.0;
+  }
+}
+
 FP_TYPE llsm_spectral_glottal_fitting(FP_TYPE* ampl, int nhar,
   llsm_cached_glottal_model* model_) {
   cached_glottal_model* model = (cached_glottal_model*)model_;
+  int nresp = model -> nresp;
   nhar = min(nhar, model -> nhar);
+  if(nhar < 1) return model -> param[0];
   FP_TYPE* power = calloc(nhar, sizeof(FP_TYPE));
+  FP_TYPE lgsum = 0;
   for(int i = 0; i < nhar; i ++) {
-    power[i] = ampl[i] * ampl[i];
-  }
-  FP_TYPE* distance = calloc(model -> nresp, sizeof(FP_TYPE));
-  FP_TYPE* power_model = calloc(nhar, sizeof(FP_TYPE));
-  for(int i = 0; i < model -> nresp; i ++) {
-    FP_TYPE lgavg = 0;
-    for(int j = 0; j < nhar; j ++) lgavg += log(power[j]) / nhar;
-    FP_TYPE gain = power[0] / model -> power[i][0];
-    for(int j = 0; j < nhar; j ++)
-      power_model[j] = model -> power[i][j] * gain;
-    distance[i] = exp(itakura_saito(power, power_model, nhar));
-  }
-  free(power_model);
+    power[i] = max(ampl[i] * ampl[i], 1e-30);
+    lgsum += log(power[i]);
+  }
+
+  // Coarse-to-fine search: every stride-th candidate first, then all the
+  //   candidates surrounding the coarse minimum.
+  const int stride = 4;
+  FP_TYPE* distance = calloc(nresp, sizeof(FP_TYPE));
+  glottal_fitting_kernel(model, power, lgsum, nhar, 0, nresp - 1, stride,
+    distance);
+  int last = (nresp - 1) / stride * stride;
+  if(last != nresp - 1)
+    glottal_fitting_kernel(model, power, lgsum, nhar, nresp - 1, nresp - 1, 1,
+      distance);
+  int coarse = nresp - 1;
+  for(int i = 0; i <= last; i += stride)
+    if(distance[i] < distance[coarse]) coarse = i;
+  int lo = max(0, coarse - stride);
+  int hi = min(nresp - 1, coarse + stride);
+  glottal_fitting_kernel(model, power, lgsum, nhar, lo, hi, 1, distance);
   free(power);
 
-  int valley = find_minima(distance, 0, model -> nresp - 1);
+  int valley = find_minima(distance, lo, hi);
   FP_TYPE param_refined = model -> param[valley];
-  if(valley > 0 && valley < model -> nresp - 1) {
+  if(valley > lo && valley < hi) {
+    // the refinement interpolates exp(distance), not the distance itself
+    for(int i = valley - 1; i <= valley + 1; i ++)
+      distance[i] = exp(distance[i]);
     qifft(distance, valley, & param_refined);
     param_refined = linterp(model -> param[(int)param_refined],
       model -> param[(int)param_refined + 1], fmod(param_refined, 1.0));
@@ -574,6 +1086,117 @@ FP_TYPE llsm_spectral_glottal_fitting(FP_TYPE* ampl, int nhar,
   return param_refined;
 }
 
+// The LF model (Ee = 1) scales with T0 in time, so its spectrum at the k-th
+//   harmonic is T0 * G_k, where G_k only depends on Rd (T0 is clamped to
+//   1 / 800 in ciglet's lfparam_from_lfmodel). G_k is tabulated on a dense,
+//   log-spaced Rd grid and interpolated in between: the magnitude in log
+//   domain and the phase after removing the linear phase of the excitation
+//   at te, which otherwise changes too fast with Rd at high harmonics.
+#define LFTABLE_NRD 256
+#define LFTABLE_NHAR 256
+#define LFTABLE_RDMIN 0.02
+#define LFTABLE_RDMAX 3.0
+// lfmodel_from_rd is piecewise in Rd; the response is discontinuous there.
+static const FP_TYPE lftable_breakpoints[2] = {0.21, 2.7};
+// Queries within this distance (in grid steps) of a grid point take the
+//   tabulated response as is.
+#define LFTABLE_TOLERANCE 1e-3
+
+typedef struct {
+  FP_TYPE* logmagn;    // log of the T0-normalized magnitude, nrd x nhar
+  FP_TYPE* phse;       // phase response without the linear phase at te
+} lfmodel_table;
+
+static lfmodel_table* lf_table = NULL;
+static llsm_once_flag lf_table_once = LLSM_ONCE_INIT;
+
+static void llsm_init_lfmodel_table() {
+  lfmodel_table* table = malloc(sizeof(lfmodel_table));
+  table -> logmagn = calloc(LFTABLE_NRD * LFTABLE_NHAR, sizeof(FP_TYPE));
+  table -> phse = calloc(LFTABLE_NRD * LFTABLE_NHAR, sizeof(FP_TYPE));
+  FP_TYPE f0 = 200.0;
+  FP_TYPE* freq = calloc(LFTABLE_NHAR, sizeof(FP_TYPE));
+  for(int i = 0; i < LFTABLE_NHAR; i ++) freq[i] = f0 * (i + 1.0);
+  for(int i = 0; i < LFTABLE_NRD; i ++) {
+    FP_TYPE rd = LFTABLE_RDMIN * pow(LFTABLE_RDMAX / LFTABLE_RDMIN,
+      (FP_TYPE)i / (LFTABLE_NRD - 1));
+    FP_TYPE* logmagn = table -> logmagn + i * LFTABLE_NHAR;
+    FP_TYPE* phse = table -> phse + i * LFTABLE_NHAR;
+    lfmodel lf = lfmodel_from_rd(rd, 1.0 / f0, 1.0);
+    FP_TYPE* magn = lfmodel_spectrum(lf, freq, LFTABLE_NHAR, phse);
+    for(int j = 0; j < LFTABLE_NHAR; j ++) {
+      logmagn[j] = log(max(magn[j] * f0, 1e-30));
+      phse[j] = wrap(phse[j] + 2.0 * M_PI * (j + 1.0) * lf.te);
+    }
+    free(magn);
+  }
+  free(freq);
+  lf_table = table;
+}
+
+static lfmodel_table* llsm_get_lfmodel_table() {
+  llsm_once(lf_table_once, llsm_init_lfmodel_table);
+  return lf_table;
+}
+
+static void lfmodel_harmonics_exact(FP_TYPE rd, FP_TYPE f0, int lhar,
+  int uhar, FP_TYPE* dst_magn, FP_TYPE* dst_phse) {
+  int n = uhar - lhar;
+  FP_TYPE* freq = calloc(n, sizeof(FP_TYPE));
+  FP_TYPE* phse = calloc(n, sizeof(FP_TYPE));
+  for(int i = 0; i < n; i ++) freq[i] = f0 * (lhar + i + 1.0);
+  lfmodel lf = lfmodel_from_rd(rd, 1.0 / f0, 1.0);
+  FP_TYPE* magn = lfmodel_spectrum(lf, freq, n, phse);
+  if(dst_magn != NULL) memcpy(dst_magn + lhar, magn, n * sizeof(FP_TYPE));
+  if(dst_phse != NULL) memcpy(dst_phse + lhar, phse, n * sizeof(FP_TYPE));
+  free(magn); free(phse); free(freq);
+}
+
+void llsm_lfmodel_harmonics(FP_TYPE rd, FP_TYPE f0, int nhar,
+  FP_TYPE* dst_magn, FP_TYPE* dst_phse) {
+  if(nhar <= 0) return;
+  if(rd < LFTABLE_RDMIN || rd > LFTABLE_RDMAX) {
+    lfmodel_harmonics_exact(rd, f0, 0, nhar, dst_magn, dst_phse);
+    return;
+  }
+  lfmodel_table* table = llsm_get_lfmodel_table();
+  int ntab = min(nhar, LFTABLE_NHAR);
+  FP_TYPE idx = log(rd / LFTABLE_RDMIN) / log(LFTABLE_RDMAX / LFTABLE_RDMIN) *
+    (LFTABLE_NRD - 1);
+  int base = min(LFTABLE_NRD - 2, (int)idx);
+  FP_TYPE ratio = idx - base;
+  if(ratio < LFTABLE_TOLERANCE) ratio = 0;
+  if(ratio > 1.0 - LFTABLE_TOLERANCE) ratio = 1.0;
+  if(ratio > 0 && ratio < 1.0) {
+    FP_TYPE step = log(LFTABLE_RDMAX / LFTABLE_RDMIN) / (LFTABLE_NRD - 1);
+    FP_TYPE rd0 = LFTABLE_RDMIN * exp(base * step);
+    FP_TYPE rd1 = LFTABLE_RDMIN * exp((base + 1) * step);
+    for(int i = 0; i < 2; i ++)
+      if(lftable_breakpoints[i] > rd0 && lftable_breakpoints[i] <= rd1) {
+        lfmodel_harmonics_exact(rd, f0, 0, nhar, dst_magn, dst_phse);
+        return;
+      }
+  }
+  FP_TYPE* logmagn0 = table -> logmagn + base * LFTABLE_NHAR;
+  FP_TYPE* logmagn1 = logmagn0 + LFTABLE_NHAR;
+  FP_TYPE* phse0 = table -> phse + base * LFTABLE_NHAR;
+  FP_TYPE* phse1 = phse0 + LFTABLE_NHAR;
+  if(dst_magn != NULL) {
+    FP_TYPE scale = max(1.0 / f0, 1.0 / 800.0);
+    for(int i = 0; i < ntab; i ++)
+      dst_magn[i] = exp(logmagn0[i] + (logmagn1[i] - logmagn0[i]) * ratio)
+        * scale;
+  }
+  if(dst_phse != NULL) {
+    FP_TYPE te = lfmodel_from_rd(rd, 1.0 / f0, 1.0).te;
+    for(int i = 0; i < ntab; i ++)
+      dst_phse[i] = wrap(phse0[i] + wrap(phse1[i] - phse0[i]) * ratio
+        - 2.0 * M_PI * (i + 1.0) * te);
+  }
+  if(nhar > ntab)
+    lfmodel_harmonics_exact(rd, f0, ntab, nhar, dst_magn, dst_phse);
+}
+
 // https://www.dsprelated.com/showarticle/1068.php
 FP_TYPE* llsm_smoothing_filter(FP_TYPE* x, int nx, int order) {
   FP_TYPE* y = calloc(nx, sizeof(FP_TYPE));
@@ -22,6 +22,8 @@
 #ifndef LLSM_DSPUTILS_H
 #define LLSM_DSPUTILS_H
 
+#include <stdint.h>
+
 /** @brief A simple F0 refinment algorithm; overwrites the input. */
 void llsm_refine_f0(FP_TYPE* x, int nx, FP_TYPE fs, FP_TYPE* f0, int nfrm,
   FP_TYPE thop);
@@ -73,6 +75,11 @@ FP_TYPE* llsm_spectral_mean(FP_TYPE* spectrum, int nspec, FP_TYPE fnyq,
 FP_TYPE* llsm_spectrum_from_envelope(FP_TYPE* freq, FP_TYPE* ampl, int nfreq,
   int nspec, FP_TYPE fnyq);
 
+/** @brief Same as llsm_spectrum_from_envelope, except that the nspec values
+ *    are written into dst. */
+void llsm_spectrum_from_envelope_into(FP_TYPE* freq, FP_TYPE* ampl,
+  int nfreq, int nspec, FP_TYPE fnyq, FP_TYPE* dst);
+
 /** @brief Get the minimum FFT size (power-of-2) for harmonic analysis. */
 int llsm_get_fftsize(FP_TYPE* f0, int nfrm, FP_TYPE fs, FP_TYPE rel_winsize);
 
@@ -80,16 +87,59 @@ int llsm_get_fftsize(FP_TYPE* f0, int nfrm, FP_TYPE fs, FP_TYPE rel_winsize);
 FP_TYPE* llsm_synthesize_harmonic_frame(FP_TYPE* ampl, FP_TYPE* phse, int nhar,
   FP_TYPE f0, int nx);
 
+/** @brief Generate a stationary harmonic signal, multiply it by the window w
+ *    (unless NULL) and add it onto y[offset ... offset + nx - 1]; samples
+ *    outside [0, ny) are skipped. */
+void llsm_synthesize_harmonic_frame_ola(FP_TYPE* ampl, FP_TYPE* phse,
+  int nhar, FP_TYPE f0, int nx, FP_TYPE* w, FP_TYPE* y, int offset, int ny);
+
 /** @brief Generate a stationary harmonic signal (ICZT algorithm). */
 FP_TYPE* llsm_synthesize_harmonic_frame_iczt(FP_TYPE* ampl, FP_TYPE* phse,
   int nhar, FP_TYPE f0, int nx);
 
+/** @brief Get the size (in number of FP_TYPE) of the buffer needed by
+ *    llsm_synthesize_harmonic_frame_iczt_buffered. */
+int llsm_synthesize_harmonic_frame_iczt_buffersize(int nhar, int nx);
+
+/** @brief Same as llsm_synthesize_harmonic_frame_iczt, except that the nx
+ *    samples are written into dst and no memory is allocated. */
+void llsm_synthesize_harmonic_frame_iczt_buffered(FP_TYPE* ampl,
+  FP_TYPE* phse, int nhar, FP_TYPE f0, int nx, FP_TYPE* dst,
+  FP_TYPE* buffer);
+
+/** @brief Fill x with Gaussian white noise (mu = 0, sigma = 1) from a
+ *    counter-based generator: x[i] only depends on seed and counter + i, so
+ *    a long sequence can be filled in any order and by any number of
+ *    threads. */
+void llsm_fill_white_noise(FP_TYPE* x, int nx, uint64_t seed,
+  uint64_t counter);
+
+/** @brief Generate a Gaussian white noise (mu = 0, sigma = 1) of length nx
+ *    from llsm_fill_white_noise, starting at counter 0. */
+FP_TYPE* llsm_generate_white_noise_seeded(int nx, uint64_t seed);
+
 /** @brief Generate a Gaussian white noise (mu = 0, sigma = 1) of length nx. */
 FP_TYPE* llsm_generate_white_noise(int nx);
 
 /** @brief Generate a bandlimited Gaussian noise of length nx. */
 FP_TYPE* llsm_generate_bandlimited_noise(int nx, FP_TYPE fmin, FP_TYPE fmax);
 
+/** @brief Get the size (in number of FP_TYPE) of the buffer needed by
+ *    llsm_filter_noise_frame. */
+int llsm_filter_noise_frame_buffersize(int nfft);
+
+/** @brief Filter a windowed and zero-padded noise frame x (nfft samples; the
+ *    window has a power of wsqr) in place, such that its PSD follows the
+ *    envelope psd (dB) given at freq. Both ends of the result are faded. */
+void llsm_filter_noise_frame(FP_TYPE* x, int nfft, FP_TYPE wsqr,
+  FP_TYPE* freq, FP_TYPE* psd, int npsd, FP_TYPE fs, FP_TYPE* buffer);
+
+/** @brief Get the band-limited Gaussian noise template for the normalized
+ *    band [fmin, fmax]. The template loops seamlessly every *dst_size
+ *    samples; it is generated on first use, cached for the lifetime of the
+ *    process and must not be freed or modified. */
+FP_TYPE* llsm_get_noise_template(FP_TYPE fmin, FP_TYPE fmax, int* dst_size);
+
 /** @brief Apply or remove lip radiation from a spectrum or harmonic model. */
 void llsm_lipfilter(FP_TYPE radius, FP_TYPE f0, int nhar,
   FP_TYPE* dst_ampl, FP_TYPE* dst_phse, int inverse);
@@ -109,6 +159,24 @@ FP_TYPE* llsm_harmonic_envelope(FP_TYPE* ampl, int nhar, FP_TYPE f0, int nfft);
  *    amplitude component. */
 FP_TYPE* llsm_harmonic_minphase(FP_TYPE* ampl, int nhar);
 
+/** @brief Get the size (in number of FP_TYPE) of the buffer needed by
+ *    llsm_harmonic_envelope_buffered. */
+int llsm_harmonic_envelope_buffersize(int nhar, int nfft);
+
+/** @brief Same as llsm_harmonic_envelope, except that the nfft / 2 + 1 bins
+ *    are written into dst and no memory is allocated. */
+void llsm_harmonic_envelope_buffered(FP_TYPE* ampl, int nhar, FP_TYPE f0,
+  int nfft, FP_TYPE* dst, FP_TYPE* buffer);
+
+/** @brief Get the size (in number of FP_TYPE) of the buffer needed by
+ *    llsm_harmonic_minphase_buffered. */
+int llsm_harmonic_minphase_buffersize(int nhar);
+
+/** @brief Same as llsm_harmonic_minphase, except that the nhar phases are
+ *    written into dst and no memory is allocated. */
+void llsm_harmonic_minphase_buffered(FP_TYPE* ampl, int nhar, FP_TYPE* dst,
+  FP_TYPE* buffer);
+
 /** @defgroup group_glottal_analysis Glottal Analysis Utilities
  *  @{ */
 typedef void llsm_cached_glottal_model;
@@ -122,9 +190,17 @@ llsm_cached_glottal_model* llsm_create_cached_glottal_model(FP_TYPE* param,
 void llsm_delete_cached_glottal_model(llsm_cached_glottal_model* dst);
 
 /** @brief Estimate the glottal model parameter by amplitude-only spectral
- *    fitting. */
+ *    fitting. The candidates are searched coarse-to-fine, so the model is
+ *    only read and can be shared across threads. */
 FP_TYPE llsm_spectral_glottal_fitting(FP_TYPE* ampl, int nhar,
   llsm_cached_glottal_model* model);
+
+/** @brief Compute the LF model (Ee = 1) response at the first nhar harmonics
+ *    of f0, as lfmodel_spectrum would. The response is looked up from a
+ *    table on a dense Rd grid when possible; either of dst_magn and dst_phse
+ *    can be NULL. */
+void llsm_lfmodel_harmonics(FP_TYPE rd, FP_TYPE f0, int nhar,
+  FP_TYPE* dst_magn, FP_TYPE* dst_phse);
 /** @} */
 
 /** @brief An improved moving average filter insensitive to impulse-like
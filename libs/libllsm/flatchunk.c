@@ -0,0 +1,285 @@
+/*
+  libllsm2 - Low Level Speech Model (version 2)
+  ===
+  Copyright (c) 2017-2020 Kanru Hua.
+
+  libllsm2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  libllsm2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libllsm. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ciglet/ciglet.h>
+
+#include "llsm.h"
+
+static llsm_flatchunk* llsm_create_flatchunk_(llsm_container* conf, int nfrm,
+  int nchannel, int maxnhar, int maxnhar_e, int npsd, int nspec) {
+  llsm_flatchunk* ret = malloc(sizeof(llsm_flatchunk));
+  ret -> conf = llsm_copy_container(conf);
+  llsm_container_attach(ret -> conf, LLSM_CONF_NFRM, llsm_create_int(nfrm),
+    llsm_delete_int, llsm_copy_int);
+  ret -> nfrm = nfrm;
+  ret -> nchannel = nchannel;
+  ret -> maxnhar = maxnhar;
+  ret -> maxnhar_e = maxnhar_e;
+  ret -> npsd = npsd;
+  ret -> nspec = nspec;
+
+  ret -> members = calloc(nfrm, sizeof(int));
+  ret -> f0 = calloc(nfrm, sizeof(FP_TYPE));
+  ret -> rd = calloc(nfrm, sizeof(FP_TYPE));
+  ret -> pbpsyn = calloc(nfrm, sizeof(int));
+  ret -> nhar = calloc(nfrm, sizeof(int));
+  ret -> ampl = calloc(nfrm * maxnhar, sizeof(FP_TYPE));
+  ret -> phse = calloc(nfrm * maxnhar, sizeof(FP_TYPE));
+  ret -> nhar_e = calloc(nfrm * nchannel, sizeof(int));
+  ret -> eenv_ampl = calloc(nfrm * nchannel * maxnhar_e, sizeof(FP_TYPE));
+  ret -> eenv_phse = calloc(nfrm * nchannel * maxnhar_e, sizeof(FP_TYPE));
+  ret -> edc = calloc(nfrm * nchannel, sizeof(FP_TYPE));
+  ret -> psd = calloc(nfrm * npsd, sizeof(FP_TYPE));
+  ret -> psdres = calloc(nfrm * npsd, sizeof(FP_TYPE));
+  ret -> vtmagn = calloc(nfrm * nspec, sizeof(FP_TYPE));
+  ret -> nvs = calloc(nfrm, sizeof(int));
+  ret -> vsphse = calloc(nfrm * maxnhar, sizeof(FP_TYPE));
+  return ret;
+}
+
+// The empty frames follow llsm_create_frame(0, nchannel, 0, npsd).
+llsm_flatchunk* llsm_create_flatchunk(llsm_container* conf, int nfrm) {
+  int* nchannel = llsm_container_peek(conf, LLSM_CONF_NCHANNEL);
+  int* npsd = llsm_container_peek(conf, LLSM_CONF_NPSD);
+  int* maxnhar = llsm_container_peek(conf, LLSM_CONF_MAXNHAR);
+  int* maxnhar_e = llsm_container_peek(conf, LLSM_CONF_MAXNHAR_E);
+  int* nspec = llsm_container_peek(conf, LLSM_CONF_NSPEC);
+  if(nchannel == NULL || npsd == NULL) return NULL;
+  llsm_flatchunk* ret = llsm_create_flatchunk_(conf, nfrm, *nchannel,
+    maxnhar == NULL ? 0 : *maxnhar, maxnhar_e == NULL ? 0 : *maxnhar_e,
+    *npsd, nspec == NULL ? 0 : *nspec);
+  for(int i = 0; i < nfrm; i ++)
+    ret -> members[i] = LLSM_FLAT_HM | LLSM_FLAT_NM;
+  for(int i = 0; i < nfrm * ret -> npsd; i ++)
+    ret -> psd[i] = -120.0;
+  for(int i = 0; i < nfrm * ret -> nchannel; i ++)
+    ret -> edc[i] = 1e-5;
+  return ret;
+}
+
+void llsm_delete_flatchunk(llsm_flatchunk* dst) {
+  if(dst == NULL) return;
+  llsm_delete_container(dst -> conf);
+  free(dst -> members);
+  free(dst -> f0);
+  free(dst -> rd);
+  free(dst -> pbpsyn);
+  free(dst -> nhar);
+  free(dst -> ampl);
+  free(dst -> phse);
+  free(dst -> nhar_e);
+  free(dst -> eenv_ampl);
+  free(dst -> eenv_phse);
+  free(dst -> edc);
+  free(dst -> psd);
+  free(dst -> psdres);
+  free(dst -> vtmagn);
+  free(dst -> nvs);
+  free(dst -> vsphse);
+  free(dst);
+}
+
+llsm_flatchunk* llsm_chunk_toflat(llsm_chunk* src) {
+  int* nfrm_ptr = llsm_container_peek(src -> conf, LLSM_CONF_NFRM);
+  int* nchannel_ptr = llsm_container_peek(src -> conf, LLSM_CONF_NCHANNEL);
+  int* npsd_ptr = llsm_container_peek(src -> conf, LLSM_CONF_NPSD);
+  if(nfrm_ptr == NULL || nchannel_ptr == NULL || npsd_ptr == NULL)
+    return NULL;
+  int nfrm = *nfrm_ptr;
+  int nchannel = *nchannel_ptr;
+  int npsd = *npsd_ptr;
+
+  // find the row sizes
+  int maxnhar = 0, maxnhar_e = 0, nspec = 0;
+  for(int i = 0; i < nfrm; i ++) {
+    llsm_container* frame = src -> frames[i];
+    llsm_hmframe* hm = llsm_container_peek(frame, LLSM_FRAME_HM);
+    llsm_nmframe* nm = llsm_container_peek(frame, LLSM_FRAME_NM);
+    FP_TYPE* vtmagn = llsm_container_peek(frame, LLSM_FRAME_VTMAGN);
+    FP_TYPE* vsphse = llsm_container_peek(frame, LLSM_FRAME_VSPHSE);
+    if(hm != NULL) maxnhar = max(maxnhar, hm -> nhar);
+    if(vsphse != NULL) maxnhar = max(maxnhar, llsm_fparray_length(vsphse));
+    if(vtmagn != NULL) nspec = max(nspec, llsm_fparray_length(vtmagn));
+    if(nm != NULL)
+      for(int c = 0; c < min(nchannel, nm -> nchannel); c ++)
+        maxnhar_e = max(maxnhar_e, nm -> eenv[c] -> nhar);
+  }
+
+  llsm_flatchunk* ret = llsm_create_flatchunk_(src -> conf, nfrm, nchannel,
+    maxnhar, maxnhar_e, npsd, nspec);
+  for(int i = 0; i < nfrm; i ++) {
+    llsm_container* frame = src -> frames[i];
+    FP_TYPE* f0 = llsm_container_peek(frame, LLSM_FRAME_F0);
+    llsm_hmframe* hm = llsm_container_peek(frame, LLSM_FRAME_HM);
+    llsm_nmframe* nm = llsm_container_peek(frame, LLSM_FRAME_NM);
+    FP_TYPE* psdres = llsm_container_peek(frame, LLSM_FRAME_PSDRES);
+    FP_TYPE* rd = llsm_container_peek(frame, LLSM_FRAME_RD);
+    FP_TYPE* vtmagn = llsm_container_peek(frame, LLSM_FRAME_VTMAGN);
+    FP_TYPE* vsphse = llsm_container_peek(frame, LLSM_FRAME_VSPHSE);
+    int* pbpsyn = llsm_container_peek(frame, LLSM_FRAME_PBPSYN);
+    int members = 0;
+    if(f0 != NULL) ret -> f0[i] = f0[0];
+    if(hm != NULL) {
+      members |= LLSM_FLAT_HM;
+      ret -> nhar[i] = hm -> nhar;
+      memcpy(ret -> ampl + i * maxnhar, hm -> ampl,
+        hm -> nhar * sizeof(FP_TYPE));
+      memcpy(ret -> phse + i * maxnhar, hm -> phse,
+        hm -> nhar * sizeof(FP_TYPE));
+    }
+    if(nm != NULL) {
+      members |= LLSM_FLAT_NM;
+      for(int c = 0; c < min(nchannel, nm -> nchannel); c ++) {
+        llsm_hmframe* eenv = nm -> eenv[c];
+        int offset = (i * nchannel + c) * maxnhar_e;
+        ret -> nhar_e[i * nchannel + c] = eenv -> nhar;
+        ret -> edc[i * nchannel + c] = nm -> edc[c];
+        memcpy(ret -> eenv_ampl + offset, eenv -> ampl,
+          eenv -> nhar * sizeof(FP_TYPE));
+        memcpy(ret -> eenv_phse + offset, eenv -> phse,
+          eenv -> nhar * sizeof(FP_TYPE));
+      }
+      memcpy(ret -> psd + i * npsd, nm -> psd,
+        min(npsd, nm -> npsd) * sizeof(FP_TYPE));
+    }
+    if(psdres != NULL) {
+      members |= LLSM_FLAT_PSDRES;
+      memcpy(ret -> psdres + i * npsd, psdres,
+        min(npsd, llsm_fparray_length(psdres)) * sizeof(FP_TYPE));
+    }
+    if(rd != NULL) {
+      members |= LLSM_FLAT_RD;
+      ret -> rd[i] = rd[0];
+    }
+    if(vtmagn != NULL && vsphse != NULL) {
+      members |= LLSM_FLAT_VT;
+      ret -> nvs[i] = llsm_fparray_length(vsphse);
+      memcpy(ret -> vtmagn + i * nspec, vtmagn,
+        llsm_fparray_length(vtmagn) * sizeof(FP_TYPE));
+      memcpy(ret -> vsphse + i * maxnhar, vsphse,
+        ret -> nvs[i] * sizeof(FP_TYPE));
+    } else if(vtmagn != NULL) {
+      members |= LLSM_FLAT_VTMAGN;
+      memcpy(ret -> vtmagn + i * nspec, vtmagn,
+        llsm_fparray_length(vtmagn) * sizeof(FP_TYPE));
+    }
+    if(pbpsyn != NULL) {
+      members |= LLSM_FLAT_PBPSYN;
+      ret -> pbpsyn[i] = pbpsyn[0];
+    }
+    ret -> members[i] = members;
+  }
+  return ret;
+}
+
+static FP_TYPE* llsm_copy_row(FP_TYPE* src, int n) {
+  FP_TYPE* ret = llsm_create_fparray(n);
+  memcpy(ret, src, n * sizeof(FP_TYPE));
+  return ret;
+}
+
+llsm_chunk* llsm_flatchunk_tochunk(llsm_flatchunk* src) {
+  llsm_chunk* ret = llsm_create_chunk(src -> conf, 0);
+  if(ret == NULL) return NULL;
+  int nchannel = src -> nchannel;
+  int npsd = src -> npsd;
+  for(int i = 0; i < src -> nfrm; i ++) {
+    llsm_container* frame = llsm_create_container(LLSM_FRAME_VSPHSE + 1);
+    int members = src -> members[i];
+    llsm_container_attach(frame, LLSM_FRAME_F0, llsm_create_fp(src -> f0[i]),
+      llsm_delete_fp, llsm_copy_fp);
+    if(members & LLSM_FLAT_HM) {
+      llsm_hmframe* hm = llsm_create_hmframe(src -> nhar[i]);
+      memcpy(hm -> ampl, src -> ampl + i * src -> maxnhar,
+        hm -> nhar * sizeof(FP_TYPE));
+      memcpy(hm -> phse, src -> phse + i * src -> maxnhar,
+        hm -> nhar * sizeof(FP_TYPE));
+      llsm_container_attach(frame, LLSM_FRAME_HM, hm,
+        llsm_delete_hmframe, llsm_copy_hmframe);
+    }
+    if(members & LLSM_FLAT_NM) {
+      llsm_nmframe* nm = llsm_create_nmframe(nchannel, 0, npsd);
+      for(int c = 0; c < nchannel; c ++) {
+        int nhar_e = src -> nhar_e[i * nchannel + c];
+        int offset = (i * nchannel + c) * src -> maxnhar_e;
+        llsm_delete_hmframe(nm -> eenv[c]);
+        nm -> eenv[c] = llsm_create_hmframe(nhar_e);
+        memcpy(nm -> eenv[c] -> ampl, src -> eenv_ampl + offset,
+          nhar_e * sizeof(FP_TYPE));
+        memcpy(nm -> eenv[c] -> phse, src -> eenv_phse + offset,
+          nhar_e * sizeof(FP_TYPE));
+        nm -> edc[c] = src -> edc[i * nchannel + c];
+      }
+      memcpy(nm -> psd, src -> psd + i * npsd, npsd * sizeof(FP_TYPE));
+      llsm_container_attach(frame, LLSM_FRAME_NM, nm,
+        llsm_delete_nmframe, llsm_copy_nmframe);
+    }
+    if(members & LLSM_FLAT_PSDRES)
+      llsm_container_attach(frame, LLSM_FRAME_PSDRES,
+        llsm_copy_row(src -> psdres + i * npsd, npsd),
+        llsm_delete_fparray, llsm_copy_fparray);
+    if(members & LLSM_FLAT_RD)
+      llsm_container_attach(frame, LLSM_FRAME_RD,
+        llsm_create_fp(src -> rd[i]), llsm_delete_fp, llsm_copy_fp);
+    if(members & LLSM_FLAT_VT) {
+      llsm_container_attach(frame, LLSM_FRAME_VTMAGN,
+        llsm_copy_row(src -> vtmagn + i * src -> nspec, src -> nspec),
+        llsm_delete_fparray, llsm_copy_fparray);
+      llsm_container_attach(frame, LLSM_FRAME_VSPHSE,
+        llsm_copy_row(src -> vsphse + i * src -> maxnhar, src -> nvs[i]),
+        llsm_delete_fparray, llsm_copy_fparray);
+    } else if(members & LLSM_FLAT_VTMAGN)
+      llsm_container_attach(frame, LLSM_FRAME_VTMAGN,
+        llsm_copy_row(src -> vtmagn + i * src -> nspec, src -> nspec),
+        llsm_delete_fparray, llsm_copy_fparray);
+    if(members & LLSM_FLAT_PBPSYN)
+      llsm_container_attach(frame, LLSM_FRAME_PBPSYN,
+        llsm_create_int(src -> pbpsyn[i]), llsm_delete_int, llsm_copy_int);
+    ret -> frames[i] = frame;
+  }
+  return ret;
+}
+
+void llsm_flatchunk_phasepropagate(llsm_flatchunk* dst, int sign) {
+  FP_TYPE* thop = llsm_container_peek(dst -> conf, LLSM_CONF_THOP);
+  if(thop == NULL) return;
+  FP_TYPE delta_phase = 0;
+  for(int i = 0; i < dst -> nfrm; i ++) {
+    delta_phase += dst -> f0[i];
+    FP_TYPE theta = delta_phase * (*thop * sign * 2.0 * M_PI);
+    int members = dst -> members[i];
+    if(members & LLSM_FLAT_HM) {
+      FP_TYPE* phse = dst -> phse + i * dst -> maxnhar;
+      for(int k = 0; k < dst -> nhar[i]; k ++)
+        phse[k] = wrap(phse[k] + theta * (k + 1.0));
+    }
+    if(members & LLSM_FLAT_NM)
+      for(int c = 0; c < dst -> nchannel; c ++) {
+        FP_TYPE* phse = dst -> eenv_phse +
+          (i * dst -> nchannel + c) * dst -> maxnhar_e;
+        for(int k = 0; k < dst -> nhar_e[i * dst -> nchannel + c]; k ++)
+          phse[k] = wrap(phse[k] + theta * (k + 1.0));
+      }
+    if(members & LLSM_FLAT_VT) {
+      FP_TYPE* phse = dst -> vsphse + i * dst -> maxnhar;
+      for(int k = 0; k < dst -> nvs[i]; k ++)
+        phse[k] = wrap(phse[k] + theta * (k + 1.0));
+    }
+  }
+}
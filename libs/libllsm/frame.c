@@ -128,20 +128,13 @@ void llsm_delete_nmframe(llsm_nmframe* dst) {
   free(dst);
 }
 
-static FP_TYPE* copy_fp(FP_TYPE* src) {
-  FP_TYPE* ret = malloc(sizeof(FP_TYPE));
-  ret[0] = src[0];
-  return ret;
-}
-
 llsm_container* llsm_create_frame(int nhar, int nchannel, int nhar_e,
   int npsd) {
   llsm_container* ret = llsm_create_container(3);
   llsm_hmframe* hm = llsm_create_hmframe(nhar);
   llsm_nmframe* nm = llsm_create_nmframe(nchannel, nhar_e, npsd);
-  FP_TYPE* f0 = malloc(sizeof(FP_TYPE));
-  f0[0] = 0;
-  llsm_container_attach(ret, LLSM_FRAME_F0, f0, free, copy_fp);
+  llsm_container_attach(ret, LLSM_FRAME_F0, llsm_create_fp(0),
+    llsm_delete_fp, llsm_copy_fp);
   llsm_container_attach(ret, LLSM_FRAME_HM, hm, llsm_delete_hmframe,
     llsm_copy_hmframe);
   llsm_container_attach(ret, LLSM_FRAME_NM, nm, llsm_delete_nmframe,
@@ -166,8 +159,8 @@ void llsm_frame_phaseshift(llsm_container* dst, FP_TYPE theta) {
 }
 
 void llsm_frame_phasesync_rps(llsm_container* dst, int layer1_based) {
-  llsm_hmframe* hm = llsm_container_get(dst, LLSM_FRAME_HM);
-  FP_TYPE* vs_phse = llsm_container_get(dst, LLSM_FRAME_VSPHSE);
+  llsm_hmframe* hm = llsm_container_peek(dst, LLSM_FRAME_HM);
+  FP_TYPE* vs_phse = llsm_container_peek(dst, LLSM_FRAME_VSPHSE);
   FP_TYPE phase_ref = 0;
   if(layer1_based && vs_phse != NULL && llsm_fparray_length(vs_phse) > 0) {
     phase_ref = vs_phse[0];
@@ -177,13 +170,227 @@ void llsm_frame_phasesync_rps(llsm_container* dst, int layer1_based) {
   llsm_frame_phaseshift(dst, -phase_ref);
 }
 
+// Note: dst may alias a or b in all of the interpolation routines below;
+//   each element is read from both sources before it is written.
+static void interp_linear(FP_TYPE* dst, FP_TYPE* a, FP_TYPE* b, int n,
+  FP_TYPE ratio) {
+  for(int i = 0; i < n; i ++)
+    dst[i] = linterp(a[i], b[i], ratio);
+}
+
+// Circular interpolation of phases through their unit vectors. The unit
+//   vectors are blended a block at a time, so that the trigonometric loop and
+//   the atan2 loop do not depend on each other.
+#define INTERP_BLOCKSIZE 64
+static void interp_phase(FP_TYPE* dst, FP_TYPE* a, FP_TYPE* b, int n,
+  FP_TYPE ratio) {
+  FP_TYPE x[INTERP_BLOCKSIZE];
+  FP_TYPE y[INTERP_BLOCKSIZE];
+  for(int i = 0; i < n; i += INTERP_BLOCKSIZE) {
+    int m = min(INTERP_BLOCKSIZE, n - i);
+    for(int j = 0; j < m; j ++) {
+      x[j] = linterp(cos_2(a[i + j]), cos_2(b[i + j]), ratio);
+      y[j] = linterp(sin_2(a[i + j]), sin_2(b[i + j]), ratio);
+    }
+    for(int j = 0; j < m; j ++)
+      dst[i + j] = atan2(y[j], x[j]);
+  }
+}
+
+static void interp_nmframe(llsm_nmframe* dst, llsm_nmframe* a,
+  llsm_nmframe* b, FP_TYPE ratio) {
+  int npsd = a -> npsd;
+  int nchannel = a -> nchannel;
+  if(dst -> npsd < npsd)
+    dst -> psd = realloc(dst -> psd, sizeof(FP_TYPE) * npsd);
+  interp_linear(dst -> psd, a -> psd, b -> psd, npsd, ratio);
+  dst -> npsd = npsd;
+
+  if(dst -> nchannel < nchannel) {
+    dst -> edc = realloc(dst -> edc, sizeof(FP_TYPE) * nchannel);
+    dst -> eenv = realloc(dst -> eenv, sizeof(llsm_hmframe*) * nchannel);
+    for(int i = dst -> nchannel; i < nchannel; i ++)
+      dst -> eenv[i] = llsm_create_hmframe(0);
+  } else if(dst -> nchannel > nchannel) {
+    for(int i = nchannel; i < dst -> nchannel; i ++)
+      llsm_delete_hmframe(dst -> eenv[i]);
+  }
+  dst -> nchannel = nchannel;
+
+  for(int i = 0; i < nchannel; i ++) {
+    llsm_hmframe* a_eenv = a -> eenv[i];
+    llsm_hmframe* b_eenv = b -> eenv[i];
+    llsm_hmframe* dst_eenv = dst -> eenv[i];
+    int minnhar = min(a_eenv -> nhar, b_eenv -> nhar);
+    int maxnhar = max(a_eenv -> nhar, b_eenv -> nhar);
+    // the longer envelope fills in the upper harmonics
+    llsm_hmframe* tail = b_eenv -> nhar > a_eenv -> nhar ? b_eenv : a_eenv;
+    if(dst_eenv -> nhar < maxnhar) {
+      dst_eenv -> ampl = realloc(dst_eenv -> ampl,
+        sizeof(FP_TYPE) * maxnhar);
+      dst_eenv -> phse = realloc(dst_eenv -> phse,
+        sizeof(FP_TYPE) * maxnhar);
+    }
+    dst -> edc[i] = linterp(a -> edc[i], b -> edc[i], ratio);
+    interp_linear(dst_eenv -> ampl, a_eenv -> ampl, b_eenv -> ampl, minnhar,
+      ratio);
+    interp_phase(dst_eenv -> phse, a_eenv -> phse, b_eenv -> phse, minnhar,
+      ratio);
+    if(tail != dst_eenv)
+      for(int j = minnhar; j < maxnhar; j ++) {
+        dst_eenv -> ampl[j] = tail -> ampl[j];
+        dst_eenv -> phse[j] = tail -> phse[j];
+      }
+    dst_eenv -> nhar = maxnhar;
+  }
+}
+
+static void frame_set_fp(llsm_container* dst, int index, FP_TYPE x) {
+  FP_TYPE* ptr = llsm_container_get(dst, index);
+  if(ptr != NULL)
+    ptr[0] = x;
+  else
+    llsm_container_attach(dst, index, llsm_create_fp(x), llsm_delete_fp,
+      llsm_copy_fp);
+}
+
+// Get the fparray member of dst for writing n elements in place; if its size
+//   does not match, a new array is returned and the old member stays readable
+//   until frame_commit_fparray is called.
+static FP_TYPE* frame_fparray_into(llsm_container* dst, int index, int n) {
+  FP_TYPE* ret = llsm_container_peek(dst, index);
+  if(ret != NULL && llsm_fparray_length(ret) == n)
+    return llsm_container_get(dst, index);
+  return llsm_create_fparray(n);
+}
+
+static void frame_commit_fparray(llsm_container* dst, int index,
+  FP_TYPE* src) {
+  if(llsm_container_peek(dst, index) != src)
+    llsm_container_attach(dst, index, src, llsm_delete_fparray,
+      llsm_copy_fparray);
+}
+
+// Write src + offset into the fparray member of dst; remove the member if
+//   src is NULL.
+static FP_TYPE* frame_offset_fparray(llsm_container* dst, int index,
+  FP_TYPE* src, FP_TYPE offset) {
+  if(src == NULL) {
+    llsm_container_remove(dst, index);
+    return NULL;
+  }
+  int n = llsm_fparray_length(src);
+  FP_TYPE* ret = frame_fparray_into(dst, index, n);
+  if(offset != 0)
+    for(int i = 0; i < n; i ++)
+      ret[i] = src[i] + offset;
+  else if(ret != src)
+    memcpy(ret, src, sizeof(FP_TYPE) * n);
+  frame_commit_fparray(dst, index, ret);
+  return ret;
+}
+
+// The vocal tract response of a layer 1 frame is stored either as VTMAGN or
+//   as its compact form VTCEP.
+static FP_TYPE* frame_peek_vt(llsm_container* src, int* index) {
+  *index = LLSM_FRAME_VTCEP;
+  FP_TYPE* ret = llsm_container_peek(src, LLSM_FRAME_VTCEP);
+  if(ret != NULL) return ret;
+  *index = LLSM_FRAME_VTMAGN;
+  return llsm_container_peek(src, LLSM_FRAME_VTMAGN);
+}
+
+// Offset a vocal tract response by gain (in dB) and apply the -80 dB floor.
+static void frame_fade_vt(llsm_container* dst, int index, FP_TYPE* src,
+  FP_TYPE gain) {
+  if(index == LLSM_FRAME_VTCEP) {
+    // a constant offset only goes into cep[0], which counts half
+    FP_TYPE* vtcep = frame_offset_fparray(dst, index, src, 0);
+    if(vtcep != NULL)
+      vtcep[0] = max(-160, vtcep[0] + gain * 2.0);
+    return;
+  }
+  FP_TYPE* vtmagn = frame_offset_fparray(dst, index, src, gain);
+  if(vtmagn != NULL) {
+    int nspec = llsm_fparray_length(vtmagn);
+    for(int i = 0; i < nspec; i ++)
+      vtmagn[i] = max(-80, vtmagn[i]);
+  }
+}
+
+void llsm_frame_interp_into(llsm_container* dst, llsm_container* a,
+  llsm_container* b, FP_TYPE ratio) {
+  if(! llsm_frame_checklayer1(a) || ! llsm_frame_checklayer1(b)) return;
+  FP_TYPE a_f0 = *((FP_TYPE*)llsm_container_peek(a, LLSM_FRAME_F0));
+  FP_TYPE b_f0 = *((FP_TYPE*)llsm_container_peek(b, LLSM_FRAME_F0));
+  FP_TYPE a_rd = *((FP_TYPE*)llsm_container_peek(a, LLSM_FRAME_RD));
+  FP_TYPE b_rd = *((FP_TYPE*)llsm_container_peek(b, LLSM_FRAME_RD));
+  FP_TYPE* a_vsphse = llsm_container_peek(a, LLSM_FRAME_VSPHSE);
+  FP_TYPE* b_vsphse = llsm_container_peek(b, LLSM_FRAME_VSPHSE);
+  int a_vtindex, b_vtindex;
+  FP_TYPE* a_vt = frame_peek_vt(a, & a_vtindex);
+  FP_TYPE* b_vt = frame_peek_vt(b, & b_vtindex);
+  // voiced frames can only be mixed if they share the same representation
+  if(a_f0 > 0 && b_f0 > 0 && (a_vtindex != b_vtindex ||
+     llsm_fparray_length(a_vt) != llsm_fparray_length(b_vt))) return;
+
+  // the noise model is interpolated regardless of voicing
+  llsm_nmframe* a_nm = llsm_container_peek(a, LLSM_FRAME_NM);
+  llsm_nmframe* b_nm = llsm_container_peek(b, LLSM_FRAME_NM);
+  llsm_nmframe* dst_nm = llsm_container_get(dst, LLSM_FRAME_NM);
+  if(dst_nm == NULL) {
+    dst_nm = llsm_create_nmframe(a_nm -> nchannel, 0, a_nm -> npsd);
+    llsm_container_attach(dst, LLSM_FRAME_NM, dst_nm, llsm_delete_nmframe,
+      llsm_copy_nmframe);
+  }
+  interp_nmframe(dst_nm, a_nm, b_nm, ratio);
+
+  int vtindex = b_f0 > 0 ? b_vtindex : a_vtindex;
+  if(a_f0 > 0 && b_f0 > 0) {
+    frame_set_fp(dst, LLSM_FRAME_F0, linterp(a_f0, b_f0, ratio));
+    frame_set_fp(dst, LLSM_FRAME_RD, linterp(a_rd, b_rd, ratio));
+    int a_nhar = llsm_fparray_length(a_vsphse);
+    int b_nhar = llsm_fparray_length(b_vsphse);
+    int minnhar = min(a_nhar, b_nhar);
+    int maxnhar = max(a_nhar, b_nhar);
+    FP_TYPE* vsphse = frame_fparray_into(dst, LLSM_FRAME_VSPHSE, maxnhar);
+    interp_phase(vsphse, a_vsphse, b_vsphse, minnhar, ratio);
+    for(int i = minnhar; i < maxnhar; i ++)
+      vsphse[i] = a_nhar < b_nhar ? b_vsphse[i] : 0;
+    frame_commit_fparray(dst, LLSM_FRAME_VSPHSE, vsphse);
+
+    int nvt = llsm_fparray_length(a_vt);
+    FP_TYPE* vt = frame_fparray_into(dst, vtindex, nvt);
+    interp_linear(vt, a_vt, b_vt, nvt, ratio);
+    frame_commit_fparray(dst, vtindex, vt);
+    frame_fade_vt(dst, vtindex, vt, 0);
+  } else if(b_f0 > 0) {
+    // fade in the voiced frame
+    frame_set_fp(dst, LLSM_FRAME_F0, b_f0);
+    frame_set_fp(dst, LLSM_FRAME_RD, b_rd);
+    frame_offset_fparray(dst, LLSM_FRAME_VSPHSE, b_vsphse, 0);
+    frame_fade_vt(dst, vtindex, b_vt,
+      log_2(max(1e-8, ratio)) * (20.0 / 2.3025851));
+  } else {
+    // fade out the voiced frame, if any
+    frame_set_fp(dst, LLSM_FRAME_F0, a_f0 > 0 ? a_f0 : 0);
+    frame_set_fp(dst, LLSM_FRAME_RD, a_f0 > 0 ? a_rd : 1.0);
+    frame_offset_fparray(dst, LLSM_FRAME_VSPHSE, a_vsphse, 0);
+    frame_fade_vt(dst, vtindex, a_vt,
+      log_2(max(1e-8, 1.0 - ratio)) * (20.0 / 2.3025851));
+  }
+  // drop the other representation so that the two never disagree
+  llsm_container_remove(dst, vtindex == LLSM_FRAME_VTCEP ?
+    LLSM_FRAME_VTMAGN : LLSM_FRAME_VTCEP);
+}
+
 FP_TYPE* llsm_frame_compute_snr(llsm_container* src, llsm_container* conf,
   int as_aperiodicity) {
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
-  llsm_hmframe* hm = llsm_container_get(src, LLSM_FRAME_HM);
-  llsm_nmframe* nm = llsm_container_get(src, LLSM_FRAME_NM);
-  FP_TYPE* fnyq = llsm_container_get(conf, LLSM_CONF_FNYQ);
-  FP_TYPE* noswarp = llsm_container_get(conf, LLSM_CONF_NOSWARP);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  llsm_hmframe* hm = llsm_container_peek(src, LLSM_FRAME_HM);
+  llsm_nmframe* nm = llsm_container_peek(src, LLSM_FRAME_NM);
+  FP_TYPE* fnyq = llsm_container_peek(conf, LLSM_CONF_FNYQ);
+  FP_TYPE* noswarp = llsm_container_peek(conf, LLSM_CONF_NOSWARP);
   if(f0 == NULL || hm == NULL || nm == NULL) return NULL;
   if(fnyq == NULL || noswarp == NULL) return NULL;
   int nfft = max(64, pow(2, ceil(log2(hm -> nhar) + 2)));
@@ -209,29 +416,30 @@ FP_TYPE* llsm_frame_compute_snr(llsm_container* src, llsm_container* conf,
 }
 
 int llsm_frame_checklayer0(llsm_container* src) {
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
-  llsm_hmframe* hm = llsm_container_get(src, LLSM_FRAME_HM);
-  llsm_nmframe* nm = llsm_container_get(src, LLSM_FRAME_NM);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  llsm_hmframe* hm = llsm_container_peek(src, LLSM_FRAME_HM);
+  llsm_nmframe* nm = llsm_container_peek(src, LLSM_FRAME_NM);
   if(f0 == NULL || nm == NULL) return 0;
   if(*f0 != 0 && hm == NULL) return 0;
   return 1;
 }
 
 int llsm_frame_checklayer1(llsm_container* src) {
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
-  FP_TYPE* rd = llsm_container_get(src, LLSM_FRAME_RD);
-  llsm_nmframe* nm = llsm_container_get(src, LLSM_FRAME_NM);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  FP_TYPE* rd = llsm_container_peek(src, LLSM_FRAME_RD);
+  llsm_nmframe* nm = llsm_container_peek(src, LLSM_FRAME_NM);
   if(f0 == NULL || rd == NULL || nm == NULL) return 0;
-  FP_TYPE* spec_env = llsm_container_get(src, LLSM_FRAME_VTMAGN);
-  FP_TYPE* vs_phse = llsm_container_get(src, LLSM_FRAME_VSPHSE);
+  FP_TYPE* spec_env = llsm_container_peek(src, LLSM_FRAME_VTMAGN);
+  if(spec_env == NULL) spec_env = llsm_container_peek(src, LLSM_FRAME_VTCEP);
+  FP_TYPE* vs_phse = llsm_container_peek(src, LLSM_FRAME_VSPHSE);
   if(f0[0] > 0 && (spec_env == NULL || vs_phse == NULL)) return 0;
   return 1;
 }
 
 int llsm_frame_checklayer_astel0(llsm_container* src) {
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
-  llsm_hmframe* hm = llsm_container_get(src, LLSM_FRAME_HM);
-  llsm_nmframe* nm = llsm_container_get(src, LLSM_FRAME_NM);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  llsm_hmframe* hm = llsm_container_peek(src, LLSM_FRAME_HM);
+  llsm_nmframe* nm = llsm_container_peek(src, LLSM_FRAME_NM);
   if (f0 == NULL) return 1;
   if (hm == NULL) return 2;
   if (nm == NULL) return 3;
@@ -239,14 +447,15 @@ int llsm_frame_checklayer_astel0(llsm_container* src) {
 }
 
 int llsm_frame_checklayer_astel1(llsm_container* src) {
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
   if (f0 == NULL) return 1;
-  FP_TYPE* rd = llsm_container_get(src, LLSM_FRAME_RD);
+  FP_TYPE* rd = llsm_container_peek(src, LLSM_FRAME_RD);
   if (rd == NULL) return 2;
-  llsm_nmframe* nm = llsm_container_get(src, LLSM_FRAME_NM);
+  llsm_nmframe* nm = llsm_container_peek(src, LLSM_FRAME_NM);
   if (nm == NULL) return 3;
-  FP_TYPE* spec_env = llsm_container_get(src, LLSM_FRAME_VTMAGN);
-  FP_TYPE* vs_phse = llsm_container_get(src, LLSM_FRAME_VSPHSE);
+  FP_TYPE* spec_env = llsm_container_peek(src, LLSM_FRAME_VTMAGN);
+  if(spec_env == NULL) spec_env = llsm_container_peek(src, LLSM_FRAME_VTCEP);
+  FP_TYPE* vs_phse = llsm_container_peek(src, LLSM_FRAME_VSPHSE);
   if (f0[0] > 0 && spec_env == NULL) return 4;
   if (f0[0] > 0 && vs_phse == NULL) return 5;
   return 0;
@@ -256,11 +465,21 @@ llsm_pbpeffect* llsm_create_pbpeffect(llsm_fgfm modifier, void* info) {
   llsm_pbpeffect* ret = malloc(sizeof(llsm_pbpeffect));
   ret -> modifier = modifier;
   ret -> info = info;
+  ret -> modifier_propagated = NULL;
+  return ret;
+}
+
+llsm_pbpeffect* llsm_create_pbpeffect_propagated(
+  llsm_fgfm_propagated modifier, void* info) {
+  llsm_pbpeffect* ret = llsm_create_pbpeffect(NULL, info);
+  ret -> modifier_propagated = modifier;
   return ret;
 }
 
 llsm_pbpeffect* llsm_copy_pbpeffect(llsm_pbpeffect* src) {
-  return llsm_create_pbpeffect(src -> modifier, src -> info);
+  llsm_pbpeffect* ret = llsm_create_pbpeffect(src -> modifier, src -> info);
+  ret -> modifier_propagated = src -> modifier_propagated;
+  return ret;
 }
 
 void llsm_delete_pbpeffect(llsm_pbpeffect* dst) {
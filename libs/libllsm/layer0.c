@@ -81,13 +81,16 @@ llsm_soptions* llsm_create_soptions(FP_TYPE fs) {
   // See test/test-harmonic.c for more information.
   ret -> use_iczt = 1;
   ret -> use_l1 = 0;
+  ret -> propagate = 0;
   ret -> iczt_param_a = 0.275;
   ret -> iczt_param_b = 2.26;
+  ret -> iczt_table = NULL;
   return ret;
 }
 
 void llsm_delete_soptions(llsm_soptions* dst) {
   if(dst == NULL) return;
+  llsm_delete_iczt_table(dst -> iczt_table);
   free(dst);
 }
 
@@ -114,8 +117,20 @@ static void llsm_analyze_harmonics(llsm_aoptions* options, FP_TYPE* x, int nx,
   free2d(tmp_ampl, nfrm); free2d(tmp_phse, nfrm); free(tmp_nhar);
 }
 
+// The phase llsm_chunk_phasepropagate adds to the first harmonic of each
+//   frame.
+static FP_TYPE* llsm_propagation_phase(FP_TYPE* f0, int nfrm, FP_TYPE thop,
+  int sign) {
+  FP_TYPE* ret = cumsum(f0, nfrm);
+  for(int i = 0; i < nfrm; i ++)
+    ret[i] *= thop * sign * 2.0 * M_PI;
+  return ret;
+}
+
+// theta (if not NULL) is the propagation phase of each frame.
 static FP_TYPE* llsm_synthesize_harmonics_l0(llsm_soptions* options,
-  llsm_chunk* chunk, FP_TYPE* f0, int nfrm, FP_TYPE thop, FP_TYPE fs, int ny) {
+  llsm_flatchunk* src, FP_TYPE* f0, FP_TYPE* theta, int nfrm, FP_TYPE thop,
+  FP_TYPE fs, int ny) {
   const int maxnhar = 2048;
   FP_TYPE* y = calloc(ny, sizeof(FP_TYPE));
   int nwin = round(thop * fs) * 2;
@@ -123,34 +138,30 @@ static FP_TYPE* llsm_synthesize_harmonics_l0(llsm_soptions* options,
   FP_TYPE* phase = calloc(maxnhar, sizeof(FP_TYPE));
   for(int i = 0; i < nfrm; i ++) {
     if(f0[i] == 0) continue; // skip unvoiced frames
-    llsm_hmframe* hm = llsm_container_get(chunk -> frames[i], LLSM_FRAME_HM);
+    FP_TYPE* ampl = src -> ampl + i * src -> maxnhar;
+    FP_TYPE* phse = src -> phse + i * src -> maxnhar;
     FP_TYPE rawidx = i * thop * fs;
     int baseidx = round(rawidx);
     FP_TYPE phase_correction = (rawidx - baseidx) * 2 * M_PI / fs * f0[i];
-    int nhar = min(maxnhar, hm -> nhar);
+    int nhar = min(maxnhar, src -> nhar[i]);
     for(int k = 0; k < nhar; k ++)
-      phase[k] = hm -> phse[k] - phase_correction * (k + 1.0);
-    FP_TYPE* yi = llsm_synthesize_harmonic_frame_auto(options,
-      hm -> ampl, phase, nhar, f0[i] / fs, nwin);
-    for(int j = 0; j < nwin; j ++) {
-      yi[j] *= w[j];
-      int idx = baseidx + j - nwin / 2;
-      if(idx >= 0 && idx < ny)
-        y[idx] += yi[j];
-    }
-    free(yi);
+      phase[k] = theta == NULL ? phse[k] : wrap(phse[k] + theta[i] * (k + 1.0));
+    for(int k = 0; k < nhar; k ++)
+      phase[k] -= phase_correction * (k + 1.0);
+    llsm_synthesize_harmonic_frame_auto_ola(options, ampl, phase,
+      nhar, f0[i] / fs, nwin, w, y, baseidx - nwin / 2, ny);
   }
   free(phase);
   free(w);
   return y;
 }
 
-static FP_TYPE* llsm_synthesize_harmonics(llsm_soptions* options,
-  llsm_chunk* chunk, FP_TYPE* f0, int nfrm, FP_TYPE thop, FP_TYPE fs, int ny) {
-  if(! options -> use_l1) {
-    return llsm_synthesize_harmonics_l0(
-      options, chunk, f0, nfrm, thop, fs, ny);
-  }
+// Layer 1 synthesis; Pulse-by-Pulse synthesis and its effects operate on
+//   LLSM frames, so this part keeps reading from the chunk. theta (if not
+//   NULL) is the propagation phase of each frame.
+static FP_TYPE* llsm_synthesize_harmonics_l1(llsm_soptions* options,
+  llsm_chunk* chunk, FP_TYPE* f0, FP_TYPE* theta, int nfrm, FP_TYPE thop,
+  FP_TYPE fs, int ny) {
 
   const int maxnhar = 2048;
   FP_TYPE* y_hm  = calloc(ny, sizeof(FP_TYPE)); // harmonic model
@@ -158,8 +169,10 @@ static FP_TYPE* llsm_synthesize_harmonics(llsm_soptions* options,
   FP_TYPE* y_mix = calloc(ny, sizeof(FP_TYPE));
   int nwin = round(thop * fs) * 2;
   FP_TYPE* w = hanning(nwin);
-  FP_TYPE* fnyq = llsm_container_get(chunk -> conf, LLSM_CONF_FNYQ);
-  FP_TYPE* liprad = llsm_container_get(chunk -> conf, LLSM_CONF_LIPRADIUS);
+  FP_TYPE* fnyq = llsm_container_peek(chunk -> conf, LLSM_CONF_FNYQ);
+  FP_TYPE* liprad = llsm_container_peek(chunk -> conf, LLSM_CONF_LIPRADIUS);
+  int* nspec_ = llsm_container_peek(chunk -> conf, LLSM_CONF_NSPEC);
+  int nspec_conf = nspec_ == NULL ? 0 : *nspec_;
 
   FP_TYPE pulse_previous = 0; // aligned to zero-time phase of glottal flow
   int pbp_periods = 0;
@@ -167,27 +180,34 @@ static FP_TYPE* llsm_synthesize_harmonics(llsm_soptions* options,
   FP_TYPE pbp_switch_rate = 0;
   FP_TYPE pbp_switch_state = 0;
   int baseidx_prev = 0;
+  llsm_pbp_engine* pbp = llsm_create_pbp_engine();
+  llsm_layerconv* conv = llsm_create_layerconv();
+  FP_TYPE* phase = theta == NULL ? NULL : calloc(maxnhar, sizeof(FP_TYPE));
 
   for(int i = 0; i < nfrm; i ++) {
     if(f0[i] == 0) continue; // skip unvoiced frames
     int baseidx = i * thop * fs;
     llsm_container* src_frame = chunk -> frames[i];
-    FP_TYPE* vsphse = llsm_container_get(src_frame, LLSM_FRAME_VSPHSE);
-    FP_TYPE* vtmagn = llsm_container_get(src_frame, LLSM_FRAME_VTMAGN);
-    FP_TYPE* rd = llsm_container_get(src_frame, LLSM_FRAME_RD);
-    int* pbpsyn = llsm_container_get(src_frame, LLSM_FRAME_PBPSYN);
-    llsm_pbpeffect* pbpeff = llsm_container_get(src_frame, LLSM_FRAME_PBPEFF);
-    if(vsphse == NULL || vtmagn == NULL || rd == NULL) continue;
+    FP_TYPE* vsphse = llsm_container_peek(src_frame, LLSM_FRAME_VSPHSE);
+    FP_TYPE* vtmagn = llsm_container_peek(src_frame, LLSM_FRAME_VTMAGN);
+    FP_TYPE* vtcep = llsm_container_peek(src_frame, LLSM_FRAME_VTCEP);
+    FP_TYPE* rd = llsm_container_peek(src_frame, LLSM_FRAME_RD);
+    int* pbpsyn = llsm_container_peek(src_frame, LLSM_FRAME_PBPSYN);
+    llsm_pbpeffect* pbpeff = llsm_container_peek(src_frame, LLSM_FRAME_PBPEFF);
+    if(vsphse == NULL || (vtmagn == NULL && vtcep == NULL) || rd == NULL)
+      continue;
     int pbp_on = pbpsyn != NULL && pbpsyn[0] == 1;
-    int nspec = llsm_fparray_length(vtmagn);
+    // a compact envelope is sized as its expansion would be
+    int nspec = vtmagn != NULL ? llsm_fparray_length(vtmagn) : nspec_conf;
     // update locations of pulses locked onto the first source harmonic
     FP_TYPE len_period = fs / f0[i];
     FP_TYPE t_period = 1.0 / f0[i];
     lfmodel source_model = lfmodel_from_rd(*rd, t_period, 1.0);
     FP_TYPE source_p0 = 0;
-    free(lfmodel_spectrum(source_model, & f0[i], 1, & source_p0));
+    llsm_lfmodel_harmonics(*rd, f0[i], 1, NULL, & source_p0);
     source_p0 -= 0.5 * M_PI; // integrate (flow derivative to flow velocity)
-    FP_TYPE p0 = wrap(vsphse[0]);
+    FP_TYPE p0 = theta == NULL ? vsphse[0] : wrap(vsphse[0] + theta[i]);
+    p0 = wrap(p0);
     FP_TYPE p0_dist = phase_diff(source_p0, p0);
     if(p0_dist < 0) p0_dist += 2.0 * M_PI;
     // the next position where a glottal flow cycle begins
@@ -203,13 +223,16 @@ static FP_TYPE* llsm_synthesize_harmonics(llsm_soptions* options,
     // pulse-by-pulse synthesis
     if(pbp_on || pbp_periods > 0) {
       if(num_periods > 0) {
-        FP_TYPE* offsets = calloc(num_periods, sizeof(FP_TYPE));
-        lfmodel* sources = calloc(num_periods, sizeof(lfmodel));
+        // the pulses (and the effects) are given the propagation phase
+        FP_TYPE theta_i = theta == NULL ? 0 : theta[i];
+        FP_TYPE* offsets = NULL;
+        lfmodel* sources = NULL;
+        llsm_pbp_engine_reserve_pulses(pbp, num_periods, & offsets, & sources);
         for(int j = 0; j < num_periods; j ++) {
           FP_TYPE delta_t = 0;
           if(pbpeff != NULL) {
             llsm_gfm g = llsm_lfmodel_to_gfm(source_model);
-            pbpeff -> modifier(& g, & delta_t, pbpeff -> info, src_frame);
+            llsm_pbpeffect_apply(pbpeff, & g, & delta_t, src_frame, theta_i);
             sources[j] = llsm_gfm_to_lfmodel(g);
           } else
             sources[j] = source_model;
@@ -217,15 +240,13 @@ static FP_TYPE* llsm_synthesize_harmonics(llsm_soptions* options,
         }
         int pulse_base = offsets[0];
         for(int j = 0; j < num_periods; j ++) offsets[j] -= pulse_base;
-        FP_TYPE* y = llsm_make_filtered_pulse(src_frame, sources, offsets,
-          num_periods, len_period, pulse_size, *fnyq, *liprad, fs);
+        FP_TYPE* y = llsm_pbp_engine_make_pulse(pbp, src_frame, theta_i,
+          sources, offsets, num_periods, len_period, pulse_size, *fnyq,
+          *liprad, fs);
         for(int k = 0; k < pulse_size; k ++) {
           int idx = pulse_base + k - len_period;
           if(idx >= 0 && idx < ny) y_pbp[idx] += y[k];
         }
-        free(y);
-        free(offsets);
-        free(sources);
         pbp_periods += pbp_on ? num_periods : -num_periods;
         pbp_periods = min(pbp_periods, pbp_periods_thrd);
         pbp_periods = max(pbp_periods, 0);
@@ -260,23 +281,31 @@ static FP_TYPE* llsm_synthesize_harmonics(llsm_soptions* options,
 
     if(pbp_on && pbp_periods == pbp_periods_thrd && (! require_hm)) continue;
 
-    // harmonic model synthesis
-    if(llsm_container_get(src_frame, LLSM_FRAME_HM) == NULL)
-      llsm_frame_tolayer0(src_frame, chunk -> conf);
-    llsm_hmframe* hm = llsm_container_get(src_frame, LLSM_FRAME_HM);
-    if(hm == NULL) continue;
-    int nhar = min(maxnhar, hm -> nhar);
-    FP_TYPE* yi = llsm_synthesize_harmonic_frame_auto(options,
-      hm -> ampl, hm -> phse, nhar, f0[i] / fs, nwin);
-    for(int j = 0; j < nwin; j ++) {
-      yi[j] *= w[j];
-      int idx = baseidx + j - nwin / 2;
-      if(idx >= 0 && idx < ny)
-        y_hm[idx] += yi[j];
+    // harmonic model synthesis; frames without one are evaluated on the fly
+    llsm_hmframe* hm = llsm_container_peek(src_frame, LLSM_FRAME_HM);
+    FP_TYPE* ampl = NULL;
+    FP_TYPE* phse = NULL;
+    int nhar = hm != NULL ? hm -> nhar :
+      llsm_layerconv_harmonics(conv, src_frame, chunk -> conf,
+        theta == NULL ? 0 : theta[i], & ampl, & phse);
+    if(nhar < 0) continue;
+    if(hm != NULL) {
+      ampl = hm -> ampl;
+      phse = hm -> phse;
     }
-    free(yi);
+    nhar = min(maxnhar, nhar);
+    if(hm != NULL && theta != NULL) {
+      for(int k = 0; k < nhar; k ++)
+        phase[k] = wrap(phse[k] + theta[i] * (k + 1.0));
+      phse = phase;
+    }
+    llsm_synthesize_harmonic_frame_auto_ola(options, ampl, phse,
+      nhar, f0[i] / fs, nwin, w, y_hm, baseidx - nwin / 2, ny);
   }
   free(w);
+  llsm_delete_pbp_engine(pbp);
+  llsm_delete_layerconv(conv);
+  free(phase);
 
   for(int i = 0; i < ny; i ++)
     y_mix[i] = y_hm[i] * (1.0 - y_mix[i]) + y_pbp[i] * y_mix[i];
@@ -286,33 +315,123 @@ static FP_TYPE* llsm_synthesize_harmonics(llsm_soptions* options,
   return y_mix;
 }
 
-static FP_TYPE* llsm_synthesize_noise_envelope(llsm_soptions* options,
-  llsm_chunk* chunk, int channel, FP_TYPE* f0, int nfrm, FP_TYPE thop,
-  FP_TYPE fs, int ny) {
-  FP_TYPE* y = calloc(ny, sizeof(FP_TYPE));
-  int nwin = round(thop * 2.0 * fs);
-  FP_TYPE* w = hanning(nwin);
-  llsm_hmframe* unvoiced_hm = llsm_create_hmframe(0);
-  for(int i = 0; i < nfrm; i ++) {
-    llsm_nmframe* nm = llsm_container_get(chunk -> frames[i], LLSM_FRAME_NM);
-    llsm_hmframe* hm = f0[i] > 0 ? nm -> eenv[channel] : unvoiced_hm;
-    FP_TYPE* yi = llsm_synthesize_harmonic_frame_auto(options,
-      hm -> ampl, hm -> phse, hm -> nhar, f0[i] / fs, nwin);
-    // Make sure the envelope is positive.
-    FP_TYPE offset = nm -> edc[channel];
-    for(int j = 0; j < nwin; j ++)
-      yi[j] = max(yi[j] + offset, 1e-8);
+// Frames per block in noise envelope synthesis.
+#define NOISE_ENVELOPE_BLOCK 64
+
+static int noise_envelope_scratchsize(int nband, int maxnhar) {
+  return maxnhar * 5 + maxnhar * nband * 2 + nband * 2;
+}
+
+// Synthesize frames i0 to i1 - 1 of the noise channel envelopes, keeping
+//   only the samples in [lo, hi); see llsm_synthesize_noise_envelopes.
+static void llsm_synthesize_noise_envelope_block(llsm_flatchunk* src,
+  int nband, FP_TYPE* f0, FP_TYPE* theta, int i0, int i1, int lo, int hi,
+  FP_TYPE thop, FP_TYPE fs, FP_TYPE* w, int nwin, int maxnhar,
+  FP_TYPE* scratch, FP_TYPE* env, int ny) {
+  int nchannel = src -> nchannel;
+  FP_TYPE* coef = scratch;           // 2 cos(omega)
+  FP_TYPE* c1 = coef + maxnhar;      // cos(omega t) at t - 1
+  FP_TYPE* c2 = c1 + maxnhar;        //   and t - 2
+  FP_TYPE* s1 = c2 + maxnhar;        // sin(omega t) at t - 1
+  FP_TYPE* s2 = s1 + maxnhar;        //   and t - 2
+  FP_TYPE* wc = s2 + maxnhar;        // ampl * cos(phse), maxnhar x nband
+  FP_TYPE* ws = wc + maxnhar * nband; // -ampl * sin(phse)
+  FP_TYPE* edc = ws + maxnhar * nband;
+  FP_TYPE* yc = edc + nband;
+
+  for(int i = i0; i < i1; i ++) {
+    int* nhar_e = src -> nhar_e + i * nchannel;
+    int nhar = 0;
+    if(f0[i] > 0)
+      for(int c = 0; c < nband; c ++)
+        nhar = max(nhar, nhar_e[c]);
+    for(int k = 0; k < nhar; k ++) {
+      FP_TYPE omega = 2.0 * M_PI * f0[i] / fs * (k + 1.0);
+      coef[k] = 2.0 * cos(omega);
+      c1[k] = cos(omega * (-1 - nwin / 2));
+      c2[k] = cos(omega * (-2 - nwin / 2));
+      s1[k] = sin(omega * (-1 - nwin / 2));
+      s2[k] = sin(omega * (-2 - nwin / 2));
+      for(int c = 0; c < nband; c ++) {
+        int offset = (i * nchannel + c) * src -> maxnhar_e + k;
+        FP_TYPE a = k < nhar_e[c] ? src -> eenv_ampl[offset] : 0;
+        FP_TYPE p = k < nhar_e[c] ? src -> eenv_phse[offset] : 0;
+        if(theta != NULL && k < nhar_e[c]) p = wrap(p + theta[i] * (k + 1.0));
+        wc[k * nband + c] = a * cos(p);
+        ws[k * nband + c] = -a * sin(p);
+      }
+    }
+    for(int c = 0; c < nband; c ++)
+      edc[c] = src -> edc[i * nchannel + c];
+
     for(int j = 0; j < nwin; j ++) {
-      yi[j] *= w[j];
+      for(int k = 0; k < nhar; k ++) {
+        FP_TYPE c0 = coef[k] * c1[k] - c2[k];
+        FP_TYPE s0 = coef[k] * s1[k] - s2[k];
+        c2[k] = c1[k]; c1[k] = c0;
+        s2[k] = s1[k]; s1[k] = s0;
+      }
+      for(int c = 0; c < nband; c ++) yc[c] = edc[c];
+      for(int k = 0; k < nhar; k ++) {
+        FP_TYPE* wck = wc + k * nband;
+        FP_TYPE* wsk = ws + k * nband;
+        for(int c = 0; c < nband; c ++)
+          yc[c] += wck[c] * c1[k] + wsk[c] * s1[k];
+      }
       int idx = round((i - 1) * thop * fs + j);
-      if(idx >= 0 && idx < ny)
-        y[idx] += yi[j];
+      if(idx < lo || idx >= hi) continue;
+      // Make sure the envelope is positive.
+      for(int c = 0; c < nband; c ++)
+        env[c * ny + idx] += max(yc[c], 1e-8) * w[j];
     }
-    free(yi);
   }
-  llsm_delete_hmframe(unvoiced_hm);
+}
+
+// Synthesize the temporal envelopes of the first nband noise channels into
+//   env (nband x ny) in a single pass. All channels share f0 and the frame
+//   timing, so each harmonic is generated once as a quadrature pair by a
+//   recursive oscillator and then weighted for every channel.
+// The output is split into blocks of samples that are synthesized in
+//   parallel. Each block goes through all the frames overlapping with it, in
+//   order, so every sample sums up the frames in the same order as a serial
+//   pass would; the price is that the frames on the block boundaries are
+//   synthesized twice.
+// theta (if not NULL) is the propagation phase of each frame.
+static void llsm_synthesize_noise_envelopes(llsm_flatchunk* src, int nband,
+  FP_TYPE* f0, FP_TYPE* theta, int nfrm, FP_TYPE thop, FP_TYPE fs,
+  FP_TYPE* env, int ny) {
+  int nwin = round(thop * 2.0 * fs);
+  FP_TYPE* w = hanning(nwin);
+  int nchannel = src -> nchannel;
+  int maxnhar = 0;
+  for(int i = 0; i < nfrm; i ++)
+    if(f0[i] > 0)
+      for(int c = 0; c < nband; c ++)
+        maxnhar = max(maxnhar, src -> nhar_e[i * nchannel + c]);
+  int nblock = (nfrm + NOISE_ENVELOPE_BLOCK - 1) / NOISE_ENVELOPE_BLOCK;
+
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    FP_TYPE* scratch = calloc(noise_envelope_scratchsize(nband, maxnhar),
+      sizeof(FP_TYPE));
+#   ifdef _OPENMP
+#   pragma omp for schedule(dynamic, 1)
+#   endif
+    for(int b = 0; b < nblock; b ++) {
+      int lo = b == 0 ? 0 : round(b * NOISE_ENVELOPE_BLOCK * thop * fs);
+      int hi = b == nblock - 1 ? ny :
+        round((b + 1) * NOISE_ENVELOPE_BLOCK * thop * fs);
+      // frame i covers the samples from about (i - 1) * thop * fs on
+      int i0 = max(0, floor((lo - nwin) / (thop * fs)));
+      int i1 = min(nfrm, ceil(hi / (thop * fs)) + 2);
+      llsm_synthesize_noise_envelope_block(src, nband, f0, theta, i0, i1, lo,
+        hi, thop, fs, w, nwin, maxnhar, scratch, env, ny);
+    }
+    free(scratch);
+  }
   free(w);
-  return y;
 }
 
 static void llsm_analyze_noise_psd(llsm_aoptions* options, FP_TYPE* x,
@@ -327,14 +446,14 @@ static void llsm_analyze_noise_psd(llsm_aoptions* options, FP_TYPE* x,
   int* center = calloc(nfrm, sizeof(int));
   int* winsize_spgm = calloc(nfrm, sizeof(int));
   for(int i = 0; i < nfrm; i ++) {
-    FP_TYPE* f0 = llsm_container_get(dst_chunk -> frames[i], LLSM_FRAME_F0);
+    FP_TYPE* f0 = llsm_container_peek(dst_chunk -> frames[i], LLSM_FRAME_F0);
     winsize_spgm[i] = f0 == NULL || f0[0] == 0 ? nwin : fs / f0[0] * 3;
     center[i] = round(i * options -> thop * fs);
   }
   llsm_compute_spectrogram(x, nx, center, winsize_spgm, nfrm, nfft_spgm,
     "hanning", spgm, NULL);
   for(int i = 0; i < nfrm; i ++) {
-    FP_TYPE* f0 = llsm_container_get(dst_chunk -> frames[i], LLSM_FRAME_F0);
+    FP_TYPE* f0 = llsm_container_peek(dst_chunk -> frames[i], LLSM_FRAME_F0);
     FP_TYPE f0_scaled = (f0 == NULL || f0[0] == 0 ? 200 : f0[0]) / fs;
     FP_TYPE* env = spec2env(spgm[i], nfft_spgm, f0_scaled, NULL);
     for(int j = 0; j < nspec; j ++) {
@@ -495,8 +614,10 @@ llsm_chunk* llsm_analyze(llsm_aoptions* options, FP_TYPE* x, int nx,
 
   // harmonic analysis and residual extraction
   llsm_analyze_harmonics(options, x, nx, fs, f0, nfrm, ret);
-  FP_TYPE* x_sin = llsm_synthesize_harmonics_l0(NULL, ret, f0, nfrm,
+  llsm_flatchunk* flat = llsm_chunk_toflat(ret);
+  FP_TYPE* x_sin = llsm_synthesize_harmonics_l0(NULL, flat, f0, NULL, nfrm,
     options -> thop, fs, nx);
+  llsm_delete_flatchunk(flat);
   FP_TYPE* x_res = calloc(nx, sizeof(FP_TYPE));
   for(int i = 0; i < nx; i ++) x_res[i] = x[i] - x_sin[i];
   free(x_sin);
@@ -510,13 +631,21 @@ llsm_chunk* llsm_analyze(llsm_aoptions* options, FP_TYPE* x, int nx,
   return ret;
 }
 
+llsm_flatchunk* llsm_analyze_flat(llsm_aoptions* options, FP_TYPE* x, int nx,
+  FP_TYPE fs, FP_TYPE* f0, int nfrm, FP_TYPE** x_ap) {
+  llsm_chunk* chunk = llsm_analyze(options, x, nx, fs, f0, nfrm, x_ap);
+  llsm_flatchunk* ret = llsm_chunk_toflat(chunk);
+  llsm_delete_chunk(chunk);
+  return ret;
+}
+
 int llsm_conf_checklayer0(llsm_container* src) {
-  int* nfrm = llsm_container_get(src, LLSM_CONF_NFRM);
-  FP_TYPE* thop = llsm_container_get(src, LLSM_CONF_THOP);
-  int* npsd = llsm_container_get(src, LLSM_CONF_NPSD);
-  FP_TYPE* fnyq = llsm_container_get(src, LLSM_CONF_FNYQ);
-  int* nchannel = llsm_container_get(src, LLSM_CONF_NCHANNEL);
-  FP_TYPE* chanfreq = llsm_container_get(src, LLSM_CONF_CHANFREQ);
+  int* nfrm = llsm_container_peek(src, LLSM_CONF_NFRM);
+  FP_TYPE* thop = llsm_container_peek(src, LLSM_CONF_THOP);
+  int* npsd = llsm_container_peek(src, LLSM_CONF_NPSD);
+  FP_TYPE* fnyq = llsm_container_peek(src, LLSM_CONF_FNYQ);
+  int* nchannel = llsm_container_peek(src, LLSM_CONF_NCHANNEL);
+  FP_TYPE* chanfreq = llsm_container_peek(src, LLSM_CONF_CHANFREQ);
   if(nfrm == NULL || thop == NULL || npsd == NULL ||
      fnyq == NULL || nchannel == NULL || chanfreq == NULL) return 0;
   return 1;
@@ -524,7 +653,7 @@ int llsm_conf_checklayer0(llsm_container* src) {
 
 static int llsm_synthesis_check_integrity(llsm_chunk* src) {
   if(! llsm_conf_checklayer0(src -> conf)) return 0;
-  int* nfrm = llsm_container_get(src -> conf, LLSM_CONF_NFRM);
+  int* nfrm = llsm_container_peek(src -> conf, LLSM_CONF_NFRM);
   for(int i = 0; i < *nfrm; i ++)
     if(! llsm_frame_checklayer0(src -> frames[i]) &&
        ! llsm_frame_checklayer1(src -> frames[i]))
@@ -532,137 +661,246 @@ static int llsm_synthesis_check_integrity(llsm_chunk* src) {
   return 1;
 }
 
-static FP_TYPE* llsm_synthesize_noise_excitation(llsm_soptions* options,
-  llsm_chunk* src, FP_TYPE* f0, int nfrm, FP_TYPE thop, FP_TYPE fs, int ny) {
-  FP_TYPE* y = calloc(ny, sizeof(FP_TYPE));
-  FP_TYPE* chanfreq = llsm_container_get(src -> conf, LLSM_CONF_CHANFREQ);
-  int nchannel = *((int*)llsm_container_get(src -> conf, LLSM_CONF_NCHANNEL));
-  for(int c = 0; c < nchannel; c ++) {
-    FP_TYPE fmin = c == 0 ? 0 : chanfreq[c - 1];
-    FP_TYPE fmax = c == nchannel - 1 ? fs / 2.0 : chanfreq[c];
-    if(fmin >= fs / 2.0) break;
-    FP_TYPE* x = llsm_generate_bandlimited_noise(ny, fmin / fs, fmax / fs);
-    FP_TYPE* env = llsm_synthesize_noise_envelope(options, src, c, f0, nfrm,
-      thop, fs, ny);
-    for(int i = 0; i < ny; i ++) {
-      x[i] *= sqrt(env[i]);
-      y[i] += x[i];
-    }
-    free(env);
-    free(x);
+static int llsm_flatchunk_check_integrity(llsm_flatchunk* src) {
+  if(! llsm_conf_checklayer0(src -> conf)) return 0;
+  for(int i = 0; i < src -> nfrm; i ++) {
+    int members = src -> members[i];
+    int voiced = src -> f0[i] != 0;
+    int layer0 = (members & LLSM_FLAT_NM) &&
+      (! voiced || (members & LLSM_FLAT_HM));
+    int layer1 = (members & LLSM_FLAT_NM) && (members & LLSM_FLAT_RD) &&
+      (src -> f0[i] <= 0 || (members & LLSM_FLAT_VT));
+    if(! layer0 && ! layer1) return 0;
   }
-  return y;
+  return 1;
 }
 
-static FP_TYPE* llsm_filter_noise(llsm_chunk* src, int nfrm, FP_TYPE thop,
-  FP_TYPE fs, FP_TYPE* x, int nx) {
-  const int nfade = 16;
-  int nwin = round(thop * fs * 2);
-  FP_TYPE* w = hanning(nwin);
-  FP_TYPE wsqr = 0;
-  for(int i = 0; i < nwin; i ++)
-    wsqr += w[i] * w[i];
-
+// Frames per block in noise filtering.
+#define NOISE_FILTER_BLOCK 64
+
+// Noise filtering (STFT -> PSD -> diff -> filter -> ISTFT) is done in
+//   contiguous blocks of frames, each overlap-added into a segment of its
+//   own; the segments are summed up in order afterwards so that the result
+//   does not depend on the number of threads.
+typedef struct {
+  llsm_flatchunk* src;
+  FP_TYPE* x;          // the noise excitation
+  int nx;
+  int nfrm;
+  FP_TYPE thop;
+  FP_TYPE fs;
+  int nwin;
+  int nfft;
+  int npsd;
+  FP_TYPE* w;
+  FP_TYPE wsqr;
+  FP_TYPE* src_axis;
+  int nblock;
+  int* seg_begin;
+  int* seg_size;
+  FP_TYPE** segments;
+} noise_filter_context;
+
+static noise_filter_context* create_noise_filter_context(
+  llsm_flatchunk* src, int nfrm, FP_TYPE thop, FP_TYPE fs, FP_TYPE* x, int nx) {
+  noise_filter_context* ret = malloc(sizeof(noise_filter_context));
+  ret -> src = src;
+  ret -> x = x;
+  ret -> nx = nx;
+  ret -> nfrm = nfrm;
+  ret -> thop = thop;
+  ret -> fs = fs;
+  ret -> nwin = round(thop * fs * 2);
+  ret -> w = hanning(ret -> nwin);
+  ret -> wsqr = 0;
+  for(int i = 0; i < ret -> nwin; i ++)
+    ret -> wsqr += ret -> w[i] * ret -> w[i];
   // at least 20% padding
-  int nfft = pow(2, ceil(log2(nwin * 1.2 + nfade * 2)));
-  int nspec = nfft / 2 + 1;
-  FP_TYPE* psd = calloc(nspec, sizeof(FP_TYPE));
-  FP_TYPE* fftbuffer = calloc(nfft * 4, sizeof(FP_TYPE));
-  FP_TYPE* x_re = fftbuffer;
-  FP_TYPE* x_im = fftbuffer + nfft;
-
-  int npsd = *((int*)llsm_container_get(src -> conf, LLSM_CONF_NPSD));
-  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_get(src -> conf, LLSM_CONF_FNYQ));
-
-  FP_TYPE* y = calloc(nx, sizeof(FP_TYPE));
-  FP_TYPE* src_axis = linspace(0, fnyq, npsd);
-  FP_TYPE* src_psd = calloc(npsd, sizeof(FP_TYPE));
-  // STFT -> PSD -> diff -> filter -> ISTFT
-  for(int i = 0; i < nfrm; i ++) {
-    llsm_nmframe* nm = llsm_container_get(src -> frames[i], LLSM_FRAME_NM);
-    FP_TYPE* resvec = llsm_container_get(src -> frames[i], LLSM_FRAME_PSDRES);
-    FP_TYPE peak = maxfp(nm -> psd, npsd);
+  ret -> nfft = pow(2, ceil(log2(ret -> nwin * 1.2 + 16 * 2)));
+
+  ret -> npsd = src -> npsd;
+  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_peek(src -> conf, LLSM_CONF_FNYQ));
+  ret -> src_axis = linspace(0, fnyq, ret -> npsd);
+
+  int nblock = (nfrm + NOISE_FILTER_BLOCK - 1) / NOISE_FILTER_BLOCK;
+  ret -> nblock = nblock;
+  ret -> segments = calloc(nblock, sizeof(FP_TYPE*));
+  ret -> seg_begin = calloc(nblock, sizeof(int));
+  ret -> seg_size = calloc(nblock, sizeof(int));
+  for(int b = 0; b < nblock; b ++) {
+    int i0 = b * NOISE_FILTER_BLOCK;
+    int i1 = min(nfrm, i0 + NOISE_FILTER_BLOCK);
+    ret -> seg_begin[b] = round(i0 * thop * fs) - ret -> nfft / 2;
+    ret -> seg_size[b] = round((i1 - 1) * thop * fs) - ret -> nfft / 2 +
+      ret -> nfft - ret -> seg_begin[b];
+  }
+  return ret;
+}
+
+// Allocate the per-thread scratch for run_noise_filter_block.
+static FP_TYPE* create_noise_filter_scratch(noise_filter_context* ctx) {
+  return malloc((llsm_filter_noise_frame_buffersize(ctx -> nfft) +
+    ctx -> nfft + ctx -> npsd) * sizeof(FP_TYPE));
+}
+
+static void run_noise_filter_block(noise_filter_context* ctx, int b,
+  FP_TYPE* scratch) {
+  int nfft = ctx -> nfft;
+  int nwin = ctx -> nwin;
+  int npsd = ctx -> npsd;
+  FP_TYPE* buffer = scratch;
+  FP_TYPE* xfrm = buffer + llsm_filter_noise_frame_buffersize(nfft);
+  FP_TYPE* src_psd = xfrm + nfft;
+  FP_TYPE* y_seg = calloc(ctx -> seg_size[b], sizeof(FP_TYPE));
+  int i1 = min(ctx -> nfrm, (b + 1) * NOISE_FILTER_BLOCK);
+  for(int i = b * NOISE_FILTER_BLOCK; i < i1; i ++) {
+    FP_TYPE* psd = ctx -> src -> psd + i * npsd;
+    FP_TYPE* resvec = ctx -> src -> members[i] & LLSM_FLAT_PSDRES ?
+      ctx -> src -> psdres + i * npsd : NULL;
+    FP_TYPE peak = maxfp(psd, npsd);
     if(peak < -100) continue; // -100 dB noise floor
 
-    // STFT
-    int center = round(i * thop * fs);
-    FP_TYPE* xfrm = fetch_frame(x, nx, center, nwin);
-    for(int j = 0; j < nwin; j ++) xfrm[j] *= w[j];
-    for(int j = 0; j < nfft; j ++) x_re[j] = 0;
-    for(int j = 0; j < nwin; j ++) x_re[j - nwin / 2 + nfft / 2] = xfrm[j];
-    fft(x_re, NULL, x_re, x_im, nfft, fftbuffer + nfft * 2);
-
-    // PSD -> diff
-    llsm_fft_to_psd(x_re, x_im, nfft, wsqr, psd);
-    FP_TYPE* env = moving_avg(psd, nspec, 3);
-    for(int j = 0; j < npsd; j ++) src_psd[j] = nm -> psd[j];
+    int center = round(i * ctx -> thop * ctx -> fs);
+    for(int j = 0; j < nfft; j ++) xfrm[j] = 0;
+    for(int j = 0; j < nwin; j ++) {
+      int isrc = center + j - nwin / 2;
+      if(isrc >= 0 && isrc < ctx -> nx)
+        xfrm[j - nwin / 2 + nfft / 2] = ctx -> x[isrc] * ctx -> w[j];
+    }
+    for(int j = 0; j < npsd; j ++) src_psd[j] = psd[j];
     if(resvec != NULL)
     for(int j = 0; j < npsd; j ++)
       src_psd[j] += resvec[j] - LOG2IN(LOGRESBIAS);
-    FP_TYPE* H = llsm_spectrum_from_envelope(
-      src_axis, src_psd, npsd, nspec - 1, fs / 2.0);
-    for(int j = 0; j < nspec - 1; j ++)
-      H[j] = exp(DB2LOG(H[j])) / sqrt(env[j] * 44100 / fs + 1e-8);
-
-    // filter
-    for(int j = 0; j < nspec - 1; j ++) {
-      x_re[j] *= H[j]; x_im[j] *= H[j];
-    }
-    x_re[nspec - 1] = x_re[nspec - 2]; complete_symm(x_re, nfft);
-    x_im[nspec - 1] = x_im[nspec - 2]; complete_asymm(x_im, nfft);
-
-    // ISTFT
-    ifft(x_re, x_im, x_re, NULL, nfft, fftbuffer + nfft * 2);
-    for(int j = 0; j < nfade; j ++) {
-      x_re[j] *= (FP_TYPE)j / nfade;
-      x_re[nfft - j - 1] *= 1.0 - (FP_TYPE)j / nfade;
-    }
-    for(int j = 0; j < nfft; j ++) {
-      int idx = center + j - nfft / 2;
-      if(idx >= 0 && idx < nx)
-        y[idx] += x_re[j];
-    }
+    llsm_filter_noise_frame(xfrm, nfft, ctx -> wsqr, ctx -> src_axis,
+      src_psd, npsd, ctx -> fs, buffer);
 
-    free(H); free(env);
-    free(xfrm);
+    int base = center - nfft / 2 - ctx -> seg_begin[b];
+    for(int j = 0; j < nfft; j ++)
+      y_seg[base + j] += xfrm[j];
   }
+  ctx -> segments[b] = y_seg;
+}
 
-  free(fftbuffer); free(psd);
-  free(src_axis); free(src_psd);
-  free(w);
+// Sum up the segments and delete the context.
+static FP_TYPE* finish_noise_filter(noise_filter_context* ctx) {
+  FP_TYPE* y = calloc(ctx -> nx, sizeof(FP_TYPE));
+  for(int b = 0; b < ctx -> nblock; b ++) {
+    for(int j = max(0, -ctx -> seg_begin[b]); j < ctx -> seg_size[b]; j ++) {
+      int idx = ctx -> seg_begin[b] + j;
+      if(idx >= ctx -> nx) break;
+      y[idx] += ctx -> segments[b][j];
+    }
+    free(ctx -> segments[b]);
+  }
+  free(ctx -> segments); free(ctx -> seg_begin); free(ctx -> seg_size);
+  free(ctx -> src_axis);
+  free(ctx -> w);
+  free(ctx);
   return y;
 }
 
-llsm_output* llsm_synthesize(llsm_soptions* options, llsm_chunk* src) {
-  if(! llsm_synthesis_check_integrity(src)) {
-    printf("Synthesis integrity check failed\n");
-    return NULL;
-  }
-  int nfrm;
-  FP_TYPE thop = *((FP_TYPE*)llsm_container_get(src -> conf, LLSM_CONF_THOP));
+// The noise component and layer 0 harmonics are synthesized from the flat
+//   chunk; chunk is only needed (and must be given) when options -> use_l1.
+static llsm_output* llsm_synthesize_(llsm_soptions* options,
+  llsm_flatchunk* src, llsm_chunk* chunk) {
+  int nfrm = src -> nfrm;
+  FP_TYPE thop = *((FP_TYPE*)llsm_container_peek(src -> conf, LLSM_CONF_THOP));
   FP_TYPE fs = options -> fs;
-  FP_TYPE* f0 = llsm_chunk_getf0(src, & nfrm);
+  FP_TYPE* f0 = src -> f0;
 
   int ny = round((nfrm + 1) * thop * fs);
   llsm_output* ret = malloc(sizeof(llsm_output));
   ret -> ny = ny;
   ret -> fs = fs;
 
-  FP_TYPE* y_sin = llsm_synthesize_harmonics(options, src, f0, nfrm,
-    thop, fs, ny);
+  // noise excitation: the band-limited templates modulated by the envelopes
+  FP_TYPE* chanfreq = llsm_container_peek(src -> conf, LLSM_CONF_CHANFREQ);
+  int nchannel = *((int*)llsm_container_peek(src -> conf, LLSM_CONF_NCHANNEL));
+  int nband = 0;
+  while(nband < nchannel && (nband == 0 || chanfreq[nband - 1] < fs / 2.0))
+    nband ++;
+  FP_TYPE* env = calloc(nband * ny, sizeof(FP_TYPE));
+  FP_TYPE* theta = options -> propagate == 0 ? NULL :
+    llsm_propagation_phase(f0, nfrm, thop, options -> propagate);
+  llsm_synthesize_noise_envelopes(src, nband, f0, theta, nfrm, thop, fs, env,
+    ny);
+  FP_TYPE** x_template = calloc(nband, sizeof(FP_TYPE*));
+  int* ntemplate = calloc(nband, sizeof(int));
+  for(int c = 0; c < nband; c ++) {
+    FP_TYPE fmin = c == 0 ? 0 : chanfreq[c - 1];
+    FP_TYPE fmax = c == nchannel - 1 ? fs / 2.0 : chanfreq[c];
+    x_template[c] = llsm_get_noise_template(fmin / fs, fmax / fs,
+      & ntemplate[c]);
+  }
+  FP_TYPE* y_exc = calloc(ny, sizeof(FP_TYPE));
+# ifdef _OPENMP
+# pragma omp parallel for schedule(static)
+# endif
+  for(int i = 0; i < ny; i ++)
+    for(int c = 0; c < nband; c ++)
+      y_exc[i] += x_template[c][i % ntemplate[c]] * sqrt(env[c * ny + i]);
+  free(x_template); free(ntemplate);
+  free(env);
+
+  // Task 0 synthesizes the harmonic part (which runs sequentially over the
+  //   frames) and the remaining tasks filter the noise block by block.
+  FP_TYPE* y_sin = NULL;
+  noise_filter_context* nf = create_noise_filter_context(src, nfrm, thop, fs,
+    y_exc, ny);
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    FP_TYPE* scratch = create_noise_filter_scratch(nf);
+#   ifdef _OPENMP
+#   pragma omp for schedule(dynamic, 1)
+#   endif
+    for(int t = 0; t <= nf -> nblock; t ++) {
+      if(t == 0)
+        y_sin = options -> use_l1 ?
+          llsm_synthesize_harmonics_l1(options, chunk, f0, theta, nfrm, thop,
+            fs, ny) :
+          llsm_synthesize_harmonics_l0(options, src, f0, theta, nfrm, thop,
+            fs, ny);
+      else
+        run_noise_filter_block(nf, t - 1, scratch);
+    }
+    free(scratch);
+  }
+  FP_TYPE* y_nos = finish_noise_filter(nf);
+  free(y_exc);
+  free(theta);
   ret -> y_sin = y_sin;
-
-  FP_TYPE* y_exc = llsm_synthesize_noise_excitation(options, src, f0, nfrm,
-    thop, fs, ny);
-  FP_TYPE* y_nos = llsm_filter_noise(src, nfrm, thop, fs, y_exc, ny);
   ret -> y_noise = y_nos;
 
   ret -> y = calloc(ny, sizeof(FP_TYPE));
   for(int i = 0; i < ny; i ++)
     ret -> y[i] = y_sin[i] + y_nos[i];
+  return ret;
+}
 
-  free(y_exc);
-  free(f0);
+llsm_output* llsm_synthesize(llsm_soptions* options, llsm_chunk* src) {
+  if(! llsm_synthesis_check_integrity(src)) {
+    printf("Synthesis integrity check failed\n");
+    return NULL;
+  }
+  llsm_flatchunk* flat = llsm_chunk_toflat(src);
+  llsm_output* ret = llsm_synthesize_(options, flat, src);
+  llsm_delete_flatchunk(flat);
+  return ret;
+}
+
+llsm_output* llsm_synthesize_flat(llsm_soptions* options,
+  llsm_flatchunk* src) {
+  if(! llsm_flatchunk_check_integrity(src)) {
+    printf("Synthesis integrity check failed\n");
+    return NULL;
+  }
+  if(! options -> use_l1)
+    return llsm_synthesize_(options, src, NULL);
+  llsm_chunk* chunk = llsm_flatchunk_tochunk(src);
+  llsm_output* ret = llsm_synthesize_(options, src, chunk);
+  llsm_delete_chunk(chunk);
   return ret;
 }
 
@@ -675,12 +913,12 @@ void llsm_delete_output(llsm_output* dst) {
 }
 
 FP_TYPE* llsm_chunk_getf0(llsm_chunk* src, int* dst_nfrm) {
-  int* nfrm = llsm_container_get(src -> conf, LLSM_CONF_NFRM);
+  int* nfrm = llsm_container_peek(src -> conf, LLSM_CONF_NFRM);
   if(nfrm == NULL) return NULL;
   FP_TYPE* f0 = calloc(*nfrm, sizeof(FP_TYPE));
   *dst_nfrm = *nfrm;
   for(int i = 0; i < *nfrm; i ++) {
-    FP_TYPE* if0 = llsm_container_get(src -> frames[i], LLSM_FRAME_F0);
+    FP_TYPE* if0 = llsm_container_peek(src -> frames[i], LLSM_FRAME_F0);
     if(if0 != NULL)
       f0[i] = if0[0];
   }
@@ -688,7 +926,7 @@ FP_TYPE* llsm_chunk_getf0(llsm_chunk* src, int* dst_nfrm) {
 }
 
 void llsm_chunk_phasesync_rps(llsm_chunk* dst, int layer1_based) {
-  int* nfrm = llsm_container_get(dst -> conf, LLSM_CONF_NFRM);
+  int* nfrm = llsm_container_peek(dst -> conf, LLSM_CONF_NFRM);
   if(nfrm == NULL) return;
   for(int i = 0; i < *nfrm; i ++)
     llsm_frame_phasesync_rps(dst -> frames[i], layer1_based);
@@ -697,13 +935,11 @@ void llsm_chunk_phasesync_rps(llsm_chunk* dst, int layer1_based) {
 void llsm_chunk_phasepropagate(llsm_chunk* dst, int sign) {
   int nfrm = 0;
   FP_TYPE* f0 = llsm_chunk_getf0(dst, & nfrm);
-  FP_TYPE* thop = llsm_container_get(dst -> conf, LLSM_CONF_THOP);
+  FP_TYPE* thop = llsm_container_peek(dst -> conf, LLSM_CONF_THOP);
   if(thop == NULL || f0 == NULL) return;
-  FP_TYPE* delta_phase = cumsum(f0, nfrm);
-  for(int i = 0; i < nfrm; i ++) {
-    delta_phase[i] *= *thop * sign * 2.0 * M_PI;
+  FP_TYPE* delta_phase = llsm_propagation_phase(f0, nfrm, *thop, sign);
+  for(int i = 0; i < nfrm; i ++)
     llsm_frame_phaseshift(dst -> frames[i], delta_phase[i]);
-  }
   free(delta_phase);
   free(f0);
 }
@@ -23,12 +23,13 @@
 #include "dsputils.h"
 #include "llsmutils.h"
 #include "constants.h"
+#include "buffer.h"
 
 static int llsm_layer0to1_check_integrity(llsm_chunk* src) {
-  int* nfrm = llsm_container_get(src -> conf, LLSM_CONF_NFRM);
-  FP_TYPE* thop = llsm_container_get(src -> conf, LLSM_CONF_THOP);
-  FP_TYPE* fnyq = llsm_container_get(src -> conf, LLSM_CONF_FNYQ);
-  FP_TYPE* liprad = llsm_container_get(src -> conf, LLSM_CONF_LIPRADIUS);
+  int* nfrm = llsm_container_peek(src -> conf, LLSM_CONF_NFRM);
+  FP_TYPE* thop = llsm_container_peek(src -> conf, LLSM_CONF_THOP);
+  FP_TYPE* fnyq = llsm_container_peek(src -> conf, LLSM_CONF_FNYQ);
+  FP_TYPE* liprad = llsm_container_peek(src -> conf, LLSM_CONF_LIPRADIUS);
   if(nfrm == NULL || thop == NULL || fnyq == NULL || liprad == NULL)
     return 0;
   for(int i = 0; i < *nfrm; i ++)
@@ -38,38 +39,113 @@ static int llsm_layer0to1_check_integrity(llsm_chunk* src) {
 }
 
 static int llsm_layer1to0_check_integrity(llsm_container* conf) {
-  FP_TYPE* fnyq = llsm_container_get(conf, LLSM_CONF_FNYQ);
-  FP_TYPE* liprad = llsm_container_get(conf, LLSM_CONF_LIPRADIUS);
-  int* nspec = llsm_container_get(conf, LLSM_CONF_NSPEC);
+  FP_TYPE* fnyq = llsm_container_peek(conf, LLSM_CONF_FNYQ);
+  FP_TYPE* liprad = llsm_container_peek(conf, LLSM_CONF_LIPRADIUS);
+  int* nspec = llsm_container_peek(conf, LLSM_CONF_NSPEC);
   if(fnyq == NULL || liprad == NULL || nspec == NULL) return 0;
   return 1;
 }
 
-static FP_TYPE* llsm_analyze_rd(llsm_chunk* src) {
-  int nfrm = *((int*)llsm_container_get(src -> conf, LLSM_CONF_NFRM));
-  FP_TYPE thop = *((FP_TYPE*)llsm_container_get(src -> conf, LLSM_CONF_THOP));
-  FP_TYPE lip_radius = *((FP_TYPE*)llsm_container_get(src -> conf,
-    LLSM_CONF_LIPRADIUS));
+// The glottal responses used for Rd analysis do not depend on the input, so
+//   they are computed once per process and shared read-only afterwards.
+static llsm_cached_glottal_model* rd_glottal_model = NULL;
+static llsm_once_flag rd_glottal_model_once = LLSM_ONCE_INIT;
 
+static void llsm_init_rd_glottal_model() {
   int ncandidate = 64;
   FP_TYPE* rd_list = linspace(0.02, 3.0, ncandidate);
-  llsm_cached_glottal_model* cgm = llsm_create_cached_glottal_model(
-    rd_list, ncandidate, 80);
+  rd_glottal_model = llsm_create_cached_glottal_model(rd_list, ncandidate, 80);
   free(rd_list);
+}
+
+static llsm_cached_glottal_model* llsm_get_rd_glottal_model() {
+  llsm_once(rd_glottal_model_once, llsm_init_rd_glottal_model);
+  return rd_glottal_model;
+}
+
+// Scratch for converting frames between layer 0 and layer 1 with a fixed
+//   nfft. The buffers grow with the number of harmonics and are reused
+//   afterwards, so conversion is allocation-free once warmed up; each thread
+//   owns its own context.
+typedef struct {
+  int nfft;
+  int nhar;            // capacity of the per-harmonic buffers
+  FP_TYPE* ampl;
+  FP_TYPE* phse;
+  FP_TYPE* vs_ampl;
+  FP_TYPE* vt_phse;
+  FP_TYPE* hm_ampl;    // harmonics evaluated by llsm_layerconv_harmonics
+  FP_TYPE* hm_phse;
+  FP_TYPE* vs_phse;    // source phase shifted by llsm_layerconv_harmonics
+  FP_TYPE* buffer;     // scratch for envelope and minimum phase estimation
+  int nbuffer;
+} layerconv_context;
+
+static layerconv_context* create_layerconv_context(int nfft) {
+  layerconv_context* ret = malloc(sizeof(layerconv_context));
+  ret -> nfft = nfft;
+  ret -> nhar = 0;
+  ret -> ampl = NULL;
+  ret -> buffer = NULL;
+  ret -> nbuffer = 0;
+  return ret;
+}
+
+static void delete_layerconv_context(layerconv_context* dst) {
+  if(dst == NULL) return;
+  free(dst -> ampl);
+  free(dst -> buffer);
+  free(dst);
+}
+
+static void layerconv_context_reserve(layerconv_context* dst, int nhar) {
+  if(nhar > dst -> nhar) {
+    dst -> nhar = nhar;
+    free(dst -> ampl);
+    dst -> ampl = calloc(nhar * 7, sizeof(FP_TYPE));
+    dst -> phse = dst -> ampl + nhar;
+    dst -> vs_ampl = dst -> phse + nhar;
+    dst -> vt_phse = dst -> vs_ampl + nhar;
+    dst -> hm_ampl = dst -> vt_phse + nhar;
+    dst -> hm_phse = dst -> hm_ampl + nhar;
+    dst -> vs_phse = dst -> hm_phse + nhar;
+  }
+  int nbuffer = llsm_harmonic_minphase_buffersize(nhar);
+  if(dst -> nfft > 0)
+    nbuffer = max(nbuffer,
+      llsm_harmonic_envelope_buffersize(nhar, dst -> nfft));
+  if(nbuffer > dst -> nbuffer) {
+    dst -> nbuffer = nbuffer;
+    free(dst -> buffer);
+    dst -> buffer = calloc(nbuffer, sizeof(FP_TYPE));
+  }
+}
+
+// Estimate Rd on the voiced frames from the first harmonics in ampl[i] and
+//   smooth the trajectory.
+static FP_TYPE* llsm_analyze_rd_(FP_TYPE* f0, FP_TYPE** ampl, int* nhar,
+  int nfrm, FP_TYPE thop, FP_TYPE lip_radius) {
+  llsm_cached_glottal_model* cgm = llsm_get_rd_glottal_model();
   FP_TYPE* rd = calloc(nfrm, sizeof(FP_TYPE));
-  for(int i = 0; i < nfrm; i ++) {
-    FP_TYPE f0 = *((FP_TYPE*)llsm_container_get(src -> frames[i],
-      LLSM_FRAME_F0));
-    if(f0 == 0) continue;
-    llsm_hmframe* hm = llsm_container_get(src -> frames[i], LLSM_FRAME_HM);
-    int nhar = min(hm -> nhar, round(8000.0 / f0));
-    FP_TYPE* ampl = calloc(nhar, sizeof(FP_TYPE));
-    memcpy(ampl, hm -> ampl, nhar * sizeof(FP_TYPE));
-    llsm_lipfilter(lip_radius, f0, nhar, ampl, NULL, 1);
-    rd[i] = llsm_spectral_glottal_fitting(ampl, nhar, cgm);
-    free(ampl);
-  }
-  llsm_delete_cached_glottal_model(cgm);
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    layerconv_context* ctx = create_layerconv_context(0);
+#   ifdef _OPENMP
+#   pragma omp for schedule(dynamic, 16)
+#   endif
+    for(int i = 0; i < nfrm; i ++) {
+      if(f0[i] == 0) continue;
+      int inhar = min(nhar[i], round(8000.0 / f0[i]));
+      layerconv_context_reserve(ctx, inhar);
+      FP_TYPE* iampl = ctx -> ampl;
+      memcpy(iampl, ampl[i], inhar * sizeof(FP_TYPE));
+      llsm_lipfilter(lip_radius, f0[i], inhar, iampl, NULL, 1);
+      rd[i] = llsm_spectral_glottal_fitting(iampl, inhar, cgm);
+    }
+    delete_layerconv_context(ctx);
+  }
 
   FP_TYPE* rd_cont = interp_in_blank(rd, nfrm, 0);
   FP_TYPE* rd_smooth = llsm_smoothing_filter(rd_cont, nfrm,
@@ -79,123 +155,556 @@ static FP_TYPE* llsm_analyze_rd(llsm_chunk* src) {
   return rd_smooth;
 }
 
-// Note: the reason we don't expose this function in llsm.h just like its
-//   counterpart llsm_frame_tolayer0, is that layer0-to-layer1 conversion
-//   cannot be done in a frame-by-frame manner, unless the Rd parameter is
-//   known in advance.
-static void llsm_frame_tolayer1(llsm_container* dst, FP_TYPE lip_radius,
-  FP_TYPE fnyq, int nfft) {
-  int nspec = nfft / 2 + 1;
-  FP_TYPE rd = *((FP_TYPE*)llsm_container_get(dst, LLSM_FRAME_RD));
-  FP_TYPE f0 = *((FP_TYPE*)llsm_container_get(dst, LLSM_FRAME_F0));
-  llsm_hmframe* hm = llsm_container_get(dst, LLSM_FRAME_HM);
-  FP_TYPE* ampl = calloc(hm -> nhar, sizeof(FP_TYPE));
-  FP_TYPE* phse = calloc(hm -> nhar, sizeof(FP_TYPE));
-  FP_TYPE* freq = calloc(hm -> nhar, sizeof(FP_TYPE));
-  memcpy(ampl, hm -> ampl, hm -> nhar * sizeof(FP_TYPE));
-  memcpy(phse, hm -> phse, hm -> nhar * sizeof(FP_TYPE));
-  for(int i = 0; i < hm -> nhar; i ++) freq[i] = f0 * (i + 1.0);
+static FP_TYPE* llsm_analyze_rd(llsm_chunk* src) {
+  int nfrm = *((int*)llsm_container_peek(src -> conf, LLSM_CONF_NFRM));
+  FP_TYPE thop = *((FP_TYPE*)llsm_container_peek(src -> conf, LLSM_CONF_THOP));
+  FP_TYPE lip_radius = *((FP_TYPE*)llsm_container_peek(src -> conf,
+    LLSM_CONF_LIPRADIUS));
+
+  FP_TYPE* f0 = calloc(nfrm, sizeof(FP_TYPE));
+  FP_TYPE** ampl = calloc(nfrm, sizeof(FP_TYPE*));
+  int* nhar = calloc(nfrm, sizeof(int));
+  for(int i = 0; i < nfrm; i ++) {
+    f0[i] = *((FP_TYPE*)llsm_container_peek(src -> frames[i], LLSM_FRAME_F0));
+    if(f0[i] == 0) continue;
+    llsm_hmframe* hm = llsm_container_peek(src -> frames[i], LLSM_FRAME_HM);
+    ampl[i] = hm -> ampl;
+    nhar[i] = hm -> nhar;
+  }
+  FP_TYPE* rd = llsm_analyze_rd_(f0, ampl, nhar, nfrm, thop, lip_radius);
+  free(f0); free(ampl); free(nhar);
+  return rd;
+}
+
+// Convert the nhar harmonics of a voiced frame into the vocal source phase
+//   (nhar) and the vocal tract envelope (ctx -> nfft / 2 + 1).
+static void llsm_harmonics_tolayer1(FP_TYPE f0, FP_TYPE rd, FP_TYPE* hm_ampl,
+  FP_TYPE* hm_phse, int nhar, FP_TYPE lip_radius, FP_TYPE fnyq,
+  layerconv_context* ctx, FP_TYPE* dst_vtmagn, FP_TYPE* dst_vsphse) {
+  layerconv_context_reserve(ctx, nhar);
+  FP_TYPE* ampl = ctx -> ampl;
+  FP_TYPE* phse = ctx -> phse;
+  memcpy(ampl, hm_ampl, nhar * sizeof(FP_TYPE));
+  memcpy(phse, hm_phse, nhar * sizeof(FP_TYPE));
 
   // Generate a LF pulse, and normalize.
-  lfmodel glott = lfmodel_from_rd(rd, 1.0 / f0, 1.0);
-  FP_TYPE* vs_ampl = lfmodel_spectrum(glott, freq, hm -> nhar, NULL);
-  for(int i = 1; i < hm -> nhar; i ++) vs_ampl[i] /= (1.0 + i) * vs_ampl[0];
+  FP_TYPE* vs_ampl = ctx -> vs_ampl;
+  llsm_lfmodel_harmonics(rd, f0, nhar, vs_ampl, NULL);
+  for(int i = 1; i < nhar; i ++) vs_ampl[i] /= (1.0 + i) * vs_ampl[0];
   vs_ampl[0] = 1.0;
 
-  llsm_lipfilter(lip_radius, f0, hm -> nhar, ampl, phse, 1);
-  for(int i = 0; i < hm -> nhar; i ++) ampl[i] /= vs_ampl[i];
+  llsm_lipfilter(lip_radius, f0, nhar, ampl, phse, 1);
+  for(int i = 0; i < nhar; i ++) ampl[i] /= vs_ampl[i];
 
-  FP_TYPE* vt_phse = llsm_harmonic_minphase(ampl, hm -> nhar);
-  FP_TYPE* vs_phse = calloc(hm -> nhar, sizeof(FP_TYPE));
-  for(int i = 0; i < hm -> nhar; i ++) vs_phse[i] = phse[i] - vt_phse[i];
+  FP_TYPE* vt_phse = ctx -> vt_phse;
+  llsm_harmonic_minphase_buffered(ampl, nhar, vt_phse, ctx -> buffer);
+  for(int i = 0; i < nhar; i ++) dst_vsphse[i] = phse[i] - vt_phse[i];
 
   // The spectral envelope after removing lip and glottal responses.
-  FP_TYPE* spec_env = llsm_harmonic_envelope(ampl, hm -> nhar,
-    f0 / fnyq / 2.0, nfft);
+  llsm_harmonic_envelope_buffered(ampl, nhar, f0 / fnyq / 2.0, ctx -> nfft,
+    dst_vtmagn, ctx -> buffer);
+}
 
+// Note: the reason we don't expose this function in llsm.h just like its
+//   counterpart llsm_frame_tolayer0, is that layer0-to-layer1 conversion
+//   cannot be done in a frame-by-frame manner, unless the Rd parameter is
+//   known in advance.
+static void llsm_frame_tolayer1(llsm_container* dst, FP_TYPE lip_radius,
+  FP_TYPE fnyq, layerconv_context* ctx) {
+  int nspec = ctx -> nfft / 2 + 1;
+  FP_TYPE rd = *((FP_TYPE*)llsm_container_peek(dst, LLSM_FRAME_RD));
+  FP_TYPE f0 = *((FP_TYPE*)llsm_container_peek(dst, LLSM_FRAME_F0));
+  llsm_hmframe* hm = llsm_container_peek(dst, LLSM_FRAME_HM);
   FP_TYPE* arr_vs_phse = llsm_create_fparray(hm -> nhar);
   FP_TYPE* arr_spec_env = llsm_create_fparray(nspec);
-  memcpy(arr_spec_env, spec_env, nspec * sizeof(FP_TYPE));
-  memcpy(arr_vs_phse, vs_phse, hm -> nhar * sizeof(FP_TYPE));
+  llsm_harmonics_tolayer1(f0, rd, hm -> ampl, hm -> phse, hm -> nhar,
+    lip_radius, fnyq, ctx, arr_spec_env, arr_vs_phse);
+
   llsm_container_attach(dst, LLSM_FRAME_VTMAGN, arr_spec_env,
     llsm_delete_fparray, llsm_copy_fparray);
   llsm_container_attach(dst, LLSM_FRAME_VSPHSE, arr_vs_phse,
     llsm_delete_fparray, llsm_copy_fparray);
+}
 
-  free(ampl); free(phse); free(freq);
-  free(vt_phse); free(vs_ampl); free(vs_phse); free(spec_env);
+// The phase offsets of llsm_chunk_phasepropagate, i.e. the integration of F0
+//   scaled by sign; NULL if the hop size is unknown.
+static FP_TYPE* llsm_chunk_propagation_phase(llsm_chunk* src, int nfrm,
+  int sign) {
+  FP_TYPE* thop = llsm_container_peek(src -> conf, LLSM_CONF_THOP);
+  if(thop == NULL) return NULL;
+  FP_TYPE* ret = malloc(nfrm * sizeof(FP_TYPE));
+  FP_TYPE f0_sum = 0;
+  for(int i = 0; i < nfrm; i ++) {
+    FP_TYPE* f0 = llsm_container_peek(src -> frames[i], LLSM_FRAME_F0);
+    f0_sum += f0 != NULL ? *f0 : 0;
+    ret[i] = f0_sum;
+    ret[i] *= *thop * sign * 2.0 * M_PI;
+  }
+  return ret;
 }
 
-void llsm_chunk_tolayer1(llsm_chunk* dst, int nfft) {
-  if(! llsm_layer0to1_check_integrity(dst)) return;
-  int nfrm = *((int*)llsm_container_get(dst -> conf, LLSM_CONF_NFRM));
-  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_get(dst -> conf, LLSM_CONF_FNYQ));
-  FP_TYPE lip_radius = *((FP_TYPE*)llsm_container_get(dst -> conf,
+// Convert to layer 1 and, if sign is non-zero, propagate the phases in the
+//   same pass.
+static void llsm_chunk_tolayer1_(llsm_chunk* dst, int nfft, int sign) {
+  if(! llsm_layer0to1_check_integrity(dst)) {
+    if(sign != 0) llsm_chunk_phasepropagate(dst, sign);
+    return;
+  }
+  int nfrm = *((int*)llsm_container_peek(dst -> conf, LLSM_CONF_NFRM));
+  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_peek(dst -> conf, LLSM_CONF_FNYQ));
+  FP_TYPE lip_radius = *((FP_TYPE*)llsm_container_peek(dst -> conf,
     LLSM_CONF_LIPRADIUS));
 
   llsm_container_attach(dst -> conf, LLSM_CONF_NSPEC,
     llsm_create_int(nfft / 2 + 1), llsm_delete_int, llsm_copy_int);
 
   FP_TYPE* rd = llsm_analyze_rd(dst);
-  for(int i = 0; i < nfrm; i ++) {
-    FP_TYPE f0 = *((FP_TYPE*)llsm_container_get(dst -> frames[i],
-      LLSM_FRAME_F0));
-    llsm_container_attach(dst -> frames[i], LLSM_FRAME_RD,
-      llsm_create_fp(rd[i]), llsm_delete_fp, llsm_copy_fp);
-    if(f0 == 0) continue;
-    llsm_frame_tolayer1(dst -> frames[i], lip_radius, fnyq, nfft);
+  FP_TYPE* theta = sign != 0 ? llsm_chunk_propagation_phase(dst, nfrm, sign)
+    : NULL;
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    layerconv_context* ctx = create_layerconv_context(nfft);
+#   ifdef _OPENMP
+#   pragma omp for schedule(dynamic, 16)
+#   endif
+    for(int i = 0; i < nfrm; i ++) {
+      FP_TYPE f0 = *((FP_TYPE*)llsm_container_peek(dst -> frames[i],
+        LLSM_FRAME_F0));
+      llsm_container_attach(dst -> frames[i], LLSM_FRAME_RD,
+        llsm_create_fp(rd[i]), llsm_delete_fp, llsm_copy_fp);
+      if(f0 != 0)
+        llsm_frame_tolayer1(dst -> frames[i], lip_radius, fnyq, ctx);
+      if(theta != NULL)
+        llsm_frame_phaseshift(dst -> frames[i], theta[i]);
+    }
+    delete_layerconv_context(ctx);
   }
+  free(theta);
   free(rd);
 }
 
-void llsm_frame_tolayer0(llsm_container* dst, llsm_container* conf) {
-  if(! llsm_layer1to0_check_integrity(conf)) return;
-  if(! llsm_frame_checklayer1(dst)) return;
-  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_get(conf, LLSM_CONF_FNYQ));
-  FP_TYPE lip_radius = *((FP_TYPE*)llsm_container_get(conf,
-    LLSM_CONF_LIPRADIUS));
-  int nspec = *((int*)llsm_container_get(conf, LLSM_CONF_NSPEC));
-  FP_TYPE* f0 = llsm_container_get(dst, LLSM_FRAME_F0);
-  FP_TYPE* rd = llsm_container_get(dst, LLSM_FRAME_RD);
-  FP_TYPE* spec_env = llsm_container_get(dst, LLSM_FRAME_VTMAGN);
-  FP_TYPE* vs_phse = llsm_container_get(dst, LLSM_FRAME_VSPHSE);
-  if(*f0 == 0) return;
-
-  int nhar = llsm_fparray_length(vs_phse);
-  int* maxnhar = llsm_container_get(conf, LLSM_CONF_MAXNHAR);
+void llsm_chunk_tolayer1(llsm_chunk* dst, int nfft) {
+  llsm_chunk_tolayer1_(dst, nfft, 0);
+}
+
+void llsm_chunk_tolayer1_propagate(llsm_chunk* dst, int nfft, int sign) {
+  llsm_chunk_tolayer1_(dst, nfft, sign);
+}
+
+// The number of harmonics to rebuild from nvs vocal source phases.
+static int llsm_layer0_nhar(FP_TYPE f0, int nvs, llsm_container* conf) {
+  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_peek(conf, LLSM_CONF_FNYQ));
+  int* maxnhar = llsm_container_peek(conf, LLSM_CONF_MAXNHAR);
+  int nhar = nvs;
   if(maxnhar != NULL) nhar = min(nhar, *maxnhar);
-  nhar = min(nhar, (int)(fnyq / *f0));
+  return min(nhar, (int)(fnyq / f0));
+}
+
+// The compact vocal tract envelope (LLSM_FRAME_VTCEP) is a cosine series on
+//   the mel-warped axis theta = pi * mel(f) / mel(fnyq),
+//     magn(f) = cep[0] / 2 + sum_k cep[k] cos(k theta)  (dB),
+//   i.e. a mel-cepstrum of the dB magnitude response.
+static FP_TYPE llsm_vtcep_warp(FP_TYPE f, FP_TYPE fnyq) {
+  return M_PI * freq2mel(min(f, fnyq)) / freq2mel(fnyq);
+}
+
+// Evaluate the series at theta by Clenshaw's recurrence.
+static FP_TYPE llsm_vtcep_eval(FP_TYPE* cep, int ncep, FP_TYPE theta) {
+  FP_TYPE x = cos(theta);
+  FP_TYPE b1 = 0;
+  FP_TYPE b2 = 0;
+  for(int k = ncep - 1; k > 0; k --) {
+    FP_TYPE b0 = cep[k] + 2.0 * x * b1 - b2;
+    b2 = b1;
+    b1 = b0;
+  }
+  return cep[0] * 0.5 + x * b1 - b2;
+}
+
+// Sample the envelope at nspec points evenly spaced on the warped axis and
+//   take the first ncep terms of their DCT-II.
+static void llsm_vtmagn_tocep(FP_TYPE* vtmagn, int nspec, FP_TYPE fnyq,
+  FP_TYPE* dst, int ncep) {
+  FP_TYPE mel_nyq = freq2mel(fnyq);
+  for(int k = 0; k < ncep; k ++) dst[k] = 0;
+  for(int i = 0; i < nspec; i ++) {
+    FP_TYPE u = (i + 0.5) / nspec;
+    FP_TYPE idx = mel2freq(u * mel_nyq) / fnyq * (nspec - 1);
+    int base = min(nspec - 2, (int)idx);
+    FP_TYPE x = linterp(vtmagn[base], vtmagn[base + 1], min(1.0, idx - base));
+    // cos(k pi u) by the Chebyshev recurrence
+    FP_TYPE c = cos(M_PI * u);
+    FP_TYPE t0 = 1.0;
+    FP_TYPE t1 = c;
+    dst[0] += x;
+    for(int k = 1; k < ncep; k ++) {
+      dst[k] += x * t1;
+      FP_TYPE t2 = 2.0 * c * t1 - t0;
+      t0 = t1;
+      t1 = t2;
+    }
+  }
+  for(int k = 0; k < ncep; k ++) dst[k] *= 2.0 / nspec;
+}
+
+static void llsm_vtcep_tomagn(FP_TYPE* cep, int ncep, FP_TYPE fnyq,
+  FP_TYPE* dst, int nspec) {
+  for(int i = 0; i < nspec; i ++)
+    dst[i] = llsm_vtcep_eval(cep, ncep,
+      llsm_vtcep_warp(fnyq * i / (nspec - 1), fnyq));
+}
+
+void llsm_vtcep_magn(FP_TYPE* cep, int ncep, FP_TYPE fnyq, FP_TYPE* freq,
+  int nfreq, FP_TYPE* dst) {
+  for(int i = 0; i < nfreq; i ++)
+    dst[i] = llsm_vtcep_eval(cep, ncep, llsm_vtcep_warp(freq[i], fnyq));
+}
+
+void llsm_frame_compress_vt(llsm_container* dst, llsm_container* conf,
+  int ncep) {
+  FP_TYPE* fnyq = llsm_container_peek(conf, LLSM_CONF_FNYQ);
+  FP_TYPE* vtmagn = llsm_container_peek(dst, LLSM_FRAME_VTMAGN);
+  if(fnyq == NULL || vtmagn == NULL || ncep < 1) return;
+  int nspec = llsm_fparray_length(vtmagn);
+  if(nspec < 2) return;
+  FP_TYPE* vtcep = llsm_create_fparray(ncep);
+  llsm_vtmagn_tocep(vtmagn, nspec, *fnyq, vtcep, ncep);
+  llsm_container_attach(dst, LLSM_FRAME_VTCEP, vtcep, llsm_delete_fparray,
+    llsm_copy_fparray);
+  llsm_container_remove(dst, LLSM_FRAME_VTMAGN);
+}
+
+void llsm_frame_expand_vt(llsm_container* dst, llsm_container* conf) {
+  FP_TYPE* fnyq = llsm_container_peek(conf, LLSM_CONF_FNYQ);
+  int* nspec = llsm_container_peek(conf, LLSM_CONF_NSPEC);
+  FP_TYPE* vtcep = llsm_container_peek(dst, LLSM_FRAME_VTCEP);
+  if(fnyq == NULL || nspec == NULL || vtcep == NULL || *nspec < 2) return;
+  FP_TYPE* vtmagn = llsm_create_fparray(*nspec);
+  llsm_vtcep_tomagn(vtcep, llsm_fparray_length(vtcep), *fnyq, vtmagn,
+    *nspec);
+  llsm_container_attach(dst, LLSM_FRAME_VTMAGN, vtmagn, llsm_delete_fparray,
+    llsm_copy_fparray);
+  llsm_container_remove(dst, LLSM_FRAME_VTCEP);
+}
+
+void llsm_chunk_compress_vt(llsm_chunk* dst, int ncep) {
+  int* nfrm = llsm_container_peek(dst -> conf, LLSM_CONF_NFRM);
+  if(nfrm == NULL) return;
+# ifdef _OPENMP
+# pragma omp parallel for schedule(dynamic, 16)
+# endif
+  for(int i = 0; i < *nfrm; i ++)
+    llsm_frame_compress_vt(dst -> frames[i], dst -> conf, ncep);
+}
+
+void llsm_chunk_expand_vt(llsm_chunk* dst) {
+  int* nfrm = llsm_container_peek(dst -> conf, LLSM_CONF_NFRM);
+  if(nfrm == NULL) return;
+# ifdef _OPENMP
+# pragma omp parallel for schedule(dynamic, 16)
+# endif
+  for(int i = 0; i < *nfrm; i ++)
+    llsm_frame_expand_vt(dst -> frames[i], dst -> conf);
+}
 
-  FP_TYPE* freq = calloc(nhar, sizeof(FP_TYPE));
-  for(int i = 0; i < nhar; i ++) freq[i] = *f0 * (i + 1.0);
+// Rebuild nhar harmonics of a voiced frame from the vocal tract envelope
+//   (nspec, or ncep coefficients of the compact envelope if spec_env is NULL)
+//   and the vocal source phase.
+static void llsm_harmonics_tolayer0(FP_TYPE f0, FP_TYPE rd, FP_TYPE* spec_env,
+  int nspec, FP_TYPE* vt_cep, int ncep, FP_TYPE* vs_phse, int nhar,
+  FP_TYPE lip_radius, FP_TYPE fnyq, layerconv_context* ctx,
+  FP_TYPE* dst_ampl, FP_TYPE* dst_phse) {
+  layerconv_context_reserve(ctx, nhar);
 
-  lfmodel glott = lfmodel_from_rd(*rd, 1.0 / *f0, 1.0);
-  FP_TYPE* vs_ampl = lfmodel_spectrum(glott, freq, nhar, NULL);
+  FP_TYPE* vs_ampl = ctx -> vs_ampl;
+  llsm_lfmodel_harmonics(rd, f0, nhar, vs_ampl, NULL);
   for(int i = 1; i < nhar; i ++) vs_ampl[i] /= (1.0 + i) * vs_ampl[0];
   vs_ampl[0] = 1.0;
 
-  FP_TYPE* faxis = linspace(0, fnyq, nspec);
-  FP_TYPE* vt_ampl = interp1(faxis, spec_env, nspec, freq, nhar);
-  for(int i = 0; i < nhar; i ++)
+  // Sample the envelope (uniform over [0, fnyq]) at the harmonics.
+  FP_TYPE* vt_ampl = ctx -> ampl;
+  for(int i = 0; i < nhar && spec_env == NULL; i ++)
+    vt_ampl[i] = exp(DB2LOG(llsm_vtcep_eval(vt_cep, ncep,
+      llsm_vtcep_warp(f0 * (i + 1.0), fnyq))));
+  for(int i = 0; i < nhar && spec_env != NULL; i ++) {
+    FP_TYPE idx = f0 * (i + 1.0) / fnyq * (nspec - 1);
+    int base = min(nspec - 2, (int)idx);
+    FP_TYPE ratio = min(1.0, idx - base);
+    vt_ampl[i] = spec_env[base] + (spec_env[base + 1] - spec_env[base]) * ratio;
     vt_ampl[i] = exp(DB2LOG(vt_ampl[i]));
-  FP_TYPE* vt_phse = llsm_harmonic_minphase(vt_ampl, nhar);
+  }
+  FP_TYPE* vt_phse = ctx -> vt_phse;
+  llsm_harmonic_minphase_buffered(vt_ampl, nhar, vt_phse, ctx -> buffer);
 
-  llsm_hmframe* hm = llsm_create_hmframe(nhar);
   for(int i = 0; i < nhar; i ++) {
-    hm -> ampl[i] = vt_ampl[i] * vs_ampl[i];
-    hm -> phse[i] = vt_phse[i] + vs_phse[i];
+    dst_ampl[i] = vt_ampl[i] * vs_ampl[i];
+    dst_phse[i] = vt_phse[i] + vs_phse[i];
+  }
+  llsm_lipfilter(lip_radius, f0, nhar, dst_ampl, dst_phse, 0);
+}
+
+// Number of harmonics a voiced layer 1 frame converts into; -1 if src cannot
+//   be converted.
+static int llsm_frame_layer0_nhar(llsm_container* src, llsm_container* conf) {
+  if(! llsm_frame_checklayer1(src)) return -1;
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  FP_TYPE* vs_phse = llsm_container_peek(src, LLSM_FRAME_VSPHSE);
+  if(*f0 == 0) return -1;
+  return llsm_layer0_nhar(*f0, llsm_fparray_length(vs_phse), conf);
+}
+
+// theta (if non-zero) shifts the source phase as llsm_frame_phaseshift does,
+//   without modifying src.
+static void llsm_frame_harmonics_ctx(llsm_container* src,
+  llsm_container* conf, int nhar, FP_TYPE theta, layerconv_context* ctx,
+  FP_TYPE* dst_ampl, FP_TYPE* dst_phse) {
+  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_peek(conf, LLSM_CONF_FNYQ));
+  FP_TYPE lip_radius = *((FP_TYPE*)llsm_container_peek(conf,
+    LLSM_CONF_LIPRADIUS));
+  int nspec = *((int*)llsm_container_peek(conf, LLSM_CONF_NSPEC));
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  FP_TYPE* rd = llsm_container_peek(src, LLSM_FRAME_RD);
+  FP_TYPE* spec_env = llsm_container_peek(src, LLSM_FRAME_VTMAGN);
+  FP_TYPE* vt_cep = llsm_container_peek(src, LLSM_FRAME_VTCEP);
+  FP_TYPE* vs_phse = llsm_container_peek(src, LLSM_FRAME_VSPHSE);
+  int ncep = spec_env == NULL ? llsm_fparray_length(vt_cep) : 0;
+  if(theta != 0) {
+    for(int i = 0; i < nhar; i ++)
+      ctx -> vs_phse[i] = wrap(vs_phse[i] + theta * (i + 1.0));
+    vs_phse = ctx -> vs_phse;
   }
-  llsm_lipfilter(lip_radius, *f0, nhar, hm -> ampl, hm -> phse, 0);
+  llsm_harmonics_tolayer0(*f0, *rd, spec_env, nspec, vt_cep, ncep, vs_phse,
+    nhar, lip_radius, fnyq, ctx, dst_ampl, dst_phse);
+}
+
+static void llsm_frame_tolayer0_ctx(llsm_container* dst, llsm_container* conf,
+  layerconv_context* ctx) {
+  int nhar = llsm_frame_layer0_nhar(dst, conf);
+  if(nhar < 0) return;
+  llsm_hmframe* hm = llsm_create_hmframe(nhar);
+  llsm_frame_harmonics_ctx(dst, conf, nhar, 0, ctx, hm -> ampl, hm -> phse);
   llsm_container_attach(dst, LLSM_FRAME_HM, hm, llsm_delete_hmframe,
     llsm_copy_hmframe);
+}
+
+llsm_layerconv* llsm_create_layerconv() {
+  return create_layerconv_context(0);
+}
+
+void llsm_delete_layerconv(llsm_layerconv* dst) {
+  delete_layerconv_context(dst);
+}
 
-  free(freq);
-  free(faxis);
-  free(vt_ampl); free(vt_phse); free(vs_ampl);
+int llsm_layerconv_harmonics(llsm_layerconv* dst, llsm_container* src,
+  llsm_container* conf, FP_TYPE theta, FP_TYPE** dst_ampl,
+  FP_TYPE** dst_phse) {
+  if(! llsm_layer1to0_check_integrity(conf)) return -1;
+  int nhar = llsm_frame_layer0_nhar(src, conf);
+  if(nhar < 0) return -1;
+  layerconv_context* ctx = dst;
+  layerconv_context_reserve(ctx, nhar);
+  llsm_frame_harmonics_ctx(src, conf, nhar, theta, ctx, ctx -> hm_ampl,
+    ctx -> hm_phse);
+  *dst_ampl = ctx -> hm_ampl;
+  *dst_phse = ctx -> hm_phse;
+  return nhar;
+}
+
+void llsm_frame_tolayer0(llsm_container* dst, llsm_container* conf) {
+  if(! llsm_layer1to0_check_integrity(conf)) return;
+  layerconv_context* ctx = create_layerconv_context(0);
+  llsm_frame_tolayer0_ctx(dst, conf, ctx);
+  delete_layerconv_context(ctx);
+}
+
+// Propagate the phases (if sign is non-zero) and convert to layer 0 in the
+//   same pass.
+static void llsm_chunk_tolayer0_(llsm_chunk* dst, int sign) {
+  if(! llsm_layer1to0_check_integrity(dst -> conf)) {
+    if(sign != 0) llsm_chunk_phasepropagate(dst, sign);
+    return;
+  }
+  int nfrm = *((int*)llsm_container_peek(dst -> conf, LLSM_CONF_NFRM));
+  FP_TYPE* theta = sign != 0 ? llsm_chunk_propagation_phase(dst, nfrm, sign)
+    : NULL;
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    layerconv_context* ctx = create_layerconv_context(0);
+#   ifdef _OPENMP
+#   pragma omp for schedule(dynamic, 16)
+#   endif
+    for(int i = 0; i < nfrm; i ++) {
+      llsm_container* frame = dst -> frames[i];
+      if(theta != NULL) {
+        // The harmonic model of a voiced frame is about to be rebuilt, so it
+        //   is dropped rather than shifted (and possibly cloned).
+        if(llsm_frame_checklayer1(frame) &&
+           *((FP_TYPE*)llsm_container_peek(frame, LLSM_FRAME_F0)) != 0)
+          llsm_container_remove(frame, LLSM_FRAME_HM);
+        llsm_frame_phaseshift(frame, theta[i]);
+      }
+      llsm_frame_tolayer0_ctx(frame, dst -> conf, ctx);
+    }
+    delete_layerconv_context(ctx);
+  }
+  free(theta);
 }
 
 void llsm_chunk_tolayer0(llsm_chunk* dst) {
-  int nfrm = *((int*)llsm_container_get(dst -> conf, LLSM_CONF_NFRM));
+  llsm_chunk_tolayer0_(dst, 0);
+}
+
+void llsm_chunk_tolayer0_propagate(llsm_chunk* dst, int sign) {
+  llsm_chunk_tolayer0_(dst, sign);
+}
+
+// Interpolate the residual PSD of a towards that of b (if any) into dst.
+static void llsm_frame_interp_psdres(llsm_container* dst, llsm_container* a,
+  llsm_container* b, FP_TYPE ratio) {
+  FP_TYPE* a_res = llsm_container_peek(a, LLSM_FRAME_PSDRES);
+  FP_TYPE* b_res = llsm_container_peek(b, LLSM_FRAME_PSDRES);
+  if(a_res == NULL) {
+    llsm_container_remove(dst, LLSM_FRAME_PSDRES);
+    return;
+  }
+  if(b_res == NULL) b_res = a_res;
+  int nres = llsm_fparray_length(a_res);
+  FP_TYPE* dst_res = llsm_container_peek(dst, LLSM_FRAME_PSDRES);
+  int inplace = dst_res != NULL && llsm_fparray_length(dst_res) == nres;
+  dst_res = inplace ? llsm_container_get(dst, LLSM_FRAME_PSDRES) :
+    llsm_create_fparray(nres);
+  for(int i = 0; i < nres; i ++)
+    dst_res[i] = linterp(a_res[i], b_res[i], ratio);
+  if(! inplace)
+    llsm_container_attach(dst, LLSM_FRAME_PSDRES, dst_res,
+      llsm_delete_fparray, llsm_copy_fparray);
+}
+
+llsm_chunk* llsm_chunk_timemap(llsm_chunk* src, int* base, FP_TYPE* ratio,
+  int nfrm) {
+  int* src_nfrm = llsm_container_peek(src -> conf, LLSM_CONF_NFRM);
+  if(src_nfrm == NULL || nfrm < 0) return NULL;
   for(int i = 0; i < nfrm; i ++)
-    llsm_frame_tolayer0(dst -> frames[i], dst -> conf);
+    if(base[i] < 0 || base[i] >= *src_nfrm) return NULL;
+
+  llsm_container* conf = llsm_copy_container(src -> conf);
+  llsm_container_attach(conf, LLSM_CONF_NFRM, llsm_create_int(nfrm),
+    llsm_delete_int, llsm_copy_int);
+  llsm_chunk* ret = llsm_create_chunk(conf, 0);
+  llsm_delete_container(conf);
+
+  // Source frames are only read, and the members an output frame shares
+  //   with them are cloned before being written.
+# ifdef _OPENMP
+# pragma omp parallel for schedule(dynamic, 16)
+# endif
+  for(int i = 0; i < nfrm; i ++) {
+    llsm_container* a = src -> frames[base[i]];
+    llsm_container* b = src -> frames[min(base[i] + 1, *src_nfrm - 1)];
+    ret -> frames[i] = llsm_copy_container(a);
+    llsm_frame_interp_into(ret -> frames[i], a, b, ratio[i]);
+    llsm_frame_interp_psdres(ret -> frames[i], a, b, ratio[i]);
+  }
+  return ret;
+}
+
+static int llsm_flatchunk_checklayer0(llsm_flatchunk* src, int i) {
+  int members = src -> members[i];
+  if(! (members & LLSM_FLAT_NM)) return 0;
+  if(src -> f0[i] != 0 && ! (members & LLSM_FLAT_HM)) return 0;
+  return 1;
+}
+
+static int llsm_flatchunk_checklayer1(llsm_flatchunk* src, int i) {
+  int members = src -> members[i];
+  if(! (members & LLSM_FLAT_RD) || ! (members & LLSM_FLAT_NM)) return 0;
+  if(src -> f0[i] > 0 && ! (members & LLSM_FLAT_VT)) return 0;
+  return 1;
+}
+
+void llsm_flatchunk_tolayer1(llsm_flatchunk* dst, int nfft) {
+  FP_TYPE* thop = llsm_container_peek(dst -> conf, LLSM_CONF_THOP);
+  FP_TYPE* fnyq = llsm_container_peek(dst -> conf, LLSM_CONF_FNYQ);
+  FP_TYPE* liprad = llsm_container_peek(dst -> conf, LLSM_CONF_LIPRADIUS);
+  int nfrm = dst -> nfrm;
+  if(thop == NULL || fnyq == NULL || liprad == NULL || nfrm < 1) return;
+  for(int i = 0; i < nfrm; i ++)
+    if(! llsm_flatchunk_checklayer0(dst, i)) return;
+
+  int nspec = nfft / 2 + 1;
+  llsm_container_attach(dst -> conf, LLSM_CONF_NSPEC,
+    llsm_create_int(nspec), llsm_delete_int, llsm_copy_int);
+  if(nspec != dst -> nspec) {
+    // previous layer 1 data (if any) has a different envelope size
+    free(dst -> vtmagn);
+    dst -> vtmagn = calloc(nfrm * nspec, sizeof(FP_TYPE));
+    dst -> nspec = nspec;
+    for(int i = 0; i < nfrm; i ++)
+      dst -> members[i] &= ~(LLSM_FLAT_VT | LLSM_FLAT_VTMAGN);
+  }
+
+  FP_TYPE** ampl = calloc(nfrm, sizeof(FP_TYPE*));
+  for(int i = 0; i < nfrm; i ++)
+    ampl[i] = dst -> ampl + i * dst -> maxnhar;
+  FP_TYPE* rd = llsm_analyze_rd_(dst -> f0, ampl, dst -> nhar, nfrm, *thop,
+    *liprad);
+  free(ampl);
+  memcpy(dst -> rd, rd, nfrm * sizeof(FP_TYPE));
+  free(rd);
+
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    layerconv_context* ctx = create_layerconv_context(nfft);
+#   ifdef _OPENMP
+#   pragma omp for schedule(dynamic, 16)
+#   endif
+    for(int i = 0; i < nfrm; i ++) {
+      dst -> members[i] |= LLSM_FLAT_RD;
+      if(dst -> f0[i] == 0) continue;
+      int offset = i * dst -> maxnhar;
+      llsm_harmonics_tolayer1(dst -> f0[i], dst -> rd[i],
+        dst -> ampl + offset, dst -> phse + offset, dst -> nhar[i],
+        *liprad, *fnyq, ctx, dst -> vtmagn + i * nspec,
+        dst -> vsphse + offset);
+      dst -> nvs[i] = dst -> nhar[i];
+      dst -> members[i] &= ~LLSM_FLAT_VTMAGN;
+      dst -> members[i] |= LLSM_FLAT_VT;
+    }
+    delete_layerconv_context(ctx);
+  }
+}
+
+void llsm_flatchunk_tolayer0(llsm_flatchunk* dst) {
+  if(! llsm_layer1to0_check_integrity(dst -> conf)) return;
+  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_peek(dst -> conf, LLSM_CONF_FNYQ));
+  FP_TYPE lip_radius = *((FP_TYPE*)llsm_container_peek(dst -> conf,
+    LLSM_CONF_LIPRADIUS));
+  int nspec = dst -> nspec;
+# ifdef _OPENMP
+# pragma omp parallel
+# endif
+  {
+    layerconv_context* ctx = create_layerconv_context(0);
+#   ifdef _OPENMP
+#   pragma omp for schedule(dynamic, 16)
+#   endif
+    for(int i = 0; i < dst -> nfrm; i ++) {
+      if(! llsm_flatchunk_checklayer1(dst, i) || dst -> f0[i] == 0) continue;
+      int offset = i * dst -> maxnhar;
+      int nhar = llsm_layer0_nhar(dst -> f0[i], dst -> nvs[i], dst -> conf);
+      llsm_harmonics_tolayer0(dst -> f0[i], dst -> rd[i],
+        dst -> vtmagn + i * nspec, nspec, NULL, 0, dst -> vsphse + offset,
+        nhar, lip_radius, fnyq, ctx, dst -> ampl + offset,
+        dst -> phse + offset);
+      dst -> nhar[i] = nhar;
+      dst -> members[i] |= LLSM_FLAT_HM;
+    }
+    delete_layerconv_context(ctx);
+  }
 }
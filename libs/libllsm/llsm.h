@@ -22,6 +22,8 @@
 #ifndef LLSM_H
 #define LLSM_H
 
+#include <stddef.h>
+
 #define LLSM_VERSION_STRING   "2.1.0"
 #define LLSM_VERSION_MAJOR    2
 #define LLSM_VERSION_MINOR    1
@@ -33,7 +35,64 @@ typedef void (*llsm_fdestructor)(void*);
 /** @brief Function pointer to copy constructors (e.g. llsm_copy_container). */
 typedef void* (*llsm_fcopy)(void*);
 
+/** @defgroup group_memory Memory Allocation
+ *  @brief The memory behind containers, chunks and fparrays.
+ *
+ *  These blocks carry a header, so they must only be resized and freed with
+ *    these functions. llsm_hmframe, llsm_nmframe and the arrays they hold are
+ *    not among them: they come from plain malloc and may be resized and
+ *    freed with realloc and free.
+ *  When libllsm is built with LLSM_USE_SLAB, blocks are handed out from size
+ *    classes cached per thread, so blocks of recurring sizes are reused
+ *    instead of going through malloc and free. With USE_PTHREAD the cache of
+ *    a thread is released when the thread exits; otherwise the thread has to
+ *    call llsm_trim_allocator.
+ *  While a thread uses an arena, its own allocations are carved out of the
+ *    arena instead; freeing them does nothing, and all of them are released
+ *    at once by llsm_delete_arena. An arena only covers the thread that
+ *    selected it: the parallel passes of libllsm (layer conversion,
+ *    analysis and synthesis under OpenMP) allocate on their worker threads,
+ *    outside of it. Freed blocks are not reused either, so an arena suits
+ *    short-lived, single-threaded work whose objects would otherwise be
+ *    freed one by one, not long or parallel processing.
+ *  @{ */
+/** @brief Allocation statistics (summed over all threads); only collected
+ *    when libllsm is built with LLSM_ALLOC_STAT, otherwise all zero. */
+typedef struct {
+  long nalloc;  /**< number of blocks allocated */
+  long nfree;   /**< number of blocks freed */
+  long nmalloc; /**< number of times malloc was called */
+  long ncached; /**< number of freed blocks kept for reuse */
+  long narena;  /**< number of blocks allocated from arenas */
+} llsm_allocstat;
+
+void* llsm_malloc(size_t size);
+void* llsm_calloc(size_t nmemb, size_t size);
+void* llsm_realloc(void* ptr, size_t size);
+void  llsm_free(void* ptr);
+/** @brief Give the blocks cached by the calling thread back to the
+ *    system. */
+void  llsm_trim_allocator();
+/** @brief Get the allocation statistics. */
+void  llsm_get_allocstat(llsm_allocstat* dst);
+
+typedef void llsm_arena;
+/** @brief Create an arena that grows by chunks of chunksize bytes. */
+llsm_arena* llsm_create_arena(size_t chunksize);
+/** @brief Release all the memory allocated from an arena. Objects allocated
+ *    from the arena must not be used (or deleted) afterwards, except that
+ *    the members they own outside the arena (e.g. llsm_create_fp) are only
+ *    released by deleting the objects. */
+void llsm_delete_arena(llsm_arena* dst);
+/** @brief Allocate from src on the calling thread from now on (or from the
+ *    heap if src is NULL); return the arena used so far. Threads spawned
+ *    inside (e.g. by OpenMP) keep allocating from the heap. */
+llsm_arena* llsm_use_arena(llsm_arena* src);
+/** @} */
+
 /** @defgroup group_utils Container-related Utilities
+ *  Scalars (llsm_create_fp, llsm_create_int) come from plain malloc, so they
+ *    may be freed with free.
  *  @{ */
 FP_TYPE* llsm_create_fp(FP_TYPE x);
 int*     llsm_create_int(int x);
@@ -55,12 +114,17 @@ typedef struct {
   void** members;
   llsm_fdestructor* destructors;
   llsm_fcopy* copyctors;
+  long** refcounts; /**< reference counts of the owned members */
   int nmember;
 } llsm_container;
 
 /** @brief Create an empty container object. */
 llsm_container* llsm_create_container(int nmember);
-/** @brief Copy-construct a container object from an existing one. */
+/** @brief Copy-construct a container object from an existing one.
+ *
+ *  Members with both a destructor and a copy constructor are not copied but
+ *    shared with src through a reference count; the copy constructor is only
+ *    called when a shared member is accessed by llsm_container_get. */
 llsm_container* llsm_copy_container(llsm_container* src);
 /** @brief In-place version of llsm_copy_container. */
 void llsm_copy_container_inplace(llsm_container* dst, llsm_container* src);
@@ -70,8 +134,19 @@ void llsm_copy_container_inplace(llsm_container* dst, llsm_container* src);
  *    deleting the container. */
 void llsm_delete_container(llsm_container* dst);
 
-/** @brief Get the member at index from a container. */
+/** @brief Get the member at index from a container for modification.
+ *
+ *  A member shared with copies of the container (see llsm_copy_container) is
+ *    cloned first, so the returned pointer is owned by src alone. This makes
+ *    get a write to src: it may allocate, and it must not run concurrently
+ *    with other accesses to src. Previously fetched pointers to the member
+ *    are invalidated, and the pointer should be fetched again after the
+ *    container is copied. Use llsm_container_peek for read-only access. */
 void* llsm_container_get(llsm_container* src, int index);
+/** @brief Get the member at index from a container without cloning it. The
+ *    member may be shared with copies of the container and must not be
+ *    modified; concurrent peeks are safe. */
+void* llsm_container_peek(llsm_container* src, int index);
 /** @brief Attach (shallow-copy) an object to a container.
  *
  *  If destructor is NULL, the added member will not be deleted when
@@ -106,6 +181,9 @@ void llsm_container_remove(llsm_container* dst, int index);
 #define LLSM_FRAME_VTMAGN   11  /**< vocal tract magnitude response
                                      (FP_TYPE*, dB) */
 #define LLSM_FRAME_VSPHSE   12  /**< vocal source harmonic phase (FP_TYPE*) */
+#define LLSM_FRAME_VTCEP    13  /**< compact vocal tract magnitude response;
+                                     mel-cepstrum of LLSM_FRAME_VTMAGN
+                                     (FP_TYPE*), used in place of it */
 /** @} */
 
 /** @defgroup group_config_index Indexing Macros for LLSM Configuration
@@ -186,14 +264,24 @@ typedef struct {
   FP_TYPE Ee; /**< decay slope (normalized to 1) */
 } llsm_gfm;
 
-/** @brief Function pointer for customized glottal flow modification. */
+/** @brief Function pointer for customized glottal flow modification.
+ *    src_frame is passed as stored, without the phase propagation applied
+ *    during synthesis (see llsm_fgfm_propagated). */
 typedef void (*llsm_fgfm)(llsm_gfm* dst, FP_TYPE* delta_t, void* info,
   llsm_container* src_frame);
 
+/** @brief Same as llsm_fgfm, but also given the phase theta by which the
+ *    synthesizer propagates src_frame (see llsm_soptions.propagate; 0 if
+ *    the phases are not propagated). src_frame itself is not shifted. */
+typedef void (*llsm_fgfm_propagated)(llsm_gfm* dst, FP_TYPE* delta_t,
+  void* info, llsm_container* src_frame, FP_TYPE theta);
+
 /** @brief Pulse-by-Pulse synthesis effect. */
 typedef struct {
   llsm_fgfm modifier;
   void* info;
+  llsm_fgfm_propagated modifier_propagated; /**< if not NULL, called instead
+                                                 of modifier */
 } llsm_pbpeffect;
 
 /** @brief Create a Pulse-by-Pulse synthesis effect object. When modifying
@@ -201,6 +289,11 @@ typedef struct {
  *    of the frames; the objects may share the same modifier and info. */
 llsm_pbpeffect* llsm_create_pbpeffect(llsm_fgfm modifier, void* info);
 
+/** @brief Same as llsm_create_pbpeffect, for a modifier that takes the
+ *    propagation phase. */
+llsm_pbpeffect* llsm_create_pbpeffect_propagated(
+  llsm_fgfm_propagated modifier, void* info);
+
 /** @brief Create a copy of a Pulse-by-Pulse synthesis effect object. */
 llsm_pbpeffect* llsm_copy_pbpeffect(llsm_pbpeffect* src);
 
@@ -223,6 +316,24 @@ void llsm_frame_tolayer0(llsm_container* dst, llsm_container* conf);
 void llsm_frame_phaseshift(llsm_container* dst, FP_TYPE theta);
 /** @brief Convert from absolute phase to relative phase shift (RPS). */
 void llsm_frame_phasesync_rps(llsm_container* dst, int layer1_based);
+/** @brief Interpolate between two layer 1 frames a (ratio = 0) and b
+ *    (ratio = 1) and write F0, Rd, the vocal tract magnitude, the vocal
+ *    source phase and the noise model into dst. Phases are interpolated on
+ *    the unit circle. When only one of the frames is voiced, its source
+ *    parameters are taken and its vocal tract magnitude is faded by the
+ *    interpolation weight. Members of dst are overwritten in place when their
+ *    sizes match and other members are left untouched; dst may be a or b. */
+void llsm_frame_interp_into(llsm_container* dst, llsm_container* a,
+  llsm_container* b, FP_TYPE ratio);
+/** @brief Replace the vocal tract magnitude response of a layer 1 frame by
+ *    ncep mel-cepstral coefficients (LLSM_FRAME_VTCEP). Interpolation and
+ *    layer 0 conversion work on the compact envelope directly; layer 1
+ *    synthesis and flat chunks need llsm_frame_expand_vt first. */
+void llsm_frame_compress_vt(llsm_container* dst, llsm_container* conf,
+  int ncep);
+/** @brief Restore the vocal tract magnitude response (LLSM_CONF_NSPEC bins)
+ *    of a frame from its compact envelope. */
+void llsm_frame_expand_vt(llsm_container* dst, llsm_container* conf);
 /** @brief Compute the Signal-to-Noise Ratio from the layer 0 representation;
       return SNR (dB) or Aperiodicity (linear) on a warped frequency axis. */
 FP_TYPE* llsm_frame_compute_snr(llsm_container* src, llsm_container* conf,
@@ -291,6 +402,16 @@ llsm_container* llsm_aoptions_toconf(llsm_aoptions* src, FP_TYPE fnyq);
 
 /** @defgroup group_soptions llsm_soptions
  *  @{ */
+/** @brief The number of harmonics above which ICZT based harmonic signal
+ *    generation outruns the recurrent method, measured on the host CPU for
+ *    a grid of frame lengths. */
+typedef struct {
+  int nnx;           /**< number of frame lengths */
+  int* nx;           /**< frame lengths (ascending) */
+  FP_TYPE* nhar;     /**< crossover number of harmonics at each frame
+                          length */
+} llsm_iczt_table;
+
 /** @brief Options for the synthesis routine. */
 typedef struct {
   FP_TYPE fs;           /**< output sampling rate (Hz) */
@@ -299,14 +420,53 @@ typedef struct {
                              than the recurrent method */
   int use_l1;           /**< directly use L1 parameters for synthesis; does
                              L1-to-L0 conversion on the fly */
+  int propagate;        /**< if non-zero, the phases are propagated while
+                             synthesizing, as llsm_chunk_phasepropagate
+                             would with this sign; the input is untouched */
   FP_TYPE iczt_param_a; /**< the slope parameter for switching on/off ICZT */
   FP_TYPE iczt_param_b; /**< the offset parameter for switching on/off ICZT */
+  llsm_iczt_table* iczt_table; /**< if not NULL, the measured crossover
+                                    overrides iczt_param_a/b; owned and
+                                    freed by the options */
 } llsm_soptions;
 
 /** @brief Create default synthesis options. */
 llsm_soptions* llsm_create_soptions(FP_TYPE fs);
 /** @brief Delete and free synthesis options. */
 void llsm_delete_soptions(llsm_soptions* dst);
+
+/** @brief Create a crossover table by timing both harmonic synthesis methods
+ *    over nnx frame lengths and nnhar harmonic counts (log-spaced). A grid of
+ *    nnx = 8, nnhar = 10 takes a few seconds. */
+llsm_iczt_table* llsm_calibrate_iczt_table(int nnx, int nnhar);
+/** @brief Copy-construct a crossover table; returns NULL if src is NULL. */
+llsm_iczt_table* llsm_copy_iczt_table(llsm_iczt_table* src);
+/** @brief Delete and free a crossover table. */
+void llsm_delete_iczt_table(llsm_iczt_table* dst);
+/** @brief Save a crossover table as text; returns 1 on success. */
+int llsm_save_iczt_table(llsm_iczt_table* src, const char* path);
+/** @brief Load a crossover table saved by llsm_save_iczt_table; returns NULL
+ *    if the file does not exist or is malformed. */
+llsm_iczt_table* llsm_load_iczt_table(const char* path);
+/** @brief Check if ICZT is expected to be faster for nhar harmonics in a
+ *    frame of nx samples. The crossover is interpolated in log scale and held
+ *    constant beyond the measured frame lengths. */
+int llsm_iczt_table_query(llsm_iczt_table* src, int nx, int nhar);
+/** @} */
+
+/** @defgroup group_noise_templates Noise Templates
+ *  @{ */
+/** @brief Save the band-limited noise templates generated so far in this
+ *    process (shared by llsm_synthesize and llsm_rtsynth_buffer); returns 1
+ *    on success. */
+int llsm_save_noise_templates(const char* path);
+/** @brief Add the noise templates saved by llsm_save_noise_templates to the
+ *    process-wide cache; returns 0 if the file does not exist or is
+ *    malformed. */
+int llsm_load_noise_templates(const char* path);
+/** @brief Number of noise templates in the process-wide cache, either
+ *    generated or loaded; a save is only worthwhile if it has grown. */
+int llsm_num_noise_templates();
 /** @} */
 
 /** @defgroup group_chunk llsm_chunk
@@ -334,6 +494,25 @@ void llsm_chunk_tolayer0(llsm_chunk* dst);
 void llsm_chunk_phasesync_rps(llsm_chunk* dst, int layer1_based);
 /** @brief Add or subtract the integration of F0 to/from the phase vectors. */
 void llsm_chunk_phasepropagate(llsm_chunk* dst, int sign);
+/** @brief Same as llsm_chunk_tolayer1 followed by
+ *    llsm_chunk_phasepropagate(dst, sign), in a single pass over the frames. */
+void llsm_chunk_tolayer1_propagate(llsm_chunk* dst, int nfft, int sign);
+/** @brief Same as llsm_chunk_phasepropagate(dst, sign) followed by
+ *    llsm_chunk_tolayer0, in a single pass over the frames. The harmonic
+ *    model of voiced frames is rebuilt without being shifted first. */
+void llsm_chunk_tolayer0_propagate(llsm_chunk* dst, int sign);
+/** @brief Create a chunk of nfrm frames from a layer 1 chunk along a time
+ *    map: frame i is interpolated between frames base[i] and base[i] + 1 of
+ *    src by ratio[i] (see llsm_frame_interp_into), together with the
+ *    residual PSD. Other members are shared with frame base[i]. The map may
+ *    stretch, compress or loop the source; returns NULL if an index is out
+ *    of range. */
+llsm_chunk* llsm_chunk_timemap(llsm_chunk* src, int* base, FP_TYPE* ratio,
+  int nfrm);
+/** @brief An extension of llsm_frame_compress_vt to LLSM chunks. */
+void llsm_chunk_compress_vt(llsm_chunk* dst, int ncep);
+/** @brief An extension of llsm_frame_expand_vt to LLSM chunks. */
+void llsm_chunk_expand_vt(llsm_chunk* dst);
 /** @brief Get F0 and number of frames from a parameter chunk. */
 FP_TYPE* llsm_chunk_getf0(llsm_chunk* src, int* dst_nfrm);
 
@@ -344,6 +523,87 @@ llsm_chunk* llsm_analyze(llsm_aoptions* options, FP_TYPE* x, int nx,
 llsm_output* llsm_synthesize(llsm_soptions* options, llsm_chunk* src);
 /** @} */
 
+/** @defgroup group_flatchunk llsm_flatchunk
+ *  @{ */
+/** @defgroup group_flatchunk_member Member Flags for Flat Chunk Frames
+ *  @brief Bit flags indicating which parameters a frame in a flat chunk has.
+ *  @{ */
+#define LLSM_FLAT_HM      1  /**< harmonic model (nhar, ampl, phse) */
+#define LLSM_FLAT_NM      2  /**< noise model (nhar_e, eenv_*, edc, psd) */
+#define LLSM_FLAT_PSDRES  4  /**< residual PSD (psdres) */
+#define LLSM_FLAT_RD      8  /**< Rd parameter (rd) */
+#define LLSM_FLAT_VT     16  /**< vocal tract magnitude response and vocal
+                                  source phase (vtmagn, nvs, vsphse) */
+#define LLSM_FLAT_PBPSYN 32  /**< Pulse-by-Pulse synthesis switch (pbpsyn) */
+#define LLSM_FLAT_VTMAGN 64  /**< vocal tract magnitude response of a frame
+                                  without vocal source phase (vtmagn) */
+/** @} */
+
+/** @brief A LLSM parameter chunk stored as a structure of arrays. Each
+ *    parameter of all frames lives in one contiguous array; vectors are
+ *    stored row by row with a fixed row size, so frame i of e.g. ampl
+ *    starts at ampl + i * maxnhar. Pulse-by-Pulse effects are not
+ *    represented. */
+typedef struct {
+  llsm_container* conf; /**< model configuration (owned) */
+  int nfrm;             /**< number of frames */
+  int nchannel;         /**< number of noise channels */
+  int maxnhar;          /**< row size of ampl, phse and vsphse */
+  int maxnhar_e;        /**< row size of eenv_ampl and eenv_phse */
+  int npsd;             /**< row size of psd and psdres */
+  int nspec;            /**< row size of vtmagn */
+  int* members;         /**< member flags (LLSM_FLAT_*) of each frame */
+  FP_TYPE* f0;          /**< fundamental frequency, nfrm */
+  FP_TYPE* rd;          /**< Rd parameter, nfrm */
+  int* pbpsyn;          /**< use Pulse-by-Pulse synthesis, nfrm */
+  int* nhar;            /**< number of harmonics, nfrm */
+  FP_TYPE* ampl;        /**< harmonic amplitude, nfrm x maxnhar */
+  FP_TYPE* phse;        /**< harmonic phase, nfrm x maxnhar */
+  int* nhar_e;          /**< number of noise envelope harmonics,
+                             nfrm x nchannel */
+  FP_TYPE* eenv_ampl;   /**< noise envelope amplitude,
+                             nfrm x nchannel x maxnhar_e */
+  FP_TYPE* eenv_phse;   /**< noise envelope phase,
+                             nfrm x nchannel x maxnhar_e */
+  FP_TYPE* edc;         /**< noise envelope mean, nfrm x nchannel */
+  FP_TYPE* psd;         /**< noise PSD (dB), nfrm x npsd */
+  FP_TYPE* psdres;      /**< residual PSD, nfrm x npsd */
+  FP_TYPE* vtmagn;      /**< vocal tract magnitude response (dB),
+                             nfrm x nspec */
+  int* nvs;             /**< size of the vocal source phase vector, nfrm */
+  FP_TYPE* vsphse;      /**< vocal source harmonic phase, nfrm x maxnhar */
+} llsm_flatchunk;
+
+/** @brief Create a flat chunk of nfrm empty frames; the row sizes are taken
+ *    from conf (LLSM_CONF_MAXNHAR, LLSM_CONF_MAXNHAR_E, LLSM_CONF_NPSD,
+ *    LLSM_CONF_NCHANNEL and, if present, LLSM_CONF_NSPEC). */
+llsm_flatchunk* llsm_create_flatchunk(llsm_container* conf, int nfrm);
+/** @brief Delete and free a flat chunk. */
+void llsm_delete_flatchunk(llsm_flatchunk* dst);
+/** @brief Flatten a parameter chunk. The row sizes grow to fit the largest
+ *    frame in src. */
+llsm_flatchunk* llsm_chunk_toflat(llsm_chunk* src);
+/** @brief Convert a flat chunk back into an array of LLSM frames. */
+llsm_chunk* llsm_flatchunk_tochunk(llsm_flatchunk* src);
+
+/** @brief Same as llsm_chunk_tolayer1, but on a flat chunk. */
+void llsm_flatchunk_tolayer1(llsm_flatchunk* dst, int nfft);
+/** @brief Same as llsm_chunk_tolayer0, but on a flat chunk. */
+void llsm_flatchunk_tolayer0(llsm_flatchunk* dst);
+/** @brief Same as llsm_chunk_phasepropagate, but on a flat chunk. */
+void llsm_flatchunk_phasepropagate(llsm_flatchunk* dst, int sign);
+
+/** @brief Same as llsm_analyze, except that the result is flattened. */
+llsm_flatchunk* llsm_analyze_flat(llsm_aoptions* options, FP_TYPE* x, int nx,
+  FP_TYPE fs, FP_TYPE* f0, int nfrm, FP_TYPE** x_ap);
+/** @brief Generate speech from a flat chunk. Layer 0 synthesis and the noise
+ *    component read the arrays directly; with options -> use_l1 the
+ *    harmonic component still goes through LLSM frames, since
+ *    Pulse-by-Pulse synthesis works on them. */
+llsm_output* llsm_synthesize_flat(llsm_soptions* options,
+  llsm_flatchunk* src);
+/** @} */
+
 /** @defgroup group_coder LLSM Coder
  *  @{ */
 /** @brief Temporary data for (lossy) encoding and decoding of LLSM frames.
@@ -17,8 +17,15 @@
   along with libllsm. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#define _DEFAULT_SOURCE
+
 #ifdef USE_PTHREAD
 #include <pthread.h>
+#include <time.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
 #endif
 
 #include <ciglet/ciglet.h>
@@ -30,7 +37,6 @@
 #include "constants.h"
 
 typedef struct {
-  int nout;      // number of output samples left in buffer_out
   int nchannel;  // number of noise channels
   int ntemplate; // size of the noise template
   int ninternal; // capacity of the internal buffers
@@ -43,67 +49,116 @@ typedef struct {
                  //   (in seconds)
   FP_TYPE pulse; // the most recent pulse location relative to floored sample
                  //   position (in samples)
+  FP_TYPE f0_sum; // sum of the F0 fed so far (with opt.propagate)
+  FP_TYPE theta;  // propagation phase of the current frame (with
+                  //   opt.propagate)
   int curr_nhop; // rounding-adjusted current hop size (in samples)
   int next_nhop; // rounding-adjusted next hop size (in samples)
   int exc_cycle; // current position in the noise template
   int sin_pos;   // read position of the sinusoid buffer
-  FP_TYPE* win;  // overlap-add window
+  int maxnhop;   // upper bound of the hop size (in samples)
+  FP_TYPE* win;  // overlap-add window (points into win_cache)
+  FP_TYPE wsqr;  // power of the overlap-add window
+  int win_nhop[2];      // hop sizes of the cached windows
+  FP_TYPE* win_cache[2]; // cached windows; size: maxnhop * 2
+  FP_TYPE win_wsqr[2];  // power of the cached windows
   int nfft;      // FFT size for noise filtering
   int pbp_offset; // sample offset for mixing pulses into buffer_sin
   int pbp_state;  // on = 1, off = 0
-  llsm_nmframe* prev_nm; // the previous noise model frame
-
-  llsm_ringbuffer*  buffer_out_p;     // output buffer for periodic signal
-  llsm_ringbuffer*  buffer_out_ap;    // output buffer for aperiodic signal
+  llsm_nmframe* prev_nm; // the previous noise model frame (points to
+                         //   nm_storage, or NULL)
+  llsm_nmframe* nm_storage; // preallocated copy of the previous frame
+
+  llsm_spscbuffer*  buffer_out;       // output buffer for periodic (channel
+                                      //   0) and aperiodic (1) signal; the
+                                      //   only state shared with the reader
+                                      //   besides the wait state below
+  long wait_space;                     // free space (in samples) the
+                                      //   writer is blocked on, 0 if it
+                                      //   is not waiting (atomic)
+  long wait_size;                     // number of samples the reader is
+                                      //   blocked on, 0 if it is not
+                                      //   waiting (atomic)
+# ifdef USE_PTHREAD
+  pthread_mutex_t wait_mtx;
+  pthread_cond_t wait_cv;
+# endif
 
   FP_TYPE** exc_template_comps;       // noise template for each channel
+                                      //   (shared, not owned)
   llsm_ringbuffer** buffer_mod_comps; // noise modulation buffer for each
                                       //   channel
   llsm_ringbuffer*  buffer_exc_mix;   // buffer for the sum of noise excitation
   llsm_ringbuffer*  buffer_noise;     // buffer for the filtered noise
   llsm_ringbuffer*  buffer_sin;       // buffer for the sinusoidal component
   llsm_dualbuffer*  buffer_pulse;     // buffer for the sum of pulses (PBPSYN)
+  llsm_pbp_engine*  pbp;              // scratch for making pulses
+  llsm_layerconv*   conv;             // scratch for layer 1 harmonics
 
-  FP_TYPE* buffer_psd; // size: nspec
-  FP_TYPE* buffer_fft; // size: nfft * 4
+  FP_TYPE* buffer_fft; // size: nfft + llsm_filter_noise_frame_buffersize
   FP_TYPE* buffer_rawexc; // size: ninternal
   FP_TYPE* buffer_rawmod; // size: ninternal
+  FP_TYPE* buffer_ola;    // size: ninternal
+  FP_TYPE* buffer_frame;  // size: maxnhop * 2
   FP_TYPE* buffer_phase;  // size: nfft
+  FP_TYPE* buffer_synth;  // size: synth_size
+  int synth_nhar;         // number of harmonics buffer_synth can take
+  int synth_size;
   FP_TYPE* psd_axis;  // size: npsd
-
-# ifdef USE_PTHREAD
-  pthread_mutex_t buffer_out_mtx;
-  pthread_cond_t  buffer_out_cv;
-# endif
 } llsm_rtsynth_buffer_;
 
-static FP_TYPE llsm_get_circular_noise(FP_TYPE* x, int nx, int i) {
-  int overlap = 32;
-  i = i % nx;
-  if(i >= overlap) return x[i];
-
-  FP_TYPE y = x[i];
-  FP_TYPE r = (FP_TYPE)i / overlap;
-  y *= 1.0 - r;
-  y += x[nx - overlap + i] * r;
-  y /= sqrt(2 * r * (r - 1) + 1);
-  return y;
-}
-
+// Point to the process-wide noise templates; channels above Nyquist are
+//   left NULL.
 static void llsm_make_exc_template(llsm_rtsynth_buffer_* dst,
   FP_TYPE* chanfreq) {
   FP_TYPE fs = dst -> fs;
   for(int c = 0; c < dst -> nchannel; c ++) {
     FP_TYPE fmin = c == 0 ? 0 : chanfreq[c - 1];
     FP_TYPE fmax = c == dst -> nchannel - 1 ? fs / 2.0 : chanfreq[c];
-    if(fmin >= fs / 2.0) break;
-    FP_TYPE* x = llsm_generate_bandlimited_noise(
-      dst -> ntemplate, fmin / fs, fmax / fs);
-    for(int j = 0; j < dst -> ntemplate; j ++)
-      dst -> exc_template_comps[c][j] = llsm_get_circular_noise(x,
-        dst -> ntemplate, j);
-    free(x);
+    dst -> exc_template_comps[c] = NULL;
+    if(fmin >= fs / 2.0) continue;
+    dst -> exc_template_comps[c] = llsm_get_noise_template(fmin / fs,
+      fmax / fs, & dst -> ntemplate);
+  }
+}
+
+// Same as hanning_2, except that the window is written into dst.
+static void llsm_fill_window(FP_TYPE* dst, int n) {
+  for(int i = 0; i < n; i ++)
+    dst[i] = 0.5 * (1 - cos_2(2 * M_PI * i / (n - 1)));
+}
+
+static FP_TYPE llsm_window_power(FP_TYPE* w, int n) {
+  FP_TYPE wsqr = 0;
+  for(int i = 0; i < n; i ++)
+    wsqr += w[i] * w[i];
+  return wsqr;
+}
+
+// The hop size only alternates between floor(thop * fs) and one sample
+//   more, so both windows are made once; any other size (from rounding
+//   errors) replaces the second slot.
+static void llsm_select_window(llsm_rtsynth_buffer_* dst, int nhop) {
+  int slot = dst -> win_nhop[0] == nhop ? 0 : 1;
+  if(dst -> win_nhop[slot] != nhop) {
+    llsm_fill_window(dst -> win_cache[slot], nhop * 2);
+    dst -> win_wsqr[slot] = llsm_window_power(dst -> win_cache[slot],
+      nhop * 2);
+    dst -> win_nhop[slot] = nhop;
   }
+  dst -> win = dst -> win_cache[slot];
+  dst -> wsqr = dst -> win_wsqr[slot];
+}
+
+// Make sure buffer_synth is large enough for nhar harmonics; only grows
+//   when a frame has more harmonics than the configuration promised.
+static void llsm_reserve_synth(llsm_rtsynth_buffer_* dst, int nhar) {
+  if(nhar <= dst -> synth_nhar) return;
+  dst -> synth_nhar = nhar;
+  dst -> synth_size = llsm_synthesize_harmonic_frame_auto_buffersize(
+    nhar, dst -> maxnhop * 2);
+  free(dst -> buffer_synth);
+  dst -> buffer_synth = malloc(dst -> synth_size * sizeof(FP_TYPE));
 }
 
 // Prepare for synthesizing the next frame.
@@ -116,8 +171,7 @@ static void llsm_update_cycle(llsm_rtsynth_buffer_* dst) {
   dst -> pulse -= prev_nhop;
   if(dst -> pbp_state && dst -> pbp_offset > dst -> sin_pos + dst -> curr_nhop)
     dst -> pbp_offset -= prev_nhop;
-  int nwin = dst -> curr_nhop * 2;
-  free(dst -> win); dst -> win = hanning_2(nwin);
+  llsm_select_window(dst, dst -> curr_nhop);
 
   dst -> next_nhop = floor((dst -> cycle + dst -> thop) * dst -> fs);
 
@@ -136,6 +190,7 @@ static void llsm_run_excitation_buffers(llsm_rtsynth_buffer_* dst, int nx) {
   FP_TYPE* m = dst -> buffer_rawmod; // modulation
   memset(x, 0, nx * sizeof(FP_TYPE));
   for(int c = 0; c < dst -> nchannel; c ++) {
+    if(dst -> exc_template_comps[c] == NULL) continue;
     llsm_ringbuffer_readchunk(dst -> buffer_mod_comps[c],
       -dst -> curr_nhop - nx, nx, m);
     for(int i = 0; i < nx; i ++)
@@ -157,59 +212,83 @@ static void llsm_fill_excitation_buffers(llsm_rtsynth_buffer_* dst) {
 llsm_rtsynth_buffer* llsm_create_rtsynth_buffer(llsm_soptions* options,
   llsm_container* conf, int capacity_samples) {
 
-  int* nchannel = llsm_container_get(conf, LLSM_CONF_NCHANNEL);
-  FP_TYPE* thop = llsm_container_get(conf, LLSM_CONF_THOP);
-  FP_TYPE* chanfreq = llsm_container_get(conf, LLSM_CONF_CHANFREQ);
+  int* nchannel = llsm_container_peek(conf, LLSM_CONF_NCHANNEL);
+  FP_TYPE* thop = llsm_container_peek(conf, LLSM_CONF_THOP);
+  FP_TYPE* chanfreq = llsm_container_peek(conf, LLSM_CONF_CHANFREQ);
   if(nchannel == NULL || thop == NULL || chanfreq == NULL) return NULL;
 
   llsm_rtsynth_buffer_* ret = malloc(sizeof(llsm_rtsynth_buffer_));
-  ret -> nout = 0;
   ret -> nchannel = *nchannel;
-  ret -> ntemplate = options -> fs;
+  ret -> ntemplate = 1;
   ret -> ninternal = options -> fs * 0.2; // 0.2 sec buffers
   ret -> conf = llsm_copy_container(conf);
   ret -> opt = *options;
+  ret -> opt.iczt_table = llsm_copy_iczt_table(options -> iczt_table);
 
   ret -> fs = options -> fs;
   ret -> thop = *thop;
   ret -> cycle = 0;
   ret -> pulse = 0;
+  ret -> f0_sum = 0;
+  ret -> theta = 0;
   ret -> curr_nhop = 0;
   ret -> next_nhop = 0;
   ret -> exc_cycle = 0;
-  ret -> win = NULL;
   ret -> nfft = pow(2, ceil(log2(*thop * ret -> fs * 2.2 + 32)));
   ret -> pbp_offset = 0;
   ret -> pbp_state = 0;
   ret -> prev_nm = NULL;
 
-  ret -> buffer_out_p  = llsm_create_ringbuffer(capacity_samples);
-  ret -> buffer_out_ap = llsm_create_ringbuffer(capacity_samples);
+  int nhop0 = floor(*thop * ret -> fs);
+  ret -> maxnhop = nhop0 + 2;
+  for(int s = 0; s < 2; s ++) {
+    ret -> win_nhop[s] = nhop0 + s;
+    ret -> win_cache[s] = malloc(ret -> maxnhop * 2 * sizeof(FP_TYPE));
+    llsm_fill_window(ret -> win_cache[s], (nhop0 + s) * 2);
+    ret -> win_wsqr[s] = llsm_window_power(ret -> win_cache[s],
+      (nhop0 + s) * 2);
+  }
+  ret -> win = ret -> win_cache[0];
+  ret -> wsqr = ret -> win_wsqr[0];
+
+  ret -> buffer_out = llsm_create_spscbuffer(capacity_samples, 2);
+  ret -> wait_space = 0;
+  ret -> wait_size = 0;
+# ifdef USE_PTHREAD
+  pthread_mutex_init(& ret -> wait_mtx, NULL);
+  pthread_cond_init(& ret -> wait_cv, NULL);
+# endif
   ret -> buffer_exc_mix = llsm_create_ringbuffer(ret -> ninternal);
   ret -> buffer_noise = llsm_create_ringbuffer(ret -> ninternal);
   ret -> buffer_sin   = llsm_create_ringbuffer(ret -> ninternal);
   ret -> buffer_pulse = llsm_create_dualbuffer(ret -> ninternal);
+  ret -> pbp = llsm_create_pbp_engine();
+  ret -> conv = llsm_create_layerconv();
 
-  ret -> exc_template_comps = malloc2d(*nchannel, ret -> ntemplate,
-    sizeof(FP_TYPE));
+  ret -> exc_template_comps = malloc(*nchannel * sizeof(FP_TYPE*));
   ret -> buffer_mod_comps = malloc(*nchannel * sizeof(llsm_ringbuffer*));
   for(int i = 0; i < *nchannel; i ++)
     ret -> buffer_mod_comps[i] = llsm_create_ringbuffer(ret -> ninternal);
 
-  int npsd = *((int*)llsm_container_get(conf, LLSM_CONF_NPSD));
-  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_get(conf, LLSM_CONF_FNYQ));
-  ret -> buffer_psd = calloc(ret -> nfft / 2 + 1, sizeof(FP_TYPE));
-  ret -> buffer_fft = calloc(ret -> nfft * 4, sizeof(FP_TYPE));
+  int npsd = *((int*)llsm_container_peek(conf, LLSM_CONF_NPSD));
+  FP_TYPE fnyq = *((FP_TYPE*)llsm_container_peek(conf, LLSM_CONF_FNYQ));
+  int* maxnhar = llsm_container_peek(conf, LLSM_CONF_MAXNHAR);
+  int* maxnhar_e = llsm_container_peek(conf, LLSM_CONF_MAXNHAR_E);
+  int nhar_e = maxnhar_e == NULL ? 0 : *maxnhar_e;
+  ret -> buffer_fft = calloc(ret -> nfft +
+    llsm_filter_noise_frame_buffersize(ret -> nfft), sizeof(FP_TYPE));
   ret -> buffer_rawexc = calloc(ret -> ninternal, sizeof(FP_TYPE));
   ret -> buffer_rawmod = calloc(ret -> ninternal, sizeof(FP_TYPE));
+  ret -> buffer_ola    = calloc(ret -> ninternal, sizeof(FP_TYPE));
+  ret -> buffer_frame  = calloc(ret -> maxnhop * 2, sizeof(FP_TYPE));
   ret -> buffer_phase  = calloc(ret -> nfft, sizeof(FP_TYPE));
+  ret -> buffer_synth = NULL;
+  ret -> synth_nhar = -1;
+  llsm_reserve_synth(ret, max(nhar_e, maxnhar == NULL ? ret -> nfft :
+    min(*maxnhar, ret -> nfft)));
+  ret -> nm_storage = llsm_create_nmframe(ret -> nchannel, nhar_e, npsd);
   ret -> psd_axis = linspace(0, fnyq, npsd);
 
-# ifdef USE_PTHREAD
-  pthread_mutex_init(& ret -> buffer_out_mtx, NULL);
-  pthread_cond_init(& ret -> buffer_out_cv, NULL);
-# endif
-
   // fill in curr_nhop and reset the cycle counter
   ret -> curr_nhop = 1;
   llsm_update_cycle(ret);
@@ -226,27 +305,32 @@ void llsm_delete_rtsynth_buffer(llsm_rtsynth_buffer* dstptr) {
   if(dstptr == NULL) return;
   llsm_rtsynth_buffer_* dst = dstptr;
   llsm_delete_container(dst -> conf);
-  llsm_delete_ringbuffer(dst -> buffer_out_p);
-  llsm_delete_ringbuffer(dst -> buffer_out_ap);
+  llsm_delete_iczt_table(dst -> opt.iczt_table);
+  llsm_delete_spscbuffer(dst -> buffer_out);
   llsm_delete_ringbuffer(dst -> buffer_exc_mix);
   llsm_delete_ringbuffer(dst -> buffer_noise);
   llsm_delete_ringbuffer(dst -> buffer_sin);
   llsm_delete_dualbuffer(dst -> buffer_pulse);
+  llsm_delete_pbp_engine(dst -> pbp);
+  llsm_delete_layerconv(dst -> conv);
   for(int i = 0; i < dst -> nchannel; i ++)
     llsm_delete_ringbuffer(dst -> buffer_mod_comps[i]);
-  llsm_delete_nmframe(dst -> prev_nm);
-  free(dst -> win);
+  llsm_delete_nmframe(dst -> nm_storage);
+  free(dst -> win_cache[0]);
+  free(dst -> win_cache[1]);
   free(dst -> buffer_mod_comps);
-  free2d(dst -> exc_template_comps, dst -> nchannel);
-  free(dst -> buffer_psd);
+  free(dst -> exc_template_comps);
   free(dst -> buffer_fft);
   free(dst -> buffer_rawexc);
   free(dst -> buffer_rawmod);
+  free(dst -> buffer_ola);
+  free(dst -> buffer_frame);
   free(dst -> buffer_phase);
+  free(dst -> buffer_synth);
   free(dst -> psd_axis);
 # ifdef USE_PTHREAD
-  pthread_mutex_destroy(& dst -> buffer_out_mtx);
-  pthread_cond_destroy(& dst -> buffer_out_cv);
+  pthread_mutex_destroy(& dst -> wait_mtx);
+  pthread_cond_destroy(& dst -> wait_cv);
 # endif
   free(dst);
 }
@@ -255,47 +339,79 @@ void llsm_delete_rtsynth_buffer(llsm_rtsynth_buffer* dstptr) {
 static void llsm_rtsynth_buffer_feed_modcomps(llsm_rtsynth_buffer_* dst,
   llsm_nmframe* nm, FP_TYPE f0) {
   int nwin = dst -> curr_nhop * 2;
-  llsm_hmframe* unvoiced_hm = llsm_create_hmframe(0);
+  FP_TYPE* x = dst -> buffer_frame;
   for(int c = 0; c < dst -> nchannel; c ++) {
-    llsm_hmframe* hm = f0 > 0 ? nm -> eenv[c] : unvoiced_hm;
-    FP_TYPE* x = llsm_synthesize_harmonic_frame_auto(& dst -> opt,
-      hm -> ampl, hm -> phse, hm -> nhar, f0 / dst -> fs, nwin);
+    if(f0 > 0) {
+      llsm_hmframe* hm = nm -> eenv[c];
+      int nhar = hm -> nhar;
+      FP_TYPE* phse = hm -> phse;
+      if(dst -> theta != 0) {
+        nhar = min(nhar, dst -> nfft);
+        for(int k = 0; k < nhar; k ++)
+          dst -> buffer_phase[k] = wrap(phse[k] + dst -> theta * (k + 1.0));
+        phse = dst -> buffer_phase;
+      }
+      llsm_reserve_synth(dst, nhar);
+      llsm_synthesize_harmonic_frame_auto_buffered(& dst -> opt,
+        hm -> ampl, phse, nhar, f0 / dst -> fs, nwin, x,
+        dst -> buffer_synth);
+    } else
+      memset(x, 0, nwin * sizeof(FP_TYPE));
     FP_TYPE offset = nm -> edc[c];
     for(int i = 0; i < nwin; i ++)
       x[i] = (max(x[i] + offset, 1e-8)) * dst -> win[i];
     llsm_ringbuffer_addchunk(dst -> buffer_mod_comps[c], -nwin, nwin, x);
-    free(x);
   }
-  llsm_delete_hmframe(unvoiced_hm);
 }
 
-// Synthesize sinusoidal component.
+// Synthesize sinusoidal component from nhar harmonics, shifting their phases
+//   by theta as llsm_frame_phaseshift does.
+static void llsm_rtsynth_buffer_feed_harmonics(llsm_rtsynth_buffer_* dst,
+  FP_TYPE f0, FP_TYPE* ampl, FP_TYPE* phse, int nhar, FP_TYPE theta) {
+  FP_TYPE* phase = dst -> buffer_phase;
+  FP_TYPE phase_shift = dst -> cycle * 2 * M_PI * f0;
+  nhar = min(nhar, dst -> nfft);
+  for(int k = 0; k < nhar; k ++)
+    phase[k] = (theta == 0 ? phse[k] : wrap(phse[k] + theta * (k + 1.0)))
+             - phase_shift * (k + 1.0);
+  FP_TYPE* x = dst -> buffer_frame;
+  llsm_reserve_synth(dst, nhar);
+  llsm_synthesize_harmonic_frame_auto_buffered(& dst -> opt,
+    ampl, phase, nhar, f0 / dst -> fs, dst -> curr_nhop * 2, x,
+    dst -> buffer_synth);
+  for(int i = 0; i < dst -> curr_nhop * 2; i ++)
+    x[i] *= dst -> win[i];
+  llsm_ringbuffer_addchunk(dst -> buffer_sin, -dst -> curr_nhop * 2,
+    dst -> curr_nhop * 2, x);
+}
+
+// Synthesize sinusoidal component from the harmonic model of a frame, or
+//   (with use_l1) from its layer 1 parameters if it has no harmonic model.
 static void llsm_rtsynth_buffer_feed_sinusoids(llsm_rtsynth_buffer_* dst,
   llsm_container* frame) {
-  FP_TYPE* f0 = llsm_container_get(frame, LLSM_FRAME_F0);
-  llsm_hmframe* hm = llsm_container_get(frame, LLSM_FRAME_HM);
-  FP_TYPE* phase = dst -> buffer_phase;
-  if(hm != NULL && f0 != NULL && *f0 > 0) {
-    FP_TYPE phase_shift = dst -> cycle * 2 * M_PI * (*f0);
-    int nhar = min(hm -> nhar, dst -> nfft);
-    for(int k = 0; k < nhar; k ++)
-      phase[k] = hm -> phse[k] - phase_shift * (k + 1.0);
-    FP_TYPE* x = llsm_synthesize_harmonic_frame_auto(& dst -> opt,
-      hm -> ampl, phase, nhar, *f0 / dst -> fs, dst -> curr_nhop * 2);
-    for(int i = 0; i < dst -> curr_nhop * 2; i ++)
-      x[i] *= dst -> win[i];
-    llsm_ringbuffer_addchunk(dst -> buffer_sin, -dst -> curr_nhop * 2,
-      dst -> curr_nhop * 2, x);
-    free(x);
+  FP_TYPE* f0 = llsm_container_peek(frame, LLSM_FRAME_F0);
+  llsm_hmframe* hm = llsm_container_peek(frame, LLSM_FRAME_HM);
+  if(f0 == NULL || *f0 <= 0) return;
+  if(hm != NULL) {
+    llsm_rtsynth_buffer_feed_harmonics(dst, *f0, hm -> ampl, hm -> phse,
+      hm -> nhar, dst -> theta);
+    return;
   }
+  if(! dst -> opt.use_l1) return;
+  FP_TYPE* ampl = NULL;
+  FP_TYPE* phse = NULL;
+  int nhar = llsm_layerconv_harmonics(dst -> conv, frame, dst -> conf,
+    dst -> theta, & ampl, & phse);
+  if(nhar >= 0)
+    llsm_rtsynth_buffer_feed_harmonics(dst, *f0, ampl, phse, nhar, 0);
 }
 
 // Synthesize deterministic component (semi-harmonic excitation and
 //   noise envelope components).
 static void llsm_rtsynth_buffer_feed_deterministic(llsm_rtsynth_buffer_* dst,
   llsm_container* frame) {
-  FP_TYPE* f0 = llsm_container_get(frame, LLSM_FRAME_F0);
-  llsm_nmframe* nm = llsm_container_get(frame, LLSM_FRAME_NM);
+  FP_TYPE* f0 = llsm_container_peek(frame, LLSM_FRAME_F0);
+  llsm_nmframe* nm = llsm_container_peek(frame, LLSM_FRAME_NM);
   if(nm != NULL)
     llsm_rtsynth_buffer_feed_modcomps(dst, nm, f0 == NULL ? 0 : *f0);
   if(! dst -> opt.use_l1) {
@@ -304,22 +420,23 @@ static void llsm_rtsynth_buffer_feed_deterministic(llsm_rtsynth_buffer_* dst,
   }
   int nhop = dst -> curr_nhop;
 
-  FP_TYPE* vsphse = llsm_container_get(frame, LLSM_FRAME_VSPHSE);
-  FP_TYPE* rd = llsm_container_get(frame, LLSM_FRAME_RD);
-  int* pbpsyn = llsm_container_get(frame, LLSM_FRAME_PBPSYN);
-  llsm_pbpeffect* pbpeff = llsm_container_get(frame, LLSM_FRAME_PBPEFF);
+  FP_TYPE* vsphse = llsm_container_peek(frame, LLSM_FRAME_VSPHSE);
+  FP_TYPE* rd = llsm_container_peek(frame, LLSM_FRAME_RD);
+  int* pbpsyn = llsm_container_peek(frame, LLSM_FRAME_PBPSYN);
+  llsm_pbpeffect* pbpeff = llsm_container_peek(frame, LLSM_FRAME_PBPEFF);
   if(vsphse == NULL || rd == NULL || *f0 == 0) return;
   int pbp_on = pbpsyn != NULL && pbpsyn[0] == 1;
-  int nspec = *((int*)llsm_container_get(dst -> conf, LLSM_CONF_NSPEC));
+  int nspec = *((int*)llsm_container_peek(dst -> conf, LLSM_CONF_NSPEC));
 
   // update locations of pulses locked onto the first source harmonic
   FP_TYPE len_period = dst -> fs / f0[0];
   FP_TYPE t_period = 1.0 / f0[0];
   lfmodel source_model = lfmodel_from_rd(*rd, t_period, 1.0);
   FP_TYPE source_p0 = 0;
-  free(lfmodel_spectrum(source_model, f0, 1, & source_p0));
+  llsm_lfmodel_harmonics(*rd, f0[0], 1, NULL, & source_p0);
   source_p0 -= 0.5 * M_PI; // integrate (flow derivative to flow velocity)
-  FP_TYPE p0 = wrap(vsphse[0]);
+  FP_TYPE p0 = wrap(dst -> theta == 0 ? vsphse[0] :
+    wrap(vsphse[0] + dst -> theta));
   FP_TYPE p0_dist = phase_diff(source_p0, p0);
   if(p0_dist < 0) p0_dist += 2.0 * M_PI;
   // the next position where a glottal flow cycle begins (relative to
@@ -334,8 +451,8 @@ static void llsm_rtsynth_buffer_feed_deterministic(llsm_rtsynth_buffer_* dst,
     len_period = (pulse_projected - dst -> pulse) / num_periods;
   int pulse_size = pow(2, ceil(log2(max(len_period * 2, nspec))));
 
-  FP_TYPE* fnyq = llsm_container_get(dst -> conf, LLSM_CONF_FNYQ);
-  FP_TYPE* liprad = llsm_container_get(dst -> conf, LLSM_CONF_LIPRADIUS);
+  FP_TYPE* fnyq = llsm_container_peek(dst -> conf, LLSM_CONF_FNYQ);
+  FP_TYPE* liprad = llsm_container_peek(dst -> conf, LLSM_CONF_LIPRADIUS);
 
   int pbp_onset = 0;
   int pbp_termination = 0;
@@ -343,8 +460,6 @@ static void llsm_rtsynth_buffer_feed_deterministic(llsm_rtsynth_buffer_* dst,
     pbp_onset = 1;
     dst -> pbp_state = 1;
     dst -> pbp_offset = -nhop;
-    if(llsm_container_get(frame, LLSM_FRAME_HM) == NULL)
-      llsm_frame_tolayer0(frame, dst -> conf);
     llsm_rtsynth_buffer_feed_sinusoids(dst, frame);
   }
   if(! pbp_on && dst -> pbp_state) {
@@ -360,13 +475,15 @@ static void llsm_rtsynth_buffer_feed_deterministic(llsm_rtsynth_buffer_* dst,
     int num_pulses = period_end - period_begin;
     int pre_rotate = min(len_period, nhop * 2);
     if(num_pulses > 0) {
-      FP_TYPE* offsets = calloc(num_pulses, sizeof(FP_TYPE));
-      lfmodel* sources = calloc(num_pulses, sizeof(lfmodel));
+      FP_TYPE* offsets = NULL;
+      lfmodel* sources = NULL;
+      llsm_pbp_engine_reserve_pulses(dst -> pbp, num_pulses,
+        & offsets, & sources);
       for(int i = 0; i < num_pulses; i ++) {
         FP_TYPE delta_t = 0;
         if(pbpeff != NULL) {
           llsm_gfm g = llsm_lfmodel_to_gfm(source_model);
-          pbpeff -> modifier(& g, & delta_t, pbpeff -> info, frame);
+          llsm_pbpeffect_apply(pbpeff, & g, & delta_t, frame, dst -> theta);
           sources[i] = llsm_gfm_to_lfmodel(g);
         } else
           sources[i] = source_model;
@@ -375,38 +492,32 @@ static void llsm_rtsynth_buffer_feed_deterministic(llsm_rtsynth_buffer_* dst,
       }
       int pulse_base = offsets[0];
       for(int i = 0; i < num_pulses; i ++) offsets[i] -= pulse_base;
-      FP_TYPE* y = llsm_make_filtered_pulse(frame, sources, offsets,
-        num_pulses, pre_rotate, pulse_size, *fnyq, *liprad, dst -> fs);
+      FP_TYPE* y = llsm_pbp_engine_make_pulse(dst -> pbp, frame, dst -> theta,
+        sources, offsets, num_pulses, pre_rotate, pulse_size, *fnyq, *liprad,
+        dst -> fs);
       llsm_dualbuffer_addchunk(dst -> buffer_pulse,
         pulse_base - pre_rotate - nhop, pulse_size, y);
-      free(y);
-      free(offsets);
-      free(sources);
     }
   }
-  if(! dst -> pbp_state) {
-    if(llsm_container_get(frame, LLSM_FRAME_HM) == NULL)
-      llsm_frame_tolayer0(frame, dst -> conf);
+  if(! dst -> pbp_state)
     llsm_rtsynth_buffer_feed_sinusoids(dst, frame);
-  }
   dst -> pulse = pulse_projected;
 
   if(dst -> pbp_state &&
      dst -> pbp_offset <= dst -> sin_pos + nhop) {
-    FP_TYPE* x = calloc(nhop * 2, sizeof(FP_TYPE));
+    FP_TYPE* x = dst -> buffer_frame;
     llsm_dualbuffer_readchunk(
       dst -> buffer_pulse, dst -> pbp_offset, nhop * 2, x);
     for(int i = 0; i < nhop * 2; i ++)
       x[i] *= dst -> win[i];
     llsm_ringbuffer_addchunk(
       dst -> buffer_sin, dst -> pbp_offset, nhop * 2, x);
-    free(x);
   }
   if(pbp_termination) {
     // Overlap-add PbP results using a trapezoid-like window to catch up
     //   with the harmonic model.
     int size = -nhop - dst -> pbp_offset;
-    FP_TYPE* x = calloc(size, sizeof(FP_TYPE));
+    FP_TYPE* x = dst -> buffer_ola;
     llsm_dualbuffer_readchunk(
       dst -> buffer_pulse, dst -> pbp_offset, size, x);
     for(int i = 0; i < nhop; i ++) {
@@ -415,154 +526,196 @@ static void llsm_rtsynth_buffer_feed_deterministic(llsm_rtsynth_buffer_* dst,
     }
     llsm_ringbuffer_addchunk(
       dst -> buffer_sin, dst -> pbp_offset, size, x);
-    free(x);
   }
 }
 
 static void llsm_rtsynth_buffer_feed_filter(llsm_rtsynth_buffer_* dst) {
-  const int nfade = 16;
   int nfft = dst -> nfft;
-  int nspec = nfft / 2 + 1;
   int nhop = dst -> curr_nhop;
   int nwin = nhop * 2;
-  FP_TYPE wsqr = 0;
-  for(int i = 0; i < nwin; i ++)
-    wsqr += dst -> win[i] * dst -> win[i];
-
-  FP_TYPE* psd = dst -> buffer_psd;
-  FP_TYPE* fftbuffer = dst -> buffer_fft;
-  FP_TYPE* x_re = fftbuffer;
-  FP_TYPE* x_im = fftbuffer + nfft;
-  memset(fftbuffer, 0, nfft * 4 * sizeof(FP_TYPE));
-
-  int npsd = *((int*)llsm_container_get(dst -> conf, LLSM_CONF_NPSD));
-  FP_TYPE* psd_axis = dst -> psd_axis;
+  int npsd = *((int*)llsm_container_peek(dst -> conf, LLSM_CONF_NPSD));
 
   llsm_nmframe* nm = dst -> prev_nm;
   if(nm != NULL) {
     FP_TYPE peak = maxfp(nm -> psd, npsd);
     if(peak < -100) return; // -100 dB noise floor
 
-    // STFT
+    FP_TYPE* x = dst -> buffer_fft;
+    memset(x, 0, nfft * sizeof(FP_TYPE));
     llsm_ringbuffer_readchunk(dst -> buffer_exc_mix, -nhop * 2,
-      nwin, x_re + nfft / 2 - nhop);
+      nwin, x + nfft / 2 - nhop);
     for(int i = 0; i < nwin; i ++)
-      x_re[i - nhop + nfft / 2] *= dst -> win[i];
-    fft(x_re, NULL, x_re, x_im, nfft, fftbuffer + nfft * 2);
-
-    // PSD -> diff
-    llsm_fft_to_psd(x_re, x_im, nfft, wsqr, psd);
-    FP_TYPE* env = moving_avg(psd, nspec, 3);
-    FP_TYPE* H = llsm_spectrum_from_envelope(
-      psd_axis, nm -> psd, npsd, nspec - 1, dst -> fs / 2.0);
-    for(int j = 0; j < nspec - 1; j ++)
-      H[j] = exp(DB2LOG(H[j])) / sqrt(env[j] * 44100 / dst -> fs + 1e-8);
-
-    // filter
-    for(int i = 0; i < nspec - 1; i ++) {
-      x_re[i] *= H[i]; x_im[i] *= H[i];
-    }
-    x_re[nspec - 1] = x_re[nspec - 2]; complete_symm (x_re, nfft);
-    x_im[nspec - 1] = x_im[nspec - 2]; complete_asymm(x_im, nfft);
-
-    // ISTFT
-    ifft(x_re, x_im, x_re, NULL, nfft, fftbuffer + nfft * 2);
-    for(int i = 0; i < nfade; i ++) {
-      x_re[i] *= (FP_TYPE)i / nfade;
-      x_re[nfft - i - 1] *= 1.0 - (FP_TYPE)i / nfade;
-    }
+      x[i - nhop + nfft / 2] *= dst -> win[i];
+    llsm_filter_noise_frame(x, nfft, dst -> wsqr, dst -> psd_axis,
+      nm -> psd, npsd, dst -> fs, x + nfft);
+    llsm_ringbuffer_addchunk(dst -> buffer_noise, -nfft, nfft, x);
+  }
+}
+
+// The number of samples ready to be read, or the free space if space is
+//   non-zero.
+static int llsm_rtsynth_available(llsm_rtsynth_buffer_* src, int space) {
+  return space ? llsm_spscbuffer_space(src -> buffer_out) :
+    llsm_spscbuffer_size(src -> buffer_out);
+}
 
-    llsm_ringbuffer_addchunk(dst -> buffer_noise, -nfft, nfft, x_re);
-    free(H); free(env);
+// Either side of the output buffer blocks in llsm_rtsynth_wait_until until
+//   the other side has moved its position far enough. A waiter publishes
+//   what it waits for (wait_space or wait_size) before checking the buffer
+//   and the other side checks it after moving its position, with a fence in
+//   between on both sides, so either the waiter sees the new position or the
+//   other side sees the threshold. The lock is only taken once, by whoever
+//   clears a threshold that has been reached; fetching a sample at a time
+//   while the writer waits for a whole hop stays lock-free until then.
+static void llsm_rtsynth_notify(llsm_rtsynth_buffer_* src, int space) {
+  long* threshold = space ? & src -> wait_space : & src -> wait_size;
+  llsm_atomic_fence();
+  long n = llsm_atomic_load(*threshold);
+  if(n == 0 || llsm_rtsynth_available(src, space) < n) return;
+  if(! llsm_atomic_cas(*threshold, n, 0)) return;
+# ifdef USE_PTHREAD
+  pthread_mutex_lock(& src -> wait_mtx);
+  pthread_cond_broadcast(& src -> wait_cv);
+  pthread_mutex_unlock(& src -> wait_mtx);
+# endif
+}
+
+#ifndef USE_PTHREAD
+// Without pthread there is nothing to block on; poll in 1 ms sleeps.
+static void llsm_rtsynth_sleep() {
+# ifdef _WIN32
+  Sleep(1);
+# else
+  usleep(1000);
+# endif
+}
+#endif
+
+// Wait until at least n samples (or, if space is non-zero, n samples of
+//   free space) are available in the output buffer, for at most timeout
+//   seconds (forever if timeout < 0). Returns what is available at the end.
+static int llsm_rtsynth_wait_until(llsm_rtsynth_buffer_* src, int n,
+  int space, FP_TYPE timeout) {
+  int ret = llsm_rtsynth_available(src, space);
+  if(ret >= n || timeout == 0) return ret;
+  long* threshold = space ? & src -> wait_space : & src -> wait_size;
+  llsm_atomic_store(*threshold, n);
+  llsm_atomic_fence();
+# ifdef USE_PTHREAD
+  struct timespec deadline;
+  if(timeout > 0) {
+    clock_gettime(CLOCK_REALTIME, & deadline);
+    double t = deadline.tv_nsec * 1e-9 + timeout;
+    deadline.tv_sec += (time_t)t;
+    deadline.tv_nsec = (long)((t - floor(t)) * 1e9);
   }
+  pthread_mutex_lock(& src -> wait_mtx);
+  while((ret = llsm_rtsynth_available(src, space)) < n) {
+    if(timeout < 0)
+      pthread_cond_wait(& src -> wait_cv, & src -> wait_mtx);
+    else if(pthread_cond_timedwait(& src -> wait_cv, & src -> wait_mtx,
+      & deadline) != 0) {
+      ret = llsm_rtsynth_available(src, space);
+      break;
+    }
+  }
+  pthread_mutex_unlock(& src -> wait_mtx);
+# else
+  for(FP_TYPE t = 0; (ret = llsm_rtsynth_available(src, space)) < n &&
+    (timeout < 0 || t < timeout); t += 1e-3)
+    llsm_rtsynth_sleep();
+# endif
+  llsm_atomic_store(*threshold, 0);
+  return ret;
 }
 
 static void llsm_rtsynth_buffer_feed_mix(llsm_rtsynth_buffer_* dst) {
-  FP_TYPE* x_nos = calloc(dst -> next_nhop, sizeof(FP_TYPE));
-  FP_TYPE* x_sin = calloc(dst -> next_nhop, sizeof(FP_TYPE));
+  FP_TYPE* x_nos = dst -> buffer_ola;
+  FP_TYPE* x_sin = dst -> buffer_ola + dst -> next_nhop;
   llsm_ringbuffer_readchunk(dst -> buffer_noise,
     -dst -> nfft, dst -> next_nhop, x_nos);
   llsm_ringbuffer_readchunk(dst -> buffer_sin,
     dst -> sin_pos, dst -> next_nhop, x_sin);
   // for(int i = 0; i < dst -> next_nhop; i ++)
   //   x_nos[i] += x_sin[i];
+  FP_TYPE* x_out[2] = {x_sin, x_nos};
 # ifdef USE_PTHREAD
-  pthread_mutex_lock(& dst -> buffer_out_mtx);
-  while(dst -> nout > dst -> buffer_out_p -> capacity - dst -> next_nhop)
-    pthread_cond_wait(& dst -> buffer_out_cv, & dst -> buffer_out_mtx);
-# endif
-  llsm_ringbuffer_appendchunk(dst -> buffer_out_p, dst -> next_nhop, x_sin);
-  llsm_ringbuffer_appendchunk(dst -> buffer_out_ap, dst -> next_nhop, x_nos);
-  dst -> nout += dst -> next_nhop;
-# ifdef USE_PTHREAD
-  pthread_cond_broadcast(& dst -> buffer_out_cv);
-  pthread_mutex_unlock(& dst -> buffer_out_mtx);
+  // Block until the reader has made room.
+  llsm_rtsynth_wait_until(dst, dst -> next_nhop, 1, -1);
+  llsm_spscbuffer_write(dst -> buffer_out, dst -> next_nhop, x_out);
+# else
+  // The reader may well be on this very thread, so waiting could dead-lock;
+  //   as in the blocking-free design this replaced, the oldest unread
+  //   samples are overwritten instead. Feeding and fetching must then not
+  //   run concurrently (see llsmrt.h).
+  int skip = max(0, dst -> next_nhop - dst -> buffer_out -> capacity);
+  int size = dst -> next_nhop - skip;
+  llsm_spscbuffer_discard(dst -> buffer_out,
+    size - llsm_spscbuffer_space(dst -> buffer_out));
+  x_out[0] += skip;
+  x_out[1] += skip;
+  llsm_spscbuffer_write(dst -> buffer_out, size, x_out);
 # endif
-  free(x_nos);
-  free(x_sin);
+  llsm_rtsynth_notify(dst, 0);
 }
 
 void llsm_rtsynth_buffer_feed(llsm_rtsynth_buffer* ptr,
   llsm_container* frame) {
   llsm_rtsynth_buffer_* dst = ptr;
   llsm_update_cycle(dst);
+  if(dst -> opt.propagate != 0) {
+    FP_TYPE* f0 = llsm_container_peek(frame, LLSM_FRAME_F0);
+    dst -> f0_sum += f0 != NULL ? *f0 : 0;
+    dst -> theta = dst -> f0_sum;
+    dst -> theta *= dst -> thop * dst -> opt.propagate * 2.0 * M_PI;
+  }
   llsm_rtsynth_buffer_feed_deterministic(dst, frame);
   llsm_run_excitation_buffers(dst, dst -> curr_nhop);
   llsm_rtsynth_buffer_feed_filter(dst);
   llsm_rtsynth_buffer_feed_mix(dst);
-  if(dst -> prev_nm != NULL) llsm_delete_nmframe(dst -> prev_nm);
-  dst -> prev_nm = llsm_container_get(frame, LLSM_FRAME_NM);
-  if(dst -> prev_nm != NULL)
-    dst -> prev_nm = llsm_copy_nmframe(dst -> prev_nm);
-  FP_TYPE* resvec = llsm_container_get(frame, LLSM_FRAME_PSDRES);
+  llsm_nmframe* nm = llsm_container_peek(frame, LLSM_FRAME_NM);
+  dst -> prev_nm = NULL;
+  if(nm != NULL) {
+    llsm_copy_nmframe_inplace(dst -> nm_storage, nm);
+    dst -> prev_nm = dst -> nm_storage;
+  }
+  FP_TYPE* resvec = llsm_container_peek(frame, LLSM_FRAME_PSDRES);
   if(resvec != NULL)
   for(int j = 0; j < dst -> prev_nm -> npsd; j ++)
     dst -> prev_nm -> psd[j] += resvec[j] - LOG2IN(LOGRESBIAS);
 }
 
+// Read up to n samples and wake up the writer if it waits for space.
+static int llsm_rtsynth_buffer_read(llsm_rtsynth_buffer_* src, int n,
+  FP_TYPE* dst_p, FP_TYPE* dst_ap) {
+  FP_TYPE* dst_out[2] = {dst_p, dst_ap};
+  int ret = llsm_spscbuffer_read(src -> buffer_out, n, dst_out);
+  if(ret > 0) llsm_rtsynth_notify(src, 1);
+  return ret;
+}
+
 int llsm_rtsynth_buffer_fetch(llsm_rtsynth_buffer* ptr, FP_TYPE* dst) {
-  llsm_rtsynth_buffer_* src = ptr;
-# ifdef USE_PTHREAD
-  pthread_mutex_lock(& src -> buffer_out_mtx);
-# endif
-  if(src -> nout > 0) {
-    *dst  = llsm_ringbuffer_read(src -> buffer_out_p, -src -> nout);
-    *dst += llsm_ringbuffer_read(src -> buffer_out_ap, -src -> nout);
-    src -> nout --;
-#   ifdef USE_PTHREAD
-    pthread_mutex_unlock(& src -> buffer_out_mtx);
-    pthread_cond_broadcast(& src -> buffer_out_cv);
-#   endif
-    return 1;
-  } else {
-#   ifdef USE_PTHREAD
-    pthread_mutex_unlock(& src -> buffer_out_mtx);
-#   endif
-  }
-  return 0;
+  return llsm_rtsynth_buffer_read(ptr, 1, dst, NULL);
 }
 
 int llsm_rtsynth_buffer_fetch_decomposed(
   llsm_rtsynth_buffer* ptr, FP_TYPE* dst_p, FP_TYPE* dst_ap) {
-  llsm_rtsynth_buffer_* src = ptr;
-# ifdef USE_PTHREAD
-  pthread_mutex_lock(& src -> buffer_out_mtx);
-# endif
-  if(src -> nout > 0) {
-    *dst_p  = llsm_ringbuffer_read(src -> buffer_out_p, -src -> nout);
-    *dst_ap = llsm_ringbuffer_read(src -> buffer_out_ap, -src -> nout);
-    src -> nout --;
-#   ifdef USE_PTHREAD
-    pthread_mutex_unlock(& src -> buffer_out_mtx);
-    pthread_cond_broadcast(& src -> buffer_out_cv);
-#   endif
-    return 1;
-  } else {
-#   ifdef USE_PTHREAD
-    pthread_mutex_unlock(& src -> buffer_out_mtx);
-#   endif
-  }
-  return 0;
+  return llsm_rtsynth_buffer_read(ptr, 1, dst_p, dst_ap);
+}
+
+int llsm_rtsynth_buffer_fetch_block(llsm_rtsynth_buffer* ptr, FP_TYPE* dst,
+  int n) {
+  return llsm_rtsynth_buffer_read(ptr, n, dst, NULL);
+}
+
+int llsm_rtsynth_buffer_fetch_block_decomposed(llsm_rtsynth_buffer* ptr,
+  FP_TYPE* dst_p, FP_TYPE* dst_ap, int n) {
+  return llsm_rtsynth_buffer_read(ptr, n, dst_p, dst_ap);
+}
+
+int llsm_rtsynth_buffer_wait(llsm_rtsynth_buffer* ptr, int n,
+  FP_TYPE timeout) {
+  return llsm_rtsynth_wait_until(ptr, n, 0, max(0, timeout));
 }
 
 int llsm_rtsynth_buffer_getlatency(llsm_rtsynth_buffer* ptr) {
@@ -572,21 +725,18 @@ int llsm_rtsynth_buffer_getlatency(llsm_rtsynth_buffer* ptr) {
 
 int llsm_rtsynth_buffer_numoutput(llsm_rtsynth_buffer* ptr) {
   llsm_rtsynth_buffer_* src = ptr;
-  return src -> nout;
+  return llsm_spscbuffer_size(src -> buffer_out);
 }
 
 void llsm_rtsynth_buffer_clear(llsm_rtsynth_buffer* ptr) {
   llsm_rtsynth_buffer_* dst = ptr;
-  int capacity_samples = dst -> buffer_out_p -> capacity;
-  dst -> nout = 0;
-  llsm_delete_ringbuffer(dst -> buffer_out_p);
-  llsm_delete_ringbuffer(dst -> buffer_out_ap);
+  int capacity_samples = dst -> buffer_out -> capacity;
+  llsm_delete_spscbuffer(dst -> buffer_out);
   llsm_delete_ringbuffer(dst -> buffer_exc_mix);
   llsm_delete_ringbuffer(dst -> buffer_noise);
   llsm_delete_ringbuffer(dst -> buffer_sin);
   llsm_delete_dualbuffer(dst -> buffer_pulse);
-  dst -> buffer_out_p  = llsm_create_ringbuffer(capacity_samples);
-  dst -> buffer_out_ap = llsm_create_ringbuffer(capacity_samples);
+  dst -> buffer_out = llsm_create_spscbuffer(capacity_samples, 2);
   dst -> buffer_exc_mix = llsm_create_ringbuffer(dst -> ninternal);
   dst -> buffer_noise = llsm_create_ringbuffer(dst -> ninternal);
   dst -> buffer_sin   = llsm_create_ringbuffer(dst -> ninternal);
@@ -27,7 +27,10 @@
 /** @defgroup group_llsmrt LLSM Real-time Synthesis
  *  @{ */
 /** @brief A type hiding the implementation details of a LLSM real-time
- *    synthesis buffer. */
+ *    synthesis buffer. When built with USE_PTHREAD, one thread may feed
+ *    frames while another fetches samples; the two sides only communicate
+ *    through a lock-free ring buffer, so fetching never blocks. Otherwise
+ *    feeding and fetching must not run concurrently. */
 typedef void llsm_rtsynth_buffer;
 
 /** @brief Create a real-time synthesis buffer based on LLSM configuraiton. */
@@ -41,7 +44,9 @@ void llsm_delete_rtsynth_buffer(llsm_rtsynth_buffer* dst);
 int llsm_rtsynth_buffer_getlatency(llsm_rtsynth_buffer* src);
 /** @brief Get the number of output samples available. */
 int llsm_rtsynth_buffer_numoutput(llsm_rtsynth_buffer* src);
-/** @brief Append a LLSM frame to the real-time synthesis buffer. */
+/** @brief Append a LLSM frame to the real-time synthesis buffer. When built
+ *    with USE_PTHREAD, it blocks until the reader has made room if the output
+ *    buffer is full; otherwise the oldest unread samples are overwritten. */
 void llsm_rtsynth_buffer_feed(llsm_rtsynth_buffer* dst, llsm_container* frame);
 /** @brief Get one sample from the real-time synthesis buffer; returns 1 on
  *    success. */
@@ -50,7 +55,22 @@ int llsm_rtsynth_buffer_fetch(llsm_rtsynth_buffer* src, FP_TYPE* dst);
  *    periodic/aperiodic outputs; returns 1 on success. */
 int llsm_rtsynth_buffer_fetch_decomposed(
   llsm_rtsynth_buffer* src, FP_TYPE* dst_p, FP_TYPE* dst_ap);
-/** @brief Reset the real-time synthesis buffer. */
+/** @brief Get up to n samples from the real-time synthesis buffer at once;
+ *    returns the number of samples written into dst. */
+int llsm_rtsynth_buffer_fetch_block(llsm_rtsynth_buffer* src, FP_TYPE* dst,
+  int n);
+/** @brief Block version of llsm_rtsynth_buffer_fetch_decomposed; returns the
+ *    number of samples written into each of dst_p and dst_ap. */
+int llsm_rtsynth_buffer_fetch_block_decomposed(llsm_rtsynth_buffer* src,
+  FP_TYPE* dst_p, FP_TYPE* dst_ap, int n);
+/** @brief Wait (for at most timeout seconds) until at least n output
+ *    samples are available and return the number of available samples.
+ *    Blocks on a condition variable when built with USE_PTHREAD and polls
+ *    otherwise. */
+int llsm_rtsynth_buffer_wait(llsm_rtsynth_buffer* src, int n,
+  FP_TYPE timeout);
+/** @brief Reset the real-time synthesis buffer; must not run concurrently
+ *    with feeding or fetching. */
 void llsm_rtsynth_buffer_clear(llsm_rtsynth_buffer* dst);
 
 /** #} */
@@ -22,6 +22,8 @@
 #include "llsmutils.h"
 #include "constants.h"
 
+#include <time.h>
+
 llsm_gfm llsm_lfmodel_to_gfm(lfmodel src) {
   llsm_gfm ret;
   ret.Fa = 1.0 / (src.ta * src.T0);
@@ -42,160 +44,559 @@ lfmodel llsm_gfm_to_lfmodel(llsm_gfm src) {
   return ret;
 }
 
+// Time per call (in clock ticks) of the recurrent (method = 0) or the ICZT
+//   (method = 1) harmonic synthesis; best of 3 runs of at least 5 ms each.
+static double time_harmonic_synthesis(int method, FP_TYPE* ampl,
+  FP_TYPE* phse, int nhar, int nx) {
+  FP_TYPE f0 = 0.4 / nhar;
+  double best = 0;
+  for(int r = 0; r < 3; r ++) {
+    int niter = 0;
+    clock_t t0 = clock();
+    clock_t t1 = t0;
+    while(t1 - t0 < CLOCKS_PER_SEC / 200) {
+      if(method == 0)
+        free(llsm_synthesize_harmonic_frame(ampl, phse, nhar, f0, nx));
+      else
+        free(llsm_synthesize_harmonic_frame_iczt(ampl, phse, nhar, f0, nx));
+      niter ++;
+      t1 = clock();
+    }
+    double t = (double)(t1 - t0) / niter;
+    if(r == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+llsm_iczt_table* llsm_calibrate_iczt_table(int nnx, int nnhar) {
+  const FP_TYPE nx_min = 64, nx_max = 4096;
+  const FP_TYPE nhar_min = 8, nhar_max = 1024;
+  if(nnx < 2 || nnhar < 2) return NULL;
+  llsm_iczt_table* ret = malloc(sizeof(llsm_iczt_table));
+  ret -> nnx = nnx;
+  ret -> nx = calloc(nnx, sizeof(int));
+  ret -> nhar = calloc(nnx, sizeof(FP_TYPE));
+
+  FP_TYPE* ampl = malloc(nhar_max * sizeof(FP_TYPE));
+  FP_TYPE* phse = malloc(nhar_max * sizeof(FP_TYPE));
+  for(int i = 0; i < nhar_max; i ++) {
+    ampl[i] = 1.0 / (i + 1.0);
+    phse[i] = i * 0.1;
+  }
+  int* nhar = calloc(nnhar, sizeof(int));
+  FP_TYPE* lratio = calloc(nnhar, sizeof(FP_TYPE));
+  for(int j = 0; j < nnhar; j ++)
+    nhar[j] = round(exp(linterp(log(nhar_min), log(nhar_max),
+      (FP_TYPE)j / (nnhar - 1))));
+
+  for(int i = 0; i < nnx; i ++) {
+    int nx = round(exp(linterp(log(nx_min), log(nx_max),
+      (FP_TYPE)i / (nnx - 1))));
+    ret -> nx[i] = nx;
+    for(int j = 0; j < nnhar; j ++)
+      lratio[j] = log(time_harmonic_synthesis(1, ampl, phse, nhar[j], nx)) -
+        log(time_harmonic_synthesis(0, ampl, phse, nhar[j], nx));
+    // The crossover is where ICZT starts to win for all larger nhar;
+    //   it's placed beyond the grid if ICZT never wins.
+    int j = nnhar;
+    while(j > 0 && lratio[j - 1] < 0) j --;
+    if(j == 0)
+      ret -> nhar[i] = nhar[0];
+    else if(j == nnhar)
+      ret -> nhar[i] = nhar[nnhar - 1] * 2;
+    else {
+      FP_TYPE r = lratio[j - 1] / (lratio[j - 1] - lratio[j]);
+      ret -> nhar[i] = exp(linterp(log(nhar[j - 1]), log(nhar[j]), r));
+    }
+  }
+
+  free(nhar); free(lratio);
+  free(ampl); free(phse);
+  return ret;
+}
+
+llsm_iczt_table* llsm_copy_iczt_table(llsm_iczt_table* src) {
+  if(src == NULL) return NULL;
+  llsm_iczt_table* ret = malloc(sizeof(llsm_iczt_table));
+  ret -> nnx = src -> nnx;
+  ret -> nx = malloc(src -> nnx * sizeof(int));
+  ret -> nhar = malloc(src -> nnx * sizeof(FP_TYPE));
+  memcpy(ret -> nx, src -> nx, src -> nnx * sizeof(int));
+  memcpy(ret -> nhar, src -> nhar, src -> nnx * sizeof(FP_TYPE));
+  return ret;
+}
+
+void llsm_delete_iczt_table(llsm_iczt_table* dst) {
+  if(dst == NULL) return;
+  free(dst -> nx);
+  free(dst -> nhar);
+  free(dst);
+}
+
+int llsm_save_iczt_table(llsm_iczt_table* src, const char* path) {
+  FILE* fp = fopen(path, "w");
+  if(fp == NULL) return 0;
+  fprintf(fp, "llsm-iczt-table 1\n%d\n", src -> nnx);
+  for(int i = 0; i < src -> nnx; i ++)
+    fprintf(fp, "%d %f\n", src -> nx[i], (double)src -> nhar[i]);
+  int ret = ! ferror(fp);
+  fclose(fp);
+  return ret;
+}
+
+llsm_iczt_table* llsm_load_iczt_table(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if(fp == NULL) return NULL;
+  int version = 0, nnx = 0;
+  if(fscanf(fp, "llsm-iczt-table %d %d", & version, & nnx) != 2 ||
+     version != 1 || nnx < 1) {
+    fclose(fp);
+    return NULL;
+  }
+  llsm_iczt_table* ret = malloc(sizeof(llsm_iczt_table));
+  ret -> nnx = nnx;
+  ret -> nx = calloc(nnx, sizeof(int));
+  ret -> nhar = calloc(nnx, sizeof(FP_TYPE));
+  for(int i = 0; i < nnx; i ++) {
+    double nhar = 0;
+    if(fscanf(fp, "%d %lf", & ret -> nx[i], & nhar) != 2 ||
+       ret -> nx[i] < 1 || nhar <= 0 ||
+       (i > 0 && ret -> nx[i] <= ret -> nx[i - 1])) {
+      llsm_delete_iczt_table(ret);
+      fclose(fp);
+      return NULL;
+    }
+    ret -> nhar[i] = nhar;
+  }
+  fclose(fp);
+  return ret;
+}
+
+int llsm_iczt_table_query(llsm_iczt_table* src, int nx, int nhar) {
+  FP_TYPE crossover;
+  int n = src -> nnx;
+  if(nx <= src -> nx[0])
+    crossover = src -> nhar[0];
+  else if(nx >= src -> nx[n - 1])
+    crossover = src -> nhar[n - 1];
+  else {
+    int i = 1;
+    while(src -> nx[i] < nx) i ++;
+    FP_TYPE r = log((FP_TYPE)nx / src -> nx[i - 1]) /
+      log((FP_TYPE)src -> nx[i] / src -> nx[i - 1]);
+    crossover = exp(linterp(log(src -> nhar[i - 1]), log(src -> nhar[i]), r));
+  }
+  return nhar > crossover;
+}
+
+static int prefer_iczt(llsm_soptions* options, int nhar, int nx) {
+  if(options == NULL || (! options -> use_iczt)) return 0;
+  if(options -> iczt_table != NULL)
+    return llsm_iczt_table_query(options -> iczt_table, nx, nhar);
+  return log_1(nx) * options -> iczt_param_a <
+         log_1(nhar) - options -> iczt_param_b;
+}
+
 FP_TYPE* llsm_synthesize_harmonic_frame_auto(llsm_soptions* options,
   FP_TYPE* ampl, FP_TYPE* phse, int nhar, FP_TYPE f0, int nx) {
-  FP_TYPE* ret = NULL;
-  if(options == NULL || (! options -> use_iczt))
-    ret = llsm_synthesize_harmonic_frame(ampl, phse, nhar, f0, nx);
-  else {
-    if(log_1(nx) * options -> iczt_param_a <
-       log_1(nhar) - options -> iczt_param_b)
-      ret = llsm_synthesize_harmonic_frame_iczt(ampl, phse, nhar, f0, nx);
-    else
-      ret = llsm_synthesize_harmonic_frame(ampl, phse, nhar, f0, nx);
+  if(prefer_iczt(options, nhar, nx))
+    return llsm_synthesize_harmonic_frame_iczt(ampl, phse, nhar, f0, nx);
+  return llsm_synthesize_harmonic_frame(ampl, phse, nhar, f0, nx);
+}
+
+int llsm_synthesize_harmonic_frame_auto_buffersize(int nhar, int nx) {
+  return llsm_synthesize_harmonic_frame_iczt_buffersize(nhar, nx);
+}
+
+void llsm_synthesize_harmonic_frame_auto_buffered(llsm_soptions* options,
+  FP_TYPE* ampl, FP_TYPE* phse, int nhar, FP_TYPE f0, int nx, FP_TYPE* dst,
+  FP_TYPE* buffer) {
+  if(prefer_iczt(options, nhar, nx)) {
+    llsm_synthesize_harmonic_frame_iczt_buffered(ampl, phse, nhar, f0, nx,
+      dst, buffer);
+    return;
   }
+  memset(dst, 0, nx * sizeof(FP_TYPE));
+  llsm_synthesize_harmonic_frame_ola(ampl, phse, nhar, f0, nx, NULL, dst,
+    0, nx);
+}
+
+void llsm_synthesize_harmonic_frame_auto_ola(llsm_soptions* options,
+  FP_TYPE* ampl, FP_TYPE* phse, int nhar, FP_TYPE f0, int nx, FP_TYPE* w,
+  FP_TYPE* y, int offset, int ny) {
+  if(prefer_iczt(options, nhar, nx)) {
+    FP_TYPE* yi = llsm_synthesize_harmonic_frame_iczt(ampl, phse, nhar, f0,
+      nx);
+    for(int j = max(0, -offset); j < min(nx, ny - offset); j ++)
+      y[offset + j] += w == NULL ? yi[j] : yi[j] * w[j];
+    free(yi);
+  } else
+    llsm_synthesize_harmonic_frame_ola(ampl, phse, nhar, f0, nx, w, y,
+      offset, ny);
+}
+
+// Scratch and caches for pulse-by-pulse synthesis. All buffers grow on demand
+//   and are reused afterwards, so making pulses is allocation-free once the
+//   engine is warmed up. The LF model spectrum of the last source is kept
+//   since consecutive periods usually share the same glottal parameters.
+typedef struct {
+  int size;            // capacity of the FFT-sized buffers
+  FP_TYPE* buffer;     // FFT work space (size * 2)
+  FP_TYPE* real_resp;
+  FP_TYPE* imag_resp;
+  FP_TYPE* y;
+  FP_TYPE* freq_axis;  // (halfsize) bin frequencies for axis_size, axis_fs
+  FP_TYPE* delta_re;   // (halfsize) per-frame phase correction
+  FP_TYPE* delta_im;
+  FP_TYPE* src_re;     // (halfsize) cached source spectrum
+  FP_TYPE* src_im;
+  FP_TYPE* rot_re;     // (halfsize) sum of linear phase shifts
+  FP_TYPE* rot_im;
+  FP_TYPE* acc_re;     // (halfsize) sum of shifted source spectra
+  FP_TYPE* acc_im;
+  int axis_size;
+  FP_TYPE axis_fs;
+
+  int nhar;            // capacity of the per-harmonic buffers
+  FP_TYPE* freq_har;   // (nhar + 1)
+  FP_TYPE* phse_har;   // (nhar + 1)
+  FP_TYPE* har_re;     // (nhar + 1)
+  FP_TYPE* har_im;     // (nhar + 1)
+  FP_TYPE* vtamplhar;  // (nhar)
+  FP_TYPE* vt_phse;    // (nhar)
+  FP_TYPE* vs_phse;    // (nhar) source phase propagated by theta
+  FP_TYPE* minphase_buffer;
+
+  int nspec;           // capacity of vtaxis
+  FP_TYPE* vtaxis;
+
+  int cached;          // whether src_re/src_im are valid
+  lfmodel cached_source;
+  FP_TYPE cached_fnyq;
+
+  int npulse;          // capacity of offsets and sources
+  FP_TYPE* offsets;
+  lfmodel* sources;
+} pbp_engine;
+
+llsm_pbp_engine* llsm_create_pbp_engine() {
+  pbp_engine* ret = calloc(1, sizeof(pbp_engine));
   return ret;
 }
 
-static void make_filtered_pulse_spectrum(llsm_container* src, lfmodel source,
-  FP_TYPE phase_shift, int size, FP_TYPE fnyq, FP_TYPE lip_radius, FP_TYPE fs,
-  FP_TYPE* vt_harphse, int nhar, FP_TYPE* freq_axis,
-  FP_TYPE* dst_re, FP_TYPE* dst_im) {
-  int halfsize = size / 2 + 1;
-  FP_TYPE* rd = llsm_container_get(src, LLSM_FRAME_RD);
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
-  FP_TYPE* vsphse = llsm_container_get(src, LLSM_FRAME_VSPHSE);
-  FP_TYPE* freq_har = calloc(nhar + 1, sizeof(FP_TYPE));
-  FP_TYPE* phse_har = calloc(nhar + 1, sizeof(FP_TYPE));
-  for(int i = 0; i <= nhar; i ++) freq_har[i] = i * f0[0];
+void llsm_delete_pbp_engine(llsm_pbp_engine* dst) {
+  if(dst == NULL) return;
+  pbp_engine* engine = dst;
+  free(engine -> buffer);
+  free(engine -> freq_har);
+  free(engine -> vtaxis);
+  free(engine -> offsets);
+  free(engine -> sources);
+  free(engine);
+}
+
+void llsm_pbp_engine_reserve_pulses(llsm_pbp_engine* dst, int num_pulses,
+  FP_TYPE** dst_offsets, lfmodel** dst_sources) {
+  pbp_engine* engine = dst;
+  if(num_pulses > engine -> npulse) {
+    engine -> npulse = num_pulses;
+    free(engine -> offsets);
+    free(engine -> sources);
+    engine -> offsets = calloc(num_pulses, sizeof(FP_TYPE));
+    engine -> sources = calloc(num_pulses, sizeof(lfmodel));
+  }
+  *dst_offsets = engine -> offsets;
+  *dst_sources = engine -> sources;
+}
+
+static void pbp_engine_reserve(pbp_engine* dst, int size, FP_TYPE fs,
+  int nhar, int nspec) {
+  if(size > dst -> size) {
+    int halfsize = size / 2 + 1;
+    dst -> size = size;
+    free(dst -> buffer);
+    dst -> buffer = calloc(size * 5 + halfsize * 9, sizeof(FP_TYPE));
+    dst -> real_resp = dst -> buffer + size * 2;
+    dst -> imag_resp = dst -> real_resp + size;
+    dst -> y = dst -> imag_resp + size;
+    dst -> freq_axis = dst -> y + size;
+    dst -> delta_re = dst -> freq_axis + halfsize;
+    dst -> delta_im = dst -> delta_re + halfsize;
+    dst -> src_re = dst -> delta_im + halfsize;
+    dst -> src_im = dst -> src_re + halfsize;
+    dst -> rot_re = dst -> src_im + halfsize;
+    dst -> rot_im = dst -> rot_re + halfsize;
+    dst -> acc_re = dst -> rot_im + halfsize;
+    dst -> acc_im = dst -> acc_re + halfsize;
+    dst -> axis_size = 0;
+  }
+  if(size != dst -> axis_size || fs != dst -> axis_fs) {
+    dst -> axis_size = size;
+    dst -> axis_fs = fs;
+    dst -> cached = 0;
+    for(int i = 0; i < size / 2 + 1; i ++)
+      dst -> freq_axis[i] = i * fs / size;
+  }
+  if(nhar > dst -> nhar) {
+    int nbuffer = llsm_harmonic_minphase_buffersize(nhar);
+    dst -> nhar = nhar;
+    free(dst -> freq_har);
+    dst -> freq_har = calloc((nhar + 1) * 4 + nhar * 3 + nbuffer,
+      sizeof(FP_TYPE));
+    dst -> phse_har = dst -> freq_har + nhar + 1;
+    dst -> har_re = dst -> phse_har + nhar + 1;
+    dst -> har_im = dst -> har_re + nhar + 1;
+    dst -> vtamplhar = dst -> har_im + nhar + 1;
+    dst -> vt_phse = dst -> vtamplhar + nhar;
+    dst -> vs_phse = dst -> vt_phse + nhar;
+    dst -> minphase_buffer = dst -> vs_phse + nhar;
+  }
+  if(nspec > dst -> nspec) {
+    dst -> nspec = nspec;
+    free(dst -> vtaxis);
+    dst -> vtaxis = calloc(nspec, sizeof(FP_TYPE));
+  }
+}
+
+// Same as interp1, but writes into y.
+static void interp1_into(FP_TYPE* xi, FP_TYPE* yi, int ni, FP_TYPE* x, int nx,
+  FP_TYPE* y) {
+  int srcidx = 0;
+  for(int i = 0; i < nx; i ++) {
+    FP_TYPE dstx = x[i];
+    while(srcidx + 1 < ni && xi[srcidx + 1] < dstx) srcidx ++;
+    int i1 = srcidx == ni - 1 ? srcidx : srcidx + 1;
+    if(srcidx != i1 && dstx > xi[0])
+      y[i] = (yi[i1] - yi[srcidx]) * (dstx - xi[srcidx]) /
+        (xi[i1] - xi[srcidx]) + yi[srcidx];
+    else
+      y[i] = yi[srcidx];
+  }
+}
+
+static int lfmodel_equal(lfmodel a, lfmodel b) {
+  return a.T0 == b.T0 && a.te == b.te && a.tp == b.tp && a.ta == b.ta &&
+    a.Ee == b.Ee;
+}
+
+// Compute the per-frame phase correction e^(j(delta - pi / 2)) into
+//   delta_re/im, where delta is the difference between the LF-model phase and
+//   the actual phase (including vocal tract phase) interpolated on the FFT
+//   axis. It does not depend on the pulses and is shared by all of them.
+static void pbp_engine_phase_delta(pbp_engine* engine, llsm_container* src,
+  FP_TYPE theta, int halfsize, int nhar) {
+  FP_TYPE* rd = llsm_container_peek(src, LLSM_FRAME_RD);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  FP_TYPE* vsphse = llsm_container_peek(src, LLSM_FRAME_VSPHSE);
+  FP_TYPE* freq_har = engine -> freq_har;
+  FP_TYPE* phse_har = engine -> phse_har;
   // First, we compute the difference between LF-model phase and the actual
   //   phase for each harmonic. This difference will be freq-interpolated and
   //   added back to the phase spectrum so that the pulse-by-pulse synthesized
   //   speech matches the result from harmonic models.
-  lfmodel source_orig = lfmodel_from_rd(*rd, 1.0 / f0[0], 1.0);
-  free(lfmodel_spectrum(source_orig, freq_har + 1, nhar, phse_har + 1));
-  FP_TYPE vsshift = vsphse[0] - (phse_har[1] - 0.5 * M_PI);
+  phse_har[0] = 0;
+  llsm_lfmodel_harmonics(*rd, f0[0], nhar, NULL, phse_har + 1);
+  // the source phase propagated by theta (as llsm_frame_phaseshift does)
+  FP_TYPE* vs_phse = engine -> vs_phse;
+  for(int i = 0; i < nhar; i ++)
+    vs_phse[i] = theta == 0 ? vsphse[i] : wrap(vsphse[i] + theta * (i + 1.0));
+  FP_TYPE vsshift = vs_phse[0] - (phse_har[1] - 0.5 * M_PI);
   for(int i = 1; i <= nhar; i ++) {
     phse_har[i] -= 0.5 * M_PI;
-    phse_har[i] = wrap(vsphse[i - 1] - phse_har[i] - vsshift * i);
+    phse_har[i] = wrap(vs_phse[i - 1] - phse_har[i] - vsshift * i);
   }
 
   // add VT phase to the phase delta vector
   for(int i = 0; i < nhar; i ++)
-    phse_har[i + 1] += vt_harphse[i];
+    phse_har[i + 1] += engine -> vt_phse[i];
 
   // Now the harmonic phase delta will be expanded into a full-sized phase
   //   envelope. Phase interpolation is error-prone but in this context
   //   systematic errors won't matter thanks to the error-cancelling effect
   //   of PSOLA. Spurious errors matter though.
-  FP_TYPE* phse_re = calloc(nhar + 1, sizeof(FP_TYPE));
-  FP_TYPE* phse_im = calloc(nhar + 1, sizeof(FP_TYPE));
   for(int i = 0; i < nhar + 1; i ++) {
-    phse_re[i] = cos_2(phse_har[i]);
-    phse_im[i] = sin_2(phse_har[i]);
-  }
-  FP_TYPE* phse_delta_re = interp1(
-    freq_har, phse_re, nhar + 1, freq_axis, halfsize);
-  FP_TYPE* phse_delta = interp1(
-    freq_har, phse_im, nhar + 1, freq_axis, halfsize);
-  for(int i = 0; i < halfsize; i ++)
-    phse_delta[i] = atan2(phse_delta[i], phse_delta_re[i]);
-  free(freq_har);
-  free(phse_har);
-  free(phse_re); free(phse_im);
-  free(phse_delta_re);
+    engine -> har_re[i] = cos_2(phse_har[i]);
+    engine -> har_im[i] = sin_2(phse_har[i]);
+  }
+  FP_TYPE* delta_re = engine -> delta_re;
+  FP_TYPE* delta_im = engine -> delta_im;
+  interp1_into(freq_har, engine -> har_re, nhar + 1, engine -> freq_axis,
+    halfsize, delta_re);
+  interp1_into(freq_har, engine -> har_im, nhar + 1, engine -> freq_axis,
+    halfsize, delta_im);
+  // Normalizing the interpolated phasor gives (cos(delta), sin(delta))
+  //   without going through atan2; rotate it by -pi / 2 (integration).
+  for(int i = 0; i < halfsize; i ++) {
+    FP_TYPE norm = sqrt(delta_re[i] * delta_re[i] +
+                        delta_im[i] * delta_im[i]);
+    FP_TYPE c = norm > 0 ? delta_re[i] / norm : 1.0;
+    FP_TYPE s = norm > 0 ? delta_im[i] / norm : 0.0;
+    delta_re[i] = s;
+    delta_im[i] = -c;
+  }
+}
 
-  // From this point we will move from harmonic reprensentations to full-sized
-  //   spectra. A spectrum generated from LF model is first integrated (to
-  //   become glottal flow velocity); then various phase corrections are
-  //   applied. The amplitude is normalized by the first glottal harmonic and
-  //   appropriately scaled for IFFT.
-  FP_TYPE* lfphseresp = calloc(halfsize, sizeof(FP_TYPE));
-  FP_TYPE* lfmagnf0 = lfmodel_spectrum(source_orig, f0, 1, NULL);
+// Integrated LF model spectrum scaled for IFFT, cached across pulses and
+//   frames as long as the source and the axis stay the same.
+static void pbp_engine_source_spectrum(pbp_engine* engine, lfmodel source,
+  int halfsize, FP_TYPE fnyq) {
+  if(engine -> cached && fnyq == engine -> cached_fnyq &&
+     lfmodel_equal(source, engine -> cached_source))
+    return;
+  FP_TYPE* lfphseresp = engine -> src_im;
   FP_TYPE* lfmagnresp = lfmodel_spectrum(
-    source, freq_axis, halfsize, lfphseresp);
-  lfmagnresp[0] = 0;
-  lfphseresp[0] = 0;
+    source, engine -> freq_axis, halfsize, lfphseresp);
+  engine -> src_re[0] = 0;
+  engine -> src_im[0] = 0;
   for(int i = 1; i < halfsize; i ++) {
-    lfmagnresp[i] *= (fnyq / freq_axis[i]) / lfmagnf0[0];
-    lfphseresp[i] += phase_shift * i * 2 * M_PI / size;
-    lfphseresp[i] += phse_delta[i] - 0.5 * M_PI;
-    dst_re[i]     += lfmagnresp[i] * cos_2(lfphseresp[i]);
-    dst_im[i]     += lfmagnresp[i] * sin_2(lfphseresp[i]);
+    FP_TYPE magn = lfmagnresp[i] * (fnyq / engine -> freq_axis[i]);
+    FP_TYPE phse = lfphseresp[i];
+    engine -> src_re[i] = magn * cos_2(phse);
+    engine -> src_im[i] = magn * sin_2(phse);
   }
-  free(lfmagnf0);
-  free(phse_delta);
-
-  free(lfmagnresp); free(lfphseresp);
+  free(lfmagnresp);
+  engine -> cached = 1;
+  engine -> cached_source = source;
+  engine -> cached_fnyq = fnyq;
 }
 
-FP_TYPE* llsm_make_filtered_pulse(llsm_container* src, lfmodel* sources,
-  FP_TYPE* offsets, int num_pulses, int pre_rotate, int size, FP_TYPE fnyq,
+FP_TYPE* llsm_pbp_engine_make_pulse(llsm_pbp_engine* dst,
+  llsm_container* src, FP_TYPE theta, lfmodel* sources, FP_TYPE* offsets,
+  int num_pulses, int pre_rotate, int size, FP_TYPE fnyq,
   FP_TYPE lip_radius, FP_TYPE fs) {
-  FP_TYPE* buffer = calloc(size * 5, sizeof(FP_TYPE));
-  FP_TYPE* freq_axis = buffer + size * 2;
-  FP_TYPE* real_resp = buffer + size * 3;
-  FP_TYPE* imag_resp = buffer + size * 4;
-  int halfsize = size / 2 + 1;
-  for(int i = 0; i < halfsize; i ++)
-    freq_axis[i] = i * fs / size;
-
-  FP_TYPE* vtmagn = llsm_container_get(src, LLSM_FRAME_VTMAGN);
-  FP_TYPE* vsphse = llsm_container_get(src, LLSM_FRAME_VSPHSE);
-  FP_TYPE* f0 = llsm_container_get(src, LLSM_FRAME_F0);
-  int nspec = llsm_fparray_length(vtmagn);
+  pbp_engine* engine = dst;
+  FP_TYPE* vtmagn = llsm_container_peek(src, LLSM_FRAME_VTMAGN);
+  FP_TYPE* vtcep = llsm_container_peek(src, LLSM_FRAME_VTCEP);
+  FP_TYPE* vsphse = llsm_container_peek(src, LLSM_FRAME_VSPHSE);
+  FP_TYPE* f0 = llsm_container_peek(src, LLSM_FRAME_F0);
+  FP_TYPE* rd = llsm_container_peek(src, LLSM_FRAME_RD);
+  // Without VTMAGN, the compact envelope is evaluated at the frequencies
+  //   needed instead.
+  int nspec = vtmagn != NULL ? llsm_fparray_length(vtmagn) : 0;
+  int ncep = vtmagn == NULL ? llsm_fparray_length(vtcep) : 0;
   int nhar = llsm_fparray_length(vsphse);
+  int halfsize = size / 2 + 1;
+  pbp_engine_reserve(engine, size, fs, nhar, nspec);
+  FP_TYPE* freq_axis = engine -> freq_axis;
+  FP_TYPE* real_resp = engine -> real_resp;
+  FP_TYPE* imag_resp = engine -> imag_resp;
 
   // To keep PbP synthesis consistent with HM, we need to compute vocal tract
   //   phase directly from its harmonic representation, albeit at a cost of
   //   slightly breaking minimum phase property (w.r.t full-sized spectra).
-  FP_TYPE* vtaxis = linspace(0, fnyq, nspec);
-  FP_TYPE* freq_har = calloc(nhar + 1, sizeof(FP_TYPE));
-  for(int i = 0; i <= nhar; i ++) freq_har[i] = i * f0[0];
-  FP_TYPE* vtamplhar = interp1(vtaxis, vtmagn, nspec, freq_har + 1, nhar);
+  FP_TYPE* vtaxis = engine -> vtaxis;
+  for(int i = 0; i < nspec; i ++)
+    vtaxis[i] = fnyq * i / (nspec - 1);
+  for(int i = 0; i <= nhar; i ++) engine -> freq_har[i] = i * f0[0];
+  if(vtmagn != NULL)
+    interp1_into(vtaxis, vtmagn, nspec, engine -> freq_har + 1, nhar,
+      engine -> vtamplhar);
+  else
+    llsm_vtcep_magn(vtcep, ncep, fnyq, engine -> freq_har + 1, nhar,
+      engine -> vtamplhar);
   for(int i = 0; i < nhar; i ++)
-    vtamplhar[i] = exp(DB2LOG(vtamplhar[i]));
-  FP_TYPE* vt_phse = llsm_harmonic_minphase(vtamplhar, nhar);
-  free(freq_har);
-  free(vtamplhar);
+    engine -> vtamplhar[i] = exp(DB2LOG(engine -> vtamplhar[i]));
+  llsm_harmonic_minphase_buffered(engine -> vtamplhar, nhar,
+    engine -> vt_phse, engine -> minphase_buffer);
+  pbp_engine_phase_delta(engine, src, theta, halfsize, nhar);
+
+  // From this point we will move from harmonic reprensentations to full-sized
+  //   spectra. A spectrum generated from LF model is first integrated (to
+  //   become glottal flow velocity); then the pulses are placed by linear
+  //   phase shifts. Pulses sharing the same source only differ in their
+  //   shifts, so the shifts of each run of identical sources are summed
+  //   before multiplying with the source spectrum.
+  FP_TYPE* acc_re = engine -> acc_re;
+  FP_TYPE* acc_im = engine -> acc_im;
+  FP_TYPE* rot_re = engine -> rot_re;
+  FP_TYPE* rot_im = engine -> rot_im;
+  for(int i = 0; i < halfsize; i ++) acc_re[i] = acc_im[i] = 0;
+  for(int p = 0; p < num_pulses; ) {
+    int q = p + 1;
+    while(q < num_pulses && lfmodel_equal(sources[q], sources[p])) q ++;
+    pbp_engine_source_spectrum(engine, sources[p], halfsize, fnyq);
+    for(int i = 0; i < halfsize; i ++) rot_re[i] = rot_im[i] = 0;
+    for(int j = p; j < q; j ++) {
+      FP_TYPE omega = (-offsets[j] - pre_rotate) * 2 * M_PI / size;
+      for(int i = 1; i < halfsize; i ++) {
+        rot_re[i] += cos_2(omega * i);
+        rot_im[i] += sin_2(omega * i);
+      }
+    }
+    FP_TYPE* src_re = engine -> src_re;
+    FP_TYPE* src_im = engine -> src_im;
+    for(int i = 1; i < halfsize; i ++) {
+      acc_re[i] += src_re[i] * rot_re[i] - src_im[i] * rot_im[i];
+      acc_im[i] += src_re[i] * rot_im[i] + src_im[i] * rot_re[i];
+    }
+    p = q;
+  }
 
-  for(int i = 0; i < num_pulses; i ++) {
-    make_filtered_pulse_spectrum(src, sources[i], -offsets[i] - pre_rotate,
-      size, fnyq, lip_radius, fs, vt_phse, nhar, freq_axis,
-      real_resp, imag_resp);
+  // Apply the phase corrections; the amplitude is normalized by the first
+  //   glottal harmonic.
+  FP_TYPE lfmagnf0 = 0;
+  llsm_lfmodel_harmonics(*rd, f0[0], 1, & lfmagnf0, NULL);
+  FP_TYPE* delta_re = engine -> delta_re;
+  FP_TYPE* delta_im = engine -> delta_im;
+  for(int i = 0; i < halfsize; i ++) {
+    real_resp[i] = (acc_re[i] * delta_re[i] - acc_im[i] * delta_im[i])
+                 / lfmagnf0;
+    imag_resp[i] = (acc_re[i] * delta_im[i] + acc_im[i] * delta_re[i])
+                 / lfmagnf0;
   }
-  free(vt_phse);
 
   // Apply the lip radiation filter.
   llsm_lipfilter_reim(lip_radius, fs / size, halfsize,
     real_resp, imag_resp, 0);
 
   // Apply the vocal tract magnitude filter (whose phase part has already been
-  //   addressed in make_filter_pulse_spectrum).
-  FP_TYPE* vtmagn_scaled = interp1(vtaxis, vtmagn, nspec, freq_axis, halfsize);
+  //   addressed in pbp_engine_phase_delta).
+  FP_TYPE* vtmagn_scaled = rot_re;
+  if(vtmagn != NULL)
+    interp1_into(vtaxis, vtmagn, nspec, freq_axis, halfsize, vtmagn_scaled);
+  else
+    llsm_vtcep_magn(vtcep, ncep, fnyq, freq_axis, halfsize, vtmagn_scaled);
   for(int i = 0; i < halfsize; i ++) {
     FP_TYPE gain = exp_2(DB2LOG(vtmagn_scaled[i]));
     real_resp[i] *= gain;
     imag_resp[i] *= gain;
   }
-  free(vtaxis); free(vtmagn_scaled);
 
   // Recover the negative part using real-dft symmetry and inverse transform.
   complete_symm (real_resp, size);
   complete_asymm(imag_resp, size);
-  ifft(real_resp, imag_resp, real_resp, NULL, size, buffer);
+  ifft(real_resp, imag_resp, real_resp, NULL, size, engine -> buffer);
 
   // Some tricks to reduce glitches at boundaries.
   int fadein = min(256, pre_rotate);
   int fadeout = min(256, size);
-  FP_TYPE* y = calloc(size, sizeof(FP_TYPE));
+  FP_TYPE* y = engine -> y;
   for(int i = 0; i < size; i ++)
     y[i] = real_resp[i];
   for(int i = 0; i < fadein; i ++)
     y[i] *= (FP_TYPE)i / fadein;
   for(int i = size - fadeout; i < size; i ++)
     y[i] *= (FP_TYPE)(size - i) / fadeout;
-  free(buffer);
 
   return y;
 }
+
+void llsm_pbpeffect_apply(llsm_pbpeffect* src, llsm_gfm* dst,
+  FP_TYPE* delta_t, llsm_container* src_frame, FP_TYPE theta) {
+  if(src -> modifier_propagated != NULL)
+    src -> modifier_propagated(dst, delta_t, src -> info, src_frame, theta);
+  else if(src -> modifier != NULL)
+    src -> modifier(dst, delta_t, src -> info, src_frame);
+}
+
+FP_TYPE* llsm_make_filtered_pulse(llsm_container* src, lfmodel* sources,
+  FP_TYPE* offsets, int num_pulses, int pre_rotate, int size, FP_TYPE fnyq,
+  FP_TYPE lip_radius, FP_TYPE fs) {
+  llsm_pbp_engine* engine = llsm_create_pbp_engine();
+  FP_TYPE* y = llsm_pbp_engine_make_pulse(engine, src, 0, sources, offsets,
+    num_pulses, pre_rotate, size, fnyq, lip_radius, fs);
+  FP_TYPE* ret = calloc(size, sizeof(FP_TYPE));
+  for(int i = 0; i < size; i ++) ret[i] = y[i];
+  llsm_delete_pbp_engine(engine);
+  return ret;
+}
@@ -38,6 +38,23 @@ lfmodel llsm_gfm_to_lfmodel(llsm_gfm src);
 FP_TYPE* llsm_synthesize_harmonic_frame_auto(llsm_soptions* options,
   FP_TYPE* ampl, FP_TYPE* phse, int nhar, FP_TYPE f0, int nx);
 
+/** @brief Same as llsm_synthesize_harmonic_frame_auto, but windowed by w
+ *    (unless NULL) and added onto y starting from offset (see
+ *    llsm_synthesize_harmonic_frame_ola). */
+void llsm_synthesize_harmonic_frame_auto_ola(llsm_soptions* options,
+  FP_TYPE* ampl, FP_TYPE* phse, int nhar, FP_TYPE f0, int nx, FP_TYPE* w,
+  FP_TYPE* y, int offset, int ny);
+
+/** @brief Get the size (in number of FP_TYPE) of the buffer needed by
+ *    llsm_synthesize_harmonic_frame_auto_buffered. */
+int llsm_synthesize_harmonic_frame_auto_buffersize(int nhar, int nx);
+
+/** @brief Same as llsm_synthesize_harmonic_frame_auto, except that the nx
+ *    samples are written into dst and no memory is allocated. */
+void llsm_synthesize_harmonic_frame_auto_buffered(llsm_soptions* options,
+  FP_TYPE* ampl, FP_TYPE* phse, int nhar, FP_TYPE f0, int nx, FP_TYPE* dst,
+  FP_TYPE* buffer);
+
 /** @brief Generate the sum of a few pulses from a LF model and filter it
  *    by layer 1 parameters, while keeping the phases coherent with the
  *    harmonic model. */
@@ -45,4 +62,57 @@ FP_TYPE* llsm_make_filtered_pulse(llsm_container* src, lfmodel* sources,
   FP_TYPE* offsets, int num_pulses, int pre_rotate, int size, FP_TYPE fnyq,
   FP_TYPE lip_radius, FP_TYPE fs);
 
+/** @brief Reusable scratch, FFT buffers and source spectrum cache for
+ *    pulse-by-pulse synthesis. The implementation is hidden; an engine must
+ *    not be shared between threads. */
+typedef void llsm_pbp_engine;
+
+llsm_pbp_engine* llsm_create_pbp_engine();
+
+void llsm_delete_pbp_engine(llsm_pbp_engine* dst);
+
+/** @brief Get arrays owned by the engine for describing at least num_pulses
+ *    pulses; they stay valid until the next call. */
+void llsm_pbp_engine_reserve_pulses(llsm_pbp_engine* dst, int num_pulses,
+  FP_TYPE** dst_offsets, lfmodel** dst_sources);
+
+/** @brief Same as llsm_make_filtered_pulse, except that the size samples
+ *    are stored in the engine and stay valid until the next call, and that
+ *    a non-zero theta renders src as if it had been shifted by
+ *    llsm_frame_phaseshift(src, theta), leaving src untouched. */
+FP_TYPE* llsm_pbp_engine_make_pulse(llsm_pbp_engine* dst,
+  llsm_container* src, FP_TYPE theta, lfmodel* sources, FP_TYPE* offsets,
+  int num_pulses, int pre_rotate, int size, FP_TYPE fnyq,
+  FP_TYPE lip_radius, FP_TYPE fs);
+
+/** @brief Run the modifier of a Pulse-by-Pulse effect on src_frame, which
+ *    the synthesizer propagates by theta. */
+void llsm_pbpeffect_apply(llsm_pbpeffect* src, llsm_gfm* dst,
+  FP_TYPE* delta_t, llsm_container* src_frame, FP_TYPE theta);
+
+/** @brief Evaluate the compact vocal tract envelope (LLSM_FRAME_VTCEP) at
+ *    nfreq frequencies (Hz, clamped to fnyq); the magnitudes (dB) are
+ *    written into dst. */
+void llsm_vtcep_magn(FP_TYPE* cep, int ncep, FP_TYPE fnyq, FP_TYPE* freq,
+  int nfreq, FP_TYPE* dst);
+
+/** @brief Scratch for evaluating the harmonics of layer 1 frames on the fly,
+ *    without attaching llsm_hmframe to them. A converter must not be shared
+ *    between threads. */
+typedef void llsm_layerconv;
+
+llsm_layerconv* llsm_create_layerconv();
+
+void llsm_delete_layerconv(llsm_layerconv* dst);
+
+/** @brief Evaluate the harmonics llsm_frame_tolayer0 would give for src;
+ *    the arrays are owned by the converter and stay valid until the next
+ *    call. A non-zero theta evaluates the frame as if it had been shifted
+ *    by llsm_frame_phaseshift(src, theta), leaving src untouched. Returns
+ *    the number of harmonics, or -1 if src (or conf) does not allow the
+ *    conversion. */
+int llsm_layerconv_harmonics(llsm_layerconv* dst, llsm_container* src,
+  llsm_container* conf, FP_TYPE theta, FP_TYPE** dst_ampl,
+  FP_TYPE** dst_phse);
+
 #endif
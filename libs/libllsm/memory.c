@@ -0,0 +1,296 @@
+/*
+  libllsm2 - Low Level Speech Model (version 2)
+  ===
+  Copyright (c) 2017-2020 Kanru Hua.
+
+  libllsm2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  libllsm2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libllsm. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "llsm.h"
+#include "buffer.h"
+#include <string.h>
+#include <stdlib.h>
+#if defined(LLSM_USE_SLAB) && defined(USE_PTHREAD)
+#include <pthread.h>
+#endif
+
+// The statistics are shared by all threads and cost an atomic operation per
+//   allocation, so they are only collected when built with LLSM_ALLOC_STAT.
+#ifdef LLSM_ALLOC_STAT
+static long stat_nalloc = 0;
+static long stat_nfree = 0;
+static long stat_nmalloc = 0;
+static long stat_ncached = 0;
+static long stat_narena = 0;
+#define llsm_stat_increment(x) llsm_atomic_increment(x)
+#define llsm_stat_decrement(x) llsm_atomic_decrement(x)
+#else
+#define llsm_stat_increment(x) ((void)0)
+#define llsm_stat_decrement(x) ((void)0)
+#endif
+
+#if defined(_MSC_VER)
+#  define LLSM_THREAD_LOCAL __declspec(thread)
+#else
+#  define LLSM_THREAD_LOCAL __thread
+#endif
+
+#define LLSM_BLOCK_HEAP  -1
+#define LLSM_BLOCK_ARENA -2
+
+// Every block starts with a header recording where it should go back to.
+typedef union {
+  struct {
+    size_t size;   // usable size (unused by the size classes)
+    int sizeclass; // size class, LLSM_BLOCK_HEAP or LLSM_BLOCK_ARENA
+  } info;
+  char pad[16];
+} llsm_blockheader;
+
+// Arenas hand out blocks by bumping a pointer through large chunks of memory,
+//   which are only given back when the arena is deleted.
+typedef struct llsm_arenachunk_ {
+  struct llsm_arenachunk_* next;
+  size_t capacity;
+  size_t used;
+} llsm_arenachunk;
+
+#define LLSM_ARENACHUNK_HEADER ((sizeof(llsm_arenachunk) + 15) & ~(size_t)15)
+
+typedef struct {
+  llsm_arenachunk* head;
+  size_t chunksize;
+} llsm_arena_;
+
+static LLSM_THREAD_LOCAL llsm_arena_* current_arena = NULL;
+
+llsm_arena* llsm_create_arena(size_t chunksize) {
+  llsm_arena_* ret = malloc(sizeof(llsm_arena_));
+  ret -> head = NULL;
+  ret -> chunksize = chunksize;
+  return ret;
+}
+
+void llsm_delete_arena(llsm_arena* dst) {
+  if(dst == NULL) return;
+  llsm_arena_* arena = dst;
+  while(arena -> head != NULL) {
+    llsm_arenachunk* next = arena -> head -> next;
+    free(arena -> head);
+    arena -> head = next;
+  }
+  free(arena);
+}
+
+llsm_arena* llsm_use_arena(llsm_arena* src) {
+  llsm_arena_* ret = current_arena;
+  current_arena = src;
+  return ret;
+}
+
+static llsm_blockheader* llsm_arena_alloc(llsm_arena_* arena, size_t size) {
+  size_t total = (sizeof(llsm_blockheader) + size + 15) & ~(size_t)15;
+  llsm_arenachunk* chunk = arena -> head;
+  if(chunk == NULL || chunk -> used + total > chunk -> capacity) {
+    size_t capacity = total > arena -> chunksize ? total : arena -> chunksize;
+    chunk = malloc(LLSM_ARENACHUNK_HEADER + capacity);
+    chunk -> next = arena -> head;
+    chunk -> capacity = capacity;
+    chunk -> used = 0;
+    arena -> head = chunk;
+    llsm_stat_increment(stat_nmalloc);
+  }
+  llsm_blockheader* block = (llsm_blockheader*)
+    ((char*)chunk + LLSM_ARENACHUNK_HEADER + chunk -> used);
+  chunk -> used += total;
+  block -> info.size = total - sizeof(llsm_blockheader);
+  block -> info.sizeclass = LLSM_BLOCK_ARENA;
+  llsm_stat_increment(stat_narena);
+  return block;
+}
+
+static llsm_blockheader* llsm_heap_alloc(size_t size) {
+  llsm_blockheader* block = malloc(sizeof(llsm_blockheader) + size);
+  block -> info.size = size;
+  block -> info.sizeclass = LLSM_BLOCK_HEAP;
+  llsm_stat_increment(stat_nmalloc);
+  return block;
+}
+
+#ifdef LLSM_USE_SLAB
+
+// Size classes: 16 bytes, then four classes per power of two up to
+//   2^(LLSM_SLAB_MAXLOG2); larger blocks go directly to malloc.
+#define LLSM_SLAB_MAXLOG2 17
+#define LLSM_SLAB_NCLASS ((LLSM_SLAB_MAXLOG2 - 4) * 4 + 1)
+// Upper limit of the memory held by each size class in each thread.
+#define LLSM_SLAB_CACHE_BYTES (1 << 20)
+
+typedef struct {
+  void* head[LLSM_SLAB_NCLASS];
+  int count[LLSM_SLAB_NCLASS];
+} llsm_slabcache;
+
+static LLSM_THREAD_LOCAL llsm_slabcache slab_cache;
+
+static void llsm_slab_drain(llsm_slabcache* cache) {
+  for(int i = 0; i < LLSM_SLAB_NCLASS; i ++) {
+    while(cache -> head[i] != NULL) {
+      llsm_blockheader* block = cache -> head[i];
+      cache -> head[i] = *((void**)(block + 1));
+      free(block);
+      llsm_stat_decrement(stat_ncached);
+    }
+    cache -> count[i] = 0;
+  }
+}
+
+#ifdef USE_PTHREAD
+// The cache of each thread is registered under a key on its first use, so
+//   that it is drained when the thread exits.
+static pthread_key_t slab_key;
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+static LLSM_THREAD_LOCAL int slab_registered = 0;
+
+static void llsm_slab_exit(void* cache) {
+  llsm_slab_drain(cache);
+}
+
+static void llsm_slab_create_key() {
+  pthread_key_create(& slab_key, llsm_slab_exit);
+}
+
+static void llsm_slab_register() {
+  if(slab_registered) return;
+  pthread_once(& slab_key_once, llsm_slab_create_key);
+  pthread_setspecific(slab_key, & slab_cache);
+  slab_registered = 1;
+}
+#else
+#define llsm_slab_register() ((void)0)
+#endif
+
+static size_t llsm_slab_classsize(int sizeclass) {
+  if(sizeclass == 0) return 16;
+  int k = 4 + (sizeclass - 1) / 4;
+  int q = (sizeclass - 1) % 4;
+  return ((size_t)1 << k) + (size_t)(q + 1) * ((size_t)1 << (k - 2));
+}
+
+static int llsm_slab_sizeclass(size_t size) {
+  if(size <= 16) return 0;
+  int k = 4;
+  while(((size_t)2 << k) < size) k ++;
+  if(k >= LLSM_SLAB_MAXLOG2) return LLSM_BLOCK_HEAP;
+  int q = (size - 1 - ((size_t)1 << k)) >> (k - 2);
+  return (k - 4) * 4 + q + 1;
+}
+
+static size_t llsm_block_capacity(llsm_blockheader* block) {
+  int sizeclass = block -> info.sizeclass;
+  return sizeclass >= 0 ? llsm_slab_classsize(sizeclass) : block -> info.size;
+}
+
+static llsm_blockheader* llsm_cached_alloc(size_t size) {
+  int sizeclass = llsm_slab_sizeclass(size);
+  if(sizeclass < 0) return llsm_heap_alloc(size);
+  llsm_blockheader* block = slab_cache.head[sizeclass];
+  if(block != NULL) {
+    slab_cache.head[sizeclass] = *((void**)(block + 1));
+    slab_cache.count[sizeclass] --;
+    llsm_stat_decrement(stat_ncached);
+  } else {
+    block = llsm_heap_alloc(llsm_slab_classsize(sizeclass));
+    block -> info.sizeclass = sizeclass;
+  }
+  return block;
+}
+
+static void llsm_cached_free(llsm_blockheader* block) {
+  int sizeclass = block -> info.sizeclass;
+  if(sizeclass < 0 || (size_t)slab_cache.count[sizeclass] >=
+     LLSM_SLAB_CACHE_BYTES / llsm_slab_classsize(sizeclass)) {
+    free(block);
+    return;
+  }
+  llsm_slab_register();
+  *((void**)(block + 1)) = slab_cache.head[sizeclass];
+  slab_cache.head[sizeclass] = block;
+  slab_cache.count[sizeclass] ++;
+  llsm_stat_increment(stat_ncached);
+}
+
+void llsm_trim_allocator() {
+  llsm_slab_drain(& slab_cache);
+}
+
+#else
+
+#define llsm_block_capacity(block) ((block) -> info.size)
+#define llsm_cached_alloc llsm_heap_alloc
+#define llsm_cached_free free
+
+void llsm_trim_allocator() { }
+
+#endif
+
+void* llsm_malloc(size_t size) {
+  llsm_stat_increment(stat_nalloc);
+  llsm_blockheader* block = current_arena != NULL ?
+    llsm_arena_alloc(current_arena, size) : llsm_cached_alloc(size);
+  return block + 1;
+}
+
+void llsm_free(void* ptr) {
+  if(ptr == NULL) return;
+  llsm_stat_increment(stat_nfree);
+  llsm_blockheader* block = (llsm_blockheader*)ptr - 1;
+  if(block -> info.sizeclass != LLSM_BLOCK_ARENA)
+    llsm_cached_free(block);
+}
+
+void* llsm_realloc(void* ptr, size_t size) {
+  if(ptr == NULL) return llsm_malloc(size);
+  llsm_blockheader* block = (llsm_blockheader*)ptr - 1;
+  size_t capacity = llsm_block_capacity(block);
+  if(size <= capacity && block -> info.sizeclass != LLSM_BLOCK_HEAP)
+    return ptr;
+  if(block -> info.sizeclass == LLSM_BLOCK_HEAP && current_arena == NULL) {
+    block = realloc(block, sizeof(llsm_blockheader) + size);
+    block -> info.size = size;
+    return block + 1;
+  }
+  void* ret = llsm_malloc(size);
+  memcpy(ret, ptr, size < capacity ? size : capacity);
+  llsm_free(ptr);
+  return ret;
+}
+
+void* llsm_calloc(size_t nmemb, size_t size) {
+  void* ret = llsm_malloc(nmemb * size);
+  memset(ret, 0, nmemb * size);
+  return ret;
+}
+
+void llsm_get_allocstat(llsm_allocstat* dst) {
+#ifdef LLSM_ALLOC_STAT
+  dst -> nalloc = llsm_atomic_load(stat_nalloc);
+  dst -> nfree = llsm_atomic_load(stat_nfree);
+  dst -> nmalloc = llsm_atomic_load(stat_nmalloc);
+  dst -> ncached = llsm_atomic_load(stat_ncached);
+  dst -> narena = llsm_atomic_load(stat_narena);
+#else
+  memset(dst, 0, sizeof(llsm_allocstat));
+#endif
+}
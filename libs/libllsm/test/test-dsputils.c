@@ -165,6 +165,76 @@ static void test_glottal_model() {
   free(param_list);
 }
 
+// compare the tabulated LF model harmonic responses against lfmodel_spectrum
+static void test_lfmodel_harmonics() {
+  int nhar = 300;
+  FP_TYPE* freq = calloc(nhar, sizeof(FP_TYPE));
+  FP_TYPE* magn = calloc(nhar, sizeof(FP_TYPE));
+  FP_TYPE* phse = calloc(nhar, sizeof(FP_TYPE));
+  FP_TYPE* phse_truth = calloc(nhar, sizeof(FP_TYPE));
+  for(int k = 0; k < 200; k ++) {
+    FP_TYPE rd = 0.01 + 3.2 / 200.0 * k;
+    FP_TYPE f0 = 60.0 + 900.0 / 200.0 * k;
+    for(int i = 0; i < nhar; i ++)
+      freq[i] = f0 * (i + 1.0);
+    lfmodel lf = lfmodel_from_rd(rd, 1.0 / f0, 1.0);
+    FP_TYPE* magn_truth = lfmodel_spectrum(lf, freq, nhar, phse_truth);
+    llsm_lfmodel_harmonics(rd, f0, nhar, magn, phse);
+    for(int i = 0; i < nhar; i ++) {
+      // only check the harmonics within 60dB from the first harmonic;
+      //   the error bound is 0.2dB in magnitude and 0.02rad in phase
+      if(magn_truth[i] < magn_truth[0] * 1e-3) continue;
+      assert(fabs(20.0 * log10(magn[i] / magn_truth[i])) < 0.2);
+      assert(fabs(wrap(phse[i] - phse_truth[i])) < 0.02);
+    }
+    free(magn_truth);
+  }
+  free(freq); free(magn); free(phse); free(phse_truth);
+}
+
+// counter-based noise does not depend on how the sequence is split
+static void test_white_noise() {
+  int nx = 100000;
+  FP_TYPE* x = llsm_generate_white_noise_seeded(nx, 7);
+  FP_TYPE* y = calloc(nx, sizeof(FP_TYPE));
+  llsm_fill_white_noise(y, 3, 7, 0);
+  llsm_fill_white_noise(y + 3, 1000, 7, 3);
+  llsm_fill_white_noise(y + 1003, nx - 1003, 7, 1003);
+  for(int i = 0; i < nx; i ++)
+    assert(x[i] == y[i]);
+  assert(fabs(meanfp(x, nx)) < 0.02);
+  assert(fabs(varfp(x, nx) - 1.0) < 0.02);
+  llsm_fill_white_noise(y, nx, 8, 0);
+  int nsame = 0;
+  for(int i = 0; i < nx; i ++)
+    nsame += x[i] == y[i];
+  assert(nsame < 10);
+  free(x); free(y);
+}
+
+// noise templates are generated once and can be persisted
+static void test_noise_templates() {
+  int n1 = 0, n2 = 0;
+  FP_TYPE* x1 = llsm_get_noise_template(0.1, 0.2, & n1);
+  FP_TYPE* x2 = llsm_get_noise_template(0.1, 0.2, & n2);
+  assert(x1 == x2 && n1 == n2 && n1 > 0);
+  assert(llsm_get_noise_template(0.2, 0.3, NULL) != x1);
+  FP_TYPE var = varfp(x1, n1);
+  assert(var > 0);
+  // the loop point should not stand out from the rest of the template
+  assert(fabs(x1[0] - x1[n1 - 1]) < sqrt(var) * 8.0);
+
+  int ntemplate = llsm_num_noise_templates();
+  assert(ntemplate >= 2);
+  assert(llsm_save_noise_templates("test-noise-templates.bin"));
+  assert(llsm_load_noise_templates("test-noise-templates.bin"));
+  assert(llsm_get_noise_template(0.1, 0.2, NULL) == x1);
+  // loading templates that are already cached adds nothing
+  assert(llsm_num_noise_templates() == ntemplate);
+  remove("test-noise-templates.bin");
+  assert(! llsm_load_noise_templates("test-noise-templates.bin"));
+}
+
 int main() {
   srand(1);
   test_empirical_kld();
@@ -172,5 +242,8 @@ int main() {
   test_harmonic_analysis(LLSM_AOPTION_HMPP);
   test_harmonic_analysis(LLSM_AOPTION_HMCZT);
   test_glottal_model();
+  test_lfmodel_harmonics();
+  test_white_noise();
+  test_noise_templates();
   return 0;
 }
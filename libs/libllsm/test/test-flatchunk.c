@@ -0,0 +1,155 @@
+#include <libpyin/pyin.h>
+
+#include "../llsm.h"
+#include "verify-utils.h"
+
+static void assert_same_output(llsm_output* a, llsm_output* b) {
+  assert(a -> ny == b -> ny);
+  for(int i = 0; i < a -> ny; i ++) {
+    assert(a -> y_sin[i] == b -> y_sin[i]);
+    assert(a -> y_noise[i] == b -> y_noise[i]);
+  }
+}
+
+static void assert_same_rows(FP_TYPE* a, FP_TYPE* b, int n) {
+  for(int i = 0; i < n; i ++)
+    assert(a[i] == b[i]);
+}
+
+// Check every member of src against the frames in chunk.
+static void assert_same_chunk(llsm_flatchunk* src, llsm_chunk* chunk) {
+  for(int i = 0; i < src -> nfrm; i ++) {
+    llsm_container* frame = chunk -> frames[i];
+    FP_TYPE* f0 = llsm_container_get(frame, LLSM_FRAME_F0);
+    llsm_hmframe* hm = llsm_container_get(frame, LLSM_FRAME_HM);
+    llsm_nmframe* nm = llsm_container_get(frame, LLSM_FRAME_NM);
+    FP_TYPE* rd = llsm_container_get(frame, LLSM_FRAME_RD);
+    FP_TYPE* vtmagn = llsm_container_get(frame, LLSM_FRAME_VTMAGN);
+    FP_TYPE* vsphse = llsm_container_get(frame, LLSM_FRAME_VSPHSE);
+    int members = src -> members[i];
+    assert(src -> f0[i] == f0[0]);
+    assert(((members & LLSM_FLAT_HM) != 0) == (hm != NULL));
+    assert(((members & LLSM_FLAT_NM) != 0) == (nm != NULL));
+    assert(((members & LLSM_FLAT_RD) != 0) == (rd != NULL));
+    assert(((members & LLSM_FLAT_VT) != 0) ==
+      (vtmagn != NULL && vsphse != NULL));
+    assert(((members & LLSM_FLAT_VTMAGN) != 0) ==
+      (vtmagn != NULL && vsphse == NULL));
+    if(hm != NULL) {
+      assert(src -> nhar[i] == hm -> nhar);
+      assert_same_rows(src -> ampl + i * src -> maxnhar, hm -> ampl,
+        hm -> nhar);
+      assert_same_rows(src -> phse + i * src -> maxnhar, hm -> phse,
+        hm -> nhar);
+    }
+    if(nm != NULL) {
+      assert_same_rows(src -> psd + i * src -> npsd, nm -> psd, nm -> npsd);
+      for(int c = 0; c < nm -> nchannel; c ++) {
+        int offset = (i * src -> nchannel + c) * src -> maxnhar_e;
+        assert(src -> nhar_e[i * src -> nchannel + c] == nm -> eenv[c] -> nhar);
+        assert(src -> edc[i * src -> nchannel + c] == nm -> edc[c]);
+        assert_same_rows(src -> eenv_ampl + offset, nm -> eenv[c] -> ampl,
+          nm -> eenv[c] -> nhar);
+      }
+    }
+    if(rd != NULL) assert(src -> rd[i] == rd[0]);
+    if(vtmagn != NULL)
+      assert_same_rows(src -> vtmagn + i * src -> nspec, vtmagn,
+        src -> nspec);
+    if(vtmagn != NULL && vsphse != NULL) {
+      assert(src -> nvs[i] == llsm_fparray_length(vsphse));
+      assert_same_rows(src -> vsphse + i * src -> maxnhar, vsphse,
+        src -> nvs[i]);
+    }
+  }
+}
+
+int main() {
+  int fs = 0;
+  int nbit = 0;
+  int nx = 0;
+  FP_TYPE* x = wavread("test/arctic_a0001.wav", & fs, & nbit, & nx);
+
+  int nhop = 128;
+  int nfrm = 0;
+  pyin_config param = pyin_init(nhop);
+  param.fmin = 50.0;
+  param.fmax = 500.0;
+  param.trange = 24;
+  param.bias = 2;
+  param.nf = ceil(fs * 0.025);
+  FP_TYPE* f0 = pyin_analyze(param, x, nx, fs, & nfrm);
+
+  llsm_aoptions* opt_a = llsm_create_aoptions();
+  opt_a -> thop = (FP_TYPE)nhop / fs;
+  llsm_soptions* opt_s = llsm_create_soptions(fs);
+
+  llsm_chunk* chunk = llsm_analyze(opt_a, x, nx, fs, f0, nfrm, NULL);
+  llsm_flatchunk* flat = llsm_chunk_toflat(chunk);
+  assert(flat -> nfrm == nfrm);
+  assert_same_chunk(flat, chunk);
+
+  printf("Checking layer 0 synthesis from a flat chunk...\n");
+  llsm_output* out0 = llsm_synthesize(opt_s, chunk);
+  llsm_output* out1 = llsm_synthesize_flat(opt_s, flat);
+  assert_same_output(out0, out1);
+  verify_data_distribution(x, nx, out1 -> y, out1 -> ny);
+  verify_spectral_distribution(x, nx, out1 -> y, out1 -> ny);
+  llsm_delete_output(out0);
+  llsm_delete_output(out1);
+
+  printf("Checking layer conversion on a flat chunk...\n");
+  llsm_chunk_tolayer1(chunk, 2048);
+  llsm_flatchunk_tolayer1(flat, 2048);
+  assert_same_chunk(flat, chunk);
+  // the analysis phases are already propagated; undo it before rebuilding
+  llsm_chunk_phasepropagate(chunk, -1);
+  llsm_flatchunk_phasepropagate(flat, -1);
+  assert_same_chunk(flat, chunk);
+  for(int i = 0; i < nfrm; i ++)
+    llsm_container_attach(chunk -> frames[i], LLSM_FRAME_HM, NULL, NULL, NULL);
+  for(int i = 0; i < nfrm; i ++)
+    flat -> members[i] &= ~LLSM_FLAT_HM;
+  llsm_chunk_phasepropagate(chunk, 1);
+  llsm_flatchunk_phasepropagate(flat, 1);
+  llsm_chunk_tolayer0(chunk);
+  llsm_flatchunk_tolayer0(flat);
+  assert_same_chunk(flat, chunk);
+
+  printf("Checking the round trip between flat chunks and chunks...\n");
+  llsm_chunk* chunk2 = llsm_flatchunk_tochunk(flat);
+  assert_same_chunk(flat, chunk2);
+  // a vocal tract response without vocal source phase is kept on its own
+  int ivoiced = 0;
+  while(flat -> f0[ivoiced] <= 0) ivoiced ++;
+  llsm_container_attach(chunk2 -> frames[ivoiced], LLSM_FRAME_VSPHSE,
+    NULL, NULL, NULL);
+  llsm_flatchunk* flat2 = llsm_chunk_toflat(chunk2);
+  assert(flat2 -> members[ivoiced] & LLSM_FLAT_VTMAGN);
+  assert_same_chunk(flat2, chunk2);
+  llsm_chunk* chunk3 = llsm_flatchunk_tochunk(flat2);
+  assert_same_chunk(flat2, chunk3);
+  llsm_delete_chunk(chunk3);
+  llsm_delete_flatchunk(flat2);
+
+  printf("Checking layer 1 synthesis from a flat chunk...\n");
+  // the reference goes through the chunk converted without flat chunks
+  opt_s -> use_l1 = 1;
+  out0 = llsm_synthesize(opt_s, chunk);
+  out1 = llsm_synthesize_flat(opt_s, flat);
+  assert_same_output(out0, out1);
+  verify_data_distribution(x, nx, out1 -> y, out1 -> ny);
+  verify_spectral_distribution(x, nx, out1 -> y, out1 -> ny);
+  wavwrite(out1 -> y, out1 -> ny, opt_s -> fs, 24, "test/test-flatchunk.wav");
+  llsm_delete_output(out0);
+  llsm_delete_output(out1);
+
+  llsm_delete_chunk(chunk2);
+  llsm_delete_flatchunk(flat);
+  llsm_delete_chunk(chunk);
+  llsm_delete_aoptions(opt_a);
+  llsm_delete_soptions(opt_s);
+  free(f0);
+  free(x);
+  return 0;
+}
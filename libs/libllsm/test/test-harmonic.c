@@ -47,11 +47,68 @@ int main(int argc, char** argv) {
   fprintf(stderr, "SNR = %f\n", 20.0 * log10(std / energy));
   free(y1); free(y2);
 
+  // The oscillator bank should agree with cig_gensins; its overlap-add form
+  //   should agree with windowing and adding the frame explicitly.
+  FP_TYPE freq[100];
+  for(int i = 0; i < 100; i ++) freq[i] = 0.004 * (i + 1.0);
+  y1 = gensins(freq, ampl, phse, 100, 1, 1024);
+  y2 = llsm_synthesize_harmonic_frame(ampl, phse, 100, 0.004, 1024);
+  for(int i = 0; i < 1024; i ++) y1[i] -= y2[i];
+  assert(sqrt(varfp(y1, 1024) / varfp(y2, 1024)) < 1e-4);
+  FP_TYPE* w = hanning(1024);
+  FP_TYPE* y3 = calloc(1500, sizeof(FP_TYPE));
+  llsm_synthesize_harmonic_frame_ola(ampl, phse, 100, 0.004, 1024, w,
+    y3, -300, 1500);
+  llsm_synthesize_harmonic_frame_ola(ampl, phse, 100, 0.004, 1024, w,
+    y3, 900, 1500);
+  FP_TYPE err = 0, ref = 0;
+  for(int i = 0; i < 1500; i ++) {
+    FP_TYPE y_ref = 0;
+    if(i + 300 < 1024) y_ref += y2[i + 300] * w[i + 300];
+    if(i >= 900) y_ref += y2[i - 900] * w[i - 900];
+    err += (y3[i] - y_ref) * (y3[i] - y_ref);
+    ref += y_ref * y_ref;
+  }
+  assert(sqrt(err / ref) < 1e-4);
+  free(y1); free(y2); free(y3); free(w);
+
+  // A crossover table should survive saving and loading, and is interpolated
+  //   in log scale between the measured frame lengths.
+  llsm_iczt_table* table = llsm_calibrate_iczt_table(2, 2);
+  assert(table != NULL && table -> nx[0] < table -> nx[1]);
+  assert(llsm_save_iczt_table(table, "test-iczt-table.txt"));
+  llsm_iczt_table* loaded = llsm_load_iczt_table("test-iczt-table.txt");
+  assert(loaded != NULL && loaded -> nnx == 2);
+  for(int i = 0; i < 2; i ++) {
+    assert(loaded -> nx[i] == table -> nx[i]);
+    assert(fabs(loaded -> nhar[i] - table -> nhar[i]) < 1e-3);
+  }
+  remove("test-iczt-table.txt");
+  llsm_delete_iczt_table(loaded);
+  assert(llsm_load_iczt_table("test-iczt-table.txt") == NULL);
+  table -> nx[0] = 100; table -> nhar[0] = 50;
+  table -> nx[1] = 1000; table -> nhar[1] = 500;
+  assert(! llsm_iczt_table_query(table, 316, 150));
+  assert(llsm_iczt_table_query(table, 316, 170));
+  assert(! llsm_iczt_table_query(table, 10, 49));
+  assert(llsm_iczt_table_query(table, 10, 51));
+  assert(! llsm_iczt_table_query(table, 5000, 499));
+  llsm_delete_iczt_table(table);
+
+  // Print the crossover measured on this machine.
+  if(argc > 1 && (! strcmp(argv[1], "calibrate"))) {
+    table = llsm_calibrate_iczt_table(8, 10);
+    for(int i = 0; i < table -> nnx; i ++)
+      printf("nx = %d, nhar = %f\n", table -> nx[i], table -> nhar[i]);
+    llsm_delete_iczt_table(table);
+  }
+
   // On Interl i7-7500U, it was found that CZT is as fast as cig_gensins when
   //   log(nhar) = log(nx) * 0.275 + 2.26.
   // That means if log(nx) * 0.275 + 2.26 < log(nhar), then CZT is faster.
-  // The parameters does not seem to be strongly dependent on platform, though
-  //   it hasn't been extensively tested.
+  // The parameters are only a fallback: the crossover moves a lot with the
+  //   SIMD width of the host, so llsm_calibrate_iczt_table should be used to
+  //   measure it (see the "calibrate" mode above).
   if(argc > 1 && (! strcmp(argv[1], "profile"))) {
     // First load the stuffs into the cache.
     for(int i = 0; i < 1000; i ++) {
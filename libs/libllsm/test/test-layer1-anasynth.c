@@ -3,6 +3,34 @@
 #include "../llsm.h"
 #include "verify-utils.h"
 
+static void assert_same_phases(FP_TYPE* a, FP_TYPE* b, int n) {
+  for(int i = 0; i < n; i ++)
+    assert(a[i] == b[i]);
+}
+
+static void assert_same_frames(llsm_chunk* a, llsm_chunk* b, int nfrm) {
+  for(int i = 0; i < nfrm; i ++) {
+    llsm_hmframe* a_hm = llsm_container_peek(a -> frames[i], LLSM_FRAME_HM);
+    llsm_hmframe* b_hm = llsm_container_peek(b -> frames[i], LLSM_FRAME_HM);
+    assert((a_hm == NULL) == (b_hm == NULL));
+    if(a_hm != NULL) {
+      assert(a_hm -> nhar == b_hm -> nhar);
+      assert_same_phases(a_hm -> ampl, b_hm -> ampl, a_hm -> nhar);
+      assert_same_phases(a_hm -> phse, b_hm -> phse, a_hm -> nhar);
+    }
+    llsm_nmframe* a_nm = llsm_container_peek(a -> frames[i], LLSM_FRAME_NM);
+    llsm_nmframe* b_nm = llsm_container_peek(b -> frames[i], LLSM_FRAME_NM);
+    for(int j = 0; j < a_nm -> nchannel; j ++)
+      assert_same_phases(a_nm -> eenv[j] -> phse, b_nm -> eenv[j] -> phse,
+        a_nm -> eenv[j] -> nhar);
+    FP_TYPE* a_vs = llsm_container_peek(a -> frames[i], LLSM_FRAME_VSPHSE);
+    FP_TYPE* b_vs = llsm_container_peek(b -> frames[i], LLSM_FRAME_VSPHSE);
+    assert((a_vs == NULL) == (b_vs == NULL));
+    if(a_vs != NULL)
+      assert_same_phases(a_vs, b_vs, llsm_fparray_length(a_vs));
+  }
+}
+
 int main() {
   int fs = 0;
   int nbit = 0;
@@ -37,6 +65,7 @@ int main() {
         llsm_create_int(1), llsm_delete_int, llsm_copy_int);
     }
   }
+  llsm_chunk* chunk_unpropagated = llsm_copy_chunk(chunk);
   llsm_chunk_phasepropagate(chunk, 1);
   
   opt_s -> use_l1 = 1;
@@ -54,6 +83,28 @@ int main() {
   printf("Checking the layer1 reconstruction against the layer0 reconstruction"
     "...\n");
   verify_spectral_distribution(out0 -> y, out0 -> ny, out1 -> y, out1 -> ny);
+
+  // Propagating the phases during synthesis renders the same samples.
+  opt_s -> propagate = 1;
+  llsm_output* out_p = llsm_synthesize(opt_s, chunk_unpropagated);
+  opt_s -> propagate = 0;
+  assert(out_p -> ny == out1 -> ny);
+  for(int i = 0; i < out1 -> ny; i ++)
+    assert(out_p -> y[i] == out1 -> y[i]);
+  llsm_delete_output(out_p);
+  llsm_delete_chunk(chunk_unpropagated);
+
+  // Frames carrying the compact vocal tract envelope only render the same
+  //   (both harmonic and pulse-by-pulse) without being expanded first.
+  llsm_chunk* chunk_cep = llsm_copy_chunk(chunk);
+  llsm_chunk_compress_vt(chunk_cep, 48);
+  llsm_output* out2 = llsm_synthesize(opt_s, chunk_cep);
+  printf("Checking the layer1 reconstruction from VTCEP...\n");
+  verify_data_distribution(out1 -> y_sin, out1 -> ny, out2 -> y_sin,
+    out2 -> ny);
+  verify_spectral_distribution(out1 -> y, out1 -> ny, out2 -> y, out2 -> ny);
+  llsm_delete_output(out2);
+  llsm_delete_chunk(chunk_cep);
   
   llsm_delete_output(out0);
   llsm_delete_output(out1);
@@ -86,6 +137,21 @@ int main() {
     "test/test-layer1-pitchshift.wav");
   llsm_delete_output(out1);
 
+  // Propagating the phases during layer conversion gives the same frames as
+  //   separate passes.
+  llsm_chunk* chunk0 = llsm_copy_chunk(chunk);
+  llsm_chunk* chunk1 = llsm_copy_chunk(chunk);
+  llsm_chunk_phasepropagate(chunk0, 1);
+  llsm_chunk_tolayer0(chunk0);
+  llsm_chunk_tolayer0_propagate(chunk1, 1);
+  assert_same_frames(chunk0, chunk1, nfrm);
+  llsm_chunk_tolayer1(chunk0, 2048);
+  llsm_chunk_phasepropagate(chunk0, -1);
+  llsm_chunk_tolayer1_propagate(chunk1, 2048, -1);
+  assert_same_frames(chunk0, chunk1, nfrm);
+  llsm_delete_chunk(chunk0);
+  llsm_delete_chunk(chunk1);
+
   llsm_delete_chunk(chunk);
   llsm_delete_aoptions(opt_a);
   llsm_delete_soptions(opt_s);
@@ -49,7 +49,7 @@ static void* reading_thread(void* ptr) {
     if(status == 0) {
       // llsm_rtsynth_buffer_fetch does not block.
       // So give it a bit of time waiting for more samples to come.
-      usleep(10);
+      llsm_rtsynth_buffer_wait(rtbuffer, 1, 0.001);
       continue;
     }
     if(count >= latency) {
@@ -127,19 +127,20 @@ int main(int argc, char** argv) {
   pthread_join(threads[1], NULL);
 # else
   int count = 0;
+  FP_TYPE block_p[256];
+  FP_TYPE block_ap[256];
   for(int i = 0; i < nfrm; i ++) {
     llsm_rtsynth_buffer_feed(rtbuffer, chunk -> frames[i]);
     while(count < nx) {
-      FP_TYPE tmp_p = 0;
-      FP_TYPE tmp_ap = 0;
-      int status = llsm_rtsynth_buffer_fetch_decomposed(
-        rtbuffer, & tmp_p, & tmp_ap);
-      if(status == 0) break;
-      if(count >= latency) {
-        y[0][count - latency] = tmp_p;
-        y[1][count - latency] = tmp_ap;
+      int n = llsm_rtsynth_buffer_fetch_block_decomposed(
+        rtbuffer, block_p, block_ap, min(256, nx - count));
+      if(n == 0) break;
+      for(int j = 0; j < n; j ++, count ++) {
+        if(count >= latency) {
+          y[0][count - latency] = block_p[j];
+          y[1][count - latency] = block_ap[j];
+        }
       }
-      count ++;
     }
   }
 # endif
@@ -156,6 +157,9 @@ int main(int argc, char** argv) {
   t1 = get_time();
   printf("Synthesis speed (llsm): %f ms, %fx real-time.\n", t1 - t0,
     1000.0 / (t1 - t0) * ((FP_TYPE)nx / opt_s -> fs));
+  // The harmonics are evaluated from layer 1 without being attached.
+  for(int i = 0; i < nfrm; i ++)
+    assert(llsm_container_peek(chunk -> frames[i], LLSM_FRAME_HM) == NULL);
   
   // mix down
   for(int i = 0; i < nx - latency; i ++) y[0][i] += y[1][i];
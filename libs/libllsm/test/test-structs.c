@@ -84,6 +84,101 @@ void test_container_fparray() {
   llsm_delete_container(c2);
 }
 
+// Copies share their members until one of them is modified.
+void test_container_cow() {
+  llsm_container* c1 = llsm_create_container(2);
+  llsm_container_attach(c1, 0, llsm_create_fparray(4),
+    llsm_delete_fparray, llsm_copy_fparray);
+  llsm_container_attach(c1, 1, llsm_create_fp(1.0), llsm_delete_fp,
+    llsm_copy_fp);
+  llsm_container* c2 = llsm_copy_container(c1);
+  llsm_container* c3 = llsm_create_container(1);
+  llsm_copy_container_inplace(c3, c2);
+  assert(c2 -> members[0] == c1 -> members[0]);
+  assert(c3 -> members[1] == c1 -> members[1]);
+  assert(llsm_container_peek(c2, 0) == c1 -> members[0]);
+
+  FP_TYPE* a2 = llsm_container_get(c2, 0);
+  assert(a2 != c1 -> members[0]);
+  assert(llsm_fparray_length(a2) == 4);
+  a2[0] = 2.0;
+  assert_equal(to_fp(c1 -> members[0])[0], 0.0);
+  assert(c3 -> members[0] == c1 -> members[0]);
+  assert(llsm_container_get(c2, 0) == a2);
+
+  // the last owner of a shared member does not clone it
+  llsm_delete_container(c1);
+  FP_TYPE* a3 = c3 -> members[0];
+  assert(llsm_container_get(c3, 0) == a3);
+  to_fp(llsm_container_get(c3, 1))[0] = 3.0;
+  assert_equal(to_fp(c2 -> members[1])[0], 1.0);
+
+  llsm_container_remove(c2, 1);
+  llsm_delete_container(c3);
+  assert_equal(a2[0], 2.0);
+  llsm_delete_container(c2);
+}
+
+void test_allocator() {
+  llsm_allocstat s0, s1;
+  llsm_get_allocstat(& s0);
+  FP_TYPE* a = llsm_create_fparray(1025);
+  for(int i = 0; i < 1025; i ++) {
+    assert(a[i] == 0);
+    a[i] = i;
+  }
+  llsm_delete_fparray(a);
+  a = llsm_create_fparray(1000);
+  for(int i = 0; i < 1000; i ++)
+    assert(a[i] == 0);
+
+  FP_TYPE* b = llsm_malloc(sizeof(FP_TYPE) * 3);
+  for(int i = 0; i < 3; i ++) b[i] = i;
+  b = llsm_realloc(b, sizeof(FP_TYPE) * 100000);
+  for(int i = 0; i < 3; i ++) assert(b[i] == i);
+  b[99999] = 1.0;
+  b = llsm_realloc(b, sizeof(FP_TYPE) * 2);
+  for(int i = 0; i < 2; i ++) assert(b[i] == i);
+  llsm_free(b);
+  llsm_delete_fparray(a);
+
+  llsm_get_allocstat(& s1);
+  assert(s1.nalloc - s0.nalloc == s1.nfree - s0.nfree);
+  assert(s1.nmalloc <= s1.nalloc);
+  llsm_trim_allocator();
+  llsm_get_allocstat(& s1);
+  assert(s1.ncached == 0);
+}
+
+void test_arena() {
+  llsm_allocstat s0, s1;
+  llsm_get_allocstat(& s0);
+  llsm_arena* arena = llsm_create_arena(4096);
+  llsm_arena* prev = llsm_use_arena(arena);
+  assert(prev == NULL);
+
+  llsm_container* c1 = llsm_create_container(2);
+  llsm_container_attach(c1, 0, llsm_create_fparray(2000),
+    llsm_delete_fparray, llsm_copy_fparray);
+  llsm_container_attach(c1, 1, llsm_create_hmframe(10),
+    llsm_delete_hmframe, llsm_copy_hmframe);
+  FP_TYPE* buf = llsm_malloc(sizeof(FP_TYPE) * 10);
+  for(int i = 0; i < 10; i ++) buf[i] = i;
+  buf = llsm_realloc(buf, sizeof(FP_TYPE) * 1000);
+  for(int i = 0; i < 10; i ++) assert(buf[i] == i);
+  llsm_get_allocstat(& s1);
+  assert(s1.narena > s0.narena || s1.nalloc == 0); // LLSM_ALLOC_STAT
+
+  llsm_use_arena(prev);
+  // blocks from the arena can still be freed (doing nothing) outside it
+  llsm_free(buf);
+  llsm_container* c2 = llsm_copy_container(c1);
+  llsm_delete_container(c1);
+  assert(llsm_fparray_length(llsm_container_get(c2, 0)) == 2000);
+  llsm_delete_container(c2);
+  llsm_delete_arena(arena);
+}
+
 void test_hmframe() {
   // test: creation
   llsm_hmframe* h1 = llsm_create_hmframe(3);
@@ -138,6 +233,159 @@ void test_nmframe() {
   llsm_delete_nmframe(n2);
 }
 
+static llsm_container* create_layer1_frame(FP_TYPE f0, int nhar,
+  FP_TYPE phse, FP_TYPE magn) {
+  llsm_container* ret = llsm_create_frame(0, 2, nhar, 8);
+  *to_fp(llsm_container_get(ret, LLSM_FRAME_F0)) = f0;
+  llsm_container_attach(ret, LLSM_FRAME_RD, llsm_create_fp(f0 > 0 ? 2.0 : 1.0),
+    llsm_delete_fp, llsm_copy_fp);
+  llsm_nmframe* nm = llsm_container_get(ret, LLSM_FRAME_NM);
+  for(int i = 0; i < 8; i ++)
+    nm -> psd[i] = magn;
+  for(int i = 0; i < nhar; i ++) {
+    nm -> eenv[0] -> ampl[i] = magn;
+    nm -> eenv[0] -> phse[i] = phse;
+  }
+  if(f0 > 0) {
+    FP_TYPE* vsphse = llsm_create_fparray(nhar);
+    FP_TYPE* vtmagn = llsm_create_fparray(16);
+    for(int i = 0; i < nhar; i ++) vsphse[i] = phse;
+    for(int i = 0; i < 16; i ++) vtmagn[i] = magn;
+    llsm_container_attach(ret, LLSM_FRAME_VSPHSE, vsphse,
+      llsm_delete_fparray, llsm_copy_fparray);
+    llsm_container_attach(ret, LLSM_FRAME_VTMAGN, vtmagn,
+      llsm_delete_fparray, llsm_copy_fparray);
+  }
+  return ret;
+}
+
+void test_frame_interp() {
+  llsm_container* a = create_layer1_frame(100.0, 4, 3.0, -20.0);
+  llsm_container* b = create_layer1_frame(200.0, 6, -3.0, -40.0);
+  llsm_container* dst = create_layer1_frame(0, 0, 0, 0);
+
+  // test: both voiced; phases are interpolated the short way around
+  llsm_frame_interp_into(dst, a, b, 0.25);
+  assert_equal(*to_fp(llsm_container_get(dst, LLSM_FRAME_F0)), 125.0);
+  assert_equal(*to_fp(llsm_container_get(dst, LLSM_FRAME_RD)), 2.0);
+  FP_TYPE* vsphse = llsm_container_get(dst, LLSM_FRAME_VSPHSE);
+  FP_TYPE* vtmagn = llsm_container_get(dst, LLSM_FRAME_VTMAGN);
+  llsm_nmframe* nm = llsm_container_get(dst, LLSM_FRAME_NM);
+  assert(llsm_fparray_length(vsphse) == 6);
+  assert(llsm_fparray_length(vtmagn) == 16);
+  for(int i = 0; i < 4; i ++) {
+    assert(fabs(vsphse[i]) > 3.0);
+    assert(fabs(nm -> eenv[0] -> phse[i]) > 3.0);
+    assert_equal(nm -> eenv[0] -> ampl[i], -25.0);
+  }
+  assert_equal(vsphse[5], -3.0);
+  assert_equal(vtmagn[0], -25.0);
+  assert_equal(nm -> psd[7], -25.0);
+  assert(nm -> eenv[0] -> nhar == 6);
+
+  // test: the arrays of dst are reused in place
+  llsm_frame_interp_into(dst, a, b, 0.5);
+  assert(llsm_container_get(dst, LLSM_FRAME_VSPHSE) == vsphse);
+  assert(llsm_container_get(dst, LLSM_FRAME_VTMAGN) == vtmagn);
+  assert(llsm_container_get(dst, LLSM_FRAME_NM) == nm);
+  assert_equal(vtmagn[0], -30.0);
+
+  // test: interpolating into one of the sources gives the same result
+  llsm_container* a2 = llsm_copy_container(a);
+  llsm_frame_interp_into(a2, a2, b, 0.5);
+  FP_TYPE* vsphse2 = llsm_container_get(a2, LLSM_FRAME_VSPHSE);
+  for(int i = 0; i < 6; i ++)
+    assert(vsphse2[i] == vsphse[i]);
+  assert_equal(*to_fp(llsm_container_get(a, LLSM_FRAME_F0)), 100.0);
+  llsm_delete_container(a2);
+
+  // test: the voiced frame is faded in when the other one is unvoiced
+  llsm_container* u = create_layer1_frame(0, 4, 0, -20.0);
+  llsm_frame_interp_into(dst, u, b, 0.5);
+  assert_equal(*to_fp(llsm_container_get(dst, LLSM_FRAME_F0)), 200.0);
+  vtmagn = llsm_container_get(dst, LLSM_FRAME_VTMAGN);
+  assert(fabs(vtmagn[0] - (-40.0 - 6.0206)) < 0.01);
+  llsm_frame_interp_into(dst, u, u, 0.5);
+  assert_equal(*to_fp(llsm_container_get(dst, LLSM_FRAME_F0)), 0);
+  assert(llsm_container_get(dst, LLSM_FRAME_VSPHSE) == NULL);
+  assert(llsm_container_get(dst, LLSM_FRAME_VTMAGN) == NULL);
+
+  llsm_delete_container(u);
+  llsm_delete_container(a);
+  llsm_delete_container(b);
+  llsm_delete_container(dst);
+}
+
+void test_frame_compress_vt() {
+  llsm_aoptions* opt = llsm_create_aoptions();
+  llsm_container* conf = llsm_aoptions_toconf(opt, 22050);
+  llsm_container_attach(conf, LLSM_CONF_NSPEC, llsm_create_int(257),
+    llsm_delete_int, llsm_copy_int);
+  llsm_container_attach(conf, LLSM_CONF_LIPRADIUS, llsm_create_fp(1.5),
+    llsm_delete_fp, llsm_copy_fp);
+  llsm_container* a = create_layer1_frame(200.0, 20, 0, -20.0);
+  FP_TYPE* envelope = llsm_create_fparray(257);
+  for(int i = 0; i < 257; i ++)
+    envelope[i] = -20.0 - 30.0 * i / 256 + 5.0 * cos(i * 0.05);
+  llsm_container_attach(a, LLSM_FRAME_VTMAGN, envelope, llsm_delete_fparray,
+    llsm_copy_fparray);
+  llsm_container* ref = llsm_copy_container(a);
+
+  // test: a smooth envelope survives the round trip
+  llsm_frame_compress_vt(a, conf, 48);
+  assert(llsm_container_get(a, LLSM_FRAME_VTMAGN) == NULL);
+  assert(llsm_fparray_length(llsm_container_get(a, LLSM_FRAME_VTCEP)) == 48);
+  assert(llsm_frame_checklayer1(a));
+  llsm_container* a2 = llsm_copy_container(a);
+  llsm_frame_expand_vt(a2, conf);
+  assert(llsm_container_get(a2, LLSM_FRAME_VTCEP) == NULL);
+  FP_TYPE* vtmagn = llsm_container_get(a2, LLSM_FRAME_VTMAGN);
+  assert(llsm_fparray_length(vtmagn) == 257);
+  for(int i = 0; i < 257; i ++)
+    assert(fabs(vtmagn[i] - envelope[i]) < 1.0);
+
+  // test: layer 0 conversion reads the compact envelope directly
+  llsm_frame_tolayer0(a2, conf);
+  llsm_frame_tolayer0(ref, conf);
+  llsm_hmframe* hm = llsm_container_get(a2, LLSM_FRAME_HM);
+  llsm_hmframe* hm_ref = llsm_container_get(ref, LLSM_FRAME_HM);
+  assert(hm -> nhar == hm_ref -> nhar);
+  for(int i = 0; i < hm -> nhar; i ++)
+    assert(fabs(log(hm -> ampl[i] / hm_ref -> ampl[i])) < 0.06);
+  llsm_container* a3 = llsm_copy_container(a);
+  llsm_frame_tolayer0(a3, conf);
+  hm = llsm_container_get(a3, LLSM_FRAME_HM);
+  assert(hm -> nhar == hm_ref -> nhar);
+  for(int i = 0; i < hm -> nhar; i ++)
+    assert(fabs(log(hm -> ampl[i] / hm_ref -> ampl[i])) < 0.06);
+
+  // test: interpolation and fading on the compact envelope
+  llsm_container* b = llsm_copy_container(a);
+  FP_TYPE* b_cep = llsm_container_get(b, LLSM_FRAME_VTCEP);
+  b_cep[0] -= 20.0;
+  FP_TYPE a_c0 = to_fp(llsm_container_get(a, LLSM_FRAME_VTCEP))[0];
+  llsm_container* dst = create_layer1_frame(200.0, 20, 0, -20.0);
+  llsm_frame_interp_into(dst, a, b, 0.5);
+  assert(llsm_container_get(dst, LLSM_FRAME_VTMAGN) == NULL);
+  FP_TYPE* vtcep = llsm_container_get(dst, LLSM_FRAME_VTCEP);
+  assert(llsm_fparray_length(vtcep) == 48);
+  assert_equal(vtcep[0], a_c0 - 10.0);
+  llsm_container* u = create_layer1_frame(0, 4, 0, -20.0);
+  llsm_frame_interp_into(dst, u, a, 0.5);
+  vtcep = llsm_container_get(dst, LLSM_FRAME_VTCEP);
+  assert(fabs(vtcep[0] - (a_c0 - 2.0 * 6.0206)) < 0.01);
+
+  llsm_delete_container(u);
+  llsm_delete_container(dst);
+  llsm_delete_container(b);
+  llsm_delete_container(a3);
+  llsm_delete_container(a2);
+  llsm_delete_container(ref);
+  llsm_delete_container(a);
+  llsm_delete_container(conf);
+  llsm_delete_aoptions(opt);
+}
+
 void test_chunk() {
   llsm_aoptions* opt = llsm_create_aoptions();
   llsm_container* conf = llsm_aoptions_toconf(opt, 22050);
@@ -165,6 +413,48 @@ void test_chunk() {
   llsm_delete_aoptions(opt);
 }
 
+void test_chunk_timemap() {
+  llsm_aoptions* opt = llsm_create_aoptions();
+  llsm_container* conf = llsm_aoptions_toconf(opt, 22050);
+  ((int*)llsm_container_get(conf, LLSM_CONF_NFRM))[0] = 3;
+  llsm_chunk* src = llsm_create_chunk(conf, 0);
+  for(int i = 0; i < 3; i ++) {
+    src -> frames[i] = create_layer1_frame(100.0 * (i + 1), 4, 0, -20.0 * i);
+    FP_TYPE* psdres = llsm_create_fparray(5);
+    for(int j = 0; j < 5; j ++) psdres[j] = i;
+    llsm_container_attach(src -> frames[i], LLSM_FRAME_PSDRES, psdres,
+      llsm_delete_fparray, llsm_copy_fparray);
+  }
+
+  // test: stretching with the last frame held
+  int base[4] = {0, 0, 1, 2};
+  FP_TYPE ratio[4] = {0, 0.5, 0.5, 0.5};
+  llsm_chunk* dst = llsm_chunk_timemap(src, base, ratio, 4);
+  assert(dst != NULL);
+  assert(((int*)llsm_container_get(dst -> conf, LLSM_CONF_NFRM))[0] == 4);
+  FP_TYPE f0[4] = {100.0, 150.0, 250.0, 300.0};
+  FP_TYPE res[4] = {0, 0.5, 1.5, 2.0};
+  for(int i = 0; i < 4; i ++) {
+    assert_equal(*to_fp(llsm_container_get(dst -> frames[i], LLSM_FRAME_F0)),
+      f0[i]);
+    FP_TYPE* psdres = llsm_container_get(dst -> frames[i], LLSM_FRAME_PSDRES);
+    assert_equal(psdres[4], res[i]);
+  }
+  assert_equal(*to_fp(llsm_container_get(src -> frames[0], LLSM_FRAME_F0)),
+    100.0);
+  FP_TYPE* psdres = llsm_container_get(src -> frames[0], LLSM_FRAME_PSDRES);
+  assert_equal(psdres[4], 0);
+  llsm_delete_chunk(dst);
+
+  // test: out-of-range indices
+  base[3] = 3;
+  assert(llsm_chunk_timemap(src, base, ratio, 4) == NULL);
+
+  llsm_delete_chunk(src);
+  llsm_delete_container(conf);
+  llsm_delete_aoptions(opt);
+}
+
 void test_buffer() {
   llsm_ringbuffer* rb1 = llsm_create_ringbuffer(4096);
   FP_TYPE x[100];
@@ -216,9 +506,15 @@ void test_buffer() {
 int main() {
   test_container();
   test_container_fparray();
+  test_container_cow();
+  test_allocator();
+  test_arena();
   test_hmframe();
   test_nmframe();
+  test_frame_interp();
+  test_frame_compress_vt();
   test_chunk();
+  test_chunk_timemap();
   test_buffer();
   return 0;
 }
@@ -1,55 +1,26 @@
 #include <ciglet/ciglet.h>
 #include <ctype.h>
 #include <libllsm/llsm.h>
+#include <libllsm/llsmrt.h>
 #include <libpyin/pyin.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 const char *version = "0.2.5";
 
-// circular interpolation of two radian values
-static FP_TYPE linterpc(FP_TYPE a, FP_TYPE b, FP_TYPE ratio) {
-  FP_TYPE ax = cos_2(a);
-  FP_TYPE ay = sin_2(a);
-  FP_TYPE bx = cos_2(b);
-  FP_TYPE by = sin_2(b);
-  FP_TYPE cx = linterp(ax, bx, ratio);
-  FP_TYPE cy = linterp(ay, by, ratio);
-  return atan2(cy, cx);
-}
-
-static void interp_nmframe(llsm_nmframe *dst, llsm_nmframe *src, FP_TYPE ratio,
-                           int dst_voiced, int src_voiced) {
-  for (int i = 0; i < dst->npsd; i++)
-    dst->psd[i] = linterp(dst->psd[i], src->psd[i], ratio);
-
-  for (int b = 0; b < dst->nchannel; b++) {
-    llsm_hmframe *srceenv = src->eenv[b];
-    llsm_hmframe *dsteenv = dst->eenv[b];
-    dst->edc[b] = linterp(dst->edc[b], src->edc[b], ratio);
-    int b_minnhar = min(srceenv->nhar, dsteenv->nhar);
-    int b_maxnhar = max(srceenv->nhar, dsteenv->nhar);
-    if (dsteenv->nhar < b_maxnhar) {
-      dsteenv->ampl = realloc(dsteenv->ampl, sizeof(FP_TYPE) * b_maxnhar);
-      dsteenv->phse = realloc(dsteenv->phse, sizeof(FP_TYPE) * b_maxnhar);
-    }
-    for (int i = 0; i < b_minnhar; i++) {
-      dsteenv->ampl[i] = linterp(dsteenv->ampl[i], srceenv->ampl[i], ratio);
-      dsteenv->phse[i] = linterpc(dsteenv->phse[i], srceenv->phse[i], ratio);
-    }
-    if (b_maxnhar == srceenv->nhar) {
-      for (int i = b_minnhar; i < b_maxnhar; i++) {
-        dsteenv->ampl[i] = srceenv->ampl[i];
-        dsteenv->phse[i] = srceenv->phse[i];
-      }
-    }
-    dsteenv->nhar = b_maxnhar;
-  }
-}
-
 int write_conf(FILE *f, llsm_aoptions *conf) {
   fwrite(&conf->thop, sizeof(FP_TYPE), 1, f);
   fwrite(&conf->maxnhar, sizeof(int), 1, f);
@@ -97,7 +68,7 @@ int save_llsm(llsm_chunk *chunk, const char *filename, llsm_aoptions *conf,
   fwrite(&version, sizeof(int), 1, f);
 
   // Frame count
-  int *nfrm = llsm_container_get(chunk->conf, LLSM_CONF_NFRM);
+  int *nfrm = llsm_container_peek(chunk->conf, LLSM_CONF_NFRM);
   fwrite(nfrm, sizeof(int), 1, f);
   fwrite(fs, sizeof(int), 1, f);
   fwrite(nbit, sizeof(int), 1, f);
@@ -110,17 +81,17 @@ int save_llsm(llsm_chunk *chunk, const char *filename, llsm_aoptions *conf,
     llsm_container *frame = chunk->frames[i];
 
     // f0
-    FP_TYPE *f0 = llsm_container_get(frame, LLSM_FRAME_F0);
+    FP_TYPE *f0 = llsm_container_peek(frame, LLSM_FRAME_F0);
     fwrite(f0, sizeof(FP_TYPE), 1, f);
 
     // HM Frame
-    llsm_hmframe *hm = llsm_container_get(frame, LLSM_FRAME_HM);
+    llsm_hmframe *hm = llsm_container_peek(frame, LLSM_FRAME_HM);
     fwrite(&hm->nhar, sizeof(int), 1, f);
     fwrite(hm->ampl, sizeof(FP_TYPE), hm->nhar, f);
     fwrite(hm->phse, sizeof(FP_TYPE), hm->nhar, f);
 
     // NM Frame
-    llsm_nmframe *nm = llsm_container_get(frame, LLSM_FRAME_NM);
+    llsm_nmframe *nm = llsm_container_peek(frame, LLSM_FRAME_NM);
     fwrite(&nm->npsd, sizeof(int), 1, f);
     fwrite(nm->psd, sizeof(FP_TYPE), nm->npsd, f);
 
@@ -181,9 +152,10 @@ llsm_chunk *read_llsm(const char *filename, int *nfrm, int *fs, int *nbit) {
     llsm_container *frame = llsm_create_frame(0, 0, 0, 0);
 
     // f0
-    FP_TYPE *f0 = malloc(sizeof(FP_TYPE));
-    fread(f0, sizeof(FP_TYPE), 1, f);
-    llsm_container_attach(frame, LLSM_FRAME_F0, f0, free, llsm_copy_fp);
+    FP_TYPE f0 = 0;
+    fread(&f0, sizeof(FP_TYPE), 1, f);
+    llsm_container_attach(frame, LLSM_FRAME_F0, llsm_create_fp(f0),
+                          llsm_delete_fp, llsm_copy_fp);
 
     // HM
     int nhar;
@@ -223,95 +195,6 @@ llsm_chunk *read_llsm(const char *filename, int *nfrm, int *fs, int *nbit) {
   return chunk;
 }
 
-#define LOG2DB (20.0 / 2.3025851)
-#define mag2db(x) (log_2(x) * LOG2DB)
-#define EPS 1e-8
-
-// dst <- (dst &> src)
-static void interp_llsm_frame(llsm_container *dst, llsm_container *src,
-                              FP_TYPE ratio) {
-  FP_TYPE dst_f0 = *((FP_TYPE *)llsm_container_get(dst, LLSM_FRAME_F0));
-  FP_TYPE src_f0 = *((FP_TYPE *)llsm_container_get(src, LLSM_FRAME_F0));
-  llsm_nmframe *dst_nm = llsm_container_get(dst, LLSM_FRAME_NM);
-  llsm_nmframe *src_nm = llsm_container_get(src, LLSM_FRAME_NM);
-  FP_TYPE *src_rd = llsm_container_get(src, LLSM_FRAME_RD);
-  FP_TYPE *dst_rd = llsm_container_get(dst, LLSM_FRAME_RD);
-  FP_TYPE *dst_vsphse = llsm_container_get(dst, LLSM_FRAME_VSPHSE);
-  FP_TYPE *src_vsphse = llsm_container_get(src, LLSM_FRAME_VSPHSE);
-  FP_TYPE *dst_vtmagn = llsm_container_get(dst, LLSM_FRAME_VTMAGN);
-  FP_TYPE *src_vtmagn = llsm_container_get(src, LLSM_FRAME_VTMAGN);
-
-  // always take the frequency of the voiced frame
-  llsm_container *voiced =
-      dst_f0 <= 0 && src_f0 <= 0 ? NULL : (src_f0 > 0 ? src : dst);
-  int bothvoiced = dst_f0 > 0 && src_f0 > 0;
-
-  int dstnhar = dst_vsphse == NULL ? 0 : llsm_fparray_length(dst_vsphse);
-  int srcnhar = src_vsphse == NULL ? 0 : llsm_fparray_length(src_vsphse);
-  int maxnhar = max(dstnhar, srcnhar);
-  int minnhar = min(dstnhar, srcnhar);
-
-  if (!bothvoiced && voiced == src) {
-    llsm_container_attach(dst, LLSM_FRAME_F0, llsm_create_fp(src_f0),
-                          llsm_delete_fp, llsm_copy_fp);
-    llsm_container_attach(dst, LLSM_FRAME_RD, llsm_create_fp(*src_rd),
-                          llsm_delete_fp, llsm_copy_fp);
-  } else if (voiced == NULL) {
-    llsm_container_attach(dst, LLSM_FRAME_F0, llsm_create_fp(0), llsm_delete_fp,
-                          llsm_copy_fp);
-    llsm_container_attach(dst, LLSM_FRAME_RD, llsm_create_fp(1.0),
-                          llsm_delete_fp, llsm_copy_fp);
-  }
-  int nspec = dst_vtmagn != NULL
-                  ? llsm_fparray_length(dst_vtmagn)
-                  : (src_vtmagn != NULL ? llsm_fparray_length(src_vtmagn) : 0);
-
-  if (bothvoiced) {
-    llsm_container_attach(dst, LLSM_FRAME_F0,
-                          llsm_create_fp(linterp(dst_f0, src_f0, ratio)),
-                          llsm_delete_fp, llsm_copy_fp);
-    llsm_container_attach(dst, LLSM_FRAME_RD,
-                          llsm_create_fp(linterp(*dst_rd, *src_rd, ratio)),
-                          llsm_delete_fp, llsm_copy_fp);
-
-    FP_TYPE *vsphse = llsm_create_fparray(maxnhar);
-    FP_TYPE *vtmagn = llsm_create_fparray(nspec);
-    for (int i = 0; i < minnhar; i++)
-      vsphse[i] = linterpc(dst_vsphse[i], src_vsphse[i], ratio);
-    for (int i = 0; i < nspec; i++)
-      vtmagn[i] = linterp(dst_vtmagn[i], src_vtmagn[i], ratio);
-    if (dstnhar < srcnhar)
-      for (int i = minnhar; i < maxnhar; i++)
-        vsphse[i] = src_vsphse[i];
-
-    dst_vsphse = vsphse;
-    dst_vtmagn = vtmagn;
-    llsm_container_attach(dst, LLSM_FRAME_VSPHSE, dst_vsphse,
-                          llsm_delete_fparray, llsm_copy_fparray);
-    llsm_container_attach(dst, LLSM_FRAME_VTMAGN, dst_vtmagn,
-                          llsm_delete_fparray, llsm_copy_fparray);
-  } else if (voiced == src) {
-    dst_vsphse = llsm_copy_fparray(src_vsphse);
-    dst_vtmagn = llsm_copy_fparray(src_vtmagn);
-    llsm_container_attach(dst, LLSM_FRAME_VSPHSE, dst_vsphse,
-                          llsm_delete_fparray, llsm_copy_fparray);
-    llsm_container_attach(dst, LLSM_FRAME_VTMAGN, dst_vtmagn,
-                          llsm_delete_fparray, llsm_copy_fparray);
-    FP_TYPE fade = mag2db(max(, ratio));
-    for (int i = 0; i < nspec; i++)
-      dst_vtmagn[i] += fade;
-  } else {
-    FP_TYPE fade = mag2db(max(, 1.0 - ratio));
-    for (int i = 0; i < nspec; i++)
-      dst_vtmagn[i] += fade;
-  }
-  for (int i = 0; i < nspec; i++)
-    dst_vtmagn[i] = max(-80, dst_vtmagn[i]);
-
-  interp_nmframe(dst_nm, src_nm, ratio, dst_f0 > 0, src_f0 > 0);
-#undef 
-}
-
 // Fix: initialize ans1/ans2 to 0
 int base64decoderForUtau(char x, char y) {
   int ans1 = 0, ans2 = 0, ans;
@@ -484,6 +367,21 @@ void convert_cents_to_hz_offset(const double *cents, int cents_len, int nfrm,
   }
 }
 
+// Replace frames [offset, offset + n) of chunk with frames interpolated
+// between frames base[i] and base[i] + 1 of chunk by ratio[i].
+static void timemap_frames(llsm_chunk *chunk, int offset, int *base,
+                           FP_TYPE *ratio, int n) {
+  llsm_chunk *mapped = llsm_chunk_timemap(chunk, base, ratio, n);
+  if (mapped == NULL)
+    return;
+  for (int i = 0; i < n; i++) {
+    llsm_delete_container(chunk->frames[offset + i]);
+    chunk->frames[offset + i] = mapped->frames[i];
+    mapped->frames[i] = NULL;
+  }
+  llsm_delete_chunk(mapped);
+}
+
 void apply_velocity(llsm_chunk *chunk, float velocity, int *consonant_frames,
                     int total_frames) {
   int consonant_frames_old = *consonant_frames;
@@ -502,36 +400,21 @@ void apply_velocity(llsm_chunk *chunk, float velocity, int *consonant_frames,
 
   *consonant_frames = consonant_frames_new;
 
-  // temp chunk with resampled consonants
-  llsm_chunk *tmp = llsm_create_chunk(chunk->conf, consonant_frames_new);
-
-  // copy temp consonants back into chunk (deep copy)
+  // resample the consonant frames
+  int *base = malloc(sizeof(int) * consonant_frames_new);
+  FP_TYPE *ratio = malloc(sizeof(FP_TYPE) * consonant_frames_new);
   for (int i = 0; i < consonant_frames_new; i++) {
     FP_TYPE mapped = (FP_TYPE)i * consonant_frames_old / consonant_frames_new;
-    int base = (int)mapped;
-    FP_TYPE ratio = mapped - base;
-
-    base = min(base, consonant_frames_old - 2);
-    if (base < 0)
-      base = 0;
-
-    tmp->frames[i] = llsm_copy_container(chunk->frames[base]);
-    interp_llsm_frame(tmp->frames[i], chunk->frames[base + 1], ratio);
-
-    FP_TYPE *resvec =
-        llsm_container_get(chunk->frames[base], LLSM_FRAME_PSDRES);
-    if (resvec != NULL) {
-      llsm_container_attach(tmp->frames[i], LLSM_FRAME_PSDRES,
-                            llsm_copy_fparray(resvec), llsm_delete_fparray,
-                            llsm_copy_fparray);
-    }
-  }
+    base[i] = (int)mapped;
+    ratio[i] = mapped - base[i];
 
-  for (int i = 0; i < consonant_frames_new; i++) {
-    if (chunk->frames[i])
-      llsm_delete_container(chunk->frames[i]);
-    chunk->frames[i] = llsm_copy_container(tmp->frames[i]);
+    base[i] = min(base[i], consonant_frames_old - 2);
+    if (base[i] < 0)
+      base[i] = 0;
   }
+  timemap_frames(chunk, 0, base, ratio, consonant_frames_new);
+  free(base);
+  free(ratio);
 
   // --- vowel region inside the *sample* ---
   int vowel_frames_old = total_frames - consonant_frames_old;
@@ -560,8 +443,31 @@ void apply_velocity(llsm_chunk *chunk, float velocity, int *consonant_frames,
       chunk->frames[i] = llsm_create_frame(0, 0, 0, 0);
     }
   }
+}
+
+// Linear gains of the tension tilt for a frame of nhar harmonics. The tilt
+// only depends on the harmonic index and nhar, so a table is shared by all
+// frames with the same number of harmonics.
+static FP_TYPE *tension_gain_table(FP_TYPE slope_db, int nhar) {
+  // Shape params: pivot ~ where tilt crosses 0; alpha controls knee sharpness
+  const FP_TYPE pivot =
+      (FP_TYPE)0.25; // 0..1 (slightly below mid so mids participate)
+  const FP_TYPE alpha = (FP_TYPE)2.6; // 1.6–2.8 soft→hard knee
 
-  llsm_delete_chunk(tmp);
+  FP_TYPE *gain = malloc(sizeof(FP_TYPE) * nhar);
+  for (int j = 0; j < nhar; ++j) {
+    // 0..1 index low→high, eased so top doesn’t dominate
+    FP_TYPE w = (nhar > 1) ? (FP_TYPE)j / (FP_TYPE)(nhar - 1) : 0;
+    FP_TYPE w_eased =
+        (FP_TYPE)0.5 - (FP_TYPE)0.5 * (FP_TYPE)cos(M_PI * w); // cosine ease
+
+    // Soft pivoted tilt in dB
+    FP_TYPE h =
+        (FP_TYPE)tanh(alpha * (w_eased - pivot)); // ~[-1,1] with soft knee
+    FP_TYPE g_db = slope_db * h; // positive: boost highs, cut lows
+    gain[j] = (FP_TYPE)pow((FP_TYPE)10.0, g_db / (FP_TYPE)20.0);
+  }
+  return gain;
 }
 
 // according to my research on the tension parameter in Synthesizer V,
@@ -578,58 +484,58 @@ void apply_tension(llsm_chunk *chunk, FP_TYPE tension) {
   // Global strength of spectral tilt in dB (±)
   const FP_TYPE slope_db = (FP_TYPE)32.0 * t; // try 14–20 to taste
 
-  // Shape params: pivot ~ where tilt crosses 0; alpha controls knee sharpness
-  const FP_TYPE pivot =
-      (FP_TYPE)0.25; // 0..1 (slightly below mid so mids participate)
-  const FP_TYPE alpha = (FP_TYPE)2.6; // 1.6–2.8 soft→hard knee
-  const FP_TYPE eps = (FP_TYPE)1e-12;
+  int maxnhar = 0;
+  for (int i = 0; i < *nfrm_p; ++i) {
+    llsm_hmframe *hm = llsm_container_peek(chunk->frames[i], LLSM_FRAME_HM);
+    if (hm && hm->nhar > maxnhar)
+      maxnhar = hm->nhar;
+  }
+  FP_TYPE **gain_tables = calloc(maxnhar + 1, sizeof(FP_TYPE *));
 
   for (int i = 0; i < *nfrm_p; ++i) {
     llsm_hmframe *hm = llsm_container_get(chunk->frames[i], LLSM_FRAME_HM);
     if (!hm || !hm->ampl || hm->nhar <= 0)
       continue;
-
-    // optional: measure pre-tilt energy to normalize later
+    const int nhar = hm->nhar;
+    if (!gain_tables[nhar])
+      gain_tables[nhar] = tension_gain_table(slope_db, nhar);
+    const FP_TYPE *gain = gain_tables[nhar];
+    FP_TYPE *ampl = hm->ampl;
+
+    // Tilt in the linear domain (the same as adding the tilt in dB), while
+    // measuring the energy before and after for normalization.
     FP_TYPE sum0 = 0;
-    for (int j = 0; j < hm->nhar; ++j)
-      sum0 += hm->ampl[j];
-
-    for (int j = 0; j < hm->nhar; ++j) {
-      // 0..1 index low→high, eased so top doesn’t dominate
-      FP_TYPE w = (hm->nhar > 1) ? (FP_TYPE)j / (FP_TYPE)(hm->nhar - 1) : 0;
-      FP_TYPE w_eased =
-          (FP_TYPE)0.5 - (FP_TYPE)0.5 * (FP_TYPE)cos(M_PI * w); // cosine ease
-
-      // Soft pivoted tilt in dB
-      FP_TYPE h =
-          (FP_TYPE)tanh(alpha * (w_eased - pivot)); // ~[-1,1] with soft knee
-      FP_TYPE g_db = slope_db * h; // positive: boost highs, cut lows
-      FP_TYPE a = hm->ampl[j];
-      FP_TYPE adb = (FP_TYPE)20.0 * (FP_TYPE)log10(a + eps);
-      adb += g_db;
-      FP_TYPE anew = (FP_TYPE)pow((FP_TYPE)10.0, adb / (FP_TYPE)20.0);
-
-      if (anew > 1.0)
-        anew = 1.0;
-      if (anew < 0.0)
-        anew = 0.0;
-      hm->ampl[j] = anew;
+    FP_TYPE sum1 = 0;
+#ifdef _OPENMP
+#pragma omp simd reduction(+ : sum0, sum1)
+#endif
+    for (int j = 0; j < nhar; ++j) {
+      FP_TYPE a = ampl[j];
+      FP_TYPE anew = a * gain[j];
+      anew = anew < (FP_TYPE)1.0 ? anew : (FP_TYPE)1.0;
+      sum0 += a;
+      sum1 += anew;
+      ampl[j] = anew;
     }
 
     // Optional energy preservation keeps loudness comparable and reveals
     // spectral shape Comment this block out if you WANT overall loudness to
     // change with tension.
-    FP_TYPE sum1 = 0;
-    for (int j = 0; j < hm->nhar; ++j)
-      sum1 += hm->ampl[j];
     if (sum0 > 0 && sum1 > 0) {
       FP_TYPE k = sum0 / sum1; // rescale to original total linear amplitude
-      for (int j = 0; j < hm->nhar; ++j) {
-        FP_TYPE v = hm->ampl[j] * k;
-        hm->ampl[j] = v > 1.0 ? 1.0 : v;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int j = 0; j < nhar; ++j) {
+        FP_TYPE v = ampl[j] * k;
+        ampl[j] = v < (FP_TYPE)1.0 ? v : (FP_TYPE)1.0;
       }
     }
   }
+
+  for (int n = 0; n <= maxnhar; ++n)
+    free(gain_tables[n]);
+  free(gain_tables);
 }
 
 /*void apply_gender(llsm_chunk* chunk, int gender) {
@@ -648,6 +554,8 @@ void apply_tension(llsm_chunk *chunk, FP_TYPE tension) {
 
 typedef struct {
   int Mt;
+  int Mc; // manipulate a compact (mel-cepstral) spectral envelope
+  int Ms; // stream the note through the real-time synthesizer
   int t;
   int g;
   int P;
@@ -661,6 +569,8 @@ int clamp_int(int val, int lo, int hi) {
 // Fix: rewritten to use pointer advancement properly
 void parse_flag_string(const char *str, Flags *flags_out) {
   flags_out->Mt = 0; // default values
+  flags_out->Mc = 0;
+  flags_out->Ms = 0;
   flags_out->t = 0;
   flags_out->g = 0;
   flags_out->P = 0;
@@ -673,6 +583,12 @@ void parse_flag_string(const char *str, Flags *flags_out) {
       flags_out->Mt = strtol(str, &end, 10); // str gets advanced
       flags_out->Mt = clamp_int(flags_out->Mt, -100, 100);
       str = end;
+    } else if (str[0] == 'M' && str[1] == 'c') {
+      str += 2;
+      flags_out->Mc = 1;
+    } else if (str[0] == 'M' && str[1] == 's') {
+      str += 2;
+      flags_out->Ms = 1;
     } else if (*str == 't') {
       str++;
       char *end;
@@ -701,27 +617,18 @@ void parse_flag_string(const char *str, Flags *flags_out) {
   }
 }
 
-void normalize_waveform(FP_TYPE *waveform, int length, FP_TYPE target_peak,
-                        int P_flag) {
+// Gain that moves a waveform with the given peak amplitude towards
+// target_peak, by P_flag percent.
+FP_TYPE normalization_gain(FP_TYPE peak, FP_TYPE target_peak, int P_flag) {
   if (P_flag <= 0)
-    return;
-
-  FP_TYPE peak = 0.0f;
-  for (int i = 0; i < length; ++i) {
-    FP_TYPE abs_val = fabsf(waveform[i]);
-    if (abs_val > peak)
-      peak = abs_val;
-  }
+    return 1.0f;
 
   if (peak < 1e-9f)
-    return; // avoid divide-by-zero
+    return 1.0f; // avoid divide-by-zero
 
   FP_TYPE full_scale = target_peak / peak;
   FP_TYPE blend = P_flag / 100.0f;
-  FP_TYPE scale = linterp(1.0f, full_scale, blend);
-
-  for (int i = 0; i < length; ++i)
-    waveform[i] *= scale;
+  return linterp(1.0f, full_scale, blend);
 }
 
 int parse_tempo(const char *tempo_str) {
@@ -745,8 +652,104 @@ typedef struct {
   int modulation;    // modulation value, 0-100
   int tempo;         // tempo in beats per minute
   char *pitch_curve; // pitch curve data
+  char *iczt_table;  // path to the ICZT crossover table measured by
+                     // --calibrate (may not exist)
+  FILE *stream;      // if not NULL, the WAV data is written here instead of
+                     // the output file
 } resampler_data;
 
+// Build the path of a file named `name` in the same directory as `file`.
+static void get_sibling_path(const char *file, const char *name, char *dst,
+                             size_t size) {
+  const char *sep = strrchr(file, '/');
+  const char *bsep = strrchr(file, '\\');
+  if (!sep || (bsep && bsep > sep))
+    sep = bsep;
+  if (!sep) {
+    snprintf(dst, size, "%s", name);
+    return;
+  }
+  snprintf(dst, size, "%.*s%s", (int)(sep - file + 1), file, name);
+}
+
+// Move src over dst, replacing dst if it already exists. Plain rename()
+// refuses to overwrite an existing file on Windows.
+static int replace_file(const char *src, const char *dst) {
+#ifdef _WIN32
+  return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+  return rename(src, dst);
+#endif
+}
+
+// Save the noise templates without ever exposing a partially written file
+// to other resampler processes working on the same voicebank. The temporary
+// file is named after the process so that concurrent saves do not collide.
+static void save_noise_templates(const char *path) {
+  static int nsave = 0;
+#ifdef _WIN32
+  int pid = _getpid();
+#else
+  int pid = getpid();
+#endif
+  char tmp_path[1024];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d-%d.tmp", path, pid, nsave++);
+  if (!llsm_save_noise_templates(tmp_path) ||
+      replace_file(tmp_path, path) != 0)
+    remove(tmp_path);
+}
+
+// Maximum number of samples fetched, converted and written at a time when
+// streaming.
+#define STREAM_BLOCK 1024
+
+// Synthesize the chunk frame by frame through a real-time synthesis buffer
+// and write the first ny output samples, multiplied by gain, to f as PCM
+// data. Nothing is written if f is NULL. Unless peak is NULL, the largest
+// magnitude of the samples before gain is stored into it. Memory use does not
+// depend on the length of the chunk. Returns 1 on success.
+static int render_stream(llsm_soptions *opt_s, llsm_chunk *chunk, int ny,
+                         FP_TYPE gain, int nbit, FILE *f, FP_TYPE *peak) {
+  llsm_rtsynth_buffer *rt =
+      llsm_create_rtsynth_buffer(opt_s, chunk->conf, STREAM_BLOCK * 4);
+  if (!rt)
+    return 0;
+  int nfrm = *((int *)llsm_container_peek(chunk->conf, LLSM_CONF_NFRM));
+  int latency = llsm_rtsynth_buffer_getlatency(rt);
+  // Fed after the last frame to flush out the latency.
+  llsm_container *silence = llsm_create_container(1);
+  llsm_container_attach(silence, LLSM_FRAME_F0, llsm_create_fp(0),
+                        llsm_delete_fp, llsm_copy_fp);
+
+  FP_TYPE block[STREAM_BLOCK];
+  FP_TYPE max_abs = 0;
+  int count = -latency; // position of the first sample in block
+  for (int i = 0; count < ny; i++) {
+    llsm_rtsynth_buffer_feed(rt, i < nfrm ? chunk->frames[i] : silence);
+    int n;
+    while (count < ny &&
+           (n = llsm_rtsynth_buffer_fetch_block(rt, block, STREAM_BLOCK))) {
+      // drop the latency at the start and anything beyond ny
+      int begin = count < 0 ? min(-count, n) : 0;
+      int end = min(n, ny - count);
+      for (int j = begin; j < end; j++) {
+        if (fabs(block[j]) > max_abs)
+          max_abs = fabs(block[j]);
+        block[j] *= gain;
+      }
+      if (f && end > begin)
+        wavwrite_samples_fp(block + begin, end - begin, nbit, f);
+      count += n;
+    }
+  }
+
+  if (peak)
+    *peak = max_abs;
+  llsm_delete_container(silence);
+  llsm_delete_rtsynth_buffer(rt);
+  return 1;
+}
+
 int resample(resampler_data *data) {
   // Allocate and load pitch curve
   double *f0_curve = malloc(sizeof(double) * 3000);
@@ -842,6 +845,14 @@ int resample(resampler_data *data) {
 
   // Fix #5: create opt_s after fs is known
   llsm_soptions *opt_s = llsm_create_soptions((FP_TYPE)fs);
+  // Falls back to the built-in heuristic if the table was never measured.
+  opt_s->iczt_table = llsm_load_iczt_table(data->iczt_table);
+  // The noise excitation templates are kept beside the analysis cache.
+  char noise_path[1024];
+  get_sibling_path(llsm_path, "moresampler2-noise.bin", noise_path,
+                   sizeof(noise_path));
+  llsm_load_noise_templates(noise_path);
+  int num_noise_templates = llsm_num_noise_templates();
 
   printf("Phase sync/stretching\n");
   // Calculate start and end frames based on offset and cutoff (in ms)
@@ -912,8 +923,9 @@ int resample(resampler_data *data) {
           llsm_copy_container(chunk->frames[start_frame + i]);
     }
   }
-  llsm_chunk_tolayer1(chunk_new, 2048);
-  llsm_chunk_phasepropagate(chunk_new, -1);
+  llsm_chunk_tolayer1_propagate(chunk_new, 2048, -1);
+  if (flags.Mc)
+    llsm_chunk_compress_vt(chunk_new, 48);
   printf("nfrm: %d\n", total_frames);
 
   // Apply velocity
@@ -939,46 +951,21 @@ int resample(resampler_data *data) {
   // Loop the vowel area instead of stretching
   if (no_stretch == 0) {
     // Only stretch the vowel area (after consonant_frames)
-    for (int i = consonant_frames; i < total_frames; i++) {
+    int nstretch = total_frames - consonant_frames;
+    int *base = malloc(sizeof(int) * nstretch);
+    FP_TYPE *ratio = malloc(sizeof(FP_TYPE) * nstretch);
+    for (int i = 0; i < nstretch; i++) {
       // Map output frame i to input frame in the vowel area
-      FP_TYPE mapped = (FP_TYPE)(i - consonant_frames) * vowel_sample_frames /
-                       vowel_total_frames;
-      int base = consonant_frames + (int)mapped;
-      FP_TYPE ratio = mapped - (int)mapped;
-      base = min(base, consonant_frames + vowel_sample_frames - 2);
-      if (base < consonant_frames)
-        base = consonant_frames;
-
-      // Copy from sources BEFORE freeing destination
-      llsm_container *new_frame = llsm_copy_container(chunk_new->frames[base]);
-      interp_llsm_frame(new_frame, chunk_new->frames[base + 1], ratio);
-
-      // Build interpolated residual while sources are still alive
-      FP_TYPE *res_interp = NULL;
-      FP_TYPE *resvec =
-          llsm_container_get(chunk_new->frames[base], LLSM_FRAME_PSDRES);
-      if (resvec != NULL) {
-        int next = min(base + 1, consonant_frames + vowel_sample_frames - 1);
-        FP_TYPE *resvec2 =
-            llsm_container_get(chunk_new->frames[next], LLSM_FRAME_PSDRES);
-        int rlen = llsm_fparray_length(resvec);
-        res_interp = llsm_create_fparray(rlen);
-        for (int j = 0; j < rlen; j++)
-          res_interp[j] =
-              linterp(resvec[j], resvec2 ? resvec2[j] : resvec[j], ratio);
-      }
-
-      // NOW safe to free the old frame
-      if (chunk_new->frames[i])
-        llsm_delete_container(chunk_new->frames[i]);
-
-      chunk_new->frames[i] = new_frame;
-      if (res_interp != NULL) {
-        llsm_container_attach(chunk_new->frames[i], LLSM_FRAME_PSDRES,
-                              res_interp, llsm_delete_fparray,
-                              llsm_copy_fparray);
-      }
+      FP_TYPE mapped = (FP_TYPE)i * vowel_sample_frames / vowel_total_frames;
+      base[i] = consonant_frames + (int)mapped;
+      ratio[i] = mapped - (int)mapped;
+      base[i] = min(base[i], consonant_frames + vowel_sample_frames - 2);
+      if (base[i] < consonant_frames)
+        base[i] = consonant_frames;
     }
+    timemap_frames(chunk_new, consonant_frames, base, ratio, nstretch);
+    free(base);
+    free(ratio);
   }
 
   // Crossfade at consonant-vowel boundary
@@ -992,11 +979,20 @@ int resample(resampler_data *data) {
     if (xf_end >= total_frames)
       xf_end = total_frames - 1;
 
-    for (int i = xf_start; i <= xf_end; i++) {
-      if (i <= 0 || i >= total_frames - 1)
-        continue;
-      FP_TYPE alpha = 0.25;
-      interp_llsm_frame(chunk_new->frames[i], chunk_new->frames[i + 1], alpha);
+    // the first and the last frame are left as they are
+    xf_start = max(xf_start, 1);
+    xf_end = min(xf_end, total_frames - 2);
+    int nxfade = xf_end - xf_start + 1;
+    if (nxfade > 0) {
+      int *base = malloc(sizeof(int) * nxfade);
+      FP_TYPE *ratio = malloc(sizeof(FP_TYPE) * nxfade);
+      for (int i = 0; i < nxfade; i++) {
+        base[i] = xf_start + i;
+        ratio[i] = 0.25;
+      }
+      timemap_frames(chunk_new, xf_start, base, ratio, nxfade);
+      free(base);
+      free(ratio);
     }
   }
 
@@ -1004,7 +1000,7 @@ int resample(resampler_data *data) {
   int avg_len = min(sample_frames, total_frames);
   double *f0_for_avg = malloc(sizeof(double) * avg_len);
   for (int i = 0; i < avg_len; i++) {
-    FP_TYPE *f0_i = llsm_container_get(chunk_new->frames[i], LLSM_FRAME_F0);
+    FP_TYPE *f0_i = llsm_container_peek(chunk_new->frames[i], LLSM_FRAME_F0);
     f0_for_avg[i] = f0_i ? f0_i[0] : 0.0;
   }
   double avg_f0_of_sample = getFreqAvg(f0_for_avg, avg_len);
@@ -1040,23 +1036,90 @@ int resample(resampler_data *data) {
     // Amplitude compensation
     FP_TYPE *vt_magn =
         llsm_container_get(chunk_new->frames[i], LLSM_FRAME_VTMAGN);
+    FP_TYPE *vt_cep =
+        llsm_container_get(chunk_new->frames[i], LLSM_FRAME_VTCEP);
+    FP_TYPE energy_comp = -20.0 * log10(f0_i[0] / old_f0);
     if (vt_magn != NULL) {
       int nspec = llsm_fparray_length(vt_magn);
-      FP_TYPE energy_comp = -20.0 * log10(f0_i[0] / old_f0);
       for (int j = 0; j < nspec; j++)
         vt_magn[j] += energy_comp;
     }
+    if (vt_cep != NULL)
+      vt_cep[0] += 2.0 * energy_comp; // cep[0] is the doubled mean (dB)
   }
 
   // Reconstruct phases and convert back
-  llsm_chunk_phasepropagate(chunk_new, 1);
-  llsm_chunk_tolayer0(chunk_new);
-  apply_tension(chunk_new, flags.Mt); // apply tension based on Mt flag
+  if (flags.Mt != 0) {
+    // Tension works on the harmonic model, so it has to be built here.
+    llsm_chunk_tolayer0_propagate(chunk_new, 1);
+    apply_tension(chunk_new, flags.Mt); // apply tension based on Mt flag
+  } else {
+    // Otherwise the harmonics are evaluated from layer 1 while rendering,
+    // with the phases propagated on the fly.
+    opt_s->propagate = 1;
+    opt_s->use_l1 = 1;
+  }
   printf("Synthesis\n");
 
-  llsm_output *out = llsm_synthesize(opt_s, chunk_new);
+  // By default the note is synthesized offline by llsm_synthesize. The Ms
+  // flag streams it through the real-time synthesizer instead, so that memory
+  // use does not grow with the note length. The streamed output is not sample
+  // identical: the real-time synthesizer has its own noise generation and
+  // harmonic synthesis, which do not go through llsm_synthesize.
+  FP_TYPE thop =
+      *((FP_TYPE *)llsm_container_peek(chunk_new->conf, LLSM_CONF_THOP));
+  int ny = round((total_frames + 1) * thop * fs); // as llsm_synthesize gives
+  FP_TYPE gain = data->volume / 100.0f;
+  llsm_output *out = NULL;
+  FP_TYPE *y = NULL; // the whole note before gain, unless it is streamed
+  int ok = 1;
+  if (!flags.Ms) {
+    out = llsm_synthesize(opt_s, chunk_new);
+    ok = out != NULL;
+    if (ok) {
+      y = out->y;
+      ny = out->ny;
+    }
+  }
+  if (ok && flags.P > 0) {
+    // Normalization needs the peak of the whole note. When streaming, the
+    // note is rendered twice instead of being kept in memory: once to find
+    // the peak and once more to write it out. The real-time synthesizer is
+    // deterministic, so both passes give the same samples.
+    FP_TYPE peak = 0;
+    if (y) {
+      for (int i = 0; i < ny; i++)
+        if (fabs(y[i]) > peak)
+          peak = fabs(y[i]);
+    } else
+      ok = render_stream(opt_s, chunk_new, ny, 1.0f, nbit, NULL, &peak);
+    gain *= normalization_gain(peak, 0.60f, flags.P);
+  }
+  FILE *fout = NULL;
+  if (ok) {
+    fout = data->stream ? data->stream : fopen(data->output, "wb");
+    if (fout) {
+      if (y) {
+        for (int i = 0; i < ny; i++)
+          y[i] *= gain;
+        wavwrite_fp(y, ny, fs, nbit, fout);
+      } else {
+        wavwrite_header_fp(ny, fs, nbit, fout);
+        ok = render_stream(opt_s, chunk_new, ny, gain, nbit, fout, NULL);
+      }
+      if (fout != data->stream)
+        fclose(fout);
+      else
+        fflush(fout);
+    }
+  }
+  if (out)
+    llsm_delete_output(out);
+  // Bands not covered by the cache (e.g. a new sampling rate) add templates.
+  if (ok && llsm_num_noise_templates() > num_noise_templates)
+    save_noise_templates(noise_path);
 
-  if (!out || !out->y) {
+  if (!ok || !fout) {
     printf("Failed to synthesize output\n");
     free(f0_array);
     free(f0_curve);
@@ -1067,15 +1130,6 @@ int resample(resampler_data *data) {
     return 1;
   }
 
-  normalize_waveform(out->y, out->ny, 0.60f, flags.P);
-
-  float scale = data->volume / 100.0f;
-  for (int i = 0; i < out->ny; ++i)
-    out->y[i] *= scale;
-
-  wavwrite(out->y, out->ny, fs, nbit, data->output);
-
-  llsm_delete_output(out);
   llsm_delete_chunk(chunk);
   llsm_delete_chunk(chunk_new);
   llsm_delete_aoptions(opt_a);
@@ -1085,8 +1139,45 @@ int resample(resampler_data *data) {
   return 0;
 }
 
+// Move stdout to a new binary stream for the WAV data and send whatever is
+// printed afterwards to stderr.
+static FILE *take_over_stdout(void) {
+  fflush(stdout);
+#ifdef _WIN32
+  int fd = _dup(_fileno(stdout));
+  _setmode(fd, _O_BINARY);
+  _dup2(_fileno(stderr), _fileno(stdout));
+  return _fdopen(fd, "wb");
+#else
+  int fd = dup(fileno(stdout));
+  dup2(fileno(stderr), fileno(stdout));
+  return fdopen(fd, "wb");
+#endif
+}
+
 int main(int argc, char *argv[]) {
+  // "-" as the output file streams the rendered note to stdout.
+  FILE *stream = NULL;
+  if (argc == 14 && !strcmp(argv[2], "-"))
+    stream = take_over_stdout();
   printf("moresampler2 version %s\n", version);
+  char iczt_table_path[1024];
+  // The ICZT crossover table lives next to the executable, so that it is
+  // shared by every voicebank rendered on this machine.
+  get_sibling_path(argv[0], "moresampler2-iczt.txt", iczt_table_path,
+                   sizeof(iczt_table_path));
+  if (argc == 2 && !strcmp(argv[1], "--calibrate")) {
+    // time the harmonic synthesis methods on this machine
+    printf("Calibrating harmonic synthesis\n");
+    llsm_iczt_table *table = llsm_calibrate_iczt_table(8, 10);
+    for (int i = 0; i < table->nnx; i++)
+      printf("frame length %d: ICZT above %.0f harmonics\n", table->nx[i],
+             table->nhar[i]);
+    int ok = llsm_save_iczt_table(table, iczt_table_path);
+    printf(ok ? "Saved to %s\n" : "Failed to save %s\n", iczt_table_path);
+    llsm_delete_iczt_table(table);
+    return ok ? 0 : 1;
+  }
   if (argc == 2) { // user dragged and dropped a folder into the executable
     printf("At the moment, autolabeling is not supported.\n");
     return 0;
@@ -1112,6 +1203,8 @@ int main(int argc, char *argv[]) {
     data.tempo = parse_tempo(
         argv[12]); // since tempo has a special format, we need to parse it
     data.pitch_curve = argv[13]; // pitch curve data as a string
+    data.iczt_table = iczt_table_path;
+    data.stream = stream;
     return resample(&data);
   }
   printf("Invalid arguments. Expected 14 arguments, got %d.\n", argc);